@@ -0,0 +1,334 @@
+/*
+ * helper层的基准测试，链接null_driver代替libvulkan，没有GPU的CI机器上也能跑
+ * 用法：helper_bench [--iterations N] [--extensions N] [--filter 名字] [--out 文件] [--baseline 文件] [--tolerance 0.25]
+ *   --extensions 每块假设备额外的扩展个数，默认200，接近真实驱动
+ *   --out        结果写成"名字 中位数ns 每次查询数"，可以当下次的baseline
+ *   --baseline   和之前的结果比较，耗时超过容差或者驱动查询次数变多都算回归，返回1
+ * 每项分成若干批，输出每次操作耗时的中位数和最小值，以及每次操作调用了多少次驱动查询
+ * 查询次数是确定的，缓存失效这类回归看它比看耗时可靠
+ */
+#include "helper.h"
+#include "queue_topology.h"
+#include "null_driver.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+const uint32_t kBatches = 15;
+// 冷启动每次都是新的物理设备句柄，能力快照缓存只增不减，次数不能太多
+const uint64_t kColdIterationLimit = 200;
+
+volatile uint64_t gSink;
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;
+    double medianNs;
+    double minNs;
+    double queriesPerOp;
+};
+
+struct BenchOptions {
+    uint64_t iterations = 20000;
+    uint32_t extensions = 200;
+    const char * filter = nullptr;
+    const char * out = nullptr;
+    const char * baseline = nullptr;
+    double tolerance = 0.25;
+};
+
+uint64_t TotalQueries()
+{
+    NullDriverStats stats = GetNullDriverStats();
+    return stats.instanceQueries + stats.physicalDeviceQueries;
+}
+
+class BenchRunner {
+public:
+    explicit BenchRunner(const BenchOptions & _options) : options_(_options) {}
+
+    void Run(const char * _name, uint64_t _iterations, const std::function<void()> & _op)
+    {
+        if (options_.filter != nullptr && strstr(_name, options_.filter) == nullptr) {
+            return;
+        }
+        uint64_t batchSize = std::max<uint64_t>(1, _iterations / kBatches);
+        // 预热一次，让只算一次的静态缓存先建好
+        _op();
+
+        std::vector<double> perOp;
+        uint64_t queries = TotalQueries();
+        for (uint32_t b = 0; b < kBatches; b++) {
+            auto begin = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < batchSize; i++) {
+                _op();
+            }
+            auto end = std::chrono::steady_clock::now();
+            perOp.push_back(std::chrono::duration<double, std::nano>(end - begin).count() / batchSize);
+        }
+        queries = TotalQueries() - queries;
+
+        std::sort(perOp.begin(), perOp.end());
+        BenchResult result;
+        result.name = _name;
+        result.iterations = batchSize * kBatches;
+        result.medianNs = perOp[perOp.size() / 2];
+        result.minNs = perOp.front();
+        result.queriesPerOp = static_cast<double>(queries) / result.iterations;
+        printf("%-32s %10llu %14.1f %14.1f %12.2f\n", _name, static_cast<unsigned long long>(result.iterations),
+                result.medianNs, result.minNs, result.queriesPerOp);
+        results_.push_back(result);
+    }
+
+    const std::vector<BenchResult> & GetResults() const { return results_; }
+
+private:
+    BenchOptions options_;
+    std::vector<BenchResult> results_;
+};
+
+bool WriteResults(const char * _path, const std::vector<BenchResult> & _results)
+{
+    std::ofstream out(_path);
+    if (!out) {
+        fprintf(stderr, "cannot write %s\n", _path);
+        return false;
+    }
+    for (const BenchResult & result : _results) {
+        out << result.name << ' ' << result.medianNs << ' ' << result.queriesPerOp << '\n';
+    }
+    return true;
+}
+
+// return: 回归的项数，baseline读不了返回-1
+int CompareBaseline(const char * _path, const std::vector<BenchResult> & _results, double _tolerance)
+{
+    std::ifstream in(_path);
+    if (!in) {
+        fprintf(stderr, "cannot read baseline %s\n", _path);
+        return -1;
+    }
+    std::map<std::string, std::pair<double, double>> baseline;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        double medianNs;
+        double queriesPerOp;
+        if (fields >> name >> medianNs >> queriesPerOp) {
+            baseline[name] = std::make_pair(medianNs, queriesPerOp);
+        }
+    }
+
+    int regressions = 0;
+    for (const BenchResult & result : _results) {
+        auto it = baseline.find(result.name);
+        if (it == baseline.end()) {
+            continue;
+        }
+        double baseNs = it->second.first;
+        double baseQueries = it->second.second;
+        if (result.queriesPerOp > baseQueries + 1e-6) {
+            printf("REGRESSION %s: driver queries per op %.2f -> %.2f\n", result.name.c_str(), baseQueries,
+                    result.queriesPerOp);
+            regressions++;
+        }
+        if (result.medianNs > baseNs * (1.0 + _tolerance)) {
+            printf("REGRESSION %s: %.1fns -> %.1fns (+%.0f%%)\n", result.name.c_str(), baseNs, result.medianNs,
+                    (result.medianNs / baseNs - 1.0) * 100.0);
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+bool ParseOptions(int argc, char ** argv, BenchOptions & _options)
+{
+    for (int i = 1; i < argc; i++) {
+        const char * arg = argv[i];
+        const char * value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        }
+        if (strcmp(arg, "--iterations") == 0) {
+            _options.iterations = strtoull(value, nullptr, 10);
+        }
+        else if (strcmp(arg, "--extensions") == 0) {
+            _options.extensions = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        }
+        else if (strcmp(arg, "--filter") == 0) {
+            _options.filter = value;
+        }
+        else if (strcmp(arg, "--out") == 0) {
+            _options.out = value;
+        }
+        else if (strcmp(arg, "--baseline") == 0) {
+            _options.baseline = value;
+        }
+        else if (strcmp(arg, "--tolerance") == 0) {
+            _options.tolerance = strtod(value, nullptr);
+        }
+        else {
+            return false;
+        }
+        i++;
+    }
+    return _options.iterations > 0;
+}
+
+// 合法的SPIR-V头加上填充，null driver只检查magic和大小
+std::vector<uint32_t> MakeFakeSpirv(size_t _wordCount)
+{
+    std::vector<uint32_t> words(std::max<size_t>(_wordCount, 5));
+    words[0] = 0x07230203;
+    words[1] = 0x00010000;
+    words[3] = 1;
+    for (size_t i = 5; i < words.size(); i++) {
+        words[i] = static_cast<uint32_t>(i);
+    }
+    return words;
+}
+
+}
+
+int main(int argc, char ** argv)
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--iterations N] [--extensions N] [--filter name] [--out file] "
+                "[--baseline file] [--tolerance 0.25]\n", argv[0]);
+        return 2;
+    }
+    SetNullDriverConfig(GetDefaultNullDriverConfig(options.extensions));
+    BenchRunner runner(options);
+    const uint64_t n = options.iterations;
+    printf("%-32s %10s %14s %14s %12s\n", "benchmark", "iterations", "median ns/op", "min ns/op", "queries/op");
+
+    const std::vector<const char*> layers = { "VK_LAYER_KHRONOS_validation" };
+    const std::vector<const char*> instanceExtensions = { "VK_KHR_surface", "VK_EXT_debug_utils" };
+    const std::vector<const char*> deviceExtensions = { "VK_KHR_swapchain", "VK_KHR_timeline_semaphore",
+        "VK_EXT_memory_budget" };
+
+    //instance
+    runner.Run("instance.check_support", n, [&]() {
+        gSink += CheckInstanceLayerPropertiesSupport(layers) && CheckInstanceExtensionPropertiesSupport(instanceExtensions);
+    });
+    runner.Run("instance.create_destroy", n, [&]() {
+        VkInstance instance = CreateInstance(layers, instanceExtensions);
+        vkDestroyInstance(instance, nullptr);
+    });
+
+    //device
+    runner.Run("device.cold_bringup", std::min(n, kColdIterationLimit), [&]() {
+        VkInstance instance = CreateInstance();
+        VkPhysicalDevice physicalDevice = GetPhysicalDevices(instance)->front();
+        int family = CheckPhysicalDeviceQueueFamilyPropertiesSupport(physicalDevice, VK_QUEUE_GRAPHICS_BIT);
+        VkDevice device = CreateLogicalDevice(physicalDevice, static_cast<uint32_t>(family), deviceExtensions);
+        VkQueue queue = VK_NULL_HANDLE;
+        vkGetDeviceQueue(device, static_cast<uint32_t>(family), 0, &queue);
+        vkDestroyDevice(device, nullptr);
+        vkDestroyInstance(instance, nullptr);
+    });
+
+    VkInstance instance = CreateInstance();
+    VkPhysicalDevice physicalDevice = GetPhysicalDevices(instance)->front();
+    uint32_t family = static_cast<uint32_t>(CheckPhysicalDeviceQueueFamilyPropertiesSupport(physicalDevice,
+                VK_QUEUE_GRAPHICS_BIT));
+    runner.Run("device.create_destroy", n, [&]() {
+        VkDevice device = CreateLogicalDevice(physicalDevice, family, deviceExtensions);
+        vkDestroyDevice(device, nullptr);
+    });
+
+    runner.Run("device.plan_queues", n, [&]() {
+        gSink += PlanQueueTopology(physicalDevice).families.size();
+    });
+    QueuePlan queuePlan = PlanQueueTopology(physicalDevice);
+    runner.Run("device.planned_create_destroy", n, [&]() {
+        VkDevice device = CreateLogicalDevice(physicalDevice, queuePlan, deviceExtensions);
+        gSink += reinterpret_cast<uintptr_t>(GetPlannedQueue(device, queuePlan, QueueRole::Transfer).Handle);
+        vkDestroyDevice(device, nullptr);
+    });
+
+    //capability checks
+    runner.Run("caps.device_extensions", n, [&]() {
+        gSink += CheckPhsicalDeviceExtensionsSupport(physicalDevice, deviceExtensions);
+    });
+    runner.Run("caps.queue_family", n, [&]() {
+        gSink += CheckPhysicalDeviceQueueFamilyPropertiesSupport(physicalDevice, VK_QUEUE_COMPUTE_BIT);
+    });
+    runner.Run("caps.device_properties", n, [&]() {
+        gSink += GetPhysicalDeviceProperties(physicalDevice)->limits.maxImageDimension2D;
+    });
+    std::unique_ptr<VkPhysicalDeviceMemoryProperties> memoryProperties = GetPhysicalDeviceMemoryProperties(physicalDevice);
+    runner.Run("caps.memory_type", n, [&]() {
+        gSink += FindMemoryTypeIndex(memoryProperties.get(), ~0u, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        gSink += FindMemoryTypeIndex(memoryProperties.get(), ~0u,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    });
+
+    //shader module
+    VkDevice device = CreateLogicalDevice(physicalDevice, family);
+    std::vector<uint32_t> spirv = MakeFakeSpirv(16 * 1024 / sizeof(uint32_t));
+    std::vector<char> spirvBytes(reinterpret_cast<const char *>(spirv.data()),
+            reinterpret_cast<const char *>(spirv.data() + spirv.size()));
+    runner.Run("shader.create_16k_words", n, [&]() {
+        vkDestroyShaderModule(device, CreateShaderModule(device, spirv.data(), spirv.size()), nullptr);
+    });
+    runner.Run("shader.create_16k_bytes", n, [&]() {
+        vkDestroyShaderModule(device, CreateShaderModule(device, spirvBytes), nullptr);
+    });
+
+    //barrier，每次构造全部12种固定layout的barrier
+    VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    VkImage image = (VkImage)(uintptr_t)0x1000;
+    typedef VkImageMemoryBarrier (*BarrierFunction)(uint32_t, uint32_t, VkImage, VkImageSubresourceRange);
+    const BarrierFunction barriers[] = {
+        GetDstSwapChainImageBeforeCopyMemoryBarrier, GetDstSwapChainImageAfterCopyMemoryBarrier,
+        GetSrcSwapChainImageBeforeCopyMemoryBarrier, GetSrcSwapChainImageAfterCopyMemoryBarrier,
+        GetSwapChainImageBeforeRenderMemoryBarrier, GetSwapChainImageAfterRenderMemoryBarrier,
+        GetSrcImageBeforeCopyMemoryBarrier, GetSrcImageAfterCopyMemoryBarrier,
+        GetDstImageBeforeCopyMemoryBarrier, GetDstImageAfterCopyMemoryBarrier,
+        GetImageBeforeRenderMemoryBarrier, GetImageAfterRenderMemoryBarrier,
+    };
+    runner.Run("barrier.fixed_layouts_same_queue", n, [&]() {
+        for (BarrierFunction get : barriers) {
+            gSink += get(0, 0, image, range).newLayout;
+        }
+    });
+    runner.Run("barrier.fixed_layouts_transfer", n, [&]() {
+        for (BarrierFunction get : barriers) {
+            gSink += get(1, 0, image, range).dstQueueFamilyIndex;
+        }
+    });
+
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    int status = 0;
+    NullDriverStats stats = GetNullDriverStats();
+    if (stats.liveObjects != 0) {
+        printf("LEAK: %llu null driver objects were not destroyed\n", static_cast<unsigned long long>(stats.liveObjects));
+        status = 1;
+    }
+    if (options.out != nullptr && !WriteResults(options.out, runner.GetResults())) {
+        status = 1;
+    }
+    if (options.baseline != nullptr) {
+        int regressions = CompareBaseline(options.baseline, runner.GetResults(), options.tolerance);
+        if (regressions != 0) {
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,140 @@
+#include "command_allocator.h"
+#include "helper.h"
+#include "thread_pool.h"
+#include <future>
+#include <algorithm>
+#include <stdexcept>
+
+CommandAllocator::CommandAllocator(VkDevice _device, uint32_t _queueFamilyIndex, uint32_t _framesInFlight,
+        uint32_t _threadCount) :
+    device_(_device),
+    threadCount_(std::max<uint32_t>(_threadCount, 1)),
+    frameIndex_(0)
+{
+    slots_.resize(std::max<uint32_t>(_framesInFlight, 1) * threadCount_);
+    for (auto & slot : slots_) {
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        // 不加RESET_COMMAND_BUFFER_BIT，只整体reset，驱动可以用更简单的分配方式
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = _queueFamilyIndex;
+        slot.pool = VK_NULL_HANDLE;
+        slot.usedPrimaries = 0;
+        slot.usedSecondaries = 0;
+        if (vkCreateCommandPool(device_, &poolInfo, nullptr, &slot.pool) != VK_SUCCESS) {
+            for (auto & created : slots_) {
+                if (created.pool != VK_NULL_HANDLE) {
+                    vkDestroyCommandPool(device_, created.pool, nullptr);
+                }
+            }
+            throw std::runtime_error("failed to create command pool!");
+        }
+    }
+}
+
+CommandAllocator::~CommandAllocator()
+{
+    // 销毁pool会一起释放里面的command buffer
+    for (auto & slot : slots_) {
+        vkDestroyCommandPool(device_, slot.pool, nullptr);
+    }
+}
+
+void CommandAllocator::BeginFrame(uint32_t _frameIndex)
+{
+    frameIndex_ = _frameIndex % (static_cast<uint32_t>(slots_.size()) / threadCount_);
+    for (uint32_t i = 0; i < threadCount_; i++) {
+        PoolSlot & slot = GetSlot(i);
+        vkResetCommandPool(device_, slot.pool, 0);
+        slot.usedPrimaries = 0;
+        slot.usedSecondaries = 0;
+    }
+}
+
+CommandAllocator::PoolSlot & CommandAllocator::GetSlot(uint32_t _thread)
+{
+    if (_thread >= threadCount_) {
+        throw std::runtime_error("command allocator thread index out of range!");
+    }
+    return slots_[frameIndex_ * threadCount_ + _thread];
+}
+
+VkCommandBuffer CommandAllocator::Allocate(PoolSlot & _slot, VkCommandBufferLevel _level)
+{
+    bool primary = _level == VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    std::vector<VkCommandBuffer> & buffers = primary ? _slot.primaries : _slot.secondaries;
+    size_t & used = primary ? _slot.usedPrimaries : _slot.usedSecondaries;
+    if (used == buffers.size()) {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = _slot.pool;
+        allocInfo.level = _level;
+        allocInfo.commandBufferCount = 1;
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(device_, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffer!");
+        }
+        buffers.push_back(commandBuffer);
+    }
+    return buffers[used++];
+}
+
+VkCommandBuffer CommandAllocator::AllocatePrimary(uint32_t _thread)
+{
+    return Allocate(GetSlot(_thread), VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+}
+
+VkCommandBuffer CommandAllocator::AllocateSecondary(uint32_t _thread)
+{
+    return Allocate(GetSlot(_thread), VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+}
+
+void CommandAllocator::RecordSecondaryParallel(VkCommandBuffer _primary,
+        const VkCommandBufferInheritanceInfo & _inheritance, uint32_t _taskCount,
+        const std::function<void(VkCommandBuffer, uint32_t)> & _record, ThreadPool & _pool)
+{
+    if (_taskCount == 0) {
+        return;
+    }
+
+    // 任务按连续的区间分给各个线程编号，每个编号只在一个任务里用，pool不会被并发访问
+    std::vector<VkCommandBuffer> secondaries(_taskCount);
+    uint32_t workers = std::min(threadCount_, _taskCount);
+    uint32_t perWorker = (_taskCount + workers - 1) / workers;
+    std::vector<std::future<void>> futures;
+    for (uint32_t worker = 0; worker < workers; worker++) {
+        uint32_t begin = worker * perWorker;
+        uint32_t end = std::min(begin + perWorker, _taskCount);
+        if (begin >= end) {
+            break;
+        }
+        futures.push_back(_pool.Enqueue([this, worker, begin, end, &secondaries, &_inheritance, &_record]() {
+            VkCommandBufferBeginInfo beginInfo = GetSecondaryCommandBufferBeginInfo(&_inheritance);
+            for (uint32_t task = begin; task < end; task++) {
+                VkCommandBuffer commandBuffer = AllocateSecondary(worker);
+                vkBeginCommandBuffer(commandBuffer, &beginInfo);
+                _record(commandBuffer, task);
+                vkEndCommandBuffer(commandBuffer);
+                secondaries[task] = commandBuffer;
+            }
+        }));
+    }
+
+    // 全部等完再抛异常，不能让还在跑的任务引用已经销毁的局部变量
+    std::exception_ptr error;
+    for (auto & future : futures) {
+        try {
+            future.get();
+        }
+        catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    vkCmdExecuteCommands(_primary, _taskCount, secondaries.data());
+}
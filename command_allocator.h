@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include <vulkan/vulkan.h>
+
+class ThreadPool;
+
+/*
+ * command buffer分配
+ * 每个frame in flight、每个录制线程一个VkCommandPool，pool只被一个线程用，不需要加锁
+ * command buffer不单独reset，BeginFrame时对这一帧的所有pool调vkResetCommandPool，buffer留着下次复用
+ * RecordSecondaryParallel把任务分给线程池并行录secondary command buffer，再按任务顺序拼到primary里
+ */
+class CommandAllocator {
+public:
+    CommandAllocator(VkDevice _device, uint32_t _queueFamilyIndex, uint32_t _framesInFlight, uint32_t _threadCount);
+    ~CommandAllocator();
+    CommandAllocator(const CommandAllocator &) = delete;
+    CommandAllocator & operator=(const CommandAllocator &) = delete;
+
+    // 调用前要保证这一帧上次提交的command buffer已经执行完(等过fence)
+    void BeginFrame(uint32_t _frameIndex);
+
+    // _thread是录制线程的编号[0, threadCount)，同一时间一个编号只能被一个线程使用
+    VkCommandBuffer AllocatePrimary(uint32_t _thread);
+    VkCommandBuffer AllocateSecondary(uint32_t _thread);
+
+    /**
+     * desc: 并行录制_taskCount个secondary command buffer，然后在_primary里vkCmdExecuteCommands
+     *       _record(commandBuffer, taskIndex)在线程池里调用，command buffer已经Begin，返回后自动End
+     *       _primary要已经Begin，如果_inheritance->renderPass不为空，_primary要用
+     *       VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS开始render pass
+     **/
+    void RecordSecondaryParallel(VkCommandBuffer _primary, const VkCommandBufferInheritanceInfo & _inheritance,
+            uint32_t _taskCount, const std::function<void(VkCommandBuffer, uint32_t)> & _record, ThreadPool & _pool);
+
+    uint32_t GetThreadCount() const { return threadCount_; }
+
+private:
+    struct PoolSlot {
+        VkCommandPool pool;
+        std::vector<VkCommandBuffer> primaries;
+        std::vector<VkCommandBuffer> secondaries;
+        size_t usedPrimaries;
+        size_t usedSecondaries;
+    };
+
+    PoolSlot & GetSlot(uint32_t _thread);
+    VkCommandBuffer Allocate(PoolSlot & _slot, VkCommandBufferLevel _level);
+
+    VkDevice device_;
+    uint32_t threadCount_;
+    uint32_t frameIndex_;
+    // [frame * threadCount + thread]
+    std::vector<PoolSlot> slots_;
+};
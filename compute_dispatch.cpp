@@ -0,0 +1,457 @@
+#include "compute_dispatch.h"
+#include "helper.h"
+#include "device_capabilities.h"
+#include "descriptor_allocator.h"
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <logger.h>
+
+namespace {
+
+const VkDeviceSize WholeEnd = std::numeric_limits<VkDeviceSize>::max();
+
+// 合并barrier用，access是dst的access
+struct BufferSpan {
+    VkDeviceSize begin;
+    VkDeviceSize end;
+    VkAccessFlags access;
+};
+
+bool IsComputeBufferDescriptor(VkDescriptorType _type)
+{
+    return _type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER || _type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+}
+
+bool IsWrite(VkAccessFlags _access)
+{
+    return (_access & VK_ACCESS_SHADER_WRITE_BIT) != 0;
+}
+
+bool Overlaps(VkDeviceSize _begin0, VkDeviceSize _end0, VkDeviceSize _begin1, VkDeviceSize _end1)
+{
+    return _begin0 < _end1 && _begin1 < _end0;
+}
+
+/**
+ * desc: 同一个buffer上重叠或者相邻的范围合并成一个barrier，access取并集
+ *       _dstAccess不为0时所有barrier都用它作为dstAccessMask
+ **/
+void AppendBufferBarriers(std::vector<VkBufferMemoryBarrier> & _barriers, VkBuffer _buffer,
+        std::vector<BufferSpan> & _spans, VkAccessFlags _srcAccess, VkAccessFlags _dstAccess)
+{
+    if (_spans.empty()) {
+        return;
+    }
+    std::sort(_spans.begin(), _spans.end(), [](const BufferSpan & _a, const BufferSpan & _b) {
+        return _a.begin < _b.begin;
+    });
+    size_t merged = 0;
+    for (size_t i = 1; i < _spans.size(); i++) {
+        BufferSpan & last = _spans[merged];
+        if (_spans[i].begin <= last.end) {
+            last.end = std::max(last.end, _spans[i].end);
+            last.access |= _spans[i].access;
+        }
+        else {
+            _spans[++merged] = _spans[i];
+        }
+    }
+    _spans.resize(merged + 1);
+
+    for (const BufferSpan & span : _spans) {
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = _srcAccess;
+        barrier.dstAccessMask = _dstAccess != 0 ? _dstAccess : span.access;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = _buffer;
+        barrier.offset = span.begin;
+        barrier.size = span.end == WholeEnd ? VK_WHOLE_SIZE : span.end - span.begin;
+        _barriers.push_back(barrier);
+    }
+}
+
+}
+
+VkExtent3D ChooseWorkgroupSize(const VkPhysicalDeviceLimits & _limits, uint32_t _dimensions, uint32_t _maxInvocations)
+{
+    if (_dimensions < 1 || _dimensions > 3) {
+        throw std::runtime_error("workgroup dimensions must be 1~3!");
+    }
+    uint32_t maxInvocations = std::min(_maxInvocations, _limits.maxComputeWorkGroupInvocations);
+    uint32_t size[3] = { 1, 1, 1 };
+    uint32_t invocations = 1;
+    // 各维轮流加倍，2维256得到16x16而不是256x1
+    bool grown = true;
+    while (grown) {
+        grown = false;
+        for (uint32_t i = 0; i < _dimensions; i++) {
+            if (size[i] * 2 <= _limits.maxComputeWorkGroupSize[i] && invocations * 2 <= maxInvocations) {
+                size[i] *= 2;
+                invocations *= 2;
+                grown = true;
+            }
+        }
+    }
+    return { size[0], size[1], size[2] };
+}
+
+ComputePipeline::ComputePipeline(VkDevice _device, VkPhysicalDevice _physicalDevice, const ComputePipelineDesc & _desc) :
+    device_(_device),
+    setLayout_(VK_NULL_HANDLE),
+    layout_(VK_NULL_HANDLE),
+    pipeline_(VK_NULL_HANDLE),
+    pushConstantSize_(_desc.pushConstantSize),
+    bindings_(_desc.bindings)
+{
+    if (_desc.code == nullptr || _desc.wordCount == 0) {
+        throw std::runtime_error("compute pipeline has no spirv!");
+    }
+    const VkPhysicalDeviceLimits & limits = GetDeviceCapabilities(_physicalDevice).properties.limits;
+    for (int i = 0; i < 3; i++) {
+        maxGroupCount_[i] = limits.maxComputeWorkGroupCount[i];
+    }
+    if (_desc.pushConstantSize % 4 != 0 || _desc.pushConstantSize > limits.maxPushConstantsSize) {
+        throw std::runtime_error("invalid compute push constant size!");
+    }
+
+    const VkExtent3D & requested = _desc.workgroupSize;
+    if (requested.width == 0 && requested.height == 0 && requested.depth == 0) {
+        workgroupSize_ = ChooseWorkgroupSize(limits, _desc.dimensions, _desc.maxInvocations);
+    }
+    else {
+        uint64_t invocations = static_cast<uint64_t>(requested.width) * requested.height * requested.depth;
+        if (invocations == 0 || requested.width > limits.maxComputeWorkGroupSize[0]
+                || requested.height > limits.maxComputeWorkGroupSize[1]
+                || requested.depth > limits.maxComputeWorkGroupSize[2]
+                || invocations > limits.maxComputeWorkGroupInvocations) {
+            throw std::runtime_error("compute workgroup size exceeds device limits!");
+        }
+        workgroupSize_ = requested;
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> layoutBindings(bindings_.size());
+    for (size_t i = 0; i < bindings_.size(); i++) {
+        if (!IsComputeBufferDescriptor(bindings_[i])) {
+            throw std::runtime_error("unsupported descriptor type in compute pipeline!");
+        }
+        VkDescriptorSetLayoutBinding & binding = layoutBindings[i];
+        binding = {};
+        binding.binding = static_cast<uint32_t>(i);
+        binding.descriptorType = bindings_[i];
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+    setLayoutInfo.pBindings = layoutBindings.data();
+    if (vkCreateDescriptorSetLayout(device_, &setLayoutInfo, nullptr, &setLayout_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute descriptor set layout!");
+    }
+
+    VkPushConstantRange pushRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, pushConstantSize_ };
+    VkPipelineLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &setLayout_;
+    layoutInfo.pushConstantRangeCount = pushConstantSize_ > 0 ? 1 : 0;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    if (vkCreatePipelineLayout(device_, &layoutInfo, nullptr, &layout_) != VK_SUCCESS) {
+        vkDestroyDescriptorSetLayout(device_, setLayout_, nullptr);
+        throw std::runtime_error("failed to create compute pipeline layout!");
+    }
+
+    // id 0~2是workgroup大小，之后是_desc.constants
+    std::vector<uint32_t> constants = { workgroupSize_.width, workgroupSize_.height, workgroupSize_.depth };
+    constants.insert(constants.end(), _desc.constants.begin(), _desc.constants.end());
+    std::vector<VkSpecializationMapEntry> entries(constants.size());
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        entries[i] = { i, static_cast<uint32_t>(i * sizeof(uint32_t)), sizeof(uint32_t) };
+    }
+    VkSpecializationInfo specialization = {};
+    specialization.mapEntryCount = static_cast<uint32_t>(entries.size());
+    specialization.pMapEntries = entries.data();
+    specialization.dataSize = constants.size() * sizeof(uint32_t);
+    specialization.pData = constants.data();
+
+    VkShaderModule shaderModule = VK_NULL_HANDLE;
+    try {
+        shaderModule = CreateShaderModule(device_, _desc.code, _desc.wordCount);
+    }
+    catch (...) {
+        vkDestroyPipelineLayout(device_, layout_, nullptr);
+        vkDestroyDescriptorSetLayout(device_, setLayout_, nullptr);
+        throw;
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = _desc.entryPoint;
+    pipelineInfo.stage.pSpecializationInfo = &specialization;
+    pipelineInfo.layout = layout_;
+    pipelineInfo.basePipelineIndex = -1;
+    VkResult result = vkCreateComputePipelines(device_, _desc.cache, 1, &pipelineInfo, nullptr, &pipeline_);
+    // pipeline建好以后module就不需要了
+    vkDestroyShaderModule(device_, shaderModule, nullptr);
+    if (result != VK_SUCCESS) {
+        vkDestroyPipelineLayout(device_, layout_, nullptr);
+        vkDestroyDescriptorSetLayout(device_, setLayout_, nullptr);
+        throw std::runtime_error("failed to create compute pipeline!");
+    }
+    logdebug("compute pipeline created, workgroup:{}x{}x{} bindings:{} push constants:{}", workgroupSize_.width,
+            workgroupSize_.height, workgroupSize_.depth, bindings_.size(), pushConstantSize_);
+}
+
+ComputePipeline::~ComputePipeline()
+{
+    vkDestroyPipeline(device_, pipeline_, nullptr);
+    vkDestroyPipelineLayout(device_, layout_, nullptr);
+    vkDestroyDescriptorSetLayout(device_, setLayout_, nullptr);
+}
+
+VkExtent3D ComputePipeline::GetGroupCount(VkExtent3D _elements) const
+{
+    VkExtent3D groups = {
+        (_elements.width + workgroupSize_.width - 1) / workgroupSize_.width,
+        (_elements.height + workgroupSize_.height - 1) / workgroupSize_.height,
+        (_elements.depth + workgroupSize_.depth - 1) / workgroupSize_.depth,
+    };
+    CheckGroupCount(groups);
+    return groups;
+}
+
+void ComputePipeline::CheckGroupCount(VkExtent3D _groups) const
+{
+    if (_groups.width > maxGroupCount_[0] || _groups.height > maxGroupCount_[1] || _groups.depth > maxGroupCount_[2]) {
+        throw std::runtime_error("compute dispatch exceeds maxComputeWorkGroupCount!");
+    }
+}
+
+ComputeBatch::ComputeBatch(DescriptorAllocator & _descriptors) :
+    descriptors_(_descriptors),
+    levelCount_(0)
+{
+}
+
+void ComputeBatch::Dispatch(const ComputePipeline & _pipeline, const std::vector<ComputeBufferBinding> & _bindings,
+        VkExtent3D _elements, const void * _pushConstants, uint32_t _pushConstantSize)
+{
+    DispatchGroups(_pipeline, _bindings, _pipeline.GetGroupCount(_elements), _pushConstants, _pushConstantSize);
+}
+
+void ComputeBatch::DispatchGroups(const ComputePipeline & _pipeline, const std::vector<ComputeBufferBinding> & _bindings,
+        VkExtent3D _groups, const void * _pushConstants, uint32_t _pushConstantSize)
+{
+    _pipeline.CheckGroupCount(_groups);
+    if (_pushConstantSize != _pipeline.GetPushConstantSize() || (_pushConstantSize > 0 && _pushConstants == nullptr)) {
+        throw std::runtime_error("compute push constant size mismatch!");
+    }
+    const std::vector<VkDescriptorType> & types = _pipeline.GetBindings();
+    if (_bindings.size() != types.size()) {
+        throw std::runtime_error("compute binding count mismatch!");
+    }
+
+    // 先算出每个binding的范围和access，再和之前的访问比较，得到能放进的最早的层
+    std::vector<DescriptorBinding> descriptorBindings(_bindings.size());
+    std::vector<BufferAccess> ranges(_bindings.size());
+    std::vector<bool> bound(types.size(), false);
+    uint32_t level = 0;
+    for (size_t i = 0; i < _bindings.size(); i++) {
+        const ComputeBufferBinding & binding = _bindings[i];
+        if (binding.binding >= types.size() || bound[binding.binding]) {
+            throw std::runtime_error("invalid compute binding!");
+        }
+        bound[binding.binding] = true;
+        VkDescriptorType type = types[binding.binding];
+        VkAccessFlags readAccess = type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ?
+            VK_ACCESS_UNIFORM_READ_BIT : VK_ACCESS_SHADER_READ_BIT;
+        VkAccessFlags access = 0;
+        switch (binding.access) {
+        case ComputeAccess::Read: access = readAccess; break;
+        case ComputeAccess::Write: access = VK_ACCESS_SHADER_WRITE_BIT; break;
+        case ComputeAccess::ReadWrite: access = readAccess | VK_ACCESS_SHADER_WRITE_BIT; break;
+        }
+        if (type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER && IsWrite(access)) {
+            throw std::runtime_error("uniform buffer can not be written in compute shader!");
+        }
+
+        DescriptorBinding & descriptor = descriptorBindings[i];
+        descriptor = {};
+        descriptor.binding = binding.binding;
+        descriptor.type = type;
+        descriptor.buffer = { binding.buffer, binding.offset, binding.range };
+
+        BufferAccess & range = ranges[i];
+        range.begin = binding.offset;
+        range.end = binding.range == VK_WHOLE_SIZE ? WholeEnd : binding.offset + binding.range;
+        range.access = access;
+        auto it = accesses_.find(binding.buffer);
+        if (it == accesses_.end()) {
+            continue;
+        }
+        // RAW、WAW、WAR都要排在对方的下一层之后，两边都只读的不冲突
+        for (const BufferAccess & previous : it->second) {
+            if ((IsWrite(access) || IsWrite(previous.access))
+                    && Overlaps(range.begin, range.end, previous.begin, previous.end)) {
+                level = std::max(level, previous.level + 1);
+            }
+        }
+    }
+
+    PendingDispatch dispatch;
+    dispatch.pipeline = &_pipeline;
+    dispatch.set = descriptorBindings.empty() ? VK_NULL_HANDLE :
+        descriptors_.GetCachedSet(_pipeline.GetSetLayout(), descriptorBindings);
+    dispatch.groups = _groups;
+    if (_pushConstantSize > 0) {
+        const uint8_t * bytes = static_cast<const uint8_t *>(_pushConstants);
+        dispatch.pushConstants.assign(bytes, bytes + _pushConstantSize);
+    }
+    dispatch.level = level;
+    dispatches_.push_back(std::move(dispatch));
+
+    for (size_t i = 0; i < _bindings.size(); i++) {
+        ranges[i].level = level;
+        accesses_[_bindings[i].buffer].push_back(ranges[i]);
+    }
+    levelCount_ = std::max(levelCount_, level + 1);
+}
+
+ComputeBatch::Stats ComputeBatch::Record(VkCommandBuffer _commandBuffer, VkPipelineStageFlags _srcStage,
+        VkAccessFlags _srcAccess, VkPipelineStageFlags _dstStage, VkAccessFlags _dstAccess)
+{
+    Stats stats = {};
+    stats.dispatches = static_cast<uint32_t>(dispatches_.size());
+    stats.levels = levelCount_;
+    if (dispatches_.empty()) {
+        return stats;
+    }
+
+    std::vector<VkBufferMemoryBarrier> barriers;
+    std::vector<BufferSpan> spans;
+    if (_srcStage != 0) {
+        // 这一批访问的所有范围都要等之前的写
+        for (const auto & buffer : accesses_) {
+            spans.clear();
+            for (const BufferAccess & access : buffer.second) {
+                spans.push_back({ access.begin, access.end, access.access });
+            }
+            AppendBufferBarriers(barriers, buffer.first, spans, _srcAccess, 0);
+        }
+        vkCmdPipelineBarrier(_commandBuffer, _srcStage, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+    }
+
+    // 按层排序，同一层里用同一个管线的排在一起，按管线第一次出现的顺序
+    std::unordered_map<const ComputePipeline *, size_t> pipelineOrder;
+    for (const PendingDispatch & dispatch : dispatches_) {
+        pipelineOrder.emplace(dispatch.pipeline, pipelineOrder.size());
+    }
+    std::vector<const PendingDispatch *> order(dispatches_.size());
+    for (size_t i = 0; i < dispatches_.size(); i++) {
+        order[i] = &dispatches_[i];
+    }
+    std::stable_sort(order.begin(), order.end(), [&pipelineOrder](const PendingDispatch * _a, const PendingDispatch * _b) {
+        if (_a->level != _b->level) {
+            return _a->level < _b->level;
+        }
+        return pipelineOrder[_a->pipeline] < pipelineOrder[_b->pipeline];
+    });
+
+    // 每一层写过、后面的层还要访问的范围，在这一层之后的barrier里可见，更远的层也能看到
+    // dst的access取后面访问这个范围的并集
+    std::vector<std::vector<std::pair<VkBuffer, BufferSpan>>> levelWrites(levelCount_);
+    for (const auto & buffer : accesses_) {
+        for (const BufferAccess & write : buffer.second) {
+            if (!IsWrite(write.access)) {
+                continue;
+            }
+            VkAccessFlags dstAccess = 0;
+            for (const BufferAccess & later : buffer.second) {
+                if (later.level > write.level && Overlaps(write.begin, write.end, later.begin, later.end)) {
+                    dstAccess |= later.access;
+                }
+            }
+            if (dstAccess != 0) {
+                levelWrites[write.level].push_back({ buffer.first, { write.begin, write.end, dstAccess } });
+            }
+        }
+    }
+
+    const ComputePipeline * boundPipeline = nullptr;
+    VkDescriptorSet boundSet = VK_NULL_HANDLE;
+    uint32_t currentLevel = 0;
+    for (const PendingDispatch * dispatch : order) {
+        if (dispatch->level != currentLevel) {
+            std::vector<std::pair<VkBuffer, BufferSpan>> & writes = levelWrites[currentLevel];
+            std::sort(writes.begin(), writes.end(), [](const std::pair<VkBuffer, BufferSpan> & _a,
+                        const std::pair<VkBuffer, BufferSpan> & _b) {
+                return std::less<VkBuffer>()(_a.first, _b.first);
+            });
+            barriers.clear();
+            for (size_t i = 0; i < writes.size();) {
+                spans.clear();
+                size_t j = i;
+                for (; j < writes.size() && writes[j].first == writes[i].first; j++) {
+                    spans.push_back(writes[j].second);
+                }
+                AppendBufferBarriers(barriers, writes[i].first, spans, VK_ACCESS_SHADER_WRITE_BIT, 0);
+                i = j;
+            }
+            // 只有WAR时barriers为空，只做执行依赖
+            vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                    static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+            stats.barriers++;
+            stats.bufferBarriers += static_cast<uint32_t>(barriers.size());
+            currentLevel = dispatch->level;
+        }
+
+        const ComputePipeline & pipeline = *dispatch->pipeline;
+        if (boundPipeline != &pipeline) {
+            vkCmdBindPipeline(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.GetPipeline());
+            stats.pipelineBinds++;
+            // 不同管线的layout不一定兼容，set重新绑
+            boundPipeline = &pipeline;
+            boundSet = VK_NULL_HANDLE;
+        }
+        if (dispatch->set != VK_NULL_HANDLE && dispatch->set != boundSet) {
+            vkCmdBindDescriptorSets(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.GetLayout(), 0, 1,
+                    &dispatch->set, 0, nullptr);
+            boundSet = dispatch->set;
+        }
+        if (!dispatch->pushConstants.empty()) {
+            vkCmdPushConstants(_commandBuffer, pipeline.GetLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                    static_cast<uint32_t>(dispatch->pushConstants.size()), dispatch->pushConstants.data());
+        }
+        vkCmdDispatch(_commandBuffer, dispatch->groups.width, dispatch->groups.height, dispatch->groups.depth);
+    }
+
+    if (_dstStage != 0) {
+        // 所有写过的范围对之后的读可见
+        barriers.clear();
+        for (const auto & buffer : accesses_) {
+            spans.clear();
+            for (const BufferAccess & access : buffer.second) {
+                if (IsWrite(access.access)) {
+                    spans.push_back({ access.begin, access.end, 0 });
+                }
+            }
+            AppendBufferBarriers(barriers, buffer.first, spans, VK_ACCESS_SHADER_WRITE_BIT, _dstAccess);
+        }
+        vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, _dstStage, 0, 0, nullptr,
+                static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+    }
+
+    dispatches_.clear();
+    accesses_.clear();
+    levelCount_ = 0;
+    return stats;
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <vulkan/vulkan.h>
+
+class DescriptorAllocator;
+
+/*
+ * 计算管线和批量dispatch
+ * workgroup大小按设备的maxComputeWorkGroupSize/maxComputeWorkGroupInvocations选，用specialization constant传给shader
+ *   shader里写 layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z_id = 2) in;
+ *   其它specialization constant的id从3开始
+ * 描述符只有set 0，binding i的类型是ComputePipelineDesc::bindings[i]，目前只支持storage/uniform buffer
+ * ComputeBatch先收集dispatch，Record时按buffer范围的读写冲突分层
+ *   同一层里的dispatch互相没有冲突，连续录制；层之间一个COMPUTE到COMPUTE的vkCmdPipelineBarrier
+ *   只有前一层写过、后面又要读写的范围才加VkBufferMemoryBarrier，只有WAR冲突时只是执行依赖
+ *   没有冲突的dispatch会提前到前面的层，录制顺序和Dispatch的调用顺序不一定相同
+ * 只跟踪binding里传进来的buffer，shader用别的方式访问的内存要调用者自己同步
+ */
+enum class ComputeAccess {
+    Read,
+    Write,
+    ReadWrite,
+};
+
+struct ComputeBufferBinding {
+    uint32_t binding;
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    // 可以是VK_WHOLE_SIZE
+    VkDeviceSize range;
+    ComputeAccess access;
+};
+
+struct ComputePipelineDesc {
+    const uint32_t * code = nullptr;
+    size_t wordCount = 0;
+    const char * entryPoint = "main";
+    // 数据的维数(1~3)，决定workgroup的形状
+    uint32_t dimensions = 1;
+    // 全为0时由ChooseWorkgroupSize选，否则检查是否超过设备限制
+    VkExtent3D workgroupSize = { 0, 0, 0 };
+    uint32_t maxInvocations = 256;
+    std::vector<VkDescriptorType> bindings;
+    uint32_t pushConstantSize = 0;
+    // id依次是3、4、5...
+    std::vector<uint32_t> constants;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+};
+
+/**
+ * desc: 按设备限制选workgroup大小，每一维是2的幂，各维轮流加倍，尽量接近方形
+ *       乘积不超过_maxInvocations和maxComputeWorkGroupInvocations，比如256: 1维256，2维16x16，3维8x8x4
+ **/
+VkExtent3D ChooseWorkgroupSize(const VkPhysicalDeviceLimits & _limits, uint32_t _dimensions,
+        uint32_t _maxInvocations = 256);
+
+class ComputePipeline {
+public:
+    // 参数不合法或者创建失败时抛runtime_error
+    ComputePipeline(VkDevice _device, VkPhysicalDevice _physicalDevice, const ComputePipelineDesc & _desc);
+    ~ComputePipeline();
+    ComputePipeline(const ComputePipeline &) = delete;
+    ComputePipeline & operator=(const ComputePipeline &) = delete;
+
+    VkPipeline GetPipeline() const { return pipeline_; }
+    VkPipelineLayout GetLayout() const { return layout_; }
+    VkDescriptorSetLayout GetSetLayout() const { return setLayout_; }
+    VkExtent3D GetWorkgroupSize() const { return workgroupSize_; }
+    uint32_t GetPushConstantSize() const { return pushConstantSize_; }
+    const std::vector<VkDescriptorType> & GetBindings() const { return bindings_; }
+
+    // 覆盖_elements需要的workgroup数，超过maxComputeWorkGroupCount时抛runtime_error
+    VkExtent3D GetGroupCount(VkExtent3D _elements) const;
+    // 超过maxComputeWorkGroupCount时抛runtime_error
+    void CheckGroupCount(VkExtent3D _groups) const;
+
+private:
+    VkDevice device_;
+    VkDescriptorSetLayout setLayout_;
+    VkPipelineLayout layout_;
+    VkPipeline pipeline_;
+    VkExtent3D workgroupSize_;
+    uint32_t maxGroupCount_[3];
+    uint32_t pushConstantSize_;
+    std::vector<VkDescriptorType> bindings_;
+};
+
+class ComputeBatch {
+public:
+    struct Stats {
+        uint32_t dispatches;
+        uint32_t levels;
+        // vkCmdPipelineBarrier的次数，不含开头和结尾的
+        uint32_t barriers;
+        uint32_t bufferBarriers;
+        uint32_t pipelineBinds;
+    };
+
+    // 描述符在Dispatch时从_descriptors的当前帧分配，Record的command buffer执行完之前不能BeginFrame这一帧
+    explicit ComputeBatch(DescriptorAllocator & _descriptors);
+    ComputeBatch(const ComputeBatch &) = delete;
+    ComputeBatch & operator=(const ComputeBatch &) = delete;
+
+    /**
+     * desc: _elements 每一维的元素数，workgroup数向上取整，shader里要自己检查越界
+     *       _pushConstants 拷贝一份，大小要等于管线的pushConstantSize
+     **/
+    void Dispatch(const ComputePipeline & _pipeline, const std::vector<ComputeBufferBinding> & _bindings,
+            VkExtent3D _elements, const void * _pushConstants = nullptr, uint32_t _pushConstantSize = 0);
+    // 直接给workgroup数
+    void DispatchGroups(const ComputePipeline & _pipeline, const std::vector<ComputeBufferBinding> & _bindings,
+            VkExtent3D _groups, const void * _pushConstants = nullptr, uint32_t _pushConstantSize = 0);
+
+    /**
+     * desc: 录到已经Begin的_commandBuffer里，然后清空
+     *       _srcStage/_srcAccess 之前写这些buffer的操作，比如上传用TRANSFER/TRANSFER_WRITE，为0时开头不加barrier
+     *       _dstStage/_dstAccess 之后读结果的操作，比如映射回读用HOST/HOST_READ，为0时结尾不加barrier
+     **/
+    Stats Record(VkCommandBuffer _commandBuffer, VkPipelineStageFlags _srcStage = 0, VkAccessFlags _srcAccess = 0,
+            VkPipelineStageFlags _dstStage = 0, VkAccessFlags _dstAccess = 0);
+
+    size_t GetPendingCount() const { return dispatches_.size(); }
+
+private:
+    // [begin, end)，VK_WHOLE_SIZE的end是UINT64_MAX
+    struct BufferAccess {
+        VkDeviceSize begin;
+        VkDeviceSize end;
+        VkAccessFlags access;
+        uint32_t level;
+    };
+
+    struct PendingDispatch {
+        const ComputePipeline * pipeline;
+        VkDescriptorSet set;
+        VkExtent3D groups;
+        std::vector<uint8_t> pushConstants;
+        uint32_t level;
+    };
+
+    DescriptorAllocator & descriptors_;
+    std::vector<PendingDispatch> dispatches_;
+    // 按buffer记录这一批里所有的访问
+    std::unordered_map<VkBuffer, std::vector<BufferAccess>> accesses_;
+    uint32_t levelCount_;
+};
@@ -0,0 +1,259 @@
+#include "debug_messenger.h"
+#include "name_registry.h"
+#include "hash.h"
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <logger.h>
+
+namespace {
+
+int64_t NowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char * SeverityName(VkDebugUtilsMessageSeverityFlagBitsEXT _severity)
+{
+    switch (_severity) {
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT: return "error";
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT: return "warning";
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT: return "info";
+    default: return "verbose";
+    }
+}
+
+}
+
+// 日志等级跟着消息的severity走
+#define LOG_BY_SEVERITY(severity, fmt, ...) \
+    do { \
+        if ((severity) == VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) logerror(fmt, ##__VA_ARGS__); \
+        else if ((severity) == VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) logwarn(fmt, ##__VA_ARGS__); \
+        else if ((severity) == VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) loginfo(fmt, ##__VA_ARGS__); \
+        else logdebug(fmt, ##__VA_ARGS__); \
+    } while (0)
+
+DebugMessenger::DebugMessenger(VkInstance _instance, const DebugMessengerConfig & _config) :
+    instance_(_instance),
+    messenger_(VK_NULL_HANDLE),
+    config_(_config),
+    received_(0),
+    filtered_(0),
+    emitted_(0),
+    suppressed_(0),
+    tableFull_(0),
+    overflowWindow_(0),
+    overflowDropped_(0),
+    overflowReportMs_(NowMs())
+{
+    uint32_t size = 16;
+    while (size < config_.tableSize) {
+        size <<= 1;
+    }
+    mask_ = size - 1;
+    slots_.reset(new Slot[size]);
+    for (uint32_t i = 0; i < size; i++) {
+        slots_[i].key.store(0, std::memory_order_relaxed);
+        slots_[i].ready.store(false, std::memory_order_relaxed);
+        slots_[i].count.store(0, std::memory_order_relaxed);
+        slots_[i].reported.store(0, std::memory_order_relaxed);
+        slots_[i].lastReportMs.store(0, std::memory_order_relaxed);
+    }
+    std::sort(config_.ignoredMessageIds.begin(), config_.ignoredMessageIds.end());
+
+    auto create = reinterpret_cast<PFN_vkCreateDebugUtilsMessengerEXT>(
+            vkGetInstanceProcAddr(instance_, "vkCreateDebugUtilsMessengerEXT"));
+    if (create == nullptr) {
+        throw std::runtime_error("VK_EXT_debug_utils is not enabled on the instance!");
+    }
+    VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+    createInfo.messageSeverity = config_.severities;
+    createInfo.messageType = config_.types;
+    createInfo.pfnUserCallback = Callback;
+    createInfo.pUserData = this;
+    if (create(instance_, &createInfo, nullptr, &messenger_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create debug messenger!");
+    }
+}
+
+DebugMessenger::~DebugMessenger()
+{
+    auto destroy = reinterpret_cast<PFN_vkDestroyDebugUtilsMessengerEXT>(
+            vkGetInstanceProcAddr(instance_, "vkDestroyDebugUtilsMessengerEXT"));
+    if (destroy != nullptr) {
+        destroy(instance_, messenger_, nullptr);
+    }
+    // 销毁以后不会再有回调
+    FlushSummary();
+    DebugMessengerStats stats = GetStats();
+    loginfo("debug messenger: received:{} filtered:{} emitted:{} suppressed:{} table full:{}",
+            stats.received, stats.filtered, stats.emitted, stats.suppressed, stats.tableFull);
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL DebugMessenger::Callback(VkDebugUtilsMessageSeverityFlagBitsEXT _severity,
+        VkDebugUtilsMessageTypeFlagsEXT _types, const VkDebugUtilsMessengerCallbackDataEXT * _data, void * _user)
+{
+    DebugMessenger * self = static_cast<DebugMessenger *>(_user);
+    self->received_.fetch_add(1, std::memory_order_relaxed);
+    // 按id屏蔽只能在回调里做
+    if ((_severity & self->config_.severities) == 0 || (_types & self->config_.types) == 0
+            || std::binary_search(self->config_.ignoredMessageIds.begin(), self->config_.ignoredMessageIds.end(),
+                _data->messageIdNumber)) {
+        self->filtered_.fetch_add(1, std::memory_order_relaxed);
+        return VK_FALSE;
+    }
+    self->OnMessage(_severity, *_data);
+    // 返回VK_FALSE，不中止触发消息的调用
+    return VK_FALSE;
+}
+
+DebugMessenger::Slot * DebugMessenger::FindSlot(uint64_t _key, const VkDebugUtilsMessengerCallbackDataEXT & _data,
+        VkDebugUtilsMessageSeverityFlagBitsEXT _severity)
+{
+    for (uint32_t probe = 0; probe <= mask_; probe++) {
+        Slot & slot = slots_[(_key + probe) & mask_];
+        uint64_t key = slot.key.load(std::memory_order_acquire);
+        if (key == _key) {
+            return &slot;
+        }
+        if (key != 0) {
+            continue;
+        }
+        uint64_t expected = 0;
+        if (slot.key.compare_exchange_strong(expected, _key, std::memory_order_acq_rel)) {
+            slot.messageId = _data.messageIdNumber;
+            slot.severity = _severity;
+            const char * name = _data.pMessageIdName != nullptr ? _data.pMessageIdName : "";
+            strncpy(slot.name, name, sizeof(slot.name) - 1);
+            slot.name[sizeof(slot.name) - 1] = '\0';
+            slot.lastReportMs.store(NowMs(), std::memory_order_relaxed);
+            slot.ready.store(true, std::memory_order_release);
+            return &slot;
+        }
+        // 别的线程刚占了这个位置，可能就是同一个key
+        if (expected == _key) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+void DebugMessenger::OnMessage(VkDebugUtilsMessageSeverityFlagBitsEXT _severity,
+        const VkDebugUtilsMessengerCallbackDataEXT & _data)
+{
+    uint64_t handle = 0;
+    uint32_t objectType = 0;
+    if (_data.objectCount > 0 && _data.pObjects != nullptr) {
+        handle = _data.pObjects[0].objectHandle;
+        objectType = static_cast<uint32_t>(_data.pObjects[0].objectType);
+    }
+    // 有的层所有消息的messageIdNumber都是0，这时候用消息内容区分
+    uint32_t words[6] = {
+        static_cast<uint32_t>(_data.messageIdNumber),
+        _data.pMessageIdName != nullptr ? HashName(_data.pMessageIdName) : 0,
+        _data.messageIdNumber == 0 && _data.pMessage != nullptr ? HashName(_data.pMessage) : 0,
+        objectType,
+        static_cast<uint32_t>(handle),
+        static_cast<uint32_t>(handle >> 32),
+    };
+    uint64_t key = HashBytes(words, sizeof(words));
+    if (key == 0) {
+        key = 1;
+    }
+
+    const char * idName = _data.pMessageIdName != nullptr ? _data.pMessageIdName : "";
+    const char * message = _data.pMessage != nullptr ? _data.pMessage : "";
+    Slot * slot = FindSlot(key, _data, _severity);
+    uint32_t count;
+    if (slot == nullptr) {
+        // 表满了，只能按周期里的总数限流，周期到了先输出上个周期丢的条数
+        tableFull_.fetch_add(1, std::memory_order_relaxed);
+        int64_t now = NowMs();
+        int64_t last = overflowReportMs_.load(std::memory_order_relaxed);
+        if (now - last >= static_cast<int64_t>(config_.summaryIntervalMs)
+                && overflowReportMs_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+            ReportOverflow(now - last);
+        }
+        count = overflowWindow_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    else {
+        count = slot->count.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    if (count <= config_.firstOccurrences) {
+        emitted_.fetch_add(1, std::memory_order_relaxed);
+        LOG_BY_SEVERITY(_severity, "validation {} [{}] {:#x}: {}{}", SeverityName(_severity), idName, handle, message,
+                count < config_.firstOccurrences ? ""
+                : slot == nullptr ? " (table full, further messages are summarized)" : " (further repeats are summarized)");
+        return;
+    }
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    if (slot == nullptr) {
+        overflowDropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // 占位的线程还没写完name
+    if (!slot->ready.load(std::memory_order_acquire)) {
+        return;
+    }
+    int64_t now = NowMs();
+    int64_t last = slot->lastReportMs.load(std::memory_order_relaxed);
+    if (now - last >= static_cast<int64_t>(config_.summaryIntervalMs)
+            && slot->lastReportMs.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+        ReportRepeats(*slot, count, now - last);
+    }
+}
+
+void DebugMessenger::ReportRepeats(Slot & _slot, uint32_t _count, int64_t _elapsedMs)
+{
+    // reported只增不减，两个线程同时汇总时同一段次数只报一次
+    uint32_t previous = _slot.reported.load(std::memory_order_relaxed);
+    do {
+        if (previous >= _count) {
+            return;
+        }
+    } while (!_slot.reported.compare_exchange_weak(previous, _count, std::memory_order_relaxed));
+    uint32_t base = std::max(previous, config_.firstOccurrences);
+    if (_count <= base) {
+        return;
+    }
+    emitted_.fetch_add(1, std::memory_order_relaxed);
+    LOG_BY_SEVERITY(_slot.severity, "validation {} [{}] id:{} repeated {} times in {}ms, {} in total",
+            SeverityName(_slot.severity), _slot.name, _slot.messageId, _count - base, _elapsedMs, _count);
+}
+
+void DebugMessenger::ReportOverflow(int64_t _elapsedMs)
+{
+    overflowWindow_.store(0, std::memory_order_relaxed);
+    uint64_t dropped = overflowDropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped == 0) {
+        return;
+    }
+    emitted_.fetch_add(1, std::memory_order_relaxed);
+    logwarn("validation message table full: {} messages dropped in {}ms, {} in total, raise tableSize",
+            dropped, _elapsedMs, tableFull_.load(std::memory_order_relaxed));
+}
+
+void DebugMessenger::FlushSummary()
+{
+    int64_t now = NowMs();
+    ReportOverflow(now - overflowReportMs_.exchange(now, std::memory_order_relaxed));
+    for (uint32_t i = 0; i <= mask_; i++) {
+        Slot & slot = slots_[i];
+        if (!slot.ready.load(std::memory_order_acquire)) {
+            continue;
+        }
+        int64_t last = slot.lastReportMs.exchange(now, std::memory_order_relaxed);
+        ReportRepeats(slot, slot.count.load(std::memory_order_relaxed), now - last);
+    }
+}
+
+DebugMessengerStats DebugMessenger::GetStats() const
+{
+    return DebugMessengerStats{ received_.load(), filtered_.load(), emitted_.load(), suppressed_.load(),
+        tableFull_.load() };
+}
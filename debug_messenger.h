@@ -0,0 +1,93 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+/*
+ * VK_EXT_debug_utils的验证层消息汇总
+ * 回调在驱动的线程里同步执行，这里只做过滤、查表计数，需要输出时才写日志
+ *   1. 按severity和type过滤，也可以按messageIdNumber屏蔽
+ *   2. (messageIdNumber, 第一个object)的hash做key，在定长的无锁开放寻址表里计数
+ *   3. 每个key前firstOccurrences次完整输出，之后每隔summaryIntervalMs输出一次这段时间重复了多少次
+ * 表满了以后新的key不再去重，每个summaryIntervalMs里前firstOccurrences条完整输出，其余的只计数
+ *   周期到了输出一次这段时间丢了多少条，统计里记tableFull
+ * 析构时把还没输出的重复次数汇总一遍，再销毁messenger
+ */
+struct DebugMessengerConfig {
+    VkDebugUtilsMessageSeverityFlagsEXT severities = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
+        | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+    VkDebugUtilsMessageTypeFlagsEXT types = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
+        | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+    uint32_t firstOccurrences = 5;
+    uint32_t summaryIntervalMs = 5000;
+    // 2的幂
+    uint32_t tableSize = 1024;
+    std::vector<int32_t> ignoredMessageIds;
+};
+
+struct DebugMessengerStats {
+    uint64_t received;
+    uint64_t filtered;
+    uint64_t emitted;
+    uint64_t suppressed;
+    uint64_t tableFull;
+};
+
+class DebugMessenger {
+public:
+    // instance要打开这个扩展，CheckInstanceExtensionPropertiesSupport不通过时不要创建
+    static const char * GetRequiredExtension() { return "VK_EXT_debug_utils"; }
+
+    DebugMessenger(VkInstance _instance, const DebugMessengerConfig & _config = DebugMessengerConfig());
+    // 要在vkDestroyInstance之前析构
+    ~DebugMessenger();
+    DebugMessenger(const DebugMessenger &) = delete;
+    DebugMessenger & operator=(const DebugMessenger &) = delete;
+
+    // 把到目前为止没有输出的重复次数输出一遍，比如每隔一段时间或者测试结束时调用
+    void FlushSummary();
+    DebugMessengerStats GetStats() const;
+
+private:
+    struct Slot {
+        // 0表示空
+        std::atomic<uint64_t> key;
+        // name写完以后置上，汇总时只看ready的slot
+        std::atomic<bool> ready;
+        std::atomic<uint32_t> count;
+        // 上次输出(完整消息或汇总)时的count
+        std::atomic<uint32_t> reported;
+        std::atomic<int64_t> lastReportMs;
+        int32_t messageId;
+        VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+        char name[64];
+    };
+
+    static VKAPI_ATTR VkBool32 VKAPI_CALL Callback(VkDebugUtilsMessageSeverityFlagBitsEXT _severity,
+            VkDebugUtilsMessageTypeFlagsEXT _types, const VkDebugUtilsMessengerCallbackDataEXT * _data, void * _user);
+    void OnMessage(VkDebugUtilsMessageSeverityFlagBitsEXT _severity, const VkDebugUtilsMessengerCallbackDataEXT & _data);
+    // 表满返回nullptr
+    Slot * FindSlot(uint64_t _key, const VkDebugUtilsMessengerCallbackDataEXT & _data,
+            VkDebugUtilsMessageSeverityFlagBitsEXT _severity);
+    void ReportRepeats(Slot & _slot, uint32_t _count, int64_t _elapsedMs);
+    // 输出表满以后丢掉的条数，开始新的周期
+    void ReportOverflow(int64_t _elapsedMs);
+
+    VkInstance instance_;
+    VkDebugUtilsMessengerEXT messenger_;
+    DebugMessengerConfig config_;
+    std::unique_ptr<Slot[]> slots_;
+    uint32_t mask_;
+
+    std::atomic<uint64_t> received_;
+    std::atomic<uint64_t> filtered_;
+    std::atomic<uint64_t> emitted_;
+    std::atomic<uint64_t> suppressed_;
+    std::atomic<uint64_t> tableFull_;
+    // 表满以后当前周期里的条数、其中没输出的条数和周期开始的时间
+    std::atomic<uint32_t> overflowWindow_;
+    std::atomic<uint64_t> overflowDropped_;
+    std::atomic<int64_t> overflowReportMs_;
+};
@@ -0,0 +1,217 @@
+#include "descriptor_allocator.h"
+#include "hash.h"
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <logger.h>
+
+namespace {
+
+void PushHandle(std::vector<uint32_t> & _words, uint64_t _value)
+{
+    _words.push_back(static_cast<uint32_t>(_value));
+    _words.push_back(static_cast<uint32_t>(_value >> 32));
+}
+
+// non-dispatchable handle在32位平台上是uint64_t，64位上是指针
+template<typename T>
+uint64_t HandleValue(T _handle)
+{
+    uint64_t value = 0;
+    memcpy(&value, &_handle, sizeof(_handle));
+    return value;
+}
+
+bool IsImageDescriptor(VkDescriptorType _type)
+{
+    return _type == VK_DESCRIPTOR_TYPE_SAMPLER || _type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+        || _type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE || _type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+        || _type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+}
+
+bool IsBufferDescriptor(VkDescriptorType _type)
+{
+    return _type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || _type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+        || _type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || _type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+}
+
+}
+
+std::vector<DescriptorPoolRatio> GetDefaultDescriptorPoolRatios()
+{
+    return {
+        { VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.0f },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 4.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2.0f },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.0f },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.0f },
+        { VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 0.5f },
+    };
+}
+
+DescriptorAllocator::DescriptorAllocator(VkDevice _device, uint32_t _framesInFlight,
+        const std::vector<DescriptorPoolRatio> & _ratios, uint32_t _initialSetsPerPool, uint32_t _maxSetsPerPool) :
+    device_(_device),
+    ratios_(_ratios),
+    nextSetsPerPool_(std::max<uint32_t>(_initialSetsPerPool, 1)),
+    maxSetsPerPool_(std::max(_maxSetsPerPool, _initialSetsPerPool)),
+    frames_(std::max<uint32_t>(_framesInFlight, 1)),
+    frameIndex_(0),
+    currentPool_(VK_NULL_HANDLE),
+    stats_({ 0, 0, 0 })
+{
+    if (ratios_.empty()) {
+        throw std::runtime_error("descriptor pool ratios are empty!");
+    }
+}
+
+DescriptorAllocator::~DescriptorAllocator()
+{
+    // 销毁pool会一起释放里面的set
+    for (VkDescriptorPool pool : allPools_) {
+        vkDestroyDescriptorPool(device_, pool, nullptr);
+    }
+}
+
+VkDescriptorPool DescriptorAllocator::CreatePool(uint32_t _maxSets)
+{
+    std::vector<VkDescriptorPoolSize> sizes;
+    sizes.reserve(ratios_.size());
+    for (const auto & ratio : ratios_) {
+        uint32_t count = static_cast<uint32_t>(ratio.ratio * _maxSets);
+        sizes.push_back({ ratio.type, std::max<uint32_t>(count, 1) });
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    // 不加FREE_DESCRIPTOR_SET_BIT，只整体reset，驱动可以用线性分配
+    poolInfo.flags = 0;
+    poolInfo.maxSets = _maxSets;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
+    poolInfo.pPoolSizes = sizes.data();
+    VkDescriptorPool pool;
+    if (vkCreateDescriptorPool(device_, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor pool!");
+    }
+    allPools_.push_back(pool);
+    stats_.poolCount++;
+    loginfo("descriptor pool created, max sets:{} pools:{}", _maxSets, allPools_.size());
+    return pool;
+}
+
+VkDescriptorPool DescriptorAllocator::GetPool()
+{
+    if (currentPool_ != VK_NULL_HANDLE) {
+        return currentPool_;
+    }
+    if (!freePools_.empty()) {
+        currentPool_ = freePools_.back();
+        freePools_.pop_back();
+    }
+    else {
+        currentPool_ = CreatePool(nextSetsPerPool_);
+        nextSetsPerPool_ = std::min(nextSetsPerPool_ + nextSetsPerPool_ / 2, maxSetsPerPool_);
+    }
+    frames_[frameIndex_].used.push_back(currentPool_);
+    return currentPool_;
+}
+
+void DescriptorAllocator::BeginFrame(uint32_t _frameIndex)
+{
+    frameIndex_ = _frameIndex % static_cast<uint32_t>(frames_.size());
+    FramePools & frame = frames_[frameIndex_];
+    for (VkDescriptorPool pool : frame.used) {
+        vkResetDescriptorPool(device_, pool, 0);
+        freePools_.push_back(pool);
+    }
+    frame.used.clear();
+    frame.cache.clear();
+    currentPool_ = VK_NULL_HANDLE;
+}
+
+VkDescriptorSet DescriptorAllocator::Allocate(VkDescriptorSetLayout _layout)
+{
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &_layout;
+
+    // 新pool里还放不下就是layout本身超过了pool的容量，不再重试
+    for (int attempt = 0; attempt < 2; attempt++) {
+        allocInfo.descriptorPool = GetPool();
+        VkDescriptorSet set;
+        VkResult result = vkAllocateDescriptorSets(device_, &allocInfo, &set);
+        if (result == VK_SUCCESS) {
+            stats_.allocations++;
+            return set;
+        }
+        if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) {
+            break;
+        }
+        currentPool_ = VK_NULL_HANDLE;
+    }
+    throw std::runtime_error("failed to allocate descriptor set!");
+}
+
+VkDescriptorSet DescriptorAllocator::GetCachedSet(VkDescriptorSetLayout _layout,
+        const std::vector<DescriptorBinding> & _bindings)
+{
+    // key只包含type对应的那部分信息，没用到的字段不影响命中
+    std::vector<uint32_t> key;
+    key.reserve(2 + _bindings.size() * 8);
+    PushHandle(key, HandleValue(_layout));
+    for (const auto & binding : _bindings) {
+        key.push_back(binding.binding);
+        key.push_back(static_cast<uint32_t>(binding.type));
+        if (IsBufferDescriptor(binding.type)) {
+            PushHandle(key, HandleValue(binding.buffer.buffer));
+            PushHandle(key, binding.buffer.offset);
+            PushHandle(key, binding.buffer.range);
+        }
+        else if (IsImageDescriptor(binding.type)) {
+            PushHandle(key, HandleValue(binding.image.sampler));
+            PushHandle(key, HandleValue(binding.image.imageView));
+            key.push_back(static_cast<uint32_t>(binding.image.imageLayout));
+        }
+        else {
+            throw std::runtime_error("unsupported descriptor type in cached set!");
+        }
+    }
+
+    FramePools & frame = frames_[frameIndex_];
+    uint64_t hash = HashBytes(key.data(), key.size() * sizeof(uint32_t));
+    auto range = frame.cache.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.first == key) {
+            stats_.cacheHits++;
+            return it->second.second;
+        }
+    }
+
+    VkDescriptorSet set = Allocate(_layout);
+    std::vector<VkWriteDescriptorSet> writes(_bindings.size());
+    for (size_t i = 0; i < _bindings.size(); i++) {
+        const DescriptorBinding & binding = _bindings[i];
+        VkWriteDescriptorSet & write = writes[i];
+        write = {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = set;
+        write.dstBinding = binding.binding;
+        write.dstArrayElement = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = binding.type;
+        if (IsBufferDescriptor(binding.type)) {
+            write.pBufferInfo = &binding.buffer;
+        }
+        else {
+            write.pImageInfo = &binding.image;
+        }
+    }
+    // 所有binding一次update
+    vkUpdateDescriptorSets(device_, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    frame.cache.emplace(hash, std::make_pair(std::move(key), set));
+    return set;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <vulkan/vulkan.h>
+
+/*
+ * descriptor set分配
+ * 每个frame in flight一串VkDescriptorPool，pool的各类descriptor数量 = maxSets * ratio
+ * 当前pool返回OUT_OF_POOL_MEMORY/FRAGMENTED_POOL时换一个新pool，新建的pool按1.5倍变大，直到maxSetsPerPool
+ * set不单独释放，BeginFrame时对这一帧用过的pool调vkResetDescriptorPool，pool放回空闲列表给所有帧复用
+ * GetCachedSet对同一帧里layout和绑定内容完全相同的请求返回同一个set，不再分配和update
+ * 不是线程安全的，一个录制线程用一个
+ */
+struct DescriptorPoolRatio {
+    VkDescriptorType type;
+    float ratio;
+};
+
+// 一个binding上的一个descriptor，按type用buffer或者image
+struct DescriptorBinding {
+    uint32_t binding;
+    VkDescriptorType type;
+    VkDescriptorBufferInfo buffer;
+    VkDescriptorImageInfo image;
+};
+
+// 常见的材质和每帧数据的比例
+std::vector<DescriptorPoolRatio> GetDefaultDescriptorPoolRatios();
+
+class DescriptorAllocator {
+public:
+    struct Stats {
+        uint64_t allocations;
+        uint64_t cacheHits;
+        // vkCreateDescriptorPool的次数
+        uint32_t poolCount;
+    };
+
+    DescriptorAllocator(VkDevice _device, uint32_t _framesInFlight,
+            const std::vector<DescriptorPoolRatio> & _ratios = GetDefaultDescriptorPoolRatios(),
+            uint32_t _initialSetsPerPool = 128, uint32_t _maxSetsPerPool = 4096);
+    ~DescriptorAllocator();
+    DescriptorAllocator(const DescriptorAllocator &) = delete;
+    DescriptorAllocator & operator=(const DescriptorAllocator &) = delete;
+
+    // 调用前要保证这一帧上次提交的命令已经执行完(等过fence)
+    void BeginFrame(uint32_t _frameIndex);
+
+    VkDescriptorSet Allocate(VkDescriptorSetLayout _layout);
+    // 分配并写入_bindings，同一帧里相同的(_layout, _bindings)直接返回之前的set
+    VkDescriptorSet GetCachedSet(VkDescriptorSetLayout _layout, const std::vector<DescriptorBinding> & _bindings);
+
+    Stats GetStats() const { return stats_; }
+
+private:
+    struct FramePools {
+        std::vector<VkDescriptorPool> used;
+        // 同一个hash可能对应多个key
+        std::unordered_multimap<uint64_t, std::pair<std::vector<uint32_t>, VkDescriptorSet>> cache;
+    };
+
+    VkDescriptorPool GetPool();
+    VkDescriptorPool CreatePool(uint32_t _maxSets);
+
+    VkDevice device_;
+    std::vector<DescriptorPoolRatio> ratios_;
+    uint32_t nextSetsPerPool_;
+    uint32_t maxSetsPerPool_;
+    std::vector<FramePools> frames_;
+    uint32_t frameIndex_;
+    VkDescriptorPool currentPool_;
+    std::vector<VkDescriptorPool> freePools_;
+    std::vector<VkDescriptorPool> allPools_;
+    Stats stats_;
+};
@@ -0,0 +1,292 @@
+#include "device_capabilities.h"
+#include <map>
+#include <mutex>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <logger.h>
+
+namespace {
+
+const uint32_t kCapsFileMagic = 0x50414344; // "DCAP"
+const uint32_t kCapsFileVersion = 1;
+// 文件里的个数超过这些就当作损坏，不按它分配内存
+const uint32_t kMaxCachedQueueFamilies = 64;
+const uint32_t kMaxCachedExtensions = 4096;
+
+/*
+ * 文件头，后面依次是features, memoryProperties, queueFamilies, extensions
+ * 结构体直接按内存布局写入，所以sizeof也写进去，头文件版本不一致的时候拒绝加载
+ */
+struct CapsFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+    uint32_t featuresSize;
+    uint32_t memoryPropertiesSize;
+    uint32_t queueFamilySize;
+    uint32_t extensionSize;
+    uint32_t queueFamilyCount;
+    uint32_t extensionCount;
+};
+
+std::mutex gCapsMutex;
+std::map<VkPhysicalDevice, std::unique_ptr<const DeviceCapabilities>> gCaps;
+
+void LogDeviceCapabilities(const DeviceCapabilities & _caps)
+{
+    loginfo("device name:{}", _caps.properties.deviceName);
+
+    loginfo("available physical device extension properties:");
+    for (const auto & ext : _caps.extensions) {
+        loginfo("\t{}, specVersion:{}", ext.extensionName, ext.specVersion);
+    }
+
+    loginfo("available queue:");
+    for (uint32_t i = 0; i < _caps.queueFamilies.size(); i++) {
+        loginfo("\t{}queueCount:{}", i, _caps.queueFamilies[i].queueCount);
+        auto flag = _caps.queueFamilies[i].queueFlags;
+        if (flag & VK_QUEUE_GRAPHICS_BIT)
+            loginfo("\t\tVK_QUEUE_GRAPHICS_BIT");
+        if (flag & VK_QUEUE_COMPUTE_BIT)
+            loginfo("\t\tVK_QUEUE_COMPUTE_BIT");
+        if (flag & VK_QUEUE_TRANSFER_BIT)
+            loginfo("\t\tVK_QUEUE_TRANSFER_BIT");
+        if (flag & VK_QUEUE_SPARSE_BINDING_BIT)
+            loginfo("\t\tVK_QUEUE_SPARSE_BINDING_BIT");
+        if (flag & VK_QUEUE_PROTECTED_BIT)
+            loginfo("\t\tVK_QUEUE_PROTECTED_BIT");
+        if (flag == VK_QUEUE_FLAG_BITS_MAX_ENUM)
+            loginfo("\t\tVK_QUEUE_FLAG_BITS_MAX_ENUM");
+    }
+
+    //VkPhysicalDeviceMemoryProperties
+    //  memoryTypes(VkMemoryType)
+    //    propertyFlags 内存类型 只能设备(gpu)可见 主机可见等
+    const VkPhysicalDeviceMemoryProperties & mem = _caps.memoryProperties;
+    for (uint32_t i = 0; i < mem.memoryHeapCount; i++) {
+        loginfo("\tmemoryHeapCount Idx:{} size:{}", i, mem.memoryHeaps[i].size);
+        auto flag = mem.memoryHeaps[i].flags;
+        if (flag & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            loginfo("\t\tVK_MEMORY_HEAP_DEVICE_LOCAL_BIT");
+        if (flag & VK_MEMORY_HEAP_MULTI_INSTANCE_BIT)
+            loginfo("\t\tVK_MEMORY_PROPERTY_HOST_VISIBLE_BIT==VK_MEMORY_HEAP_MULTI_INSTANCE_BIT_KHR");
+        if (flag == VK_MEMORY_HEAP_FLAG_BITS_MAX_ENUM)
+            loginfo("\t\tVK_MEMORY_HEAP_FLAG_BITS_MAX_ENUM");
+    }
+    for (uint32_t i = 0; i < mem.memoryTypeCount; i++) {
+        loginfo("\tmemoryType Idx:{}, memoryHeap Idx:{}", i, mem.memoryTypes[i].heapIndex);
+        auto flag = mem.memoryTypes[i].propertyFlags;
+        if (flag & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)// = 0x00000001,
+            loginfo("\t\tVK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT");
+        if (flag & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)// = 0x00000002,
+            loginfo("\t\tVK_MEMORY_PROPERTY_HOST_VISIBLE_BIT");
+        if (flag & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)// = 0x00000004,
+            loginfo("\t\tVK_MEMORY_PROPERTY_HOST_COHERENT_BIT");
+        if (flag & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)// = 0x00000008,
+            loginfo("\t\tVK_MEMORY_PROPERTY_HOST_CACHED_BIT");
+        if (flag & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)// = 0x00000010,
+            loginfo("\t\tVK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT");
+        if (flag == VK_MEMORY_PROPERTY_FLAG_BITS_MAX_ENUM)//= 0x7FFFFFF
+            loginfo("\t\tVK_MEMORY_PROPERTY_FLAG_BITS_MAX_ENUM");
+    }
+}
+
+std::unique_ptr<DeviceCapabilities> EnumerateDeviceCapabilities(VkPhysicalDevice _physicalDevice)
+{
+    std::unique_ptr<DeviceCapabilities> caps = std::make_unique<DeviceCapabilities>();
+
+    //VkPhysicalDeviceProperties
+    //  deviceType 字段集成或者独立显
+    //  apiVersion 支持的vulkan的最高版本
+    //  VkPhysicalDeviceLimits limits 显卡的物理限制，如
+    //     1. limits.discreteQueuePriorities 和队列优先级有关
+    vkGetPhysicalDeviceProperties(_physicalDevice, &caps->properties);
+    vkGetPhysicalDeviceFeatures(_physicalDevice, &caps->features);
+    vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &caps->memoryProperties);
+
+    //VkQueueFamilyProperties
+    //  queueFlags 常见包括图形功能 计算功能 传输操作(例如复制缓冲区和映像内容)
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
+    caps->queueFamilies.resize(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, caps->queueFamilies.data());
+
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extensionCount, nullptr);
+    caps->extensions.resize(extensionCount);
+    vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extensionCount, caps->extensions.data());
+    caps->extensions.resize(extensionCount);
+
+    return caps;
+}
+
+// 调用者持有gCapsMutex
+const DeviceCapabilities & InstallDeviceCapabilities(VkPhysicalDevice _physicalDevice,
+        std::unique_ptr<DeviceCapabilities> _caps)
+{
+    _caps->extensionSupport = MakeNameSupport(_caps->extensions);
+    LogDeviceCapabilities(*_caps);
+    auto & slot = gCaps[_physicalDevice];
+    slot = std::move(_caps);
+    return *slot;
+}
+
+template<typename T>
+bool ReadItems(FILE * _file, T * _items, size_t _count)
+{
+    return fread(_items, sizeof(T), _count, _file) == _count;
+}
+
+// 剩下的字节数，失败返回-1
+long GetRemainingSize(FILE * _file)
+{
+    long current = ftell(_file);
+    if (current < 0 || fseek(_file, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    long end = ftell(_file);
+    if (end < current || fseek(_file, current, SEEK_SET) != 0) {
+        return -1;
+    }
+    return end - current;
+}
+
+// 内存类型和堆的个数、类型指向的堆都要在范围内，否则FindMemoryTypeIndex会越界
+bool IsValidMemoryProperties(const VkPhysicalDeviceMemoryProperties & _properties)
+{
+    if (_properties.memoryTypeCount > VK_MAX_MEMORY_TYPES || _properties.memoryHeapCount > VK_MAX_MEMORY_HEAPS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < _properties.memoryTypeCount; i++) {
+        if (_properties.memoryTypes[i].heapIndex >= _properties.memoryHeapCount) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename T>
+bool WriteItems(FILE * _file, const T * _items, size_t _count)
+{
+    return fwrite(_items, sizeof(T), _count, _file) == _count;
+}
+
+}
+
+const DeviceCapabilities & GetDeviceCapabilities(VkPhysicalDevice _physicalDevice)
+{
+    std::lock_guard<std::mutex> lock(gCapsMutex);
+    auto it = gCaps.find(_physicalDevice);
+    if (it != gCaps.end()) {
+        return *it->second;
+    }
+    return InstallDeviceCapabilities(_physicalDevice, EnumerateDeviceCapabilities(_physicalDevice));
+}
+
+/**
+ * desc: 热启动时从文件恢复快照，只调用一次vkGetPhysicalDeviceProperties来校验key
+ **/
+bool LoadDeviceCapabilities(VkPhysicalDevice _physicalDevice, const char * _path)
+{
+    {
+        std::lock_guard<std::mutex> lock(gCapsMutex);
+        if (gCaps.find(_physicalDevice) != gCaps.end()) {
+            return true;
+        }
+    }
+
+    FILE * file = fopen(_path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    std::unique_ptr<DeviceCapabilities> caps = std::make_unique<DeviceCapabilities>();
+    vkGetPhysicalDeviceProperties(_physicalDevice, &caps->properties);
+
+    CapsFileHeader header;
+    bool ok = ReadItems(file, &header, 1)
+        && header.magic == kCapsFileMagic
+        && header.version == kCapsFileVersion
+        && header.vendorID == caps->properties.vendorID
+        && header.deviceID == caps->properties.deviceID
+        && header.driverVersion == caps->properties.driverVersion
+        && memcmp(header.pipelineCacheUUID, caps->properties.pipelineCacheUUID, VK_UUID_SIZE) == 0
+        && header.featuresSize == sizeof(VkPhysicalDeviceFeatures)
+        && header.memoryPropertiesSize == sizeof(VkPhysicalDeviceMemoryProperties)
+        && header.queueFamilySize == sizeof(VkQueueFamilyProperties)
+        && header.extensionSize == sizeof(VkExtensionProperties)
+        && header.queueFamilyCount <= kMaxCachedQueueFamilies
+        && header.extensionCount <= kMaxCachedExtensions;
+    if (ok) {
+        // 截断或者多出来的文件都不要，大小要和header说的完全一致
+        long expected = static_cast<long>(sizeof(VkPhysicalDeviceFeatures) + sizeof(VkPhysicalDeviceMemoryProperties)
+            + header.queueFamilyCount * sizeof(VkQueueFamilyProperties)
+            + header.extensionCount * sizeof(VkExtensionProperties));
+        ok = GetRemainingSize(file) == expected;
+    }
+    if (ok) {
+        caps->queueFamilies.resize(header.queueFamilyCount);
+        caps->extensions.resize(header.extensionCount);
+        ok = ReadItems(file, &caps->features, 1)
+            && ReadItems(file, &caps->memoryProperties, 1)
+            && IsValidMemoryProperties(caps->memoryProperties)
+            && ReadItems(file, caps->queueFamilies.data(), caps->queueFamilies.size())
+            && ReadItems(file, caps->extensions.data(), caps->extensions.size());
+    }
+    // 扩展名后面按字符串用，必须有结尾的0
+    for (size_t i = 0; ok && i < caps->extensions.size(); i++) {
+        ok = memchr(caps->extensions[i].extensionName, 0, VK_MAX_EXTENSION_NAME_SIZE) != nullptr;
+    }
+    fclose(file);
+
+    if (!ok) {
+        loginfo("device capabilities cache {} is stale or corrupt, enumerate again", _path);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(gCapsMutex);
+    if (gCaps.find(_physicalDevice) == gCaps.end()) {
+        InstallDeviceCapabilities(_physicalDevice, std::move(caps));
+    }
+    return true;
+}
+
+bool SaveDeviceCapabilities(VkPhysicalDevice _physicalDevice, const char * _path)
+{
+    const DeviceCapabilities & caps = GetDeviceCapabilities(_physicalDevice);
+
+    CapsFileHeader header = {};
+    header.magic = kCapsFileMagic;
+    header.version = kCapsFileVersion;
+    header.vendorID = caps.properties.vendorID;
+    header.deviceID = caps.properties.deviceID;
+    header.driverVersion = caps.properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, caps.properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.featuresSize = sizeof(VkPhysicalDeviceFeatures);
+    header.memoryPropertiesSize = sizeof(VkPhysicalDeviceMemoryProperties);
+    header.queueFamilySize = sizeof(VkQueueFamilyProperties);
+    header.extensionSize = sizeof(VkExtensionProperties);
+    header.queueFamilyCount = static_cast<uint32_t>(caps.queueFamilies.size());
+    header.extensionCount = static_cast<uint32_t>(caps.extensions.size());
+
+    FILE * file = fopen(_path, "wb");
+    if (file == nullptr) {
+        logerror("open {} for write fail", _path);
+        return false;
+    }
+    bool ok = WriteItems(file, &header, 1)
+        && WriteItems(file, &caps.features, 1)
+        && WriteItems(file, &caps.memoryProperties, 1)
+        && WriteItems(file, caps.queueFamilies.data(), caps.queueFamilies.size())
+        && WriteItems(file, caps.extensions.data(), caps.extensions.size());
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        logerror("write device capabilities to {} fail", _path);
+        remove(_path);
+    }
+    return ok;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "name_registry.h"
+
+/*
+ * 物理设备能力快照，每个VkPhysicalDevice只枚举一次，之后所有查询都读这里
+ * 构建完成后不再修改，可以在多个线程里同时读
+ */
+struct DeviceCapabilities {
+    VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceFeatures features;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    std::vector<VkQueueFamilyProperties> queueFamilies;
+    std::vector<VkExtensionProperties> extensions;
+    // 由extensions生成，检查device扩展用
+    NameSupport extensionSupport;
+};
+
+// 第一次调用时枚举并记录日志，之后直接返回缓存的快照
+const DeviceCapabilities & GetDeviceCapabilities(VkPhysicalDevice _physicalDevice);
+
+// 磁盘缓存以vendorID/deviceID/driverVersion/pipelineCacheUUID为key
+// load成功后GetDeviceCapabilities不再做任何枚举；驱动升级后key不匹配，返回false
+bool LoadDeviceCapabilities(VkPhysicalDevice _physicalDevice, const char * _path);
+bool SaveDeviceCapabilities(VkPhysicalDevice _physicalDevice, const char * _path);
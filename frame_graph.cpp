@@ -0,0 +1,416 @@
+#include "frame_graph.h"
+#include "helper.h"
+#include "device_capabilities.h"
+#include "gpu_profiler.h"
+#include <algorithm>
+#include <stdexcept>
+#include <logger.h>
+
+namespace {
+
+VkImageUsageFlags GetImageUsageFlags(ImageUsage _usage)
+{
+    switch (_usage) {
+    case ImageUsage::TransferSrc:
+        return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    case ImageUsage::TransferDst:
+        return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    case ImageUsage::ColorAttachment:
+        return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    case ImageUsage::DepthStencilAttachment:
+    case ImageUsage::DepthStencilRead:
+        return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    case ImageUsage::FragmentShaderRead:
+    case ImageUsage::ComputeShaderRead:
+        return VK_IMAGE_USAGE_SAMPLED_BIT;
+    case ImageUsage::ComputeShaderWrite:
+        return VK_IMAGE_USAGE_STORAGE_BIT;
+    case ImageUsage::Present:
+        return 0;
+    }
+    return 0;
+}
+
+VkDeviceSize AlignUp(VkDeviceSize _value, VkDeviceSize _alignment)
+{
+    return (_value + _alignment - 1) / _alignment * _alignment;
+}
+
+const VkImageUsageFlags kAttachmentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+    | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+}
+
+void FrameGraphPassBuilder::Read(FrameGraphResource _resource, ImageUsage _usage)
+{
+    graph_.passes_[pass_].accesses.push_back({ _resource, _usage, false });
+}
+
+void FrameGraphPassBuilder::Write(FrameGraphResource _resource, ImageUsage _usage)
+{
+    graph_.passes_[pass_].accesses.push_back({ _resource, _usage, true });
+}
+
+FrameGraph::FrameGraph(VkDevice _device, VkPhysicalDevice _physicalDevice) :
+    device_(_device),
+    physicalDevice_(_physicalDevice),
+    transientBytes_(0),
+    unaliasedBytes_(0),
+    compiled_(false),
+    profiler_(nullptr)
+{
+}
+
+FrameGraph::~FrameGraph()
+{
+    Release();
+}
+
+FrameGraphResource FrameGraph::CreateImage(const char * _name, const FrameGraphImageDesc & _desc)
+{
+    if (compiled_) {
+        throw std::runtime_error("frame graph is already compiled!");
+    }
+    Resource resource = {};
+    resource.name = _name;
+    resource.imported = false;
+    resource.desc = _desc;
+    resource.range = { _desc.aspect, 0, 1, 0, 1 };
+    resource.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resources_.push_back(resource);
+    return static_cast<FrameGraphResource>(resources_.size() - 1);
+}
+
+FrameGraphResource FrameGraph::ImportImage(const char * _name, VkImage _image, VkImageView _view,
+        const VkImageSubresourceRange & _range, VkImageLayout _initialLayout, ImageUsage _finalUsage)
+{
+    if (compiled_) {
+        throw std::runtime_error("frame graph is already compiled!");
+    }
+    Resource resource = {};
+    resource.name = _name;
+    resource.imported = true;
+    resource.image = _image;
+    resource.view = _view;
+    resource.range = _range;
+    resource.initialLayout = _initialLayout;
+    resource.finalUsage = _finalUsage;
+    resources_.push_back(resource);
+    return static_cast<FrameGraphResource>(resources_.size() - 1);
+}
+
+void FrameGraph::SetImportedImage(FrameGraphResource _resource, VkImage _image, VkImageView _view)
+{
+    Resource & resource = resources_.at(_resource);
+    if (!resource.imported) {
+        throw std::runtime_error("only imported images can be replaced!");
+    }
+    resource.image = _image;
+    resource.view = _view;
+}
+
+void FrameGraph::MarkOutput(FrameGraphResource _resource)
+{
+    resources_.at(_resource).output = true;
+}
+
+void FrameGraph::AddPass(const char * _name, const SetupFunc & _setup, const ExecuteFunc & _execute)
+{
+    if (compiled_) {
+        throw std::runtime_error("frame graph is already compiled!");
+    }
+    Pass pass;
+    pass.name = _name;
+    pass.execute = _execute;
+    pass.culled = false;
+    passes_.push_back(pass);
+    FrameGraphPassBuilder builder(*this, static_cast<uint32_t>(passes_.size() - 1));
+    _setup(builder);
+}
+
+VkImage FrameGraph::GetImage(FrameGraphResource _resource) const
+{
+    return resources_.at(_resource).image;
+}
+
+VkImageView FrameGraph::GetImageView(FrameGraphResource _resource) const
+{
+    return resources_.at(_resource).view;
+}
+
+void FrameGraph::CullPasses()
+{
+    std::vector<bool> needed(resources_.size());
+    for (size_t i = 0; i < resources_.size(); i++) {
+        needed[i] = resources_[i].output || resources_[i].imported;
+    }
+    // 读只会读前面pass写的结果，倒着扫一遍就够了
+    for (size_t i = passes_.size(); i-- > 0;) {
+        Pass & pass = passes_[i];
+        pass.culled = true;
+        for (const auto & access : pass.accesses) {
+            if (access.write && needed[access.resource]) {
+                pass.culled = false;
+                break;
+            }
+        }
+        if (pass.culled) {
+            loginfo("frame graph: cull pass {}", pass.name);
+            continue;
+        }
+        for (const auto & access : pass.accesses) {
+            if (!access.write) {
+                needed[access.resource] = true;
+            }
+        }
+    }
+
+    order_.clear();
+    for (uint32_t i = 0; i < passes_.size(); i++) {
+        if (!passes_[i].culled) {
+            order_.push_back(i);
+        }
+    }
+}
+
+void FrameGraph::ComputeLifetimes()
+{
+    for (auto & resource : resources_) {
+        resource.firstPass = -1;
+        resource.lastPass = -1;
+    }
+    for (int i = 0; i < static_cast<int>(order_.size()); i++) {
+        const Pass & pass = passes_[order_[i]];
+        for (const auto & access : pass.accesses) {
+            Resource & resource = resources_[access.resource];
+            if (resource.firstPass < 0) {
+                resource.firstPass = i;
+                if (!resource.imported && !access.write) {
+                    logwarn("frame graph: pass {} reads {} before anything writes it", pass.name, resource.name);
+                }
+            }
+            resource.lastPass = i;
+            if (!resource.imported) {
+                resource.desc.usage |= GetImageUsageFlags(access.usage);
+            }
+        }
+    }
+}
+
+void FrameGraph::CreateTransientImages()
+{
+    const DeviceCapabilities & caps = GetDeviceCapabilities(physicalDevice_);
+    for (auto & resource : resources_) {
+        if (resource.imported || resource.firstPass < 0) {
+            continue;
+        }
+        VkImageUsageFlags usage = resource.desc.usage;
+        // 只当attachment用的image内容不需要写回内存，tile-based GPU上可以完全不分配
+        bool lazy = (usage & ~kAttachmentUsage) == 0;
+        if (lazy) {
+            usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        }
+        VkImageCreateInfo createInfo = Get2DImageCreateInfo(resource.desc.width, resource.desc.height,
+                VK_IMAGE_TILING_OPTIMAL, usage, resource.desc.format);
+        if (vkCreateImage(device_, &createInfo, nullptr, &resource.image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create frame graph image!");
+        }
+        vkGetImageMemoryRequirements(device_, resource.image, &resource.requirements);
+
+        int typeIndex = FindMemoryTypeIndex(&caps.memoryProperties, resource.requirements.memoryTypeBits,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lazy ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0);
+        if (typeIndex < 0) {
+            throw std::runtime_error("failed to find memory type for frame graph image!");
+        }
+
+        // 同一种memory type的image放到同一个组里做别名
+        resource.memoryGroup = static_cast<uint32_t>(memoryGroups_.size());
+        for (uint32_t i = 0; i < memoryGroups_.size(); i++) {
+            if (memoryGroups_[i].memoryTypeIndex == static_cast<uint32_t>(typeIndex)) {
+                resource.memoryGroup = i;
+                break;
+            }
+        }
+        if (resource.memoryGroup == memoryGroups_.size()) {
+            memoryGroups_.push_back({ static_cast<uint32_t>(typeIndex), 0, VK_NULL_HANDLE });
+        }
+    }
+}
+
+void FrameGraph::AssignAliases()
+{
+    std::vector<uint32_t> transients;
+    for (uint32_t i = 0; i < resources_.size(); i++) {
+        if (!resources_[i].imported && resources_[i].firstPass >= 0) {
+            transients.push_back(i);
+        }
+    }
+    // 大的先放，减少碎片
+    std::sort(transients.begin(), transients.end(), [this](uint32_t _a, uint32_t _b) {
+        return resources_[_a].requirements.size > resources_[_b].requirements.size;
+    });
+
+    std::vector<uint32_t> placed;
+    for (uint32_t index : transients) {
+        Resource & resource = resources_[index];
+        const VkDeviceSize size = resource.requirements.size;
+        const VkDeviceSize alignment = resource.requirements.alignment;
+
+        // 生命周期重叠的image不能共用内存
+        std::vector<std::pair<VkDeviceSize, VkDeviceSize>> busy;
+        for (uint32_t other : placed) {
+            const Resource & o = resources_[other];
+            if (o.memoryGroup == resource.memoryGroup
+                    && o.firstPass <= resource.lastPass && resource.firstPass <= o.lastPass) {
+                busy.push_back({ o.offset, o.offset + o.requirements.size });
+            }
+        }
+        std::sort(busy.begin(), busy.end());
+
+        // 候选位置是0和每个已占用区间的末尾，取第一个放得下的
+        VkDeviceSize offset = 0;
+        for (const auto & range : busy) {
+            if (AlignUp(offset, alignment) + size <= range.first) {
+                break;
+            }
+            offset = std::max(offset, range.second);
+        }
+        resource.offset = AlignUp(offset, alignment);
+        MemoryGroup & group = memoryGroups_[resource.memoryGroup];
+        group.size = std::max(group.size, resource.offset + size);
+        unaliasedBytes_ += size;
+        placed.push_back(index);
+    }
+
+    // 每个image第一次使用前要等共用这段内存的所有image的访问，包括上一帧的自己
+    std::vector<VkPipelineStageFlags> stages(resources_.size(), 0);
+    std::vector<VkAccessFlags> writes(resources_.size(), 0);
+    for (uint32_t passIndex : order_) {
+        for (const auto & access : passes_[passIndex].accesses) {
+            ImageUsageInfo info = GetImageUsageInfo(access.usage);
+            stages[access.resource] |= info.stage;
+            if (access.write) {
+                writes[access.resource] |= info.access;
+            }
+        }
+    }
+    for (uint32_t a : transients) {
+        Resource & resource = resources_[a];
+        resource.aliasStages = 0;
+        resource.aliasAccess = 0;
+        for (uint32_t b : transients) {
+            const Resource & o = resources_[b];
+            if (o.memoryGroup == resource.memoryGroup && o.offset < resource.offset + resource.requirements.size
+                    && resource.offset < o.offset + o.requirements.size) {
+                resource.aliasStages |= stages[b];
+                resource.aliasAccess |= writes[b];
+            }
+        }
+    }
+}
+
+void FrameGraph::Compile()
+{
+    if (compiled_) {
+        return;
+    }
+    CullPasses();
+    ComputeLifetimes();
+    CreateTransientImages();
+    AssignAliases();
+
+    for (auto & group : memoryGroups_) {
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = group.size;
+        allocInfo.memoryTypeIndex = group.memoryTypeIndex;
+        if (vkAllocateMemory(device_, &allocInfo, nullptr, &group.memory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate frame graph memory!");
+        }
+        transientBytes_ += group.size;
+    }
+
+    for (auto & resource : resources_) {
+        if (resource.imported || resource.firstPass < 0) {
+            continue;
+        }
+        vkBindImageMemory(device_, resource.image, memoryGroups_[resource.memoryGroup].memory, resource.offset);
+        VkImageViewCreateInfo viewInfo = Get2DImageViewCreateInfo(resource.image, resource.desc.format);
+        viewInfo.subresourceRange.aspectMask = resource.desc.aspect;
+        if (vkCreateImageView(device_, &viewInfo, nullptr, &resource.view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create frame graph image view!");
+        }
+    }
+
+    loginfo("frame graph: {} of {} passes, transient memory {} bytes (without aliasing {} bytes)",
+            order_.size(), passes_.size(), transientBytes_, unaliasedBytes_);
+    compiled_ = true;
+}
+
+void FrameGraph::Execute(VkCommandBuffer _commandBuffer)
+{
+    if (!compiled_) {
+        throw std::runtime_error("frame graph is not compiled!");
+    }
+
+    for (const auto & resource : resources_) {
+        if (resource.firstPass < 0) {
+            continue;
+        }
+        tracker_.Register(resource.image, resource.range, resource.initialLayout);
+        if (!resource.imported && resource.aliasStages != 0) {
+            tracker_.SetPriorAccess(resource.image, resource.aliasStages, resource.aliasAccess);
+        }
+    }
+
+    for (int i = 0; i < static_cast<int>(order_.size()); i++) {
+        const Pass & pass = passes_[order_[i]];
+        for (const auto & access : pass.accesses) {
+            const Resource & resource = resources_[access.resource];
+            // 临时image每帧的内容都是新的
+            bool discard = resource.firstPass == i && access.write
+                && (!resource.imported || resource.initialLayout == VK_IMAGE_LAYOUT_UNDEFINED);
+            tracker_.Require(resource.image, access.usage, VK_QUEUE_FAMILY_IGNORED, discard);
+        }
+        // barrier也算在pass里
+        GpuScope scope(profiler_, _commandBuffer, pass.name.c_str());
+        tracker_.Flush(_commandBuffer);
+        pass.execute(_commandBuffer, *this);
+    }
+
+    for (const auto & resource : resources_) {
+        if (resource.imported && resource.firstPass >= 0) {
+            tracker_.Require(resource.image, resource.finalUsage);
+        }
+    }
+    tracker_.Flush(_commandBuffer);
+
+    for (const auto & resource : resources_) {
+        if (resource.firstPass >= 0) {
+            tracker_.Unregister(resource.image);
+        }
+    }
+}
+
+void FrameGraph::Release()
+{
+    for (auto & resource : resources_) {
+        if (resource.imported) {
+            continue;
+        }
+        if (resource.view != VK_NULL_HANDLE) {
+            vkDestroyImageView(device_, resource.view, nullptr);
+        }
+        if (resource.image != VK_NULL_HANDLE) {
+            vkDestroyImage(device_, resource.image, nullptr);
+        }
+        resource.view = VK_NULL_HANDLE;
+        resource.image = VK_NULL_HANDLE;
+    }
+    for (auto & group : memoryGroups_) {
+        if (group.memory != VK_NULL_HANDLE) {
+            vkFreeMemory(device_, group.memory, nullptr);
+        }
+    }
+    memoryGroups_.clear();
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <vulkan/vulkan.h>
+#include "image_state_tracker.h"
+
+/*
+ * frame graph
+ * pass声明自己读写哪些image，Compile时
+ *   1. 从输出(MarkOutput和导入的image)往回找，没有贡献的pass剔除
+ *   2. 按声明顺序执行剩下的pass，读总是读之前pass写好的内容，所以声明顺序就是合法的拓扑序
+ *   3. 根据每个临时image第一次和最后一次被用到的pass算生命周期，生命周期不重叠的image共用同一段内存
+ *   4. 只做attachment的临时image加TRANSIENT_ATTACHMENT，优先放进LAZILY_ALLOCATED内存
+ * Execute时每个pass前用ImageStateTracker插入需要的barrier
+ * Compile一次可以Execute很多帧，导入的image(比如swapchain)每帧用SetImportedImage换
+ */
+using FrameGraphResource = uint32_t;
+
+struct FrameGraphImageDesc {
+    uint32_t width;
+    uint32_t height;
+    VkFormat format;
+    VkImageUsageFlags usage;
+    VkImageAspectFlags aspect;
+};
+
+class FrameGraph;
+class GpuProfiler;
+
+class FrameGraphPassBuilder {
+public:
+    void Read(FrameGraphResource _resource, ImageUsage _usage);
+    void Write(FrameGraphResource _resource, ImageUsage _usage);
+
+private:
+    friend class FrameGraph;
+    FrameGraphPassBuilder(FrameGraph & _graph, uint32_t _pass) : graph_(_graph), pass_(_pass) {}
+    FrameGraph & graph_;
+    uint32_t pass_;
+};
+
+class FrameGraph {
+public:
+    using SetupFunc = std::function<void(FrameGraphPassBuilder &)>;
+    using ExecuteFunc = std::function<void(VkCommandBuffer, const FrameGraph &)>;
+
+    FrameGraph(VkDevice _device, VkPhysicalDevice _physicalDevice);
+    ~FrameGraph();
+    FrameGraph(const FrameGraph &) = delete;
+    FrameGraph & operator=(const FrameGraph &) = delete;
+
+    // 由graph创建和管理内存的临时image
+    FrameGraphResource CreateImage(const char * _name, const FrameGraphImageDesc & _desc);
+    // 外部image，帧开始时是_initialLayout，最后一个pass之后转换到_finalUsage
+    FrameGraphResource ImportImage(const char * _name, VkImage _image, VkImageView _view,
+            const VkImageSubresourceRange & _range, VkImageLayout _initialLayout, ImageUsage _finalUsage);
+    void SetImportedImage(FrameGraphResource _resource, VkImage _image, VkImageView _view);
+    void MarkOutput(FrameGraphResource _resource);
+
+    void AddPass(const char * _name, const SetupFunc & _setup, const ExecuteFunc & _execute);
+
+    // 剔除、算生命周期、分配内存，加完所有pass以后调用一次
+    void Compile();
+    void Execute(VkCommandBuffer _commandBuffer);
+    // 设置以后Execute给每个pass加一个以pass名字命名的GPU scope
+    void SetProfiler(GpuProfiler * _profiler) { profiler_ = _profiler; }
+
+    VkImage GetImage(FrameGraphResource _resource) const;
+    VkImageView GetImageView(FrameGraphResource _resource) const;
+    // 临时image实际占用的内存，和不做别名时的总大小
+    VkDeviceSize GetTransientMemorySize() const { return transientBytes_; }
+    VkDeviceSize GetUnaliasedMemorySize() const { return unaliasedBytes_; }
+
+private:
+    friend class FrameGraphPassBuilder;
+
+    struct Access {
+        FrameGraphResource resource;
+        ImageUsage usage;
+        bool write;
+    };
+    struct Pass {
+        std::string name;
+        ExecuteFunc execute;
+        std::vector<Access> accesses;
+        bool culled;
+    };
+    struct Resource {
+        std::string name;
+        bool imported;
+        bool output;
+        FrameGraphImageDesc desc;
+        VkImage image;
+        VkImageView view;
+        VkImageSubresourceRange range;
+        VkImageLayout initialLayout;
+        ImageUsage finalUsage;
+        // 按编译后的执行顺序，-1表示没有用到
+        int firstPass;
+        int lastPass;
+        uint32_t memoryGroup;
+        VkDeviceSize offset;
+        VkMemoryRequirements requirements;
+        // 和它共用内存的其它image的访问，第一次使用前要等
+        VkPipelineStageFlags aliasStages;
+        VkAccessFlags aliasAccess;
+    };
+    struct MemoryGroup {
+        uint32_t memoryTypeIndex;
+        VkDeviceSize size;
+        VkDeviceMemory memory;
+    };
+
+    void CullPasses();
+    void ComputeLifetimes();
+    void CreateTransientImages();
+    void AssignAliases();
+    void Release();
+
+    VkDevice device_;
+    VkPhysicalDevice physicalDevice_;
+    std::vector<Pass> passes_;
+    std::vector<uint32_t> order_;
+    std::vector<Resource> resources_;
+    std::vector<MemoryGroup> memoryGroups_;
+    ImageStateTracker tracker_;
+    VkDeviceSize transientBytes_;
+    VkDeviceSize unaliasedBytes_;
+    bool compiled_;
+    GpuProfiler * profiler_;
+};
@@ -0,0 +1,23 @@
+#include "frame_target.h"
+#include <stdexcept>
+
+void FrameTarget::Submit(const FrameImage & _frame, VkQueue _queue, VkCommandBuffer _commandBuffer)
+{
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    if (_frame.imageAvailable != VK_NULL_HANDLE) {
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &_frame.imageAvailable;
+        submitInfo.pWaitDstStageMask = &waitStage;
+    }
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &_commandBuffer;
+    if (_frame.renderFinished != VK_NULL_HANDLE) {
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &_frame.renderFinished;
+    }
+    if (vkQueueSubmit(_queue, 1, &submitInfo, _frame.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit frame!");
+    }
+}
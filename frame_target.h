@@ -0,0 +1,41 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include "image_state_tracker.h"
+
+/*
+ * 帧循环的输出目标，交换链(Presenter)和离屏(HeadlessTarget)都实现这个接口
+ * 帧循环只依赖这里的接口，同一套代码可以跑在有窗口和没有显示器的机器上
+ */
+struct FrameImage {
+    uint32_t frameIndex;
+    uint32_t imageIndex;
+    VkImage image;
+    VkImageView view;
+    // 渲染提交要wait imageAvailable，signal renderFinished，带上fence
+    // 离屏模式下两个semaphore都是VK_NULL_HANDLE
+    VkSemaphore imageAvailable;
+    VkSemaphore renderFinished;
+    VkFence fence;
+};
+
+class FrameTarget {
+public:
+    virtual ~FrameTarget() = default;
+
+    // 等帧槽空闲并拿到这一帧要画的image，返回false时跳过这一帧
+    virtual bool BeginFrame(FrameImage & _frame) = 0;
+    // 提交一个command buffer，wait/signal/fence都按_frame填好
+    virtual void Submit(const FrameImage & _frame, VkQueue _queue, VkCommandBuffer _commandBuffer);
+    // 交换链是present，离屏是交给输出回调
+    virtual bool Present(const FrameImage & _frame) = 0;
+
+    virtual VkFormat GetFormat() const = 0;
+    virtual VkExtent2D GetExtent() const = 0;
+    virtual uint32_t GetImageCount() const = 0;
+    // FrameImage::frameIndex的取值个数，按帧分配的资源(command pool、query)要按它分
+    // 交换链的image数可以比它少，不能用GetImageCount代替
+    virtual uint32_t GetFramesInFlight() const = 0;
+
+    // 渲染结束后image要处于的用途，给frame graph的ImportImage用
+    virtual ImageUsage GetFinalUsage() const = 0;
+};
@@ -0,0 +1,344 @@
+#include "gpu_profiler.h"
+#include "helper.h"
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <logger.h>
+
+const uint32_t GpuProfiler::kInvalidScope;
+const uint32_t GpuProfiler::kSummaryWindow;
+const size_t GpuProfiler::kMaxTraceEvents;
+
+namespace {
+
+// Chrome trace里GPU是0号线程，CPU线程从1开始编号
+const uint32_t kGpuThread = 0;
+
+uint32_t GetTraceThread()
+{
+    static std::atomic<uint32_t> next(1);
+    thread_local uint32_t thread = next.fetch_add(1);
+    return thread;
+}
+
+void WriteJsonString(FILE * _file, const std::string & _value)
+{
+    fputc('"', _file);
+    for (char c : _value) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', _file);
+            fputc(c, _file);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            fprintf(_file, "\\u%04x", c);
+        }
+        else {
+            fputc(c, _file);
+        }
+    }
+    fputc('"', _file);
+}
+
+}
+
+GpuProfiler::GpuProfiler(VkDevice _device, VkPhysicalDevice _physicalDevice, VkQueue _queue,
+        uint32_t _queueFamilyIndex, uint32_t _framesInFlight, uint32_t _maxScopesPerFrame) :
+    device_(_device),
+    queue_(_queue),
+    queueFamilyIndex_(_queueFamilyIndex),
+    queryPool_(VK_NULL_HANDLE),
+    maxScopes_(std::max<uint32_t>(_maxScopesPerFrame, 1)),
+    timestampPeriod_(0.0f),
+    timestampMask_(0),
+    frames_(new FrameQueries[std::max<uint32_t>(_framesInFlight, 1)]),
+    frameCount_(std::max<uint32_t>(_framesInFlight, 1)),
+    anchorTicks_(0),
+    anchorUs_(0.0),
+    currentFrame_(0),
+    cpuStart_(std::chrono::steady_clock::now()),
+    droppedEvents_(0),
+    overflowScopes_(0)
+{
+    for (uint32_t i = 0; i < frameCount_; i++) {
+        frames_[i].scopes.reset(new ScopeRecord[maxScopes_]);
+        frames_[i].used.store(0);
+        frames_[i].submitted = false;
+    }
+
+    auto properties = GetPhysicalDeviceProperties(_physicalDevice);
+    auto families = GetPhysicalDeviceQueueFamilyProperties(_physicalDevice);
+    if (_queueFamilyIndex >= families->size()) {
+        throw std::runtime_error("profiler queue family index out of range!");
+    }
+    uint32_t validBits = (*families)[_queueFamilyIndex].timestampValidBits;
+    timestampPeriod_ = properties->limits.timestampPeriod;
+    if (validBits == 0) {
+        logwarn("queue family {} does not support timestamps, gpu profiling disabled", _queueFamilyIndex);
+        return;
+    }
+    timestampMask_ = validBits >= 64 ? UINT64_MAX : ((uint64_t(1) << validBits) - 1);
+
+    // 最后一个query留给Calibrate
+    VkQueryPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = frameCount_ * maxScopes_ * 2 + 1;
+    if (vkCreateQueryPool(device_, &poolInfo, nullptr, &queryPool_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create timestamp query pool!");
+    }
+    // 每个query一个值加一个availability
+    results_.resize(maxScopes_ * 2 * 2);
+    loginfo("gpu profiler: timestamp period:{}ns valid bits:{} frames:{} scopes per frame:{}",
+            timestampPeriod_, validBits, frameCount_, maxScopes_);
+    Calibrate();
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    if (queryPool_ != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device_, queryPool_, nullptr);
+    }
+}
+
+double GpuProfiler::GetCpuTimeUs() const
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - cpuStart_).count();
+}
+
+double GpuProfiler::TicksToUs(uint64_t _from, uint64_t _to) const
+{
+    return static_cast<double>((_to - _from) & timestampMask_) * timestampPeriod_ / 1000.0;
+}
+
+void GpuProfiler::Calibrate()
+{
+    if (queryPool_ == VK_NULL_HANDLE) {
+        return;
+    }
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex_;
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create profiler command pool!");
+    }
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    VkFence fence = VK_NULL_HANDLE;
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkAllocateCommandBuffers(device_, &allocInfo, &commandBuffer) != VK_SUCCESS
+            || vkCreateFence(device_, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+        vkDestroyCommandPool(device_, commandPool, nullptr);
+        throw std::runtime_error("failed to create profiler calibration objects!");
+    }
+
+    const uint32_t query = frameCount_ * maxScopes_ * 2;
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    vkCmdResetQueryPool(commandBuffer, queryPool_, query, 1);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool_, query);
+    vkEndCommandBuffer(commandBuffer);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    // 队列空闲时timestamp基本是提交后立刻写的，取提交前后CPU时间的中点
+    vkQueueWaitIdle(queue_);
+    // 在途的帧都已经执行完，从最老的一帧开始用旧的基准读回，换了基准以后它们的tick比基准早，差值会回绕
+    for (uint32_t i = 1; i <= frameCount_; i++) {
+        uint32_t index = (currentFrame_ + i) % frameCount_;
+        ResolveFrame(index);
+        frames_[index].submitted = false;
+    }
+    double before = GetCpuTimeUs();
+    VkResult result = vkQueueSubmit(queue_, 1, &submitInfo, fence);
+    if (result == VK_SUCCESS) {
+        result = vkWaitForFences(device_, 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+    double after = GetCpuTimeUs();
+    uint64_t ticks = 0;
+    if (result == VK_SUCCESS) {
+        result = vkGetQueryPoolResults(device_, queryPool_, query, 1, sizeof(ticks), &ticks, sizeof(ticks),
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    }
+    vkDestroyFence(device_, fence, nullptr);
+    vkDestroyCommandPool(device_, commandPool, nullptr);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to calibrate gpu timestamps!");
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    anchorTicks_ = ticks & timestampMask_;
+    anchorUs_ = (before + after) * 0.5;
+}
+
+void GpuProfiler::BeginFrame(uint32_t _frameIndex, VkCommandBuffer _commandBuffer)
+{
+    if (queryPool_ == VK_NULL_HANDLE) {
+        return;
+    }
+    currentFrame_ = _frameIndex % frameCount_;
+    ResolveFrame(currentFrame_);
+    FrameQueries & frame = frames_[currentFrame_];
+    vkCmdResetQueryPool(_commandBuffer, queryPool_, currentFrame_ * maxScopes_ * 2, maxScopes_ * 2);
+    frame.used.store(0, std::memory_order_relaxed);
+    frame.submitted = true;
+}
+
+void GpuProfiler::ResolveFrame(uint32_t _frameIndex)
+{
+    FrameQueries & frame = frames_[_frameIndex];
+    uint32_t count = std::min(frame.used.load(std::memory_order_relaxed), maxScopes_);
+    if (!frame.submitted || count == 0) {
+        return;
+    }
+    // 不等待；没写过的query(scope没有End)availability是0，跳过
+    VkResult result = vkGetQueryPoolResults(device_, queryPool_, _frameIndex * maxScopes_ * 2, count * 2,
+            results_.size() * sizeof(uint64_t), results_.data(), 2 * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (result != VK_SUCCESS && result != VK_NOT_READY) {
+        logerror("failed to read timestamp queries, result:{}", static_cast<int>(result));
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 这一帧最早的timestamp做下一次的基准，相邻两次之间不会回绕
+    double earliest = -1.0;
+    uint64_t earliestTicks = anchorTicks_;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint64_t * query = &results_[i * 4];
+        if (query[1] == 0 || query[3] == 0) {
+            continue;
+        }
+        uint64_t begin = query[0] & timestampMask_;
+        uint64_t end = query[2] & timestampMask_;
+        double offset = TicksToUs(anchorTicks_, begin);
+        Record(frame.scopes[i].name, true, kGpuThread, anchorUs_ + offset, anchorUs_ + offset + TicksToUs(begin, end));
+        if (earliest < 0.0 || offset < earliest) {
+            earliest = offset;
+            earliestTicks = begin;
+        }
+    }
+    if (earliest >= 0.0) {
+        anchorTicks_ = earliestTicks;
+        anchorUs_ += earliest;
+    }
+}
+
+uint32_t GpuProfiler::BeginGpuScope(VkCommandBuffer _commandBuffer, const char * _name)
+{
+    if (queryPool_ == VK_NULL_HANDLE) {
+        return kInvalidScope;
+    }
+    FrameQueries & frame = frames_[currentFrame_];
+    uint32_t scope = frame.used.fetch_add(1, std::memory_order_relaxed);
+    if (scope >= maxScopes_) {
+        overflowScopes_.fetch_add(1, std::memory_order_relaxed);
+        return kInvalidScope;
+    }
+    frame.scopes[scope].name = _name;
+    vkCmdWriteTimestamp(_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool_,
+            (currentFrame_ * maxScopes_ + scope) * 2);
+    return scope;
+}
+
+void GpuProfiler::EndGpuScope(VkCommandBuffer _commandBuffer, uint32_t _scope)
+{
+    if (_scope == kInvalidScope) {
+        return;
+    }
+    vkCmdWriteTimestamp(_commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool_,
+            (currentFrame_ * maxScopes_ + _scope) * 2 + 1);
+}
+
+void GpuProfiler::AddCpuScope(const char * _name, double _beginUs, double _endUs)
+{
+    uint32_t thread = GetTraceThread();
+    std::lock_guard<std::mutex> lock(mutex_);
+    Record(_name, false, thread, _beginUs, _endUs);
+}
+
+void GpuProfiler::Record(const char * _name, bool _gpu, uint32_t _thread, double _beginUs, double _endUs)
+{
+    if (events_.size() < kMaxTraceEvents) {
+        events_.push_back({ _name, _thread, _beginUs, _endUs - _beginUs });
+    }
+    else {
+        droppedEvents_++;
+    }
+
+    // GPU和CPU同名的scope分开统计
+    std::string key = _gpu ? "gpu:" : "cpu:";
+    key += _name;
+    auto it = history_.find(key);
+    if (it == history_.end()) {
+        History history = {};
+        history.gpu = _gpu;
+        it = history_.emplace(std::move(key), history).first;
+    }
+    History & history = it->second;
+    history.samples[history.next] = (_endUs - _beginUs) / 1000.0;
+    history.next = (history.next + 1) % kSummaryWindow;
+    history.count = std::min(history.count + 1, kSummaryWindow);
+}
+
+std::vector<ProfileStat> GpuProfiler::GetSummary() const
+{
+    std::vector<ProfileStat> stats;
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.reserve(history_.size());
+    for (const auto & item : history_) {
+        const History & history = item.second;
+        ProfileStat stat;
+        stat.name = item.first.substr(4);
+        stat.gpu = history.gpu;
+        stat.samples = history.count;
+        stat.lastMs = history.samples[(history.next + kSummaryWindow - 1) % kSummaryWindow];
+        stat.minMs = history.samples[0];
+        stat.maxMs = history.samples[0];
+        double total = 0.0;
+        for (uint32_t i = 0; i < history.count; i++) {
+            total += history.samples[i];
+            stat.minMs = std::min(stat.minMs, history.samples[i]);
+            stat.maxMs = std::max(stat.maxMs, history.samples[i]);
+        }
+        stat.avgMs = total / history.count;
+        stats.push_back(stat);
+    }
+    std::sort(stats.begin(), stats.end(), [](const ProfileStat & _a, const ProfileStat & _b) {
+        return _a.gpu != _b.gpu ? _a.gpu : _a.name < _b.name;
+    });
+    return stats;
+}
+
+bool GpuProfiler::WriteChromeTrace(const char * _path) const
+{
+    FILE * file = fopen(_path, "w");
+    if (file == nullptr) {
+        logerror("failed to open trace file {}", _path);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", kGpuThread);
+    for (const TraceEvent & event : events_) {
+        fprintf(file, ",\n{\"name\":");
+        WriteJsonString(file, event.name);
+        fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                event.thread == kGpuThread ? "gpu" : "cpu", event.thread, event.beginUs, event.durationUs);
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    loginfo("chrome trace written to {}, events:{} dropped:{} overflow scopes:{}", _path, events_.size(),
+            droppedEvents_, overflowScopes_.load());
+    return ok;
+}
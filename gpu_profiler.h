@@ -0,0 +1,168 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <vulkan/vulkan.h>
+
+/*
+ * GPU/CPU耗时统计
+ * 每个frame in flight一段timestamp query，每个GPU scope用一对query，begin写在TOP_OF_PIPE，end写在BOTTOM_OF_PIPE
+ * BeginFrame时这一帧上一轮的query已经执行完(调用者等过fence)，不带WAIT_BIT直接读，比提交晚framesInFlight帧，不会卡住
+ * GPU时间在构造时提交一次timestamp和CPU时钟对齐，之后每帧用相邻两帧的差值累加，timestampValidBits小于64时回绕也不出错
+ * CPU scope和GPU scope放在同一条时间线上，可以导出成Chrome trace(chrome://tracing或者Perfetto打开)
+ * 另外按名字保留最近kSummaryWindow次的耗时，GetSummary给出平均/最小/最大
+ * 队列族不支持timestamp时GPU scope都是空操作，CPU scope照常
+ */
+struct ProfileStat {
+    std::string name;
+    bool gpu;
+    uint32_t samples;
+    double lastMs;
+    double avgMs;
+    double minMs;
+    double maxMs;
+};
+
+class GpuProfiler {
+public:
+    static const uint32_t kInvalidScope = UINT32_MAX;
+    static const uint32_t kSummaryWindow = 128;
+    // trace里最多保留的事件数，超过以后只更新summary
+    static const size_t kMaxTraceEvents = 1 << 20;
+
+    GpuProfiler(VkDevice _device, VkPhysicalDevice _physicalDevice, VkQueue _queue, uint32_t _queueFamilyIndex,
+            uint32_t _framesInFlight, uint32_t _maxScopesPerFrame = 256);
+    ~GpuProfiler();
+    GpuProfiler(const GpuProfiler &) = delete;
+    GpuProfiler & operator=(const GpuProfiler &) = delete;
+
+    bool IsGpuSupported() const { return queryPool_ != VK_NULL_HANDLE; }
+
+    /**
+     * desc: 读回这一帧上一轮的结果，再reset这一帧的query
+     *       调用前要等过这一帧上次提交的fence，_commandBuffer是这一帧最先提交的command buffer，不能在render pass里
+     **/
+    void BeginFrame(uint32_t _frameIndex, VkCommandBuffer _commandBuffer);
+
+    // _name在这一帧的结果读回之前要一直有效，一般是字面量或者frame graph里pass的名字
+    // 不同线程可以同时往各自的command buffer里录
+    uint32_t BeginGpuScope(VkCommandBuffer _commandBuffer, const char * _name);
+    void EndGpuScope(VkCommandBuffer _commandBuffer, uint32_t _scope);
+
+    // 构造以来的微秒数，GPU时间也换算到这个时钟上
+    double GetCpuTimeUs() const;
+    void AddCpuScope(const char * _name, double _beginUs, double _endUs);
+
+    /**
+     * desc: 重新和CPU时钟对齐，长时间运行后两个时钟会有漂移
+     *       会等队列空闲，先读回所有在途帧的结果再换基准，要在两帧之间调用(这一帧的command buffer都提交了，下一帧还没BeginFrame)
+     **/
+    void Calibrate();
+
+    std::vector<ProfileStat> GetSummary() const;
+    bool WriteChromeTrace(const char * _path) const;
+
+private:
+    struct ScopeRecord {
+        const char * name;
+    };
+    struct FrameQueries {
+        std::unique_ptr<ScopeRecord[]> scopes;
+        std::atomic<uint32_t> used;
+        bool submitted;
+    };
+    struct TraceEvent {
+        std::string name;
+        uint32_t thread;
+        double beginUs;
+        double durationUs;
+    };
+    struct History {
+        bool gpu;
+        double samples[kSummaryWindow];
+        uint32_t count;
+        uint32_t next;
+    };
+
+    void ResolveFrame(uint32_t _frameIndex);
+    // 调用前持有mutex_
+    void Record(const char * _name, bool _gpu, uint32_t _thread, double _beginUs, double _endUs);
+    // 两个tick之间的微秒数，处理回绕
+    double TicksToUs(uint64_t _from, uint64_t _to) const;
+
+    VkDevice device_;
+    VkQueue queue_;
+    uint32_t queueFamilyIndex_;
+    VkQueryPool queryPool_;
+    uint32_t maxScopes_;
+    float timestampPeriod_;
+    uint64_t timestampMask_;
+    std::unique_ptr<FrameQueries[]> frames_;
+    uint32_t frameCount_;
+    std::vector<uint64_t> results_;
+
+    // 上一次对齐时的GPU tick和对应的CPU微秒
+    uint64_t anchorTicks_;
+    double anchorUs_;
+    uint32_t currentFrame_;
+
+    std::chrono::steady_clock::time_point cpuStart_;
+    mutable std::mutex mutex_;
+    std::vector<TraceEvent> events_;
+    uint64_t droppedEvents_;
+    std::unordered_map<std::string, History> history_;
+    // 一帧里超过maxScopesPerFrame没有记录的scope
+    std::atomic<uint64_t> overflowScopes_;
+};
+
+// 作用域内的GPU耗时，_profiler为空时什么都不做
+class GpuScope {
+public:
+    GpuScope(GpuProfiler * _profiler, VkCommandBuffer _commandBuffer, const char * _name) :
+        profiler_(_profiler),
+        commandBuffer_(_commandBuffer),
+        scope_(_profiler != nullptr ? _profiler->BeginGpuScope(_commandBuffer, _name) : GpuProfiler::kInvalidScope)
+    {
+    }
+    ~GpuScope()
+    {
+        if (profiler_ != nullptr) {
+            profiler_->EndGpuScope(commandBuffer_, scope_);
+        }
+    }
+    GpuScope(const GpuScope &) = delete;
+    GpuScope & operator=(const GpuScope &) = delete;
+
+private:
+    GpuProfiler * profiler_;
+    VkCommandBuffer commandBuffer_;
+    uint32_t scope_;
+};
+
+class CpuScope {
+public:
+    CpuScope(GpuProfiler * _profiler, const char * _name) :
+        profiler_(_profiler),
+        name_(_name),
+        beginUs_(_profiler != nullptr ? _profiler->GetCpuTimeUs() : 0)
+    {
+    }
+    ~CpuScope()
+    {
+        if (profiler_ != nullptr) {
+            profiler_->AddCpuScope(name_, beginUs_, profiler_->GetCpuTimeUs());
+        }
+    }
+    CpuScope(const CpuScope &) = delete;
+    CpuScope & operator=(const CpuScope &) = delete;
+
+private:
+    GpuProfiler * profiler_;
+    const char * name_;
+    double beginUs_;
+};
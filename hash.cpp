@@ -0,0 +1,100 @@
+#include "hash.h"
+#include <cstring>
+
+namespace {
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t Rotl(uint64_t _x, int _r)
+{
+    return (_x << _r) | (_x >> (64 - _r));
+}
+
+inline uint64_t Read64(const uint8_t * _p)
+{
+    uint64_t v;
+    memcpy(&v, _p, sizeof(v));
+    return v;
+}
+
+inline uint32_t Read32(const uint8_t * _p)
+{
+    uint32_t v;
+    memcpy(&v, _p, sizeof(v));
+    return v;
+}
+
+inline uint64_t Round(uint64_t _acc, uint64_t _input)
+{
+    _acc += _input * kPrime2;
+    _acc = Rotl(_acc, 31);
+    return _acc * kPrime1;
+}
+
+inline uint64_t MergeRound(uint64_t _acc, uint64_t _val)
+{
+    _acc ^= Round(0, _val);
+    return _acc * kPrime1 + kPrime4;
+}
+
+}
+
+uint64_t HashBytes(const void * _data, size_t _size)
+{
+    const uint8_t * p = static_cast<const uint8_t *>(_data);
+    const size_t len = _size;
+    const uint8_t * end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        // 4个lane之间没有依赖，可以并行跑满流水线
+        uint64_t v1 = kPrime1 + kPrime2;
+        uint64_t v2 = kPrime2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - kPrime1;
+        const uint8_t * limit = end - 32;
+        do {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+        h = MergeRound(h, v1);
+        h = MergeRound(h, v2);
+        h = MergeRound(h, v3);
+        h = MergeRound(h, v4);
+    }
+    else {
+        h = kPrime5;
+    }
+    h += static_cast<uint64_t>(len);
+
+    while (p + 8 <= end) {
+        h ^= Round(0, Read64(p));
+        h = Rotl(h, 27) * kPrime1 + kPrime4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(Read32(p)) * kPrime1;
+        h = Rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= static_cast<uint64_t>(*p) * kPrime5;
+        h = Rotl(h, 11) * kPrime1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
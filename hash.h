@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * desc: xxHash64(seed 0)，4路独立累加，长输入按32字节一块处理
+ *       通用的字节hash，shader代码和各种缓存的key都用它
+ **/
+uint64_t HashBytes(const void * _data, size_t _size);
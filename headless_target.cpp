@@ -0,0 +1,119 @@
+#include "headless_target.h"
+#include "helper.h"
+#include "device_capabilities.h"
+#include <algorithm>
+#include <stdexcept>
+#include <logger.h>
+
+HeadlessTarget::HeadlessTarget(VkPhysicalDevice _physicalDevice, VkDevice _device, VkExtent2D _extent,
+        VkFormat _format, uint32_t _imageCount) :
+    device_(_device),
+    extent_(_extent),
+    format_(_format),
+    frameIndex_(0)
+{
+    if (_extent.width == 0 || _extent.height == 0) {
+        throw std::runtime_error("headless target extent is empty!");
+    }
+    const VkPhysicalDeviceMemoryProperties & memoryProps = GetDeviceCapabilities(_physicalDevice).memoryProperties;
+    images_.resize(std::max<uint32_t>(_imageCount, 1), TargetImage{ VK_NULL_HANDLE, VK_NULL_HANDLE,
+            VK_NULL_HANDLE, VK_NULL_HANDLE });
+    try {
+        for (auto & target : images_) {
+            // 和交换链一样带TRANSFER_DST，同一套帧循环可以直接往里拷贝或者clear
+            VkImageCreateInfo imageInfo = Get2DImageCreateInfo(extent_.width, extent_.height, VK_IMAGE_TILING_OPTIMAL,
+                    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                    format_);
+            if (vkCreateImage(device_, &imageInfo, nullptr, &target.image) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create headless image!");
+            }
+
+            VkMemoryRequirements requirements;
+            vkGetImageMemoryRequirements(device_, target.image, &requirements);
+            // 软件ICD上可能没有单独的DEVICE_LOCAL类型，只作为偏好
+            int memoryType = FindMemoryTypeIndex(&memoryProps, requirements.memoryTypeBits, 0,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            if (memoryType < 0) {
+                throw std::runtime_error("no memory type for headless image!");
+            }
+            VkMemoryAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocInfo.allocationSize = requirements.size;
+            allocInfo.memoryTypeIndex = static_cast<uint32_t>(memoryType);
+            if (vkAllocateMemory(device_, &allocInfo, nullptr, &target.memory) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate headless image memory!");
+            }
+            vkBindImageMemory(device_, target.image, target.memory, 0);
+
+            VkImageViewCreateInfo viewInfo = Get2DImageViewCreateInfo(target.image, format_);
+            if (vkCreateImageView(device_, &viewInfo, nullptr, &target.view) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create headless image view!");
+            }
+
+            VkFenceCreateInfo fenceInfo = {};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+            if (vkCreateFence(device_, &fenceInfo, nullptr, &target.fence) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create headless frame fence!");
+            }
+        }
+    }
+    catch (...) {
+        Destroy();
+        throw;
+    }
+    loginfo("headless target {}x{} format:{} images:{}", extent_.width, extent_.height,
+            static_cast<int>(format_), images_.size());
+}
+
+HeadlessTarget::~HeadlessTarget()
+{
+    vkDeviceWaitIdle(device_);
+    Destroy();
+}
+
+void HeadlessTarget::Destroy()
+{
+    for (auto & target : images_) {
+        if (target.fence != VK_NULL_HANDLE) {
+            vkDestroyFence(device_, target.fence, nullptr);
+        }
+        if (target.view != VK_NULL_HANDLE) {
+            vkDestroyImageView(device_, target.view, nullptr);
+        }
+        if (target.image != VK_NULL_HANDLE) {
+            vkDestroyImage(device_, target.image, nullptr);
+        }
+        if (target.memory != VK_NULL_HANDLE) {
+            vkFreeMemory(device_, target.memory, nullptr);
+        }
+    }
+    images_.clear();
+}
+
+bool HeadlessTarget::BeginFrame(FrameImage & _frame)
+{
+    TargetImage & target = images_[frameIndex_];
+    vkWaitForFences(device_, 1, &target.fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(device_, 1, &target.fence);
+
+    // 帧槽和image一一对应，不存在交换链那种image比帧槽少的情况
+    _frame.frameIndex = frameIndex_;
+    _frame.imageIndex = frameIndex_;
+    _frame.image = target.image;
+    _frame.view = target.view;
+    _frame.imageAvailable = VK_NULL_HANDLE;
+    _frame.renderFinished = VK_NULL_HANDLE;
+    _frame.fence = target.fence;
+
+    frameIndex_ = (frameIndex_ + 1) % static_cast<uint32_t>(images_.size());
+    return true;
+}
+
+bool HeadlessTarget::Present(const FrameImage & _frame)
+{
+    if (output_) {
+        output_(_frame);
+    }
+    return true;
+}
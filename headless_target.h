@@ -0,0 +1,55 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "frame_target.h"
+
+/*
+ * 离屏渲染目标，不需要VkSurfaceKHR和窗口，instance/device都不开surface相关扩展
+ * imageCount张Get2DImageCreateInfo建的OPTIMAL image，每张一个fence，轮流使用
+ * 没有acquire/present，FrameImage里的semaphore都是VK_NULL_HANDLE
+ * 渲染结束后image处于TRANSFER_SRC_OPTIMAL，Present时把它交给输出回调(回读、编码等)
+ * 只用到核心功能，lavapipe这类软件ICD上也能跑
+ */
+class HeadlessTarget : public FrameTarget {
+public:
+    // Present时调用，回调里可以等_frame.fence再去读image
+    using OutputCallback = std::function<void(const FrameImage &)>;
+
+    HeadlessTarget(VkPhysicalDevice _physicalDevice, VkDevice _device, VkExtent2D _extent,
+            VkFormat _format = VK_FORMAT_R8G8B8A8_UNORM, uint32_t _imageCount = 2);
+    ~HeadlessTarget();
+    HeadlessTarget(const HeadlessTarget &) = delete;
+    HeadlessTarget & operator=(const HeadlessTarget &) = delete;
+
+    void SetOutputCallback(OutputCallback _callback) { output_ = std::move(_callback); }
+
+    // 等这张image上一次的提交结束
+    bool BeginFrame(FrameImage & _frame) override;
+    bool Present(const FrameImage & _frame) override;
+
+    VkFormat GetFormat() const override { return format_; }
+    VkExtent2D GetExtent() const override { return extent_; }
+    uint32_t GetImageCount() const override { return static_cast<uint32_t>(images_.size()); }
+    // 每张image一个帧槽
+    uint32_t GetFramesInFlight() const override { return static_cast<uint32_t>(images_.size()); }
+
+    ImageUsage GetFinalUsage() const override { return ImageUsage::TransferSrc; }
+
+private:
+    struct TargetImage {
+        VkImage image;
+        VkImageView view;
+        VkDeviceMemory memory;
+        VkFence fence;
+    };
+
+    void Destroy();
+
+    VkDevice device_;
+    VkExtent2D extent_;
+    VkFormat format_;
+    std::vector<TargetImage> images_;
+    uint32_t frameIndex_;
+    OutputCallback output_;
+};
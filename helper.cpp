@@ -1,7 +1,10 @@
 #include "helper.h"
-#include <set>
-#include <fstream>
 #include <logger.h>
+#include "device_capabilities.h"
+#include "name_registry.h"
+#include "shader_loader.h"
+#include <cstring>
+#include <algorithm>
 
 /*
  * desc: 返回支持的layer
@@ -29,27 +32,9 @@ std::unique_ptr<std::vector<VkLayerProperties>> GetInstanceLayerProperties()
  * 检查某些layer是否支持
  * @param _enableLayers init like that std::vector<const char*> _enableLayers = { "VK_LAYER_LUNARG_standard_validation" };
  **/
-bool CheckInstanceLayerPropertiesSupport(std::vector<const char*> _enableLayers)
+bool CheckInstanceLayerPropertiesSupport(const std::vector<const char*> & _enableLayers)
 {
-    std::shared_ptr<std::vector<VkLayerProperties>> 
-        availableLayers = GetInstanceLayerProperties();
-
-    for (const char* layerName : _enableLayers) {
-        bool layerFound = false;
-
-        for (int i = 0; i < availableLayers->size(); i++) {
-            if (strcmp(layerName, availableLayers->operator[](i).layerName) == 0) {
-                layerFound = true;
-                break;
-            }
-        }
-
-        if (!layerFound) {
-            return false;
-        }
-    }
-
-    return true;
+    return CheckNameSupport(GetInstanceLayerSupport(), MakeNameRequirement(_enableLayers));
 }
 
 /**
@@ -75,27 +60,9 @@ std::unique_ptr<std::vector<VkExtensionProperties>> GetInstanceExtensionProperti
 /*
  * desc: 检查instance支持的扩展，比如VK_KHR_swapchain就是一个扩展(vulkan自身就支持做离屏渲染)
  */
-bool CheckInstanceExtensionPropertiesSupport(std::vector<const char*> _enableExtensions)
+bool CheckInstanceExtensionPropertiesSupport(const std::vector<const char*> & _enableExtensions)
 {
-    std::unique_ptr<std::vector<VkExtensionProperties>>
-        availableExtensions = GetInstanceExtensionProperties();
-
-    for (const char* extensionName : _enableExtensions) {
-        bool extensionFound = false;
-
-        for (int i = 0; i < availableExtensions->size(); i++) {
-            if (strcmp(extensionName, availableExtensions->operator[](i).extensionName) == 0) {
-                extensionFound = true;
-                break;
-            }
-        }
-
-        if (!extensionFound) {
-            return false;
-        }
-    }
-
-    return true;
+    return CheckNameSupport(GetInstanceExtensionSupport(), MakeNameRequirement(_enableExtensions));
 }
 
 /**
@@ -103,17 +70,25 @@ bool CheckInstanceExtensionPropertiesSupport(std::vector<const char*> _enableExt
  **/
 bool CheckInstanceExtensionPropertiesSupport(const char ** _enableExtensions, int _count)
 {
-    std::vector<const char *> exts;
-    for (int i = 0; i < _count; i++) {
-        exts.push_back(_enableExtensions[i]);
-    }
-    return CheckInstanceExtensionPropertiesSupport(exts);
+    return CheckInstanceExtensionPropertiesSupport(std::vector<const char *>(_enableExtensions, _enableExtensions + _count));
+}
+
+uint32_t GetInstanceVersion()
+{
+    auto enumerateVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(
+            vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion"));
+    uint32_t version = VK_API_VERSION_1_0;
+    if (enumerateVersion != nullptr && enumerateVersion(&version) != VK_SUCCESS) {
+        version = VK_API_VERSION_1_0;
+    }
+    return version;
 }
 
 /**
  * 创建instance
  **/
-VkInstance CreateInstance(const std::vector<const char*> _enableLayers, const std::vector<const char*> _enableExtensions)
+VkInstance CreateInstance(const std::vector<const char*> _enableLayers, const std::vector<const char*> _enableExtensions,
+        uint32_t _apiVersion)
 {
     VkApplicationInfo appInfo = {};
     appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -121,7 +96,7 @@ VkInstance CreateInstance(const std::vector<const char*> _enableLayers, const st
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = _apiVersion;
     
     VkInstanceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -175,79 +150,30 @@ std::unique_ptr<VkPhysicalDeviceProperties> GetPhysicalDeviceProperties(VkPhysic
     //  apiVersion 支持的vulkan的最高版本
     //  VkPhysicalDeviceLimits limits 显卡的物理限制，如
     //     1. limits.discreteQueuePriorities 和队列优先级有关
-    std::unique_ptr<VkPhysicalDeviceProperties>
-    props = std::make_unique<VkPhysicalDeviceProperties>();
-    vkGetPhysicalDeviceProperties(_physicalDevice, props.get());
-    
-    loginfo("device name:{}", props->deviceName);
-    
-    return props;
+    return std::make_unique<VkPhysicalDeviceProperties>(GetDeviceCapabilities(_physicalDevice).properties);
 }
 
 /**
  * extension properties: char extensionName[VK_MAX_EXTENSION_NAME_SIZE];uint32_t specVersion;
  * 扩展名，如VK_KHR_swapchain
  **/
-std::unique_ptr<std::vector<VkExtensionProperties>> GetPhysicalDeviceExtensionProperties(VkPhysicalDevice _physicalDevice)
-{
-    uint32_t extensionCount;
-    vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extensionCount, nullptr);
-    
-    std::unique_ptr<std::vector<VkExtensionProperties>> props =
-    std::make_unique<std::vector<VkExtensionProperties>>(extensionCount);
-    
-    vkEnumerateDeviceExtensionProperties(_physicalDevice, nullptr, &extensionCount, props->data());
-    
-    loginfo("available physical device extension properties:");
-    for (uint32_t i = 0; i < extensionCount; i++) {
-        loginfo("\t{}, specVersion:{}", props->operator[](i).extensionName, props->operator[](i).specVersion);
-    }
-    
-    return props;
+std::unique_ptr<std::vector<VkExtensionProperties>> GetPhysicalDeviceExtensionProperties(VkPhysicalDevice _physicalDevice)
+{
+    return std::make_unique<std::vector<VkExtensionProperties>>(GetDeviceCapabilities(_physicalDevice).extensions);
 }
 
 std::unique_ptr<std::vector<VkQueueFamilyProperties>> GetPhysicalDeviceQueueFamilyProperties(
     VkPhysicalDevice _physicalDevice)
 {
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
-
     //VkQueueFamilyProperties
     //  queueFlags 常见包括图形功能 计算功能 传输操作(例如复制缓冲区和映像内容)
-    std::unique_ptr<std::vector<VkQueueFamilyProperties>> props =
-        std::make_unique<std::vector<VkQueueFamilyProperties>>(queueFamilyCount);
-
-    vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, props->data());
-    
-    loginfo("available queue:");
-    for (uint32_t i = 0; i < queueFamilyCount; i++) {
-        loginfo("\t{}queueCount:{}", i, props->operator[](i).queueCount);
-        auto flag = props->operator[](i).queueFlags;
-        if (flag & VK_QUEUE_GRAPHICS_BIT)
-            loginfo("\t\tVK_QUEUE_GRAPHICS_BIT");
-        if (flag & VK_QUEUE_COMPUTE_BIT)
-            loginfo("\t\tVK_QUEUE_COMPUTE_BIT");
-        if (flag & VK_QUEUE_TRANSFER_BIT)
-            loginfo("\t\tVK_QUEUE_TRANSFER_BIT");
-        if (flag & VK_QUEUE_SPARSE_BINDING_BIT)
-            loginfo("\t\tVK_QUEUE_SPARSE_BINDING_BIT");
-        if (flag & VK_QUEUE_PROTECTED_BIT)
-            loginfo("\t\tVK_QUEUE_PROTECTED_BIT");
-        if (flag == VK_QUEUE_FLAG_BITS_MAX_ENUM)
-            loginfo("\t\tVK_QUEUE_FLAG_BITS_MAX_ENUM");
-    }
-
-    return props;
+    return std::make_unique<std::vector<VkQueueFamilyProperties>>(GetDeviceCapabilities(_physicalDevice).queueFamilies);
 }
 
 
 std::unique_ptr<VkPhysicalDeviceFeatures> GetPhysicalDeviceFeatures(VkPhysicalDevice _physicalDevice)
 {
-    std::unique_ptr<VkPhysicalDeviceFeatures>
-        features = std::make_unique<VkPhysicalDeviceFeatures>();
-    vkGetPhysicalDeviceFeatures(_physicalDevice, features.get());
-
-    return features;
+    return std::make_unique<VkPhysicalDeviceFeatures>(GetDeviceCapabilities(_physicalDevice).features);
 }
 
 std::unique_ptr<VkPhysicalDeviceMemoryProperties> GetPhysicalDeviceMemoryProperties(VkPhysicalDevice _physicalDevice)
@@ -255,46 +181,15 @@ std::unique_ptr<VkPhysicalDeviceMemoryProperties> GetPhysicalDeviceMemoryPropert
     //VkPhysicalDeviceMemoryProperties
     //  memoryTypes(VkMemoryType)
     //    propertyFlags 内存类型 只能设备(gpu)可见 主机可见等
-    std::unique_ptr<VkPhysicalDeviceMemoryProperties>
-        props = std::make_unique<VkPhysicalDeviceMemoryProperties>();
-    vkGetPhysicalDeviceMemoryProperties(_physicalDevice, props.get());
-
-    for (uint32_t i = 0; i < props->memoryHeapCount; i++) {
-        loginfo("\tmemoryHeapCount Idx:{} size:{}", i, props->memoryHeaps[i].size);
-        auto flag = props->memoryHeaps[i].flags;
-        if (flag & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
-            loginfo("\t\tVK_MEMORY_HEAP_DEVICE_LOCAL_BIT");
-        if (flag & VK_MEMORY_HEAP_MULTI_INSTANCE_BIT)
-            loginfo("\t\tVK_MEMORY_PROPERTY_HOST_VISIBLE_BIT==VK_MEMORY_HEAP_MULTI_INSTANCE_BIT_KHR");
-        if (flag == VK_MEMORY_HEAP_FLAG_BITS_MAX_ENUM)
-            loginfo("\t\tVK_MEMORY_HEAP_FLAG_BITS_MAX_ENUM");
-    }
-    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
-        loginfo("\tmemoryType Idx:{}, memoryHeap Idx:{}", i, props->memoryTypes[i].heapIndex);
-        auto flag = props->memoryTypes[i].propertyFlags;
-        if (flag & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)// = 0x00000001,
-            loginfo("\t\tVK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT");
-        if (flag & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)// = 0x00000002,
-            loginfo("\t\tVK_MEMORY_PROPERTY_HOST_VISIBLE_BIT");
-        if (flag & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)// = 0x00000004,
-            loginfo("\t\tVK_MEMORY_PROPERTY_HOST_COHERENT_BIT");
-        if (flag & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)// = 0x00000008,
-            loginfo("\t\tVK_MEMORY_PROPERTY_HOST_CACHED_BIT");
-        if (flag & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)// = 0x00000010,
-            loginfo("\t\tVK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT");
-        if (flag == VK_MEMORY_PROPERTY_FLAG_BITS_MAX_ENUM)//= 0x7FFFFFF
-            loginfo("\t\tVK_MEMORY_PROPERTY_FLAG_BITS_MAX_ENUM");
-    }
-
-    return props;
-}
+    return std::make_unique<VkPhysicalDeviceMemoryProperties>(GetDeviceCapabilities(_physicalDevice).memoryProperties);
+}
 
 
 int CheckPhysicalDeviceQueueFamilyPropertiesSupport(VkPhysicalDevice _physicalDevice, VkQueueFlags _propsFlag)
 {
-    auto props = GetPhysicalDeviceQueueFamilyProperties(_physicalDevice);
-    for (int i = 0; i < props->size(); i++) {
-        if (props->operator[](i).queueCount > 0 && props->operator[](i).queueFlags & _propsFlag) {
+    const auto & props = GetDeviceCapabilities(_physicalDevice).queueFamilies;
+    for (int i = 0; i < props.size(); i++) {
+        if (props[i].queueCount > 0 && props[i].queueFlags & _propsFlag) {
             return i;
         }
     }
@@ -304,42 +199,116 @@ int CheckPhysicalDeviceQueueFamilyPropertiesSupport(VkPhysicalDevice _physicalDe
 VkMemoryPropertyFlags GetBestMemoryPropertyFlags(VkMemoryPropertyFlags _must,
     VkMemoryPropertyFlags _optional, const VkPhysicalDeviceMemoryProperties * _devicePorps)
 {
-    VkMemoryPropertyFlags bestFlags = 0;
-    for (uint32_t i = 0; i < _devicePorps->memoryTypeCount; i++) {
-        int m = _devicePorps->memoryTypes[i].propertyFlags & _must;
-        int o = _devicePorps->memoryTypes[i].propertyFlags & _optional;
-        if (m > 0 && o > 0)
-            return _must | _optional;
-        if (m > 0 && bestFlags == 0)
-            bestFlags = _devicePorps->memoryTypes[i].propertyFlags;
+    int index = FindMemoryTypeIndex(_devicePorps, ~0u, _must, _optional);
+    if (index < 0)
+        return 0;
+    // _must全部满足，_optional只返回实际满足的那部分
+    return _must | (_devicePorps->memoryTypes[index].propertyFlags & _optional);
+}
+
+static uint32_t CountBits(uint32_t _value)
+{
+    uint32_t n = 0;
+    for (; _value != 0; _value &= _value - 1) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * desc: 从memoryTypeBits里选内存类型
+ *   _required必须全部满足
+ *   _preferred每满足一位加分，多出来的不需要的属性扣分(比如只要DEVICE_LOCAL却选到了HOST_VISIBLE的BAR内存)
+ *   分数一样取下标小的，规范要求驱动把性能好的类型排在前面
+ * return: memory type index, < 0 没有满足的类型
+ **/
+int FindMemoryTypeIndex(const VkPhysicalDeviceMemoryProperties * _deviceProps, uint32_t _memoryTypeBits,
+    VkMemoryPropertyFlags _required, VkMemoryPropertyFlags _preferred)
+{
+    int bestIndex = -1;
+    int bestScore = 0;
+    for (uint32_t i = 0; i < _deviceProps->memoryTypeCount; i++) {
+        if ((_memoryTypeBits & (1u << i)) == 0)
+            continue;
+        VkMemoryPropertyFlags flags = _deviceProps->memoryTypes[i].propertyFlags;
+        if ((flags & _required) != _required)
+            continue;
+        // protected内存只能给protected资源用，没有明确要求的时候不能选
+        if ((flags & VK_MEMORY_PROPERTY_PROTECTED_BIT) && !(_required & VK_MEMORY_PROPERTY_PROTECTED_BIT))
+            continue;
+
+        int score = 16 * CountBits(flags & _preferred) - CountBits(flags & ~(_required | _preferred));
+        if (bestIndex < 0 || score > bestScore) {
+            bestIndex = static_cast<int>(i);
+            bestScore = score;
+        }
     }
-    if (bestFlags > 0)
-        return _must;
-    return 0;
+    return bestIndex;
 }
 
 /**
  * extension properties：检查扩展是否支持，如VK_KHR_swapchain
  **/
-bool CheckPhsicalDeviceExtensionsSupport(VkPhysicalDevice _physicalDevice, const std::vector<const char*> _enableExtensions)
+bool CheckPhsicalDeviceExtensionsSupport(VkPhysicalDevice _physicalDevice, const std::vector<const char*> & _enableExtensions)
 {
-    auto exts = GetPhysicalDeviceExtensionProperties(_physicalDevice);
-
-    std::set<std::string> requiredExtensions(_enableExtensions.begin(), _enableExtensions.end());
+    return CheckNameSupport(GetDeviceExtensionSupport(_physicalDevice), MakeNameRequirement(_enableExtensions));
+}
 
-    for (int i = 0; i < exts->size(); i++) {
-        requiredExtensions.erase(exts->operator[](i).extensionName);
+/**
+ * desc: 在_queueFamilyIndex上建一个队列的逻辑设备，离屏模式不传swapchain扩展
+ **/
+VkDevice CreateLogicalDevice(VkPhysicalDevice _physicalDevice, uint32_t _queueFamilyIndex,
+        const std::vector<const char*> & _enableExtensions)
+{
+    if (!CheckPhsicalDeviceExtensionsSupport(_physicalDevice, _enableExtensions)) {
+        throw std::runtime_error("device extensions not supported!");
     }
-
-    return requiredExtensions.empty();
+    float priority = 1.0f;
+    VkDeviceQueueCreateInfo queueInfo = {};
+    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = _queueFamilyIndex;
+    queueInfo.queueCount = 1;
+    queueInfo.pQueuePriorities = &priority;
+
+    VkDeviceCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.queueCreateInfoCount = 1;
+    createInfo.pQueueCreateInfos = &queueInfo;
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(_enableExtensions.size());
+    createInfo.ppEnabledExtensionNames = _enableExtensions.data();
+
+    VkDevice device = VK_NULL_HANDLE;
+    if (vkCreateDevice(_physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create logical device!");
+    }
+    return device;
 }
 
 VkShaderModule CreateShaderModule(VkDevice _device, const std::vector<char>& _code)
 {
+    //大小不是4的倍数的不是合法spirv，不补0
+    if (_code.empty() || _code.size() % sizeof(uint32_t) != 0) {
+        throw std::runtime_error("invalid spirv: empty or not a multiple of 4 bytes!");
+    }
+    //pCode要求4字节对齐，地址不对齐的时候拷一份
+    if (reinterpret_cast<uintptr_t>(_code.data()) % sizeof(uint32_t) != 0) {
+        std::vector<uint32_t> words(_code.size() / sizeof(uint32_t));
+        memcpy(words.data(), _code.data(), _code.size());
+        return CreateShaderModule(_device, words.data(), words.size());
+    }
+    return CreateShaderModule(_device, reinterpret_cast<const uint32_t*>(_code.data()), _code.size() / sizeof(uint32_t));
+}
+
+VkShaderModule CreateShaderModule(VkDevice _device, const uint32_t * _code, size_t _wordCount)
+{
+    //和char版本一样的检查和错误，pCode必须4字节对齐
+    if (_code == nullptr || _wordCount == 0 || reinterpret_cast<uintptr_t>(_code) % sizeof(uint32_t) != 0) {
+        throw std::runtime_error("invalid spirv: empty or not a multiple of 4 bytes!");
+    }
     VkShaderModuleCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = _code.size();
-    createInfo.pCode = reinterpret_cast<const uint32_t*>(_code.data());
+    createInfo.codeSize = _wordCount * sizeof(uint32_t);
+    createInfo.pCode = _code;
 
     VkShaderModule shaderModule;
     if (vkCreateShaderModule(_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
@@ -351,31 +320,18 @@ VkShaderModule CreateShaderModule(VkDevice _device, const std::vector<char>& _co
 
 VkShaderModule CreateShaderModuleFromFile(VkDevice _device, const char * _fileName)
 {
-    std::ifstream file(_fileName, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file!");
-    }
-
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<char> buffer(fileSize);
-
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
-
-    file.close();
-
-    return CreateShaderModule(_device, buffer);
+    //mmap以后直接用映射的内存，不再读到vector里
+    return CreateShaderModuleFromMappedFile(_device, _fileName);
 }
 
 int CheckPhysicalDeviceSurfaceSupport(VkPhysicalDevice _physicalDevice, VkSurfaceKHR _surface)
 {
-    auto props = GetPhysicalDeviceQueueFamilyProperties(_physicalDevice);
-    for (int i = 0; i < props->size(); i++) {
+    const auto & props = GetDeviceCapabilities(_physicalDevice).queueFamilies;
+    for (int i = 0; i < props.size(); i++) {
         VkBool32 presentSupport = false;
         vkGetPhysicalDeviceSurfaceSupportKHR(_physicalDevice, i, _surface, &presentSupport);
 
-        if (props->operator[](i).queueCount > 0 && presentSupport) {
+        if (props[i].queueCount > 0 && presentSupport) {
             return i;
         }
     }
@@ -435,8 +391,7 @@ VkSurfaceFormatKHR GetProperSwapSurfaceFormat(const std::vector<VkSurfaceFormatK
 VkPresentModeKHR GetProperSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes)
 {
     // FIFO present mode is always available
-    //VkPresentModeKHR backupMode = VK_PRESENT_MODE_FIFO_KHR;
-    VkPresentModeKHR backupMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+    VkPresentModeKHR backupMode = VK_PRESENT_MODE_FIFO_KHR;
 
     for (const auto& bestMode : availablePresentModes) {
         // MAILBOX is the lowest latency V-Sync enabled mode
@@ -450,11 +405,12 @@ VkPresentModeKHR GetProperSwapPresentMode(const std::vector<VkPresentModeKHR> av
 }
 
 // Most of the cases we define size of the swap_chain images equal to current window's size
-VkExtent2D GetProperSwapChainExtent(VkSurfaceCapabilitiesKHR &surfaceCapabilities) {
+VkExtent2D GetProperSwapChainExtent(VkSurfaceCapabilitiesKHR &surfaceCapabilities, VkExtent2D _desiredExtent) {
     // Special value of surface extent is width == height == -1
     // If this is so we define the size by ourselves but it must fit within defined confines
+    // 一般传窗口的framebuffer大小(glfwGetFramebufferSize)
     if (surfaceCapabilities.currentExtent.width == -1) {
-        VkExtent2D swapchainExtent = { 640, 480 };
+        VkExtent2D swapchainExtent = _desiredExtent;
         if (swapchainExtent.width < surfaceCapabilities.minImageExtent.width) {
             swapchainExtent.width = surfaceCapabilities.minImageExtent.width;
         }
@@ -474,6 +430,53 @@ VkExtent2D GetProperSwapChainExtent(VkSurfaceCapabilitiesKHR &surfaceCapabilitie
     return surfaceCapabilities.currentExtent;
 }
 
+VkPresentModeKHR GetPresentModeForPolicy(PresentPolicy _policy, const std::vector<VkPresentModeKHR> & _availablePresentModes)
+{
+    std::vector<VkPresentModeKHR> preferred;
+    switch (_policy) {
+    case PresentPolicy::LowLatency:
+        //MAILBOX不撕裂，总是显示最新的一帧
+        preferred = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+        break;
+    case PresentPolicy::SmoothVsync:
+        break;
+    case PresentPolicy::MaxThroughput:
+        preferred = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+        break;
+    }
+    for (VkPresentModeKHR mode : preferred) {
+        for (VkPresentModeKHR available : _availablePresentModes) {
+            if (mode == available) {
+                return mode;
+            }
+        }
+    }
+    //FIFO是规范保证一定支持的
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+uint32_t GetSwapChainImageCount(PresentPolicy _policy, VkPresentModeKHR _presentMode,
+        const VkSurfaceCapabilitiesKHR & _surfaceCapabilities)
+{
+    uint32_t count = _surfaceCapabilities.minImageCount;
+    if (_presentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+        //mailbox要有一张在显示、一张在排队、一张在画
+        count = std::max<uint32_t>(count, 3);
+    }
+    else if (_policy == PresentPolicy::SmoothVsync) {
+        //多一张吸收偶尔超时的帧，避免掉到半帧率
+        count = std::max<uint32_t>(count + 1, 3);
+    }
+    else if (_policy == PresentPolicy::MaxThroughput) {
+        count = count + 1;
+    }
+    //maxImageCount为0表示没有上限
+    if (_surfaceCapabilities.maxImageCount > 0 && count > _surfaceCapabilities.maxImageCount) {
+        count = _surfaceCapabilities.maxImageCount;
+    }
+    return count;
+}
+
 VkImageUsageFlags GetSwapSufaceImageUsageFlags(VkSurfaceCapabilitiesKHR &surfaceCapabilities) {
     // Color attachment flag must always be supported
     // We can define other usage flags but we always need to check if they are supported
@@ -512,8 +515,17 @@ VkSurfaceTransformFlagBitsKHR GetSwapChainTransform(VkSurfaceCapabilitiesKHR &su
     }
 }
 
+uint32_t GetMipLevelCount(uint32_t _width, uint32_t _height)
+{
+    uint32_t levels = 1;
+    for (uint32_t size = std::max(_width, _height); size > 1; size >>= 1) {
+        levels++;
+    }
+    return levels;
+}
+
 VkImageCreateInfo Get2DImageCreateInfo(uint32_t width, uint32_t height,
-        VkImageTiling _tiling, VkImageUsageFlags _usageFlags, VkFormat _format)
+        VkImageTiling _tiling, VkImageUsageFlags _usageFlags, VkFormat _format, uint32_t _mipLevels)
 {
     VkImageCreateInfo image_create_info = {
         VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO, // VkStructureType     sType;
@@ -526,7 +538,7 @@ VkImageCreateInfo Get2DImageCreateInfo(uint32_t width, uint32_t height,
             height,                          // uint32_t            height
             1                                // uint32_t            depth
         },
-        1,                                   // uint32_t            mipLevels
+        _mipLevels,                          // uint32_t            mipLevels
         1,                                   // uint32_t            arrayLayers
         VK_SAMPLE_COUNT_1_BIT,               // VkSampleCountFlagBits samples
         _tiling,                             // VkImageTiling         tiling
@@ -539,7 +551,7 @@ VkImageCreateInfo Get2DImageCreateInfo(uint32_t width, uint32_t height,
     return image_create_info;
 }
 
-VkImageViewCreateInfo Get2DImageViewCreateInfo(VkImage _image, VkFormat _format)
+VkImageViewCreateInfo Get2DImageViewCreateInfo(VkImage _image, VkFormat _format, uint32_t _mipLevels)
 {
     VkImageViewCreateInfo image_view_create_info = {
         VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,  // VkStructureType            sType
@@ -557,7 +569,7 @@ VkImageViewCreateInfo Get2DImageViewCreateInfo(VkImage _image, VkFormat _format)
         {                                          // VkImageSubresourceRange    subresourceRange
             VK_IMAGE_ASPECT_COLOR_BIT,             // VkImageAspectFlags         aspectMask
             0,                                     // uint32_t                   baseMipLevel
-            1,                                     // uint32_t                   levelCount
+            _mipLevels,                            // uint32_t                   levelCount
             0,                                     // uint32_t                   baseArrayLayer
             1                                      // uint32_t                   layerCount
         }
@@ -565,7 +577,7 @@ VkImageViewCreateInfo Get2DImageViewCreateInfo(VkImage _image, VkFormat _format)
     return image_view_create_info;
 }
 
-VkSamplerCreateInfo GetSamplerCreateInfo()
+VkSamplerCreateInfo GetSamplerCreateInfo(uint32_t _mipLevels)
 {
     VkSamplerCreateInfo sampler_create_info = {
         VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,                // VkStructureType            sType
@@ -573,7 +585,8 @@ VkSamplerCreateInfo GetSamplerCreateInfo()
         0,                                                    // VkSamplerCreateFlags       flags
         VK_FILTER_LINEAR,                                     // VkFilter                   magFilter
         VK_FILTER_LINEAR,                                     // VkFilter                   minFilter
-        VK_SAMPLER_MIPMAP_MODE_NEAREST,                       // VkSamplerMipmapMode        mipmapMode
+        _mipLevels > 1 ? VK_SAMPLER_MIPMAP_MODE_LINEAR
+                       : VK_SAMPLER_MIPMAP_MODE_NEAREST,      // VkSamplerMipmapMode        mipmapMode
         VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,                // VkSamplerAddressMode       addressModeU
         VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,                // VkSamplerAddressMode       addressModeV
         VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,                // VkSamplerAddressMode       addressModeW
@@ -583,13 +596,23 @@ VkSamplerCreateInfo GetSamplerCreateInfo()
         VK_FALSE,                                             // VkBool32                   compareEnable
         VK_COMPARE_OP_ALWAYS,                                 // VkCompareOp                compareOp
         0.0f,                                                 // float                      minLod
-        0.0f,                                                 // float                      maxLod
+        static_cast<float>(_mipLevels - 1),                   // float                      maxLod
         VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,              // VkBorderColor              borderColor
         VK_FALSE                                              // VkBool32                   unnormalizedCoordinates
     };
     return sampler_create_info;
 }
 
+//src和dst是同一个family时不是ownership transfer，要填VK_QUEUE_FAMILY_IGNORED
+static VkImageMemoryBarrier IgnoreSameQueueFamily(VkImageMemoryBarrier _barrier)
+{
+    if (_barrier.srcQueueFamilyIndex == _barrier.dstQueueFamilyIndex) {
+        _barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        _barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    }
+    return _barrier;
+}
+
 VkCommandBufferBeginInfo GetCommandBufferOneTimeSubmitBeginInfo() {
 
     VkCommandBufferBeginInfo command_buffer_begin_info = {
@@ -601,6 +624,21 @@ VkCommandBufferBeginInfo GetCommandBufferOneTimeSubmitBeginInfo() {
     return command_buffer_begin_info;
 }
 
+VkCommandBufferBeginInfo GetSecondaryCommandBufferBeginInfo(const VkCommandBufferInheritanceInfo * _inheritance) {
+
+    VkCommandBufferUsageFlags flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (_inheritance->renderPass != VK_NULL_HANDLE) {
+        flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    }
+    VkCommandBufferBeginInfo command_buffer_begin_info = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,        // VkStructureType                        sType
+        nullptr,                                            // const void                            *pNext
+        flags,                                              // VkCommandBufferUsageFlags              flags
+        _inheritance                                        // const VkCommandBufferInheritanceInfo  *pInheritanceInfo
+    };
+    return command_buffer_begin_info;
+}
+
 VkImageMemoryBarrier GetDstSwapChainImageBeforeCopyMemoryBarrier(
     uint32_t _presentQueue, uint32_t _graphicQueue, VkImage _image, VkImageSubresourceRange _range)
 {
@@ -618,7 +656,7 @@ VkImageMemoryBarrier GetDstSwapChainImageBeforeCopyMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetSrcSwapChainImageBeforeCopyMemoryBarrier(
@@ -637,7 +675,7 @@ VkImageMemoryBarrier GetSrcSwapChainImageBeforeCopyMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetDstSwapChainImageAfterCopyMemoryBarrier(
@@ -655,7 +693,7 @@ VkImageMemoryBarrier GetDstSwapChainImageAfterCopyMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetSrcSwapChainImageAfterCopyMemoryBarrier(
@@ -673,7 +711,7 @@ VkImageMemoryBarrier GetSrcSwapChainImageAfterCopyMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetSwapChainImageBeforeRenderMemoryBarrier(
@@ -691,7 +729,7 @@ VkImageMemoryBarrier GetSwapChainImageBeforeRenderMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetSwapChainImageAfterRenderMemoryBarrier(
@@ -709,7 +747,7 @@ VkImageMemoryBarrier GetSwapChainImageAfterRenderMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetSrcImageBeforeCopyMemoryBarrier(
@@ -727,7 +765,7 @@ VkImageMemoryBarrier GetSrcImageBeforeCopyMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetSrcImageAfterCopyMemoryBarrier(
@@ -745,7 +783,7 @@ VkImageMemoryBarrier GetSrcImageAfterCopyMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetDstImageBeforeCopyMemoryBarrier(
@@ -764,7 +802,7 @@ VkImageMemoryBarrier GetDstImageBeforeCopyMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetDstImageAfterCopyMemoryBarrier(
@@ -782,7 +820,7 @@ VkImageMemoryBarrier GetDstImageAfterCopyMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetImageBeforeRenderMemoryBarrier(
@@ -801,7 +839,7 @@ VkImageMemoryBarrier GetImageBeforeRenderMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkImageMemoryBarrier GetImageAfterRenderMemoryBarrier(
@@ -820,7 +858,7 @@ VkImageMemoryBarrier GetImageAfterRenderMemoryBarrier(
         _image,                                   // VkImage               image
         _range                                    // VkImageSubresourceRange subresourceRange
     };
-    return barrier;
+    return IgnoreSameQueueFamily(barrier);
 }
 
 VkDeviceSize GetLinearImageRowPitch(VkDevice _device, VkImage _image) {
@@ -11,26 +11,39 @@ struct SwapChainSupportDetails {
     std::vector<VkPresentModeKHR> presentModes;
 };
 
+enum class PresentPolicy {
+    LowLatency,
+    SmoothVsync,
+    MaxThroughput,
+};
+
 struct QueueParameters {
     VkQueue                       Handle;
     uint32_t                      FamilyIndex;
+    // 族里的第几个队列
+    uint32_t                      Index;
 
     QueueParameters() :
         Handle(VK_NULL_HANDLE),
-        FamilyIndex(-1) {
+        FamilyIndex(-1),
+        Index(0) {
     }
 };
 
 //instance level
 //  layer
 std::unique_ptr<std::vector<VkLayerProperties>> GetInstanceLayerProperties();
-bool CheckInstanceLayerPropertiesSupport(std::vector<const char*> _enableLayers);
+bool CheckInstanceLayerPropertiesSupport(const std::vector<const char*> & _enableLayers);
 //  extension
 std::unique_ptr<std::vector<VkExtensionProperties>> GetInstanceExtensionProperties();
-bool CheckInstanceExtensionPropertiesSupport(std::vector<const char*> _enableExtensions);
+bool CheckInstanceExtensionPropertiesSupport(const std::vector<const char*> & _enableExtensions);
 bool CheckInstanceExtensionPropertiesSupport(const char ** _enableExtensions, int _count);
 
-VkInstance CreateInstance(const std::vector<const char*> enableLayers = {}, const std::vector<const char*> _enableExtensions = {});
+//loader支持的最高版本，1.0的loader没有vkEnumerateInstanceVersion
+uint32_t GetInstanceVersion();
+//_apiVersion 程序要用的最高版本，设备实际能用的是它和物理设备apiVersion的较小值，大于GetInstanceVersion时1.0的loader会失败
+VkInstance CreateInstance(const std::vector<const char*> enableLayers = {}, const std::vector<const char*> _enableExtensions = {},
+        uint32_t _apiVersion = VK_API_VERSION_1_0);
 
 //physical device info
 std::unique_ptr<std::vector<VkPhysicalDevice>> GetPhysicalDevices(VkInstance _instance);
@@ -42,14 +55,24 @@ std::unique_ptr<VkPhysicalDeviceFeatures> GetPhysicalDeviceFeatures(VkPhysicalDe
 std::unique_ptr<VkPhysicalDeviceMemoryProperties> GetPhysicalDeviceMemoryProperties(VkPhysicalDevice _physicalDevice);
 VkMemoryPropertyFlags GetBestMemoryPropertyFlags(VkMemoryPropertyFlags _must, 
         VkMemoryPropertyFlags _optional, const VkPhysicalDeviceMemoryProperties * _devicePorps);
+// return memoryTypeIndex >= 0, 分配内存用这个，子分配见memory_allocator.h
+// < 0 not support
+int FindMemoryTypeIndex(const VkPhysicalDeviceMemoryProperties * _deviceProps, uint32_t _memoryTypeBits,
+        VkMemoryPropertyFlags _required, VkMemoryPropertyFlags _preferred = 0);
 
-// return queueFamilyIndex >= 0
+// return queueFamilyIndex >= 0，只返回第一个匹配的族，要分开transfer/compute队列用queue_topology.h
 // < 0 not support
 int CheckPhysicalDeviceQueueFamilyPropertiesSupport(VkPhysicalDevice _physicalDevice, VkQueueFlags _propsFlag);
-bool CheckPhsicalDeviceExtensionsSupport(VkPhysicalDevice _physicalDevice, const std::vector<const char*> _enableExtensions);
+bool CheckPhsicalDeviceExtensionsSupport(VkPhysicalDevice _physicalDevice, const std::vector<const char*> & _enableExtensions);
+//需要反复检查的地方用name_registry.h里的NameRequirement，只构造一次
+//单队列的逻辑设备，离屏渲染时_enableExtensions为空，不需要surface和swapchain
+VkDevice CreateLogicalDevice(VkPhysicalDevice _physicalDevice, uint32_t _queueFamilyIndex,
+        const std::vector<const char*> & _enableExtensions = {});
 
 //shader module
 VkShaderModule CreateShaderModule(VkDevice _device, const std::vector<char>& _code);
+VkShaderModule CreateShaderModule(VkDevice _device, const uint32_t * _code, size_t _wordCount);
+//批量加载用shader_loader.h里的CreateShaderModulesFromFiles
 VkShaderModule CreateShaderModuleFromFile(VkDevice _device, const char * _fileName);
 
 //on screen
@@ -57,19 +80,31 @@ int CheckPhysicalDeviceSurfaceSupport(VkPhysicalDevice _physicalDevice, VkSurfac
 SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice _physicalDevice, VkSurfaceKHR _surface);
 VkSurfaceFormatKHR GetProperSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 VkPresentModeKHR GetProperSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes);
-VkExtent2D GetProperSwapChainExtent(VkSurfaceCapabilitiesKHR &surface_capabilities);
+//surface没有规定大小时用_desiredExtent，并限制在min/maxImageExtent之间
+VkExtent2D GetProperSwapChainExtent(VkSurfaceCapabilitiesKHR &surface_capabilities, VkExtent2D _desiredExtent);
+//LowLatency: MAILBOX或IMMEDIATE  SmoothVsync: FIFO  MaxThroughput: IMMEDIATE优先，都没有就FIFO
+VkPresentModeKHR GetPresentModeForPolicy(PresentPolicy _policy, const std::vector<VkPresentModeKHR> & _availablePresentModes);
+uint32_t GetSwapChainImageCount(PresentPolicy _policy, VkPresentModeKHR _presentMode,
+        const VkSurfaceCapabilitiesKHR & _surfaceCapabilities);
 VkImageUsageFlags GetSwapSufaceImageUsageFlags(VkSurfaceCapabilitiesKHR &surface_capabilities);
 VkSurfaceTransformFlagBitsKHR GetSwapChainTransform(VkSurfaceCapabilitiesKHR &surface_capabilities);
 
 
 //create info
+//完整mip链的层数 floor(log2(max(width, height))) + 1
+uint32_t GetMipLevelCount(uint32_t _width, uint32_t _height);
 VkImageCreateInfo Get2DImageCreateInfo(uint32_t width, uint32_t height,
-VkImageTiling _tiling, VkImageUsageFlags _usageFlags, VkFormat _format);
-VkImageViewCreateInfo Get2DImageViewCreateInfo(VkImage _image, VkFormat _format);
-VkSamplerCreateInfo GetSamplerCreateInfo();
+VkImageTiling _tiling, VkImageUsageFlags _usageFlags, VkFormat _format, uint32_t _mipLevels = 1);
+VkImageViewCreateInfo Get2DImageViewCreateInfo(VkImage _image, VkFormat _format, uint32_t _mipLevels = 1);
+//_mipLevels大于1时mip之间线性插值，maxLod覆盖全部mip
+VkSamplerCreateInfo GetSamplerCreateInfo(uint32_t _mipLevels = 1);
 VkCommandBufferBeginInfo GetCommandBufferOneTimeSubmitBeginInfo();
+//_inheritance->renderPass不为空时加RENDER_PASS_CONTINUE
+VkCommandBufferBeginInfo GetSecondaryCommandBufferBeginInfo(const VkCommandBufferInheritanceInfo * _inheritance);
 
 //barrier
+//固定layout的barrier，_presentQueue和_graphicQueue相同时不做ownership transfer
+//需要按实际状态生成barrier的用image_state_tracker.h
 VkImageMemoryBarrier GetDstSwapChainImageBeforeCopyMemoryBarrier(
 uint32_t _presentQueue, uint32_t _graphicQueue, VkImage _image, VkImageSubresourceRange _range);
 VkImageMemoryBarrier GetDstSwapChainImageAfterCopyMemoryBarrier(
@@ -102,5 +137,5 @@ VkImageMemoryBarrier GetImageAfterRenderMemoryBarrier(
 
 
 //tools
-// not use now. because we do not use linear image
+// LINEAR tiling image第0层的行距，readback_ring.h的LinearImage模式用
 VkDeviceSize GetLinearImageRowPitch(VkDevice _device, VkImage _image);
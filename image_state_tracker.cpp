@@ -0,0 +1,190 @@
+#include "image_state_tracker.h"
+#include <stdexcept>
+
+ImageUsageInfo GetImageUsageInfo(ImageUsage _usage)
+{
+    switch (_usage) {
+    case ImageUsage::TransferSrc:
+        return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false };
+    case ImageUsage::TransferDst:
+        return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true };
+    case ImageUsage::ColorAttachment:
+        return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true };
+    case ImageUsage::DepthStencilAttachment:
+        return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true };
+    case ImageUsage::DepthStencilRead:
+        return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false };
+    case ImageUsage::FragmentShaderRead:
+        return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+    case ImageUsage::ComputeShaderRead:
+        return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+    case ImageUsage::ComputeShaderWrite:
+        return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_GENERAL, true };
+    case ImageUsage::Present:
+        //present不是管线里的访问，由semaphore保证可见性
+        return { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false };
+    }
+    throw std::runtime_error("unknown image usage!");
+}
+
+void ImageStateTracker::Register(VkImage _image, const VkImageSubresourceRange & _range,
+        VkImageLayout _initialLayout, uint32_t _queueFamily)
+{
+    ImageState state = {};
+    state.range = _range;
+    state.layout = _initialLayout;
+    state.queueFamily = _queueFamily;
+    images_[_image] = state;
+}
+
+void ImageStateTracker::Unregister(VkImage _image)
+{
+    images_.erase(_image);
+}
+
+void ImageStateTracker::SetPriorAccess(VkImage _image, VkPipelineStageFlags _stages, VkAccessFlags _access)
+{
+    auto it = images_.find(_image);
+    if (it == images_.end()) {
+        throw std::runtime_error("image is not registered in state tracker!");
+    }
+    it->second.writeStages |= _stages;
+    it->second.writeAccess |= _access;
+    it->second.visibleStages = 0;
+    it->second.visibleAccess = 0;
+}
+
+VkImageLayout ImageStateTracker::GetLayout(VkImage _image) const
+{
+    auto it = images_.find(_image);
+    return it == images_.end() ? VK_IMAGE_LAYOUT_UNDEFINED : it->second.layout;
+}
+
+void ImageStateTracker::Require(VkImage _image, ImageUsage _usage, uint32_t _queueFamily, bool _discard)
+{
+    auto it = images_.find(_image);
+    if (it == images_.end()) {
+        throw std::runtime_error("image is not registered in state tracker!");
+    }
+    ImageState & state = it->second;
+    const ImageUsageInfo info = GetImageUsageInfo(_usage);
+
+    const bool familyChange = _queueFamily != VK_QUEUE_FAMILY_IGNORED
+        && state.queueFamily != VK_QUEUE_FAMILY_IGNORED && _queueFamily != state.queueFamily;
+    const bool layoutChange = info.layout != state.layout || (_discard && state.layout != VK_IMAGE_LAYOUT_UNDEFINED);
+
+    VkPipelineStageFlags srcStages = 0;
+    VkAccessFlags srcAccess = 0;
+    if (!familyChange && !layoutChange && !info.write) {
+        // 读之后再读，或者上次写入已经对这个stage可见，不需要barrier
+        if (state.writeStages == 0
+                || ((info.stage & ~state.visibleStages) == 0 && (info.access & ~state.visibleAccess) == 0)) {
+            state.readStages |= info.stage;
+            return;
+        }
+        // RAW: 只需要等写入
+        srcStages = state.writeStages;
+        srcAccess = state.writeAccess;
+        state.readStages |= info.stage;
+        state.visibleStages |= info.stage;
+        state.visibleAccess |= info.access;
+    }
+    else {
+        // WAR/WAW或者layout转换: 要等之前所有的读和写
+        srcStages = state.writeStages | state.readStages;
+        srcAccess = state.writeAccess;
+        if (srcStages == 0 && !layoutChange && !familyChange) {
+            // 注册以后第一次访问，layout也对
+            state.writeStages = info.write ? info.stage : 0;
+            state.writeAccess = info.write ? info.access : 0;
+            state.readStages = info.write ? 0 : info.stage;
+            state.visibleStages = info.stage;
+            state.visibleAccess = info.access;
+            return;
+        }
+        // layout转换本身也是一次写，之后别的stage来读还要再等一次
+        state.writeStages = (info.write || layoutChange) ? info.stage : 0;
+        state.writeAccess = info.write ? info.access : 0;
+        state.readStages = info.write ? 0 : info.stage;
+        state.visibleStages = info.stage;
+        state.visibleAccess = info.access;
+    }
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = info.access;
+    barrier.oldLayout = _discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+    barrier.newLayout = info.layout;
+    barrier.srcQueueFamilyIndex = familyChange ? state.queueFamily : VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = familyChange ? _queueFamily : VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = _image;
+    barrier.subresourceRange = state.range;
+
+    if (familyChange) {
+        // release端只负责让写入available，dstAccess会被忽略
+        VkImageMemoryBarrier release = barrier;
+        release.dstAccessMask = 0;
+        Record(releases_, release, srcStages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+        // acquire端不需要等原来queue上的stage，依赖由semaphore提供
+        barrier.srcAccessMask = 0;
+        srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    }
+    Record(pending_, barrier, srcStages, info.stage);
+
+    state.layout = info.layout;
+    if (_queueFamily != VK_QUEUE_FAMILY_IGNORED) {
+        state.queueFamily = _queueFamily;
+    }
+}
+
+void ImageStateTracker::Record(BarrierBatch & _batch, const VkImageMemoryBarrier & _barrier,
+        VkPipelineStageFlags _srcStages, VkPipelineStageFlags _dstStages)
+{
+    _batch.srcStages |= _srcStages;
+    _batch.dstStages |= _dstStages;
+    // 同一批次里同一个image多次Require，中间没有命令，合并成一个转换
+    for (auto & barrier : _batch.barriers) {
+        if (barrier.image == _barrier.image) {
+            barrier.srcAccessMask |= _barrier.srcAccessMask;
+            barrier.dstAccessMask = _barrier.dstAccessMask;
+            barrier.newLayout = _barrier.newLayout;
+            barrier.dstQueueFamilyIndex = _barrier.dstQueueFamilyIndex;
+            return;
+        }
+    }
+    _batch.barriers.push_back(_barrier);
+}
+
+void ImageStateTracker::Emit(VkCommandBuffer _commandBuffer, BarrierBatch & _batch)
+{
+    if (_batch.barriers.empty()) {
+        return;
+    }
+    VkPipelineStageFlags srcStages = _batch.srcStages != 0 ? _batch.srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkPipelineStageFlags dstStages = _batch.dstStages != 0 ? _batch.dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    vkCmdPipelineBarrier(_commandBuffer, srcStages, dstStages, 0, 0, nullptr, 0, nullptr,
+            static_cast<uint32_t>(_batch.barriers.size()), _batch.barriers.data());
+    _batch = BarrierBatch();
+}
+
+void ImageStateTracker::Flush(VkCommandBuffer _commandBuffer)
+{
+    Emit(_commandBuffer, pending_);
+}
+
+void ImageStateTracker::FlushReleases(VkCommandBuffer _srcQueueCommandBuffer)
+{
+    Emit(_srcQueueCommandBuffer, releases_);
+}
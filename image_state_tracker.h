@@ -0,0 +1,84 @@
+#pragma once
+#include <map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/*
+ * image状态跟踪
+ * 记录每个image当前的layout、最近的写入(stage/access)、之后已经可见的读和所属的queue family
+ * Require只在需要的时候生成barrier：读之后再读、已经可见的写之后再读都不生成
+ * Flush把攒下来的barrier合并成一次vkCmdPipelineBarrier，stage mask只包含真正涉及的stage
+ * 只有queue family真的不同时才做ownership transfer，否则两边都是VK_QUEUE_FAMILY_IGNORED
+ * 按整个image跟踪，不区分mip和array layer
+ */
+enum class ImageUsage {
+    TransferSrc,
+    TransferDst,
+    ColorAttachment,
+    DepthStencilAttachment,
+    DepthStencilRead,
+    FragmentShaderRead,
+    ComputeShaderRead,
+    ComputeShaderWrite,
+    Present,
+};
+
+struct ImageUsageInfo {
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkImageLayout layout;
+    bool write;
+};
+
+ImageUsageInfo GetImageUsageInfo(ImageUsage _usage);
+
+class ImageStateTracker {
+public:
+    // _initialLayout之前的访问认为已经同步好了
+    void Register(VkImage _image, const VkImageSubresourceRange & _range,
+            VkImageLayout _initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            uint32_t _queueFamily = VK_QUEUE_FAMILY_IGNORED);
+    void Unregister(VkImage _image);
+    // 内存别名：新image第一次使用前要等之前占用同一块内存的访问，把这些访问当成这个image上的写
+    void SetPriorAccess(VkImage _image, VkPipelineStageFlags _stages, VkAccessFlags _access);
+
+    /**
+     * desc: 声明接下来要以_usage使用image
+     *       _queueFamily 正在录制的command buffer所属的queue family，IGNORED表示不关心ownership
+     *       _discard 不需要保留以前的内容，oldLayout用UNDEFINED
+     **/
+    void Require(VkImage _image, ImageUsage _usage, uint32_t _queueFamily = VK_QUEUE_FAMILY_IGNORED,
+            bool _discard = false);
+    // 把Require产生的barrier合并成一次vkCmdPipelineBarrier，没有barrier时什么都不录
+    void Flush(VkCommandBuffer _commandBuffer);
+    // ownership transfer的release部分，要录到原来queue family的command buffer里，并且先于acquire提交
+    void FlushReleases(VkCommandBuffer _srcQueueCommandBuffer);
+
+    VkImageLayout GetLayout(VkImage _image) const;
+
+private:
+    struct ImageState {
+        VkImageSubresourceRange range;
+        VkImageLayout layout;
+        uint32_t queueFamily;
+        VkPipelineStageFlags writeStages;
+        VkAccessFlags writeAccess;
+        VkPipelineStageFlags readStages;
+        // 最近一次写入已经对这些stage/access可见
+        VkPipelineStageFlags visibleStages;
+        VkAccessFlags visibleAccess;
+    };
+    struct BarrierBatch {
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        std::vector<VkImageMemoryBarrier> barriers;
+    };
+
+    void Record(BarrierBatch & _batch, const VkImageMemoryBarrier & _barrier,
+            VkPipelineStageFlags _srcStages, VkPipelineStageFlags _dstStages);
+    static void Emit(VkCommandBuffer _commandBuffer, BarrierBatch & _batch);
+
+    std::map<VkImage, ImageState> images_;
+    BarrierBatch pending_;
+    BarrierBatch releases_;
+};
@@ -0,0 +1,561 @@
+#include "job_scheduler.h"
+#include "thread_pool.h"
+#include "name_registry.h"
+#include "device_capabilities.h"
+#include <algorithm>
+#include <stdexcept>
+#include <logger.h>
+
+namespace {
+
+// fence模式下没法从CPU叫醒vkWaitForFences，隔一段时间回来看一次有没有新队列
+const uint64_t kFencePollNs = 1000000;
+
+enum class JobKind {
+    Gpu,
+    Cpu,
+};
+
+enum class JobStatus {
+    Pending,
+    // 只有GPU任务有，已经在队列上
+    Submitted,
+    Done,
+};
+
+// 设备实际能用的版本是instance的apiVersion和物理设备apiVersion的较小值
+uint32_t GetDeviceApiVersion(uint32_t _instanceVersion, VkPhysicalDevice _physicalDevice)
+{
+    return std::min(_instanceVersion, GetDeviceCapabilities(_physicalDevice).properties.apiVersion);
+}
+
+// 1.2以上用核心的入口，以下只有VK_KHR_timeline_semaphore的
+template<typename T>
+T LoadDeviceFunction(VkDevice _device, bool _core, const char * _coreName, const char * _khrName)
+{
+    return reinterpret_cast<T>(vkGetDeviceProcAddr(_device, _core ? _coreName : _khrName));
+}
+
+void RemoveJob(std::vector<std::shared_ptr<JobState>> & _jobs, const std::shared_ptr<JobState> & _job)
+{
+    _jobs.erase(std::remove(_jobs.begin(), _jobs.end(), _job), _jobs.end());
+}
+
+VkSemaphore CreateTimelineSemaphore(VkDevice _device)
+{
+    VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    createInfo.pNext = &typeInfo;
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    if (vkCreateSemaphore(_device, &createInfo, nullptr, &semaphore) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create timeline semaphore!");
+    }
+    return semaphore;
+}
+
+}
+
+struct JobState {
+    JobScheduler * owner = nullptr;
+    JobKind kind = JobKind::Cpu;
+    JobStatus status = JobStatus::Pending;
+    // 还没满足的依赖数
+    uint32_t remaining = 0;
+    std::exception_ptr error;
+    // 完成时通知
+    std::vector<std::shared_ptr<JobState>> dependents;
+    // 提交时通知，只有timeline模式下GPU任务依赖GPU任务时用
+    std::vector<std::shared_ptr<JobState>> submitDependents;
+
+    VkQueue queue = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> commandBuffers;
+    VkPipelineStageFlags waitStage = 0;
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<uint64_t> waitValues;
+    uint64_t value = 0;
+    VkFence fence = VK_NULL_HANDLE;
+
+    std::function<void()> task;
+};
+
+bool Job::IsDone() const
+{
+    if (state_ == nullptr) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(state_->owner->mutex_);
+    return state_->status == JobStatus::Done;
+}
+
+void Job::Wait() const
+{
+    if (state_ == nullptr) {
+        return;
+    }
+    JobScheduler * owner = state_->owner;
+    std::unique_lock<std::mutex> lock(owner->mutex_);
+    owner->cond_.wait(lock, [this]() { return state_->status == JobStatus::Done; });
+    if (state_->error) {
+        std::rethrow_exception(state_->error);
+    }
+}
+
+bool SupportsTimelineSemaphore(VkInstance _instance, uint32_t _instanceVersion, VkPhysicalDevice _physicalDevice)
+{
+    if (GetDeviceApiVersion(_instanceVersion, _physicalDevice) < VK_API_VERSION_1_2
+            && !GetMissingDeviceExtensions(_physicalDevice, { "VK_KHR_timeline_semaphore" }).empty()) {
+        return false;
+    }
+    // 1.0的instance只能用VK_KHR_get_physical_device_properties2的入口，没打开时取到空
+    auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2>(vkGetInstanceProcAddr(_instance,
+            _instanceVersion >= VK_API_VERSION_1_1 ? "vkGetPhysicalDeviceFeatures2" : "vkGetPhysicalDeviceFeatures2KHR"));
+    if (getFeatures2 == nullptr) {
+        return false;
+    }
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    VkPhysicalDeviceFeatures2 features = {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &timelineFeatures;
+    getFeatures2(_physicalDevice, &features);
+    return timelineFeatures.timelineSemaphore == VK_TRUE;
+}
+
+JobScheduler::JobScheduler(VkDevice _device, VkPhysicalDevice _physicalDevice, VkInstance _instance,
+        uint32_t _instanceVersion, bool _timeline, ThreadPool & _cpuPool) :
+    device_(_device),
+    timeline_(_timeline),
+    cpuPool_(_cpuPool),
+    getCounterValue_(nullptr),
+    waitSemaphores_(nullptr),
+    signalSemaphore_(nullptr),
+    wakeSemaphore_(VK_NULL_HANDLE),
+    wakeValue_(0),
+    unfinished_(0),
+    lost_(false),
+    stopping_(false)
+{
+    if (timeline_ && !SupportsTimelineSemaphore(_instance, _instanceVersion, _physicalDevice)) {
+        logwarn("device does not support timelineSemaphore, job scheduler falls back to fences");
+        timeline_ = false;
+    }
+    if (timeline_) {
+        bool core = GetDeviceApiVersion(_instanceVersion, _physicalDevice) >= VK_API_VERSION_1_2;
+        getCounterValue_ = LoadDeviceFunction<PFN_vkGetSemaphoreCounterValueKHR>(device_, core,
+                "vkGetSemaphoreCounterValue", "vkGetSemaphoreCounterValueKHR");
+        waitSemaphores_ = LoadDeviceFunction<PFN_vkWaitSemaphoresKHR>(device_, core, "vkWaitSemaphores",
+                "vkWaitSemaphoresKHR");
+        signalSemaphore_ = LoadDeviceFunction<PFN_vkSignalSemaphoreKHR>(device_, core, "vkSignalSemaphore",
+                "vkSignalSemaphoreKHR");
+        if (getCounterValue_ == nullptr || waitSemaphores_ == nullptr || signalSemaphore_ == nullptr) {
+            logwarn("timeline semaphore functions not found, job scheduler falls back to fences");
+            timeline_ = false;
+        }
+    }
+    if (timeline_) {
+        wakeSemaphore_ = CreateTimelineSemaphore(device_);
+    }
+    loginfo("job scheduler uses {}", timeline_ ? "timeline semaphores" : "fences");
+    thread_ = std::thread(&JobScheduler::SchedulerLoop, this);
+}
+
+JobScheduler::~JobScheduler()
+{
+    WaitIdle();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        Wake();
+    }
+    thread_.join();
+    for (auto & item : timelines_) {
+        if (item.second.semaphore != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device_, item.second.semaphore, nullptr);
+        }
+    }
+    if (wakeSemaphore_ != VK_NULL_HANDLE) {
+        vkDestroySemaphore(device_, wakeSemaphore_, nullptr);
+    }
+    for (VkFence fence : allFences_) {
+        vkDestroyFence(device_, fence, nullptr);
+    }
+}
+
+Job JobScheduler::SubmitGpu(VkQueue _queue, const std::vector<VkCommandBuffer> & _commandBuffers,
+        const std::vector<Job> & _dependencies, VkPipelineStageFlags _waitStage)
+{
+    if (_queue == VK_NULL_HANDLE) {
+        throw std::runtime_error("gpu job needs a queue!");
+    }
+    std::shared_ptr<JobState> job = std::make_shared<JobState>();
+    job->kind = JobKind::Gpu;
+    job->queue = _queue;
+    job->commandBuffers = _commandBuffers;
+    job->waitStage = _waitStage;
+    return Add(job, _dependencies);
+}
+
+Job JobScheduler::SubmitCpu(std::function<void()> _task, const std::vector<Job> & _dependencies)
+{
+    std::shared_ptr<JobState> job = std::make_shared<JobState>();
+    job->kind = JobKind::Cpu;
+    job->task = std::move(_task);
+    return Add(job, _dependencies);
+}
+
+void JobScheduler::WaitIdle()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]() { return unfinished_ == 0; });
+}
+
+Job JobScheduler::Add(const std::shared_ptr<JobState> & _job, const std::vector<Job> & _dependencies)
+{
+    for (const Job & dependency : _dependencies) {
+        if (dependency.IsValid() && dependency.state_->owner != this) {
+            throw std::runtime_error("job depends on a job of another scheduler!");
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    _job->owner = this;
+    try {
+        for (const Job & dependency : _dependencies) {
+            if (!dependency.IsValid()) {
+                continue;
+            }
+            const std::shared_ptr<JobState> & other = dependency.state_;
+            if (other->status == JobStatus::Done) {
+                if (other->error && !_job->error) {
+                    _job->error = other->error;
+                }
+                continue;
+            }
+            // GPU等GPU不需要CPU参与，对方提交以后wait它的timeline值就行
+            if (timeline_ && _job->kind == JobKind::Gpu && other->kind == JobKind::Gpu) {
+                if (other->status == JobStatus::Submitted) {
+                    _job->waitSemaphores.push_back(timelines_.at(other->queue).semaphore);
+                    _job->waitValues.push_back(other->value);
+                }
+                else {
+                    other->submitDependents.push_back(_job);
+                    _job->remaining++;
+                }
+                continue;
+            }
+            other->dependents.push_back(_job);
+            _job->remaining++;
+        }
+    }
+    catch (...) {
+        // 已经挂上去的要撤掉，不然依赖完成时会去满足一个没登记的任务
+        for (const Job & dependency : _dependencies) {
+            if (dependency.IsValid()) {
+                RemoveJob(dependency.state_->dependents, _job);
+                RemoveJob(dependency.state_->submitDependents, _job);
+            }
+        }
+        throw;
+    }
+    // 登记完才计数，前面抛出的话WaitIdle不会等一个不存在的任务
+    unfinished_++;
+    if (_job->remaining == 0) {
+        Dispatch(_job);
+    }
+    return Job(_job);
+}
+
+void JobScheduler::Satisfy(const std::shared_ptr<JobState> & _job)
+{
+    if (--_job->remaining == 0) {
+        Dispatch(_job);
+    }
+}
+
+void JobScheduler::Dispatch(const std::shared_ptr<JobState> & _job)
+{
+    // 依赖失败的任务不执行
+    if (_job->error) {
+        Complete(_job);
+        return;
+    }
+    // 这里经常在线程池或者调度线程里经Complete调到，异常抛出去没人接，任务会一直Pending，WaitIdle永远等不到
+    try {
+        if (_job->kind == JobKind::Gpu) {
+            SubmitNow(_job);
+            return;
+        }
+        std::shared_ptr<JobState> job = _job;
+        cpuPool_.Enqueue([this, job]() {
+            std::exception_ptr error;
+            try {
+                job->task();
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            job->error = error;
+            Complete(job);
+        });
+    }
+    catch (...) {
+        // 已经提交上去的由调度线程完成
+        if (_job->status != JobStatus::Pending) {
+            logerror("failed to notify dependents of a submitted gpu job");
+            return;
+        }
+        logerror("failed to dispatch job");
+        _job->error = std::current_exception();
+        Complete(_job);
+    }
+}
+
+void JobScheduler::SubmitNow(const std::shared_ptr<JobState> & _job)
+{
+    QueueTimeline & timeline = GetTimeline(_job->queue);
+    std::vector<VkPipelineStageFlags> waitStages(_job->waitSemaphores.size(), _job->waitStage);
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(_job->waitSemaphores.size());
+    submitInfo.pWaitSemaphores = _job->waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.commandBufferCount = static_cast<uint32_t>(_job->commandBuffers.size());
+    submitInfo.pCommandBuffers = _job->commandBuffers.data();
+
+    uint64_t value = timeline.nextValue + 1;
+    VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+    VkFence fence = VK_NULL_HANDLE;
+    if (timeline_) {
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(_job->waitValues.size());
+        timelineInfo.pWaitSemaphoreValues = _job->waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &value;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &timeline.semaphore;
+    }
+    else {
+        fence = AcquireFence();
+    }
+    if (vkQueueSubmit(_job->queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+        if (fence != VK_NULL_HANDLE) {
+            freeFences_.push_back(fence);
+        }
+        logerror("failed to submit gpu job");
+        _job->error = std::make_exception_ptr(std::runtime_error("failed to submit gpu job!"));
+        Complete(_job);
+        return;
+    }
+    timeline.nextValue = value;
+    _job->value = value;
+    _job->fence = fence;
+    _job->status = JobStatus::Submitted;
+    // 调度线程只等每个队列最早的提交，队列原来是空的才需要叫醒它
+    timeline.inFlight.push_back(_job);
+    if (timeline.inFlight.size() == 1) {
+        Wake();
+    }
+
+    std::vector<std::shared_ptr<JobState>> dependents;
+    dependents.swap(_job->submitDependents);
+    for (const std::shared_ptr<JobState> & dependent : dependents) {
+        dependent->waitSemaphores.push_back(timeline.semaphore);
+        dependent->waitValues.push_back(value);
+        Satisfy(dependent);
+    }
+}
+
+void JobScheduler::Complete(const std::shared_ptr<JobState> & _job)
+{
+    _job->status = JobStatus::Done;
+    _job->commandBuffers.clear();
+    _job->waitSemaphores.clear();
+    _job->waitValues.clear();
+    _job->task = nullptr;
+    unfinished_--;
+
+    // 提交失败的GPU任务也要放掉等它提交的任务
+    std::vector<std::shared_ptr<JobState>> dependents;
+    dependents.swap(_job->dependents);
+    dependents.insert(dependents.end(), _job->submitDependents.begin(), _job->submitDependents.end());
+    _job->submitDependents.clear();
+    for (const std::shared_ptr<JobState> & dependent : dependents) {
+        if (_job->error && !dependent->error) {
+            dependent->error = _job->error;
+        }
+        Satisfy(dependent);
+    }
+    cond_.notify_all();
+}
+
+JobScheduler::QueueTimeline & JobScheduler::GetTimeline(VkQueue _queue)
+{
+    auto it = timelines_.find(_queue);
+    if (it != timelines_.end()) {
+        return it->second;
+    }
+    // 先建semaphore，失败时不在表里留半个timeline
+    VkSemaphore semaphore = timeline_ ? CreateTimelineSemaphore(device_) : VK_NULL_HANDLE;
+    QueueTimeline & timeline = timelines_[_queue];
+    timeline.semaphore = semaphore;
+    timeline.nextValue = 0;
+    return timeline;
+}
+
+VkFence JobScheduler::AcquireFence()
+{
+    if (!freeFences_.empty()) {
+        VkFence fence = freeFences_.back();
+        freeFences_.pop_back();
+        return fence;
+    }
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VkFence fence = VK_NULL_HANDLE;
+    if (vkCreateFence(device_, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create job fence!");
+    }
+    allFences_.push_back(fence);
+    return fence;
+}
+
+void JobScheduler::Wake()
+{
+    if (timeline_ && !lost_) {
+        VkSemaphoreSignalInfoKHR signalInfo = {};
+        signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO_KHR;
+        signalInfo.semaphore = wakeSemaphore_;
+        signalInfo.value = ++wakeValue_;
+        signalSemaphore_(device_, &signalInfo);
+    }
+    else {
+        cond_.notify_all();
+    }
+}
+
+void JobScheduler::SchedulerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (lost_ ? WaitLost(lock) : timeline_ ? WaitTimelines(lock) : WaitFences(lock)) {
+    }
+}
+
+bool JobScheduler::WaitTimelines(std::unique_lock<std::mutex> & _lock)
+{
+    // wakeValue_在解锁之后才增加的话，semaphore已经到了这个值，vkWaitSemaphores马上返回
+    std::vector<VkSemaphore> semaphores = { wakeSemaphore_ };
+    std::vector<uint64_t> values = { wakeValue_ + 1 };
+    for (const auto & item : timelines_) {
+        if (!item.second.inFlight.empty()) {
+            semaphores.push_back(item.second.semaphore);
+            values.push_back(item.second.inFlight.front()->value);
+        }
+    }
+    if (semaphores.size() == 1 && stopping_) {
+        return false;
+    }
+    _lock.unlock();
+    VkSemaphoreWaitInfoKHR waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+    waitInfo.flags = VK_SEMAPHORE_WAIT_ANY_BIT_KHR;
+    waitInfo.semaphoreCount = static_cast<uint32_t>(semaphores.size());
+    waitInfo.pSemaphores = semaphores.data();
+    waitInfo.pValues = values.data();
+    VkResult result = waitSemaphores_(device_, &waitInfo, UINT64_MAX);
+    _lock.lock();
+
+    if (result != VK_SUCCESS) {
+        logerror("vkWaitSemaphores failed:{}, all in-flight and later gpu jobs fail", static_cast<int>(result));
+        lost_ = true;
+        FailInFlight();
+        return true;
+    }
+    for (auto & item : timelines_) {
+        QueueTimeline & timeline = item.second;
+        if (timeline.inFlight.empty()) {
+            continue;
+        }
+        uint64_t value = 0;
+        getCounterValue_(device_, timeline.semaphore, &value);
+        while (!timeline.inFlight.empty() && timeline.inFlight.front()->value <= value) {
+            std::shared_ptr<JobState> job = timeline.inFlight.front();
+            timeline.inFlight.pop_front();
+            Complete(job);
+        }
+    }
+    return true;
+}
+
+bool JobScheduler::WaitFences(std::unique_lock<std::mutex> & _lock)
+{
+    std::vector<VkFence> fences;
+    for (const auto & item : timelines_) {
+        if (!item.second.inFlight.empty()) {
+            fences.push_back(item.second.inFlight.front()->fence);
+        }
+    }
+    if (fences.empty()) {
+        if (stopping_) {
+            return false;
+        }
+        cond_.wait(_lock);
+        return true;
+    }
+    _lock.unlock();
+    VkResult result = vkWaitForFences(device_, static_cast<uint32_t>(fences.size()), fences.data(), VK_FALSE,
+            kFencePollNs);
+    _lock.lock();
+
+    if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+        logerror("vkWaitForFences failed:{}, all in-flight and later gpu jobs fail", static_cast<int>(result));
+        lost_ = true;
+        FailInFlight();
+        return true;
+    }
+    for (auto & item : timelines_) {
+        QueueTimeline & timeline = item.second;
+        while (!timeline.inFlight.empty()) {
+            std::shared_ptr<JobState> job = timeline.inFlight.front();
+            if (vkGetFenceStatus(device_, job->fence) != VK_SUCCESS) {
+                break;
+            }
+            timeline.inFlight.pop_front();
+            vkResetFences(device_, 1, &job->fence);
+            freeFences_.push_back(job->fence);
+            job->fence = VK_NULL_HANDLE;
+            Complete(job);
+        }
+    }
+    return true;
+}
+
+bool JobScheduler::WaitLost(std::unique_lock<std::mutex> & _lock)
+{
+    // 丢失以后还能提交成功的任务也不会完成了，Wake改成notify cond_
+    FailInFlight();
+    if (stopping_) {
+        return false;
+    }
+    cond_.wait(_lock);
+    return true;
+}
+
+void JobScheduler::FailInFlight()
+{
+    // 丢失的任务的fence状态不确定，不放回池里，析构时统一销毁
+    for (auto & item : timelines_) {
+        QueueTimeline & timeline = item.second;
+        while (!timeline.inFlight.empty()) {
+            std::shared_ptr<JobState> job = timeline.inFlight.front();
+            timeline.inFlight.pop_front();
+            job->error = std::make_exception_ptr(std::runtime_error("gpu job lost!"));
+            job->fence = VK_NULL_HANDLE;
+            Complete(job);
+        }
+    }
+}
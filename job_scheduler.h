@@ -0,0 +1,125 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <vulkan/vulkan.h>
+
+class ThreadPool;
+class JobScheduler;
+struct JobState;
+
+/*
+ * GPU提交和CPU任务的依赖调度，每次提交返回一个Job，可以查询、等待，也可以当作后面任务的依赖
+ * timeline模式：每个VkQueue一个timeline semaphore，每次提交signal一个递增的值
+ *   GPU任务依赖GPU任务时直接在提交里wait对方的值，依赖一提交出去就能提交，不在CPU上等
+ *   调度线程用vkWaitSemaphores(WAIT_ANY)睡在各队列最早未完成的值和一个唤醒用的semaphore上，完成后启动依赖它的任务
+ * fence模式(设备不支持或者没开timelineSemaphore)：每次提交带一个池里的fence，依赖全部在CPU上完成后才提交
+ * 同一个队列上的提交按顺序完成，每个队列只需要看最早的那个
+ * CPU任务在ThreadPool里执行，抛出的异常在Wait时重新抛出，依赖失败的任务不再执行，直接以同一个错误结束
+ * 交给调度器的VkQueue不能再从别的地方提交，除非调用者自己加锁；Job不能在调度器析构之后使用
+ * GPU写、CPU读的数据，command buffer里要自己加到HOST的barrier，semaphore只保证执行完成
+ */
+class Job {
+public:
+    Job() = default;
+
+    bool IsValid() const { return state_ != nullptr; }
+    bool IsDone() const;
+    // 任务失败时重新抛出，不要在调度器的CPU任务里等，线程池可能被占满
+    void Wait() const;
+
+private:
+    friend class JobScheduler;
+    explicit Job(std::shared_ptr<JobState> _state) : state_(std::move(_state)) {}
+
+    std::shared_ptr<JobState> state_;
+};
+
+/**
+ * desc: _instanceVersion 是CreateInstance时给的apiVersion，和物理设备的apiVersion取小的作为设备的版本
+ *       1.2以下要有VK_KHR_timeline_semaphore扩展；instance是1.0时要打开VK_KHR_get_physical_device_properties2，否则返回false
+ **/
+bool SupportsTimelineSemaphore(VkInstance _instance, uint32_t _instanceVersion, VkPhysicalDevice _physicalDevice);
+
+class JobScheduler {
+public:
+    /**
+     * desc: _timeline 设备创建时打开了timelineSemaphore特性
+     *       打开方法：SupportsTimelineSemaphore为true时加上VK_KHR_timeline_semaphore扩展，
+     *       VkPhysicalDeviceTimelineSemaphoreFeaturesKHR作为CreateLogicalDevice(queue_topology.h)的_next传进去
+     *       不支持或者取不到函数入口时退回fence模式，设备版本1.2以下只用KHR的入口
+     **/
+    JobScheduler(VkDevice _device, VkPhysicalDevice _physicalDevice, VkInstance _instance, uint32_t _instanceVersion,
+            bool _timeline, ThreadPool & _cpuPool);
+    // 等所有任务完成
+    ~JobScheduler();
+    JobScheduler(const JobScheduler &) = delete;
+    JobScheduler & operator=(const JobScheduler &) = delete;
+
+    bool IsTimeline() const { return timeline_; }
+
+    /**
+     * desc: 依赖都满足后把_commandBuffers提交到_queue，command buffer在Job完成之前要保持有效
+     *       _waitStage 在哪个stage等依赖的GPU任务
+     **/
+    Job SubmitGpu(VkQueue _queue, const std::vector<VkCommandBuffer> & _commandBuffers,
+            const std::vector<Job> & _dependencies = {},
+            VkPipelineStageFlags _waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    // 依赖都完成后在线程池里执行_task
+    Job SubmitCpu(std::function<void()> _task, const std::vector<Job> & _dependencies = {});
+
+    void WaitIdle();
+
+private:
+    friend class Job;
+
+    struct QueueTimeline {
+        VkSemaphore semaphore;
+        uint64_t nextValue;
+        // 提交顺序，最早的在前面
+        std::deque<std::shared_ptr<JobState>> inFlight;
+    };
+
+    Job Add(const std::shared_ptr<JobState> & _job, const std::vector<Job> & _dependencies);
+    // 以下调用前持有mutex_
+    void Satisfy(const std::shared_ptr<JobState> & _job);
+    void Dispatch(const std::shared_ptr<JobState> & _job);
+    void SubmitNow(const std::shared_ptr<JobState> & _job);
+    void Complete(const std::shared_ptr<JobState> & _job);
+    QueueTimeline & GetTimeline(VkQueue _queue);
+    VkFence AcquireFence();
+    void Wake();
+
+    void SchedulerLoop();
+    bool WaitTimelines(std::unique_lock<std::mutex> & _lock);
+    bool WaitFences(std::unique_lock<std::mutex> & _lock);
+    // 设备丢失以后不再调驱动等待，在途的任务直接失败
+    bool WaitLost(std::unique_lock<std::mutex> & _lock);
+    void FailInFlight();
+
+    VkDevice device_;
+    bool timeline_;
+    ThreadPool & cpuPool_;
+    PFN_vkGetSemaphoreCounterValueKHR getCounterValue_;
+    PFN_vkWaitSemaphoresKHR waitSemaphores_;
+    PFN_vkSignalSemaphoreKHR signalSemaphore_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::map<VkQueue, QueueTimeline> timelines_;
+    std::vector<VkFence> freeFences_;
+    std::vector<VkFence> allFences_;
+    // 新队列有了第一个未完成的提交或者要退出时signal，把调度线程从vkWaitSemaphores里叫醒
+    VkSemaphore wakeSemaphore_;
+    uint64_t wakeValue_;
+    uint64_t unfinished_;
+    // vkWaitSemaphores/vkWaitForFences返回过错误，之后每次都会立刻返回同样的错误
+    bool lost_;
+    bool stopping_;
+    std::thread thread_;
+};
@@ -4,30 +4,223 @@
 #include <stdio.h>
 #include <logger.h>
 #include "helper.h"
+#include "device_capabilities.h"
+#include "name_registry.h"
+#include "frame_target.h"
+#include "headless_target.h"
+#include "readback_ring.h"
+#include "command_allocator.h"
+#include "image_state_tracker.h"
+#include "gpu_profiler.h"
+#include "debug_messenger.h"
+#include "queue_topology.h"
+#include "compute_dispatch.h"
+#include "descriptor_allocator.h"
+#include "memory_allocator.h"
+#include "shader_loader.h"
+#include "thread_pool.h"
+#include "job_scheduler.h"
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
 
-VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugReportFlagsEXT flags, VkDebugReportObjectTypeEXT objType, uint64_t obj, size_t location, int32_t code, const char* layerPrefix, const char* msg, void* userData) {
-    logerror("validation layer:{}", msg);
-    
-    return VK_FALSE;
+/**
+ * desc: 帧循环只依赖FrameTarget，交换链和离屏共用
+ *   这里每帧只clear一次，image的状态交给ImageStateTracker
+ **/
+void RunFrames(FrameTarget & _target, VkDevice _device, VkQueue _queue, uint32_t _queueFamilyIndex,
+        uint32_t _frameCount, GpuProfiler * _profiler = nullptr)
+{
+    CommandAllocator commandAllocator(_device, _queueFamilyIndex, _target.GetFramesInFlight(), 1);
+    ImageStateTracker tracker;
+    VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    for (uint32_t i = 0; i < _frameCount; i++) {
+        FrameImage frame;
+        if (!_target.BeginFrame(frame)) {
+            continue;
+        }
+        CpuScope cpuScope(_profiler, "frame");
+        commandAllocator.BeginFrame(frame.frameIndex);
+        VkCommandBuffer commandBuffer = commandAllocator.AllocatePrimary(0);
+        VkCommandBufferBeginInfo beginInfo = GetCommandBufferOneTimeSubmitBeginInfo();
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        if (_profiler != nullptr) {
+            _profiler->BeginFrame(frame.frameIndex, commandBuffer);
+        }
+        {
+            //scope要在vkEndCommandBuffer之前结束
+            GpuScope gpuScope(_profiler, commandBuffer, "clear");
+            // 每帧整张覆盖，旧内容不需要
+            tracker.Register(frame.image, range);
+            if (frame.imageAvailable != VK_NULL_HANDLE) {
+                // 交换链的acquire semaphore在COLOR_ATTACHMENT_OUTPUT等待，layout转换要排在它后面
+                tracker.SetPriorAccess(frame.image, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0);
+            }
+            else {
+                // 离屏image上一帧的输出可能还在被回读拷贝，覆盖之前要等它
+                tracker.SetPriorAccess(frame.image, GetImageUsageInfo(_target.GetFinalUsage()).stage, 0);
+            }
+            tracker.Require(frame.image, ImageUsage::TransferDst, VK_QUEUE_FAMILY_IGNORED, true);
+            tracker.Flush(commandBuffer);
+            VkClearColorValue color = { { 0.1f, 0.2f, 0.3f * (i % 4), 1.0f } };
+            vkCmdClearColorImage(commandBuffer, frame.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &range);
+            tracker.Require(frame.image, _target.GetFinalUsage());
+            tracker.Flush(commandBuffer);
+            tracker.Unregister(frame.image);
+        }
+
+        vkEndCommandBuffer(commandBuffer);
+        _target.Submit(frame, _queue, commandBuffer);
+        _target.Present(frame);
+    }
+    vkQueueWaitIdle(_queue);
 }
 
-int SetupValidationLayerCallback(VkInstance instance, PFN_vkDebugReportCallbackEXT _pfnCallback, VkDebugReportCallbackEXT *h)
+/**
+ * desc: 计算管线的自检，结果和CPU算的比较，软件ICD(lavapipe)上也能跑
+ *   _spirvPath是saxpy的shader，y[i] = a * x[i] + y[i]：
+ *     layout(local_size_x_id = 0) in;
+ *     layout(binding = 0) readonly buffer X { float x[]; };
+ *     layout(binding = 1) buffer Y { float y[]; };
+ *     layout(push_constant) uniform P { float a; uint n; };
+ *   数据分成几段，每段连续做几遍，段之间没有依赖，ComputeBatch会把每一遍的各段排在同一层
+ *   写数据、计算、校验是_scheduler里前后依赖的三个任务，中间不用vkQueueWaitIdle，_queue交给_scheduler提交
+ **/
+bool RunComputeCheck(VkPhysicalDevice _physicalDevice, VkDevice _device, VkQueue _queue, uint32_t _queueFamilyIndex,
+        const char * _spirvPath, JobScheduler & _scheduler)
 {
-    VkDebugReportCallbackCreateInfoEXT createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-    createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-    createInfo.pfnCallback = _pfnCallback;
-    
-    auto func = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
-    if (func != nullptr) {
-        return func(instance, &createInfo, nullptr, h);
+    const uint32_t chunkCount = 8;
+    const uint32_t chunkSize = 8192;
+    const uint32_t passCount = 4;
+    const uint32_t count = chunkCount * chunkSize;
+    const VkDeviceSize size = count * sizeof(float);
+
+    MappedFile spirv(_spirvPath);
+    if (!IsValidSpirv(spirv.GetData(), spirv.GetSize())) {
+        logerror("compute check: {} is not spirv", _spirvPath);
+        return false;
     }
-    return VK_ERROR_EXTENSION_NOT_PRESENT;
-}
+    ComputePipelineDesc desc;
+    desc.code = static_cast<const uint32_t *>(spirv.GetData());
+    desc.wordCount = spirv.GetSize() / sizeof(uint32_t);
+    desc.bindings = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER };
+    desc.pushConstantSize = 2 * sizeof(uint32_t);
+    ComputePipeline pipeline(_device, _physicalDevice, desc);
+
+    DeviceMemoryAllocator memory(_device, _physicalDevice);
+    VkBuffer buffers[2];
+    MemoryAllocation allocations[2];
+    for (int i = 0; i < 2; i++) {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (vkCreateBuffer(_device, &bufferInfo, nullptr, &buffers[i]) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute buffer!");
+        }
+        allocations[i] = memory.AllocateForBuffer(buffers[i],
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+    float * x = static_cast<float *>(allocations[0].mapped);
+    float * y = static_cast<float *>(allocations[1].mapped);
+    std::vector<float> expected(count);
+    // 每一遍每一段的系数，GPU和CPU算的时候都用它
+    auto coefficient = [](uint32_t _pass, uint32_t _chunk) { return static_cast<float>(_pass + _chunk + 1); };
+    // 提交前在CPU上写的映射内存对GPU可见，不用flush
+    Job upload = _scheduler.SubmitCpu([&]() {
+        for (uint32_t i = 0; i < count; i++) {
+            x[i] = static_cast<float>(i % 97);
+            y[i] = static_cast<float>(i % 13);
+            expected[i] = y[i];
+        }
+        for (uint32_t pass = 0; pass < passCount; pass++) {
+            for (uint32_t i = 0; i < count; i++) {
+                expected[i] = coefficient(pass, i / chunkSize) * x[i] + expected[i];
+            }
+        }
+    });
+
+    DescriptorAllocator descriptors(_device, 1);
+    descriptors.BeginFrame(0);
+    ComputeBatch batch(descriptors);
+    for (uint32_t pass = 0; pass < passCount; pass++) {
+        for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+            struct {
+                float a;
+                uint32_t n;
+            } constants = { coefficient(pass, chunk), chunkSize };
+            VkDeviceSize offset = chunk * chunkSize * sizeof(float);
+            VkDeviceSize range = chunkSize * sizeof(float);
+            batch.Dispatch(pipeline, {
+                    { 0, buffers[0], offset, range, ComputeAccess::Read },
+                    { 1, buffers[1], offset, range, ComputeAccess::ReadWrite } },
+                    { chunkSize, 1, 1 }, &constants, sizeof(constants));
+        }
+    }
+
+    CommandAllocator commandAllocator(_device, _queueFamilyIndex, 1, 1);
+    commandAllocator.BeginFrame(0);
+    VkCommandBuffer commandBuffer = commandAllocator.AllocatePrimary(0);
+    VkCommandBufferBeginInfo beginInfo = GetCommandBufferOneTimeSubmitBeginInfo();
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    // 数据是映射内存直接写的，结果也是映射读
+    ComputeBatch::Stats stats = batch.Record(commandBuffer, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_WRITE_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+    vkEndCommandBuffer(commandBuffer);
+    // 录制和写数据同时进行，数据写完才提交
+    Job compute = _scheduler.SubmitGpu(_queue, { commandBuffer }, { upload });
 
+    uint32_t mismatches = 0;
+    Job verify = _scheduler.SubmitCpu([&]() {
+        for (uint32_t i = 0; i < count; i++) {
+            if (std::fabs(y[i] - expected[i]) > 1e-3f * std::fabs(expected[i]) + 1e-3f) {
+                if (mismatches++ < 8) {
+                    logerror("compute check: y[{}] = {}, expected {}", i, y[i], expected[i]);
+                }
+            }
+        }
+    }, { compute });
+    verify.Wait();
+    VkExtent3D workgroup = pipeline.GetWorkgroupSize();
+    loginfo("compute check: workgroup:{}x{}x{} dispatches:{} levels:{} barriers:{} buffer barriers:{} mismatches:{} sync:{}",
+            workgroup.width, workgroup.height, workgroup.depth, stats.dispatches, stats.levels, stats.barriers,
+            stats.bufferBarriers, mismatches, _scheduler.IsTimeline() ? "timeline" : "fences");
+
+    for (int i = 0; i < 2; i++) {
+        vkDestroyBuffer(_device, buffers[i], nullptr);
+        memory.Free(allocations[i]);
+    }
+    return mismatches == 0;
+}
 
 int main(int argc, char **argv){
-    logger_init_file_output("vulkan.log");
+    //--headless: 不建窗口和surface，渲染到离屏image，CI和没有显示器的机器用
+    //--binlog: 二进制日志写到vulkan.blog，debug也打开，用binlog_decode看
+    //--compute <saxpy.spv>: 离屏模式下先跑计算管线的自检，见RunComputeCheck
+    bool headless = false;
+    bool binlog = false;
+    const char * computeShader = nullptr;
+    int exitCode = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--binlog") == 0) {
+            binlog = true;
+        }
+        else if (strcmp(argv[i], "--compute") == 0 && i + 1 < argc) {
+            computeShader = argv[++i];
+        }
+    }
+    if (binlog) {
+        logger_set_level_debug();
+        logger_init_binary_output("vulkan.blog", 1 << 20);
+    }
+    else {
+        logger_init_async_file_output("vulkan.log", 8192, LOGGER_OVERFLOW_BLOCK);
+    }
     
     
 #ifdef __APPLE__
@@ -36,24 +229,107 @@ int main(int argc, char **argv){
     printf("not on mac\n");
     const std::vector<const char*> validationLayers = { "VK_LAYER_LUNARG_standard_validation" };
 #endif
-    if (!CheckInstanceLayerPropertiesSupport(validationLayers)) {
-        logerror("checkInstanceLayerPropertiesSupport fail");
-        return -1;
+    std::vector<const char*> enabledLayers = validationLayers;
+    std::vector<const char*> missingLayers = GetMissingInstanceLayers(validationLayers);
+    if (!missingLayers.empty()) {
+        for (const char * layer : missingLayers) {
+            logerror("checkInstanceLayerPropertiesSupport fail: {} not support", layer);
+        }
+        //CI的软件ICD(lavapipe)一般没装验证层，离屏模式下不强制
+        if (!headless) {
+            return -1;
+        }
+        enabledLayers.clear();
     }
 
     GetInstanceExtensionProperties();
     
-    VkInstance instance = CreateInstance(validationLayers);
+    //离屏模式不开任何surface扩展
+    std::vector<const char*> instanceExtensions;
+    bool debugUtils = !enabledLayers.empty()
+        && CheckInstanceExtensionPropertiesSupport({ DebugMessenger::GetRequiredExtension() });
+    if (debugUtils) {
+        instanceExtensions.push_back(DebugMessenger::GetRequiredExtension());
+    }
+    //JobScheduler的timeline semaphore在1.2是核心，loader支持的话按1.2建；1.0的instance查特性要靠properties2扩展
+    uint32_t instanceVersion = std::min<uint32_t>(GetInstanceVersion(), VK_API_VERSION_1_2);
+    if (instanceVersion < VK_API_VERSION_1_1
+            && CheckInstanceExtensionPropertiesSupport({ "VK_KHR_get_physical_device_properties2" })) {
+        instanceExtensions.push_back("VK_KHR_get_physical_device_properties2");
+    }
+    VkInstance instance = CreateInstance(enabledLayers, instanceExtensions, instanceVersion);
     
     std::unique_ptr<std::vector<VkPhysicalDevice>> devices = GetPhysicalDevices(instance);
     for (int i = 0; i < devices->size(); i++){
         VkPhysicalDevice device = devices->operator[](i);
-        GetPhysicalDeviceProperties(device);
-        GetPhysicalDeviceExtensionProperties(device);
-        GetPhysicalDeviceQueueFamilyProperties(device);
-        GetPhysicalDeviceMemoryProperties(device);
+        //热启动直接读缓存，驱动变化或者第一次启动才枚举，然后写回去
+        std::string capsCache = "device_caps_" + std::to_string(i) + ".bin";
+        if (!LoadDeviceCapabilities(device, capsCache.c_str())) {
+            GetDeviceCapabilities(device);
+            SaveDeviceCapabilities(device, capsCache.c_str());
+        }
     }
 
-    VkDebugReportCallbackEXT hDebugCallback;
-    SetupValidationLayerCallback(instance, debugCallback, &hDebugCallback);
+    //同一条验证消息只完整输出前几次，之后定期汇总重复次数
+    std::unique_ptr<DebugMessenger> debugMessenger;
+    if (debugUtils) {
+        debugMessenger.reset(new DebugMessenger(instance));
+    }
+
+    if (headless) {
+        VkPhysicalDevice physicalDevice = devices->operator[](0);
+        //transfer和async compute队列先建好，之后上传和计算从图形队列上移走
+        QueuePlan queuePlan = PlanQueueTopology(physicalDevice);
+        //支持的话打开timeline semaphore给JobScheduler用，1.2以上扩展可有可无
+        bool timeline = SupportsTimelineSemaphore(instance, instanceVersion, physicalDevice);
+        std::vector<const char*> deviceExtensions;
+        if (timeline && GetMissingDeviceExtensions(physicalDevice, { "VK_KHR_timeline_semaphore" }).empty()) {
+            deviceExtensions.push_back("VK_KHR_timeline_semaphore");
+        }
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        timelineFeatures.timelineSemaphore = VK_TRUE;
+        VkDevice device = CreateLogicalDevice(physicalDevice, queuePlan, deviceExtensions,
+                timeline ? &timelineFeatures : nullptr);
+        QueueParameters graphicsQueue = GetPlannedQueue(device, queuePlan, QueueRole::Graphics);
+        VkQueue queue = graphicsQueue.Handle;
+        uint32_t queueFamilyIndex = graphicsQueue.FamilyIndex;
+        if (computeShader != nullptr) {
+            QueueParameters computeQueue = queuePlan.Has(QueueRole::AsyncCompute) ?
+                GetPlannedQueue(device, queuePlan, QueueRole::AsyncCompute) : graphicsQueue;
+            //调度器析构时等任务做完，之后帧循环才能用同一个队列
+            ThreadPool cpuPool(2);
+            JobScheduler scheduler(device, physicalDevice, instance, instanceVersion, timeline, cpuPool);
+            if (!RunComputeCheck(physicalDevice, device, computeQueue.Handle, computeQueue.FamilyIndex, computeShader,
+                    scheduler)) {
+                exitCode = 1;
+            }
+        }
+        {
+            HeadlessTarget target(physicalDevice, device, { 1280, 720 });
+            ReadbackRing readback(device, physicalDevice, queue, queueFamilyIndex,
+                    target.GetExtent(), target.GetFormat());
+            //不等回读完成，下一帧的渲染和这一帧的拷贝重叠
+            target.SetOutputCallback([&readback](const FrameImage & _frame) {
+                readback.Readback(_frame.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, [](const ReadbackData & _data) {
+                    const uint8_t * pixel = static_cast<const uint8_t *>(_data.data);
+                    loginfo("readback {} first pixel:{} {} {} {}", _data.id, pixel[0], pixel[1], pixel[2], pixel[3]);
+                });
+            });
+            GpuProfiler profiler(device, physicalDevice, queue, queueFamilyIndex,
+                    target.GetFramesInFlight());
+            RunFrames(target, device, queue, queueFamilyIndex, 8, &profiler);
+            readback.Finish();
+            for (const ProfileStat & stat : profiler.GetSummary()) {
+                loginfo("{} {}: avg {:.3f}ms min {:.3f}ms max {:.3f}ms samples:{}", stat.gpu ? "gpu" : "cpu",
+                        stat.name, stat.avgMs, stat.minMs, stat.maxMs, stat.samples);
+            }
+            profiler.WriteChromeTrace("vulkan_trace.json");
+        }
+        vkDestroyDevice(device, nullptr);
+        loginfo("headless frames done");
+    }
+    debugMessenger.reset();
+    vkDestroyInstance(instance, nullptr);
+    return exitCode;
 }
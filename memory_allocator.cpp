@@ -0,0 +1,511 @@
+#include "memory_allocator.h"
+#include "helper.h"
+#include "device_capabilities.h"
+#include <set>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <logger.h>
+
+namespace {
+
+const VkDeviceSize kMinBuddySize = 256;
+
+VkDeviceSize AlignUp(VkDeviceSize _value, VkDeviceSize _alignment)
+{
+    return (_value + _alignment - 1) / _alignment * _alignment;
+}
+
+VkDeviceSize NextPowerOfTwo(VkDeviceSize _value)
+{
+    VkDeviceSize v = 1;
+    while (v < _value) {
+        v <<= 1;
+    }
+    return v;
+}
+
+uint32_t Log2(VkDeviceSize _value)
+{
+    uint32_t n = 0;
+    while (_value > 1) {
+        _value >>= 1;
+        n++;
+    }
+    return n;
+}
+
+}
+
+class MemoryBlock {
+public:
+    MemoryBlock(VkDeviceMemory _memory, VkDeviceSize _size, void * _mapped) :
+        memory(_memory),
+        size(_size),
+        mapped(_mapped),
+        allocationCount(0),
+        usedBytes(0) {
+    }
+    virtual ~MemoryBlock() {}
+
+    virtual bool Allocate(VkDeviceSize _size, VkDeviceSize _alignment, VkDeviceSize * _offset) = 0;
+    virtual void Free(VkDeviceSize _offset, VkDeviceSize _size) = 0;
+    virtual void Reset() {}
+
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void * mapped;
+    uint32_t allocationCount;
+    VkDeviceSize usedBytes;
+};
+
+namespace {
+
+class LinearBlock : public MemoryBlock {
+public:
+    LinearBlock(VkDeviceMemory _memory, VkDeviceSize _size, void * _mapped) :
+        MemoryBlock(_memory, _size, _mapped),
+        head_(0) {
+    }
+
+    bool Allocate(VkDeviceSize _size, VkDeviceSize _alignment, VkDeviceSize * _offset) override {
+        VkDeviceSize offset = AlignUp(head_, _alignment);
+        if (offset + _size > size) {
+            return false;
+        }
+        head_ = offset + _size;
+        *_offset = offset;
+        return true;
+    }
+
+    void Free(VkDeviceSize _offset, VkDeviceSize _size) override {
+    }
+
+    void Reset() override {
+        head_ = 0;
+    }
+
+private:
+    VkDeviceSize head_;
+};
+
+class BuddyBlock : public MemoryBlock {
+public:
+    // _size必须是2的幂
+    BuddyBlock(VkDeviceMemory _memory, VkDeviceSize _size, void * _mapped) :
+        MemoryBlock(_memory, _size, _mapped),
+        maxOrder_(Log2(_size / kMinBuddySize)),
+        freeLists_(maxOrder_ + 1) {
+        freeLists_[maxOrder_].insert(0);
+    }
+
+    bool Allocate(VkDeviceSize _size, VkDeviceSize _alignment, VkDeviceSize * _offset) override {
+        //节点的offset是节点大小的整数倍，所以节点不小于alignment就自然对齐了
+        VkDeviceSize need = NextPowerOfTwo(std::max(std::max(_size, _alignment), kMinBuddySize));
+        uint32_t order = Log2(need / kMinBuddySize);
+        if (order > maxOrder_) {
+            return false;
+        }
+
+        uint32_t j = order;
+        while (j <= maxOrder_ && freeLists_[j].empty()) {
+            j++;
+        }
+        if (j > maxOrder_) {
+            return false;
+        }
+
+        VkDeviceSize offset = *freeLists_[j].begin();
+        freeLists_[j].erase(freeLists_[j].begin());
+        while (j > order) {
+            j--;
+            freeLists_[j].insert(offset + (kMinBuddySize << j));
+        }
+        allocated_[offset] = order;
+        *_offset = offset;
+        return true;
+    }
+
+    void Free(VkDeviceSize _offset, VkDeviceSize _size) override {
+        auto it = allocated_.find(_offset);
+        if (it == allocated_.end()) {
+            logerror("buddy free unknown offset:{}", _offset);
+            return;
+        }
+        uint32_t order = it->second;
+        allocated_.erase(it);
+
+        VkDeviceSize offset = _offset;
+        while (order < maxOrder_) {
+            VkDeviceSize buddy = offset ^ (kMinBuddySize << order);
+            auto b = freeLists_[order].find(buddy);
+            if (b == freeLists_[order].end()) {
+                break;
+            }
+            freeLists_[order].erase(b);
+            offset = std::min(offset, buddy);
+            order++;
+        }
+        freeLists_[order].insert(offset);
+    }
+
+private:
+    uint32_t maxOrder_;
+    std::vector<std::set<VkDeviceSize>> freeLists_;
+    std::unordered_map<VkDeviceSize, uint32_t> allocated_;
+};
+
+class FreeListBlock : public MemoryBlock {
+public:
+    FreeListBlock(VkDeviceMemory _memory, VkDeviceSize _size, void * _mapped) :
+        MemoryBlock(_memory, _size, _mapped) {
+        free_[0] = _size;
+    }
+
+    bool Allocate(VkDeviceSize _size, VkDeviceSize _alignment, VkDeviceSize * _offset) override {
+        //best fit，剩余最小的空闲段
+        auto best = free_.end();
+        VkDeviceSize bestWaste = 0;
+        for (auto it = free_.begin(); it != free_.end(); ++it) {
+            VkDeviceSize aligned = AlignUp(it->first, _alignment);
+            VkDeviceSize end = it->first + it->second;
+            if (aligned + _size > end) {
+                continue;
+            }
+            VkDeviceSize waste = end - aligned - _size;
+            if (best == free_.end() || waste < bestWaste) {
+                best = it;
+                bestWaste = waste;
+                if (waste == 0) {
+                    break;
+                }
+            }
+        }
+        if (best == free_.end()) {
+            return false;
+        }
+
+        VkDeviceSize start = best->first;
+        VkDeviceSize end = best->first + best->second;
+        VkDeviceSize aligned = AlignUp(start, _alignment);
+        free_.erase(best);
+        if (aligned > start) {
+            free_[start] = aligned - start;
+        }
+        if (aligned + _size < end) {
+            free_[aligned + _size] = end - aligned - _size;
+        }
+        *_offset = aligned;
+        return true;
+    }
+
+    void Free(VkDeviceSize _offset, VkDeviceSize _size) override {
+        VkDeviceSize offset = _offset;
+        VkDeviceSize size = _size;
+
+        auto next = free_.lower_bound(offset);
+        if (next != free_.end() && offset + size == next->first) {
+            size += next->second;
+            next = free_.erase(next);
+        }
+        if (next != free_.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                prev->second += size;
+                return;
+            }
+        }
+        free_[offset] = size;
+    }
+
+private:
+    std::map<VkDeviceSize, VkDeviceSize> free_;
+};
+
+}
+
+bool DeviceMemoryAllocator::PoolKey::operator<(const PoolKey & _other) const
+{
+    if (memoryTypeIndex != _other.memoryTypeIndex)
+        return memoryTypeIndex < _other.memoryTypeIndex;
+    if (pool != _other.pool)
+        return pool < _other.pool;
+    return optimalImage < _other.optimalImage;
+}
+
+DeviceMemoryAllocator::DeviceMemoryAllocator(VkDevice _device, VkPhysicalDevice _physicalDevice,
+        VkDeviceSize _blockSize) :
+    device_(_device),
+    blockSize_(_blockSize),
+    deviceAllocationCount_(0)
+{
+    const DeviceCapabilities & caps = GetDeviceCapabilities(_physicalDevice);
+    memoryProperties_ = caps.memoryProperties;
+    nonCoherentAtomSize_ = std::max<VkDeviceSize>(caps.properties.limits.nonCoherentAtomSize, 1);
+    maxAllocationCount_ = caps.properties.limits.maxMemoryAllocationCount;
+
+    heapStats_.resize(memoryProperties_.memoryHeapCount);
+    for (uint32_t i = 0; i < memoryProperties_.memoryHeapCount; i++) {
+        heapStats_[i].heapSize = memoryProperties_.memoryHeaps[i].size;
+    }
+}
+
+DeviceMemoryAllocator::~DeviceMemoryAllocator()
+{
+    for (auto & pool : pools_) {
+        for (auto & block : pool.second) {
+            if (pool.first.pool != MemoryPoolType::Linear && block->allocationCount > 0) {
+                logwarn("memory block of type {} destroyed with {} live allocations",
+                        pool.first.memoryTypeIndex, block->allocationCount);
+            }
+            FreeDeviceMemory(pool.first.memoryTypeIndex, block->memory, block->size, block->mapped != nullptr);
+        }
+    }
+}
+
+VkDeviceMemory DeviceMemoryAllocator::AllocateDeviceMemory(uint32_t _memoryTypeIndex, VkDeviceSize _size, void ** _mapped)
+{
+    if (deviceAllocationCount_ >= maxAllocationCount_) {
+        throw std::runtime_error("maxMemoryAllocationCount exceeded!");
+    }
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = _size;
+    allocInfo.memoryTypeIndex = _memoryTypeIndex;
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    if (vkAllocateMemory(device_, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate device memory!");
+    }
+    deviceAllocationCount_++;
+
+    *_mapped = nullptr;
+    if (memoryProperties_.memoryTypes[_memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(device_, memory, 0, VK_WHOLE_SIZE, 0, _mapped) != VK_SUCCESS) {
+            vkFreeMemory(device_, memory, nullptr);
+            deviceAllocationCount_--;
+            throw std::runtime_error("failed to map device memory!");
+        }
+    }
+
+    MemoryHeapStats & stats = heapStats_[memoryProperties_.memoryTypes[_memoryTypeIndex].heapIndex];
+    stats.blockCount++;
+    stats.blockBytes += _size;
+    return memory;
+}
+
+void DeviceMemoryAllocator::FreeDeviceMemory(uint32_t _memoryTypeIndex, VkDeviceMemory _memory,
+        VkDeviceSize _size, bool _mapped)
+{
+    if (_mapped) {
+        vkUnmapMemory(device_, _memory);
+    }
+    vkFreeMemory(device_, _memory, nullptr);
+    deviceAllocationCount_--;
+
+    MemoryHeapStats & stats = heapStats_[memoryProperties_.memoryTypes[_memoryTypeIndex].heapIndex];
+    stats.blockCount--;
+    stats.blockBytes -= _size;
+}
+
+MemoryAllocation DeviceMemoryAllocator::Allocate(const VkMemoryRequirements & _requirements,
+        VkMemoryPropertyFlags _required, VkMemoryPropertyFlags _preferred, MemoryPoolType _pool, bool _optimalImage)
+{
+    int typeIndex = FindMemoryTypeIndex(&memoryProperties_, _requirements.memoryTypeBits, _required, _preferred);
+    if (typeIndex < 0) {
+        throw std::runtime_error("failed to find suitable memory type!");
+    }
+
+    MemoryAllocation allocation;
+    allocation.memoryTypeIndex = static_cast<uint32_t>(typeIndex);
+    allocation.size = _requirements.size;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    MemoryHeapStats & stats = heapStats_[memoryProperties_.memoryTypes[typeIndex].heapIndex];
+
+    VkDeviceSize blockSize = _pool == MemoryPoolType::Buddy ? NextPowerOfTwo(blockSize_) : blockSize_;
+    if (_requirements.size > blockSize / 2) {
+        allocation.memory = AllocateDeviceMemory(allocation.memoryTypeIndex, _requirements.size, &allocation.mapped);
+        stats.allocationCount++;
+        stats.usedBytes += allocation.size;
+        return allocation;
+    }
+
+    VkDeviceSize alignment = std::max<VkDeviceSize>(_requirements.alignment, 1);
+    auto & blocks = pools_[PoolKey{ allocation.memoryTypeIndex, _pool, _optimalImage }];
+    MemoryBlock * block = nullptr;
+    for (auto & b : blocks) {
+        if (b->Allocate(_requirements.size, alignment, &allocation.offset)) {
+            block = b.get();
+            break;
+        }
+    }
+
+    if (block == nullptr) {
+        void * mapped = nullptr;
+        VkDeviceMemory memory = AllocateDeviceMemory(allocation.memoryTypeIndex, blockSize, &mapped);
+        std::unique_ptr<MemoryBlock> b;
+        switch (_pool) {
+        case MemoryPoolType::Linear:
+            b = std::make_unique<LinearBlock>(memory, blockSize, mapped);
+            break;
+        case MemoryPoolType::Buddy:
+            b = std::make_unique<BuddyBlock>(memory, blockSize, mapped);
+            break;
+        default:
+            b = std::make_unique<FreeListBlock>(memory, blockSize, mapped);
+            break;
+        }
+        // 对齐补齐以后新块也可能放不下，比如Buddy/Linear块里接近块一半大小又要求大对齐的请求
+        if (!b->Allocate(_requirements.size, alignment, &allocation.offset)) {
+            FreeDeviceMemory(allocation.memoryTypeIndex, memory, blockSize, mapped != nullptr);
+            throw std::runtime_error("allocation does not fit in a new memory block!");
+        }
+        block = b.get();
+        blocks.push_back(std::move(b));
+    }
+
+    block->allocationCount++;
+    block->usedBytes += allocation.size;
+    stats.allocationCount++;
+    stats.usedBytes += allocation.size;
+
+    allocation.memory = block->memory;
+    allocation.block = block;
+    if (block->mapped != nullptr) {
+        allocation.mapped = static_cast<char *>(block->mapped) + allocation.offset;
+    }
+    return allocation;
+}
+
+MemoryAllocation DeviceMemoryAllocator::AllocateForBuffer(VkBuffer _buffer, VkMemoryPropertyFlags _required,
+        VkMemoryPropertyFlags _preferred, MemoryPoolType _pool)
+{
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device_, _buffer, &requirements);
+
+    MemoryAllocation allocation = Allocate(requirements, _required, _preferred, _pool, false);
+    if (vkBindBufferMemory(device_, _buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        Free(allocation);
+        throw std::runtime_error("failed to bind buffer memory!");
+    }
+    return allocation;
+}
+
+MemoryAllocation DeviceMemoryAllocator::AllocateForImage(VkImage _image, VkImageTiling _tiling,
+        VkMemoryPropertyFlags _required, VkMemoryPropertyFlags _preferred, MemoryPoolType _pool)
+{
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device_, _image, &requirements);
+
+    MemoryAllocation allocation = Allocate(requirements, _required, _preferred, _pool,
+            _tiling == VK_IMAGE_TILING_OPTIMAL);
+    if (vkBindImageMemory(device_, _image, allocation.memory, allocation.offset) != VK_SUCCESS) {
+        Free(allocation);
+        throw std::runtime_error("failed to bind image memory!");
+    }
+    return allocation;
+}
+
+void DeviceMemoryAllocator::Free(const MemoryAllocation & _allocation)
+{
+    if (_allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    MemoryHeapStats & stats = heapStats_[memoryProperties_.memoryTypes[_allocation.memoryTypeIndex].heapIndex];
+
+    if (_allocation.block == nullptr) {
+        stats.allocationCount--;
+        stats.usedBytes -= _allocation.size;
+        FreeDeviceMemory(_allocation.memoryTypeIndex, _allocation.memory, _allocation.size,
+                _allocation.mapped != nullptr);
+        return;
+    }
+
+    for (auto & pool : pools_) {
+        auto & blocks = pool.second;
+        for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+            MemoryBlock * block = it->get();
+            if (block != _allocation.block) {
+                continue;
+            }
+            //Linear池等ResetLinearPools统一回收，统计也在那时一起减掉
+            if (pool.first.pool == MemoryPoolType::Linear) {
+                return;
+            }
+            block->Free(_allocation.offset, _allocation.size);
+            block->allocationCount--;
+            block->usedBytes -= _allocation.size;
+            stats.allocationCount--;
+            stats.usedBytes -= _allocation.size;
+
+            //每个池至少留一块，避免分配释放反复调用vkAllocateMemory
+            if (block->allocationCount == 0 && blocks.size() > 1) {
+                FreeDeviceMemory(pool.first.memoryTypeIndex, block->memory, block->size, block->mapped != nullptr);
+                blocks.erase(it);
+            }
+            return;
+        }
+    }
+    logerror("free memory allocation from unknown block");
+}
+
+void DeviceMemoryAllocator::ResetLinearPools()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto & pool : pools_) {
+        if (pool.first.pool != MemoryPoolType::Linear) {
+            continue;
+        }
+        MemoryHeapStats & stats = heapStats_[memoryProperties_.memoryTypes[pool.first.memoryTypeIndex].heapIndex];
+        for (auto & block : pool.second) {
+            stats.allocationCount -= block->allocationCount;
+            stats.usedBytes -= block->usedBytes;
+            block->allocationCount = 0;
+            block->usedBytes = 0;
+            block->Reset();
+        }
+    }
+}
+
+VkMappedMemoryRange DeviceMemoryAllocator::GetMappedRange(const MemoryAllocation & _allocation) const
+{
+    VkDeviceSize memorySize = _allocation.block != nullptr ? _allocation.block->size : _allocation.size;
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = _allocation.memory;
+    range.offset = _allocation.offset / nonCoherentAtomSize_ * nonCoherentAtomSize_;
+    range.size = AlignUp(_allocation.offset + _allocation.size, nonCoherentAtomSize_) - range.offset;
+    if (range.offset + range.size > memorySize) {
+        range.size = VK_WHOLE_SIZE;
+    }
+    return range;
+}
+
+void DeviceMemoryAllocator::Flush(const MemoryAllocation & _allocation)
+{
+    if (memoryProperties_.memoryTypes[_allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return;
+    }
+    VkMappedMemoryRange range = GetMappedRange(_allocation);
+    vkFlushMappedMemoryRanges(device_, 1, &range);
+}
+
+void DeviceMemoryAllocator::Invalidate(const MemoryAllocation & _allocation)
+{
+    if (memoryProperties_.memoryTypes[_allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return;
+    }
+    VkMappedMemoryRange range = GetMappedRange(_allocation);
+    vkInvalidateMappedMemoryRanges(device_, 1, &range);
+}
+
+std::vector<MemoryHeapStats> DeviceMemoryAllocator::GetHeapStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return heapStats_;
+}
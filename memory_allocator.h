@@ -0,0 +1,96 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/*
+ * 设备内存子分配
+ * 每个memory type按块(默认64M)调用一次vkAllocateMemory，资源从块里切，避免碰到maxMemoryAllocationCount
+ *   Linear   只能整体Reset，适合每帧临时数据
+ *   Buddy    2的幂大小，分配释放都很快，有内部碎片
+ *   FreeList 按大小最合适的空闲段分配，释放时合并相邻空闲段，适合长期存在的资源
+ * 比块的一半还大的请求直接单独vkAllocateMemory
+ */
+enum class MemoryPoolType {
+    Linear,
+    Buddy,
+    FreeList,
+};
+
+class MemoryBlock;
+
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // HOST_VISIBLE的内存整块持久映射，这里已经加上了offset
+    void * mapped = nullptr;
+    uint32_t memoryTypeIndex = 0;
+    // nullptr表示单独分配
+    MemoryBlock * block = nullptr;
+};
+
+struct MemoryHeapStats {
+    VkDeviceSize heapSize = 0;
+    // vkAllocateMemory的次数和总大小
+    uint32_t blockCount = 0;
+    VkDeviceSize blockBytes = 0;
+    // 分配给资源的个数和大小
+    uint32_t allocationCount = 0;
+    VkDeviceSize usedBytes = 0;
+};
+
+class DeviceMemoryAllocator {
+public:
+    DeviceMemoryAllocator(VkDevice _device, VkPhysicalDevice _physicalDevice,
+            VkDeviceSize _blockSize = 64 * 1024 * 1024);
+    ~DeviceMemoryAllocator();
+    DeviceMemoryAllocator(const DeviceMemoryAllocator &) = delete;
+    DeviceMemoryAllocator & operator=(const DeviceMemoryAllocator &) = delete;
+
+    // _optimalImage: OPTIMAL tiling的image和buffer/linear image分开放，不用处理bufferImageGranularity
+    MemoryAllocation Allocate(const VkMemoryRequirements & _requirements, VkMemoryPropertyFlags _required,
+            VkMemoryPropertyFlags _preferred = 0, MemoryPoolType _pool = MemoryPoolType::FreeList,
+            bool _optimalImage = false);
+    // 分配并bind
+    MemoryAllocation AllocateForBuffer(VkBuffer _buffer, VkMemoryPropertyFlags _required,
+            VkMemoryPropertyFlags _preferred = 0, MemoryPoolType _pool = MemoryPoolType::FreeList);
+    MemoryAllocation AllocateForImage(VkImage _image, VkImageTiling _tiling, VkMemoryPropertyFlags _required,
+            VkMemoryPropertyFlags _preferred = 0, MemoryPoolType _pool = MemoryPoolType::FreeList);
+    // Linear池里的分配Free时什么都不做，内存和统计都只在ResetLinearPools时回收
+    void Free(const MemoryAllocation & _allocation);
+    // 调用前要保证GPU已经不再使用Linear池里的内存
+    void ResetLinearPools();
+
+    // 非HOST_COHERENT的内存写完以后要flush，读之前要invalidate
+    void Flush(const MemoryAllocation & _allocation);
+    void Invalidate(const MemoryAllocation & _allocation);
+
+    std::vector<MemoryHeapStats> GetHeapStats();
+    const VkPhysicalDeviceMemoryProperties & GetMemoryProperties() const { return memoryProperties_; }
+    VkDevice GetDevice() const { return device_; }
+
+private:
+    VkDeviceMemory AllocateDeviceMemory(uint32_t _memoryTypeIndex, VkDeviceSize _size, void ** _mapped);
+    void FreeDeviceMemory(uint32_t _memoryTypeIndex, VkDeviceMemory _memory, VkDeviceSize _size, bool _mapped);
+    VkMappedMemoryRange GetMappedRange(const MemoryAllocation & _allocation) const;
+
+    struct PoolKey {
+        uint32_t memoryTypeIndex;
+        MemoryPoolType pool;
+        bool optimalImage;
+        bool operator<(const PoolKey & _other) const;
+    };
+
+    VkDevice device_;
+    VkPhysicalDeviceMemoryProperties memoryProperties_;
+    VkDeviceSize blockSize_;
+    VkDeviceSize nonCoherentAtomSize_;
+    uint32_t maxAllocationCount_;
+    uint32_t deviceAllocationCount_;
+    std::mutex mutex_;
+    std::map<PoolKey, std::vector<std::unique_ptr<MemoryBlock>>> pools_;
+    std::vector<MemoryHeapStats> heapStats_;
+};
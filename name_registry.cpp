@@ -0,0 +1,140 @@
+#include "name_registry.h"
+#include "helper.h"
+#include "device_capabilities.h"
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+
+const std::unordered_map<uint32_t, int> & KnownNameTable()
+{
+    static const std::unordered_map<uint32_t, int> table = [] {
+        std::unordered_map<uint32_t, int> t;
+        for (size_t i = 0; i < kKnownNameCount; i++) {
+            t[HashName(kKnownNames[i])] = static_cast<int>(i);
+        }
+        return t;
+    }();
+    return table;
+}
+
+void AddSupportedName(NameSupport & _support, const char * _name)
+{
+    int index = LookupKnownName(_name);
+    if (index >= 0) {
+        _support.mask.set(index);
+    }
+    else {
+        _support.others.insert(_name);
+    }
+}
+
+}
+
+int LookupKnownName(const char * _name)
+{
+    const auto & table = KnownNameTable();
+    auto it = table.find(HashName(_name));
+    //hash只是为了快，命中以后还要比一次字符串
+    if (it == table.end() || strcmp(kKnownNames[it->second], _name) != 0) {
+        return -1;
+    }
+    return it->second;
+}
+
+NameSupport MakeNameSupport(const std::vector<VkLayerProperties> & _layers)
+{
+    NameSupport support;
+    for (const auto & layer : _layers) {
+        AddSupportedName(support, layer.layerName);
+    }
+    return support;
+}
+
+NameSupport MakeNameSupport(const std::vector<VkExtensionProperties> & _extensions)
+{
+    NameSupport support;
+    for (const auto & ext : _extensions) {
+        AddSupportedName(support, ext.extensionName);
+    }
+    return support;
+}
+
+NameRequirement MakeNameRequirement(const std::vector<const char*> & _names)
+{
+    NameRequirement required;
+    for (const char * name : _names) {
+        int index = LookupKnownName(name);
+        if (index >= 0) {
+            required.mask.set(index);
+        }
+        else {
+            required.others.push_back(name);
+        }
+    }
+    return required;
+}
+
+bool CheckNameSupport(const NameSupport & _support, const NameRequirement & _required)
+{
+    if ((_required.mask & ~_support.mask).any()) {
+        return false;
+    }
+    for (const char * name : _required.others) {
+        if (_support.others.find(name) == _support.others.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<const char*> GetMissingNames(const NameSupport & _support, const NameRequirement & _required)
+{
+    std::vector<const char*> missing;
+    NameMask missingMask = _required.mask & ~_support.mask;
+    for (size_t i = 0; missingMask.any() && i < kKnownNameCount; i++) {
+        if (missingMask.test(i)) {
+            missing.push_back(kKnownNames[i]);
+            missingMask.reset(i);
+        }
+    }
+    for (const char * name : _required.others) {
+        if (_support.others.find(name) == _support.others.end()) {
+            missing.push_back(name);
+        }
+    }
+    return missing;
+}
+
+const NameSupport & GetInstanceLayerSupport()
+{
+    static const NameSupport support = MakeNameSupport(*GetInstanceLayerProperties());
+    return support;
+}
+
+const NameSupport & GetInstanceExtensionSupport()
+{
+    static const NameSupport support = MakeNameSupport(*GetInstanceExtensionProperties());
+    return support;
+}
+
+const NameSupport & GetDeviceExtensionSupport(VkPhysicalDevice _physicalDevice)
+{
+    return GetDeviceCapabilities(_physicalDevice).extensionSupport;
+}
+
+std::vector<const char*> GetMissingInstanceLayers(const std::vector<const char*> & _enableLayers)
+{
+    return GetMissingNames(GetInstanceLayerSupport(), MakeNameRequirement(_enableLayers));
+}
+
+std::vector<const char*> GetMissingInstanceExtensions(const std::vector<const char*> & _enableExtensions)
+{
+    return GetMissingNames(GetInstanceExtensionSupport(), MakeNameRequirement(_enableExtensions));
+}
+
+std::vector<const char*> GetMissingDeviceExtensions(VkPhysicalDevice _physicalDevice,
+        const std::vector<const char*> & _enableExtensions)
+{
+    return GetMissingNames(GetDeviceExtensionSupport(_physicalDevice), MakeNameRequirement(_enableExtensions));
+}
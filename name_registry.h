@@ -0,0 +1,149 @@
+#pragma once
+#include <bitset>
+#include <vector>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <vulkan/vulkan.h>
+
+/*
+ * 常用layer和extension名字的注册表
+ * 名字在编译期hash，每个名字对应NameMask里的一位；支持情况在instance/device上只算一次，
+ * 之后检查需求就是一次mask与运算
+ * 新名字直接加到kKnownNames末尾即可，不在表里的名字会退回到字符串set查找
+ */
+static constexpr const char * kKnownNames[] = {
+    //layer
+    "VK_LAYER_LUNARG_standard_validation",
+    "VK_LAYER_KHRONOS_validation",
+    "VK_LAYER_LUNARG_api_dump",
+    "VK_LAYER_RENDERDOC_Capture",
+    "MoltenVK",
+    //instance extension
+    "VK_KHR_surface",
+    "VK_KHR_win32_surface",
+    "VK_KHR_xcb_surface",
+    "VK_KHR_xlib_surface",
+    "VK_KHR_wayland_surface",
+    "VK_KHR_android_surface",
+    "VK_MVK_macos_surface",
+    "VK_MVK_ios_surface",
+    "VK_EXT_metal_surface",
+    "VK_EXT_debug_report",
+    "VK_EXT_debug_utils",
+    "VK_KHR_get_physical_device_properties2",
+    "VK_KHR_portability_enumeration",
+    //device extension
+    "VK_KHR_swapchain",
+    "VK_KHR_maintenance1",
+    "VK_KHR_maintenance2",
+    "VK_KHR_maintenance3",
+    "VK_KHR_dedicated_allocation",
+    "VK_KHR_get_memory_requirements2",
+    "VK_KHR_bind_memory2",
+    "VK_KHR_sampler_ycbcr_conversion",
+    "VK_KHR_push_descriptor",
+    "VK_KHR_shader_draw_parameters",
+    "VK_KHR_16bit_storage",
+    "VK_KHR_8bit_storage",
+    "VK_KHR_timeline_semaphore",
+    "VK_KHR_portability_subset",
+    "VK_EXT_descriptor_indexing",
+    "VK_EXT_memory_budget",
+    "VK_EXT_calibrated_timestamps",
+    "VK_EXT_sampler_filter_minmax",
+};
+
+static constexpr size_t kKnownNameCount = sizeof(kKnownNames) / sizeof(kKnownNames[0]);
+
+typedef std::bitset<kKnownNameCount> NameMask;
+
+// FNV-1a
+constexpr uint32_t HashName(const char * _name)
+{
+    uint32_t hash = 2166136261u;
+    while (*_name != '\0') {
+        hash ^= static_cast<uint8_t>(*_name++);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr bool NameEquals(const char * _a, const char * _b)
+{
+    while (*_a != '\0' && *_a == *_b) {
+        _a++;
+        _b++;
+    }
+    return *_a == *_b;
+}
+
+// 返回名字在kKnownNames里的下标，不在表里返回-1
+constexpr int KnownNameIndex(const char * _name)
+{
+    for (size_t i = 0; i < kKnownNameCount; i++) {
+        if (NameEquals(kKnownNames[i], _name)) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+constexpr bool KnownNameHashesUnique()
+{
+    for (size_t i = 0; i < kKnownNameCount; i++) {
+        for (size_t j = i + 1; j < kKnownNameCount; j++) {
+            if (HashName(kKnownNames[i]) == HashName(kKnownNames[j])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+static_assert(KnownNameHashesUnique(), "kKnownNames hash collision");
+
+constexpr size_t RequireKnownName(int _index)
+{
+    return _index >= 0 ? static_cast<size_t>(_index) : throw "not a known layer/extension name";
+}
+
+// 编译期取下标，名字拼错或者没注册直接编译失败
+#define KNOWN_NAME_INDEX(name) (std::integral_constant<size_t, RequireKnownName(KnownNameIndex(name))>::value)
+
+// 运行期查表，O(1)
+int LookupKnownName(const char * _name);
+
+/*
+ * instance或者device支持的名字，注册过的进mask，其它的进others
+ */
+struct NameSupport {
+    NameMask mask;
+    std::unordered_set<std::string> others;
+};
+
+/*
+ * 一组需求，提前构造一次后可以反复检查
+ */
+struct NameRequirement {
+    NameMask mask;
+    std::vector<const char*> others;
+};
+
+NameSupport MakeNameSupport(const std::vector<VkLayerProperties> & _layers);
+NameSupport MakeNameSupport(const std::vector<VkExtensionProperties> & _extensions);
+NameRequirement MakeNameRequirement(const std::vector<const char*> & _names);
+
+bool CheckNameSupport(const NameSupport & _support, const NameRequirement & _required);
+// 一次返回所有不支持的名字，全部支持返回空
+std::vector<const char*> GetMissingNames(const NameSupport & _support, const NameRequirement & _required);
+
+// instance的layer和extension由loader决定，进程里只枚举一次
+const NameSupport & GetInstanceLayerSupport();
+const NameSupport & GetInstanceExtensionSupport();
+// device的extension在DeviceCapabilities快照里
+const NameSupport & GetDeviceExtensionSupport(VkPhysicalDevice _physicalDevice);
+
+std::vector<const char*> GetMissingInstanceLayers(const std::vector<const char*> & _enableLayers);
+std::vector<const char*> GetMissingInstanceExtensions(const std::vector<const char*> & _enableExtensions);
+std::vector<const char*> GetMissingDeviceExtensions(VkPhysicalDevice _physicalDevice,
+        const std::vector<const char*> & _enableExtensions);
@@ -0,0 +1,325 @@
+#include "object_cache.h"
+#include "device_capabilities.h"
+#include "hash.h"
+#include <mutex>
+#include <vector>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <logger.h>
+
+namespace {
+
+// pNext链上所有结构共有的头，1.0的头文件里没有VkBaseInStructure
+struct ChainHeader {
+    VkStructureType sType;
+    const void * pNext;
+};
+
+// create info逐字段写成uint32序列，避开结构体里的padding和指针
+class KeyWriter {
+public:
+    void Push(uint32_t _value) { words_.push_back(_value); }
+    void PushFloat(float _value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &_value, sizeof(bits));
+        Push(bits);
+    }
+    // non-dispatchable handle在32位平台上是uint64_t，64位上是指针
+    template<typename T>
+    void PushHandle(T _handle)
+    {
+        uint64_t value = 0;
+        memcpy(&value, &_handle, sizeof(_handle));
+        Push(static_cast<uint32_t>(value));
+        Push(static_cast<uint32_t>(value >> 32));
+    }
+    const std::vector<uint32_t> & GetWords() const { return words_; }
+
+private:
+    std::vector<uint32_t> words_;
+};
+
+// 返回false表示有不认识的pNext结构
+bool WriteSamplerChain(KeyWriter & _writer, const void * _next)
+{
+    for (; _next != nullptr; _next = static_cast<const ChainHeader *>(_next)->pNext) {
+        VkStructureType type = static_cast<const ChainHeader *>(_next)->sType;
+        _writer.Push(static_cast<uint32_t>(type));
+        switch (type) {
+#ifdef VK_VERSION_1_1
+        case VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO:
+            _writer.PushHandle(static_cast<const VkSamplerYcbcrConversionInfo *>(_next)->conversion);
+            break;
+#endif
+#ifdef VK_VERSION_1_2
+        case VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO:
+            _writer.Push(static_cast<uint32_t>(
+                    static_cast<const VkSamplerReductionModeCreateInfo *>(_next)->reductionMode));
+            break;
+#endif
+#ifdef VK_EXT_custom_border_color
+        case VK_STRUCTURE_TYPE_SAMPLER_CUSTOM_BORDER_COLOR_CREATE_INFO_EXT: {
+            const auto * info = static_cast<const VkSamplerCustomBorderColorCreateInfoEXT *>(_next);
+            for (uint32_t value : info->customBorderColor.uint32) {
+                _writer.Push(value);
+            }
+            _writer.Push(static_cast<uint32_t>(info->format));
+            break;
+        }
+#endif
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WriteImageViewChain(KeyWriter & _writer, const void * _next)
+{
+    for (; _next != nullptr; _next = static_cast<const ChainHeader *>(_next)->pNext) {
+        VkStructureType type = static_cast<const ChainHeader *>(_next)->sType;
+        _writer.Push(static_cast<uint32_t>(type));
+        switch (type) {
+#ifdef VK_VERSION_1_1
+        case VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO:
+            _writer.Push(static_cast<const VkImageViewUsageCreateInfo *>(_next)->usage);
+            break;
+        case VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_INFO:
+            _writer.PushHandle(static_cast<const VkSamplerYcbcrConversionInfo *>(_next)->conversion);
+            break;
+#endif
+#ifdef VK_EXT_astc_decode_mode
+        case VK_STRUCTURE_TYPE_IMAGE_VIEW_ASTC_DECODE_MODE_EXT:
+            _writer.Push(static_cast<uint32_t>(static_cast<const VkImageViewASTCDecodeModeEXT *>(_next)->decodeMode));
+            break;
+#endif
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WriteSamplerKey(KeyWriter & _writer, const VkSamplerCreateInfo & _info)
+{
+    _writer.Push(_info.flags);
+    _writer.Push(static_cast<uint32_t>(_info.magFilter));
+    _writer.Push(static_cast<uint32_t>(_info.minFilter));
+    _writer.Push(static_cast<uint32_t>(_info.mipmapMode));
+    _writer.Push(static_cast<uint32_t>(_info.addressModeU));
+    _writer.Push(static_cast<uint32_t>(_info.addressModeV));
+    _writer.Push(static_cast<uint32_t>(_info.addressModeW));
+    _writer.PushFloat(_info.mipLodBias);
+    _writer.Push(_info.anisotropyEnable);
+    // 没开的功能对应的参数不影响结果，归一化以后能多合并一些
+    _writer.PushFloat(_info.anisotropyEnable ? _info.maxAnisotropy : 0.0f);
+    _writer.Push(_info.compareEnable);
+    _writer.Push(_info.compareEnable ? static_cast<uint32_t>(_info.compareOp) : 0);
+    _writer.PushFloat(_info.minLod);
+    _writer.PushFloat(_info.maxLod);
+    _writer.Push(static_cast<uint32_t>(_info.borderColor));
+    _writer.Push(_info.unnormalizedCoordinates);
+    return WriteSamplerChain(_writer, _info.pNext);
+}
+
+bool WriteImageViewKey(KeyWriter & _writer, const VkImageViewCreateInfo & _info)
+{
+    _writer.Push(_info.flags);
+    _writer.PushHandle(_info.image);
+    _writer.Push(static_cast<uint32_t>(_info.viewType));
+    _writer.Push(static_cast<uint32_t>(_info.format));
+    _writer.Push(static_cast<uint32_t>(_info.components.r));
+    _writer.Push(static_cast<uint32_t>(_info.components.g));
+    _writer.Push(static_cast<uint32_t>(_info.components.b));
+    _writer.Push(static_cast<uint32_t>(_info.components.a));
+    _writer.Push(_info.subresourceRange.aspectMask);
+    _writer.Push(_info.subresourceRange.baseMipLevel);
+    _writer.Push(_info.subresourceRange.levelCount);
+    _writer.Push(_info.subresourceRange.baseArrayLayer);
+    _writer.Push(_info.subresourceRange.layerCount);
+    return WriteImageViewChain(_writer, _info.pNext);
+}
+
+/*
+ * 和ShaderModuleCache一样的weak_ptr去重，句柄的deleter持有这个状态的shared_ptr
+ * sampler和view创建都很快，直接在锁里创建，上限检查是准确的
+ */
+template<typename Ref>
+class HandleCache : public std::enable_shared_from_this<HandleCache<Ref>> {
+public:
+    using Shared = std::shared_ptr<const Ref>;
+    using Destroy = void (*)(const Ref *);
+
+    HandleCache(Destroy _destroy, size_t _maxLive) :
+        destroy_(_destroy),
+        maxLive_(_maxLive),
+        hits_(0),
+        misses_(0),
+        uncached_(0),
+        live_(0)
+    {
+    }
+
+    // _create返回的Ref里hash由这里填
+    Shared Get(const std::vector<uint32_t> & _key, bool _cacheable, const std::function<Ref()> & _create)
+    {
+        const uint64_t hash = HashBytes(_key.data(), _key.size() * sizeof(uint32_t));
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (_cacheable) {
+            auto range = entries_.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second.key == _key) {
+                    Shared shared = it->second.weak.lock();
+                    if (shared) {
+                        hits_++;
+                        return shared;
+                    }
+                }
+            }
+        }
+        if (live_ >= maxLive_) {
+            logerror("object cache limit reached, live:{} max:{}", live_, maxLive_);
+            throw std::runtime_error("too many live objects in cache!");
+        }
+
+        Ref * ref = new Ref(_create());
+        ref->hash = hash;
+        live_++;
+        auto self = this->shared_from_this();
+        Shared shared(ref, [self, _cacheable](const Ref * _ref) {
+            self->Release(_ref, _cacheable);
+        });
+        if (!_cacheable) {
+            uncached_++;
+            return shared;
+        }
+        misses_++;
+        Entry entry;
+        entry.key = _key;
+        entry.ref = ref;
+        entry.weak = shared;
+        entries_.emplace(hash, std::move(entry));
+        return shared;
+    }
+
+    ObjectCacheStats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ObjectCacheStats{ hits_, misses_, uncached_, live_ };
+    }
+
+private:
+    void Release(const Ref * _ref, bool _cacheable)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (_cacheable) {
+                auto range = entries_.equal_range(_ref->hash);
+                for (auto it = range.first; it != range.second; ++it) {
+                    if (it->second.ref == _ref) {
+                        entries_.erase(it);
+                        break;
+                    }
+                }
+            }
+            live_--;
+        }
+        destroy_(_ref);
+        delete _ref;
+    }
+
+    struct Entry {
+        std::vector<uint32_t> key;
+        const Ref * ref;
+        std::weak_ptr<const Ref> weak;
+    };
+
+    Destroy destroy_;
+    size_t maxLive_;
+    std::mutex mutex_;
+    std::unordered_multimap<uint64_t, Entry> entries_;
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t uncached_;
+    size_t live_;
+};
+
+}
+
+struct SamplerCache::State : public HandleCache<SamplerRef> {
+    State(VkDevice _device, size_t _maxLive) :
+        HandleCache<SamplerRef>([](const SamplerRef * _ref) {
+            vkDestroySampler(_ref->device, _ref->sampler, nullptr);
+        }, _maxLive),
+        device(_device)
+    {
+    }
+    VkDevice device;
+};
+
+SamplerCache::SamplerCache(VkDevice _device, VkPhysicalDevice _physicalDevice) :
+    state_(std::make_shared<State>(_device,
+            GetDeviceCapabilities(_physicalDevice).properties.limits.maxSamplerAllocationCount))
+{
+}
+
+SamplerCache::~SamplerCache() = default;
+
+SharedSampler SamplerCache::Get(const VkSamplerCreateInfo & _createInfo)
+{
+    KeyWriter writer;
+    bool cacheable = WriteSamplerKey(writer, _createInfo);
+    VkDevice device = state_->device;
+    return state_->Get(writer.GetWords(), cacheable, [device, &_createInfo]() {
+        VkSampler sampler;
+        if (vkCreateSampler(device, &_createInfo, nullptr, &sampler) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create sampler!");
+        }
+        return SamplerRef{ device, sampler, 0 };
+    });
+}
+
+ObjectCacheStats SamplerCache::GetStats() const
+{
+    return state_->GetStats();
+}
+
+struct ImageViewCache::State : public HandleCache<ImageViewRef> {
+    explicit State(VkDevice _device) :
+        HandleCache<ImageViewRef>([](const ImageViewRef * _ref) {
+            vkDestroyImageView(_ref->device, _ref->view, nullptr);
+        }, SIZE_MAX),
+        device(_device)
+    {
+    }
+    VkDevice device;
+};
+
+ImageViewCache::ImageViewCache(VkDevice _device) :
+    state_(std::make_shared<State>(_device))
+{
+}
+
+ImageViewCache::~ImageViewCache() = default;
+
+SharedImageView ImageViewCache::Get(const VkImageViewCreateInfo & _createInfo)
+{
+    KeyWriter writer;
+    bool cacheable = WriteImageViewKey(writer, _createInfo);
+    VkDevice device = state_->device;
+    return state_->Get(writer.GetWords(), cacheable, [device, &_createInfo]() {
+        VkImageView view;
+        if (vkCreateImageView(device, &_createInfo, nullptr, &view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create image view!");
+        }
+        return ImageViewRef{ device, view, 0 };
+    });
+}
+
+ObjectCacheStats ImageViewCache::GetStats() const
+{
+    return state_->GetStats();
+}
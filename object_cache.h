@@ -0,0 +1,66 @@
+#pragma once
+#include <memory>
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+/*
+ * VkSampler和VkImageView的去重缓存，每个device一个
+ * key是create info逐字段序列化的结果(不含指针，含认识的pNext结构)，hash相同时还要逐字比较
+ * 返回共享句柄，最后一个引用释放时销毁对象，缓存里只保存weak_ptr
+ * pNext里有不认识的结构时不缓存，单独创建一个，统计在uncached里
+ * 缓存对象可以先于句柄析构，句柄持有内部状态
+ * 线程安全
+ */
+struct SamplerRef {
+    VkDevice device;
+    VkSampler sampler;
+    uint64_t hash;
+};
+using SharedSampler = std::shared_ptr<const SamplerRef>;
+
+struct ImageViewRef {
+    VkDevice device;
+    VkImageView view;
+    uint64_t hash;
+};
+using SharedImageView = std::shared_ptr<const ImageViewRef>;
+
+struct ObjectCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t uncached;
+    // 当前存活的对象数，包括uncached的
+    size_t liveObjects;
+};
+
+class SamplerCache {
+public:
+    // 存活的sampler数不能超过maxSamplerAllocationCount，超过时Get抛异常
+    SamplerCache(VkDevice _device, VkPhysicalDevice _physicalDevice);
+    ~SamplerCache();
+    SamplerCache(const SamplerCache &) = delete;
+    SamplerCache & operator=(const SamplerCache &) = delete;
+
+    SharedSampler Get(const VkSamplerCreateInfo & _createInfo);
+    ObjectCacheStats GetStats() const;
+
+private:
+    struct State;
+    std::shared_ptr<State> state_;
+};
+
+class ImageViewCache {
+public:
+    explicit ImageViewCache(VkDevice _device);
+    ~ImageViewCache();
+    ImageViewCache(const ImageViewCache &) = delete;
+    ImageViewCache & operator=(const ImageViewCache &) = delete;
+
+    // image销毁之前要先释放它的所有view句柄
+    SharedImageView Get(const VkImageViewCreateInfo & _createInfo);
+    ObjectCacheStats GetStats() const;
+
+private:
+    struct State;
+    std::shared_ptr<State> state_;
+};
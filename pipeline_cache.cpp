@@ -0,0 +1,181 @@
+#include "pipeline_cache.h"
+#include "device_capabilities.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <logger.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+// VK_PIPELINE_CACHE_HEADER_VERSION_ONE的header布局
+struct PipelineCacheHeader {
+    uint32_t headerSize;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+std::vector<char> ReadWholeFile(const char * _path)
+{
+    std::vector<char> data;
+    FILE * file = fopen(_path, "rb");
+    if (file == nullptr) {
+        return data;
+    }
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long size = ftell(file);
+        if (size > 0 && fseek(file, 0, SEEK_SET) == 0) {
+            data.resize(static_cast<size_t>(size));
+            if (fread(data.data(), 1, data.size(), file) != data.size()) {
+                data.clear();
+            }
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+bool ReplaceFile(const char * _from, const char * _to)
+{
+#ifdef _WIN32
+    return MoveFileExA(_from, _to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(_from, _to) == 0;
+#endif
+}
+
+}
+
+bool IsPipelineCacheCompatible(const void * _data, size_t _size, const VkPhysicalDeviceProperties & _properties)
+{
+    if (_data == nullptr || _size < sizeof(PipelineCacheHeader)) {
+        return false;
+    }
+    PipelineCacheHeader header;
+    memcpy(&header, _data, sizeof(header));
+    return header.headerSize >= sizeof(PipelineCacheHeader)
+        && header.headerSize <= _size
+        && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.vendorID == _properties.vendorID
+        && header.deviceID == _properties.deviceID
+        && memcmp(header.pipelineCacheUUID, _properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+PipelineCacheManager::PipelineCacheManager(VkDevice _device, VkPhysicalDevice _physicalDevice, const char * _path) :
+    device_(_device),
+    physicalDevice_(_physicalDevice),
+    path_(_path),
+    mainCache_(VK_NULL_HANDLE)
+{
+    std::vector<char> data = ReadWholeFile(_path);
+    if (!data.empty() && !IsPipelineCacheCompatible(data.data(), data.size(),
+                GetDeviceCapabilities(_physicalDevice).properties)) {
+        loginfo("pipeline cache {} is from another device or driver, ignore it", _path);
+        data.clear();
+    }
+
+    VkPipelineCacheCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData = data.empty() ? nullptr : data.data();
+    VkResult result = vkCreatePipelineCache(device_, &createInfo, nullptr, &mainCache_);
+    if (result != VK_SUCCESS && !data.empty()) {
+        // 驱动自己也可能拒绝数据，退回空cache
+        logwarn("create pipeline cache from {} fail:{}, start with empty cache", _path, static_cast<int>(result));
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = nullptr;
+        result = vkCreatePipelineCache(device_, &createInfo, nullptr, &mainCache_);
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+    if (!data.empty()) {
+        loginfo("loaded pipeline cache {} ({} bytes)", _path, data.size());
+    }
+}
+
+PipelineCacheManager::~PipelineCacheManager()
+{
+    Save();
+    for (auto & it : threadCaches_) {
+        vkDestroyPipelineCache(device_, it.second, nullptr);
+    }
+    vkDestroyPipelineCache(device_, mainCache_, nullptr);
+}
+
+VkPipelineCache PipelineCacheManager::GetThreadCache()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto & cache = threadCaches_[std::this_thread::get_id()];
+    if (cache == VK_NULL_HANDLE) {
+        VkPipelineCacheCreateInfo createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        if (vkCreatePipelineCache(device_, &createInfo, nullptr, &cache) != VK_SUCCESS) {
+            threadCaches_.erase(std::this_thread::get_id());
+            throw std::runtime_error("failed to create thread pipeline cache!");
+        }
+    }
+    return cache;
+}
+
+VkPipelineCache PipelineCacheManager::Merge()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!threadCaches_.empty()) {
+        std::vector<VkPipelineCache> caches;
+        caches.reserve(threadCaches_.size());
+        for (auto & it : threadCaches_) {
+            caches.push_back(it.second);
+        }
+        if (vkMergePipelineCaches(device_, mainCache_, static_cast<uint32_t>(caches.size()), caches.data())
+                != VK_SUCCESS) {
+            logerror("merge {} pipeline caches fail", caches.size());
+        }
+    }
+    return mainCache_;
+}
+
+bool PipelineCacheManager::Save()
+{
+    Merge();
+
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device_, mainCache_, &size, nullptr) != VK_SUCCESS || size == 0) {
+        return false;
+    }
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device_, mainCache_, &size, data.data()) != VK_SUCCESS) {
+        logerror("get pipeline cache data fail");
+        return false;
+    }
+    data.resize(size);
+
+    std::string tmpPath = path_ + ".tmp";
+    FILE * file = fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr) {
+        logerror("open {} for write fail", tmpPath);
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), file) == data.size() && fflush(file) == 0;
+#ifndef _WIN32
+    // rename之前落盘，否则掉电后可能得到一个空文件
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || !ReplaceFile(tmpPath.c_str(), path_.c_str())) {
+        logerror("write pipeline cache to {} fail", path_);
+        remove(tmpPath.c_str());
+        return false;
+    }
+    loginfo("saved pipeline cache {} ({} bytes)", path_, data.size());
+    return true;
+}
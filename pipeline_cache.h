@@ -0,0 +1,41 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vulkan/vulkan.h>
+
+/*
+ * VkPipelineCache落盘
+ * 创建时从文件加载，header里的vendorID/deviceID/pipelineCacheUUID和当前设备不一致就丢弃旧数据
+ * 每个线程用自己的cache创建pipeline，避免驱动内部对同一个cache加锁
+ * Save时把线程的cache合并到主cache，先写临时文件再rename，中途崩溃不会留下半个文件
+ */
+class PipelineCacheManager {
+public:
+    PipelineCacheManager(VkDevice _device, VkPhysicalDevice _physicalDevice, const char * _path);
+    // 析构时会Save一次
+    ~PipelineCacheManager();
+    PipelineCacheManager(const PipelineCacheManager &) = delete;
+    PipelineCacheManager & operator=(const PipelineCacheManager &) = delete;
+
+    // 当前线程专用的cache，第一次调用时创建
+    VkPipelineCache GetThreadCache();
+    // 只合并不写文件，返回主cache
+    VkPipelineCache Merge();
+    // 合并后写回文件，调用时其它线程不能正在用自己的cache创建pipeline
+    bool Save();
+
+private:
+    VkDevice device_;
+    VkPhysicalDevice physicalDevice_;
+    std::string path_;
+    VkPipelineCache mainCache_;
+    std::mutex mutex_;
+    std::map<std::thread::id, VkPipelineCache> threadCaches_;
+};
+
+/**
+ * desc: 检查cache数据的header是不是当前设备产生的
+ **/
+bool IsPipelineCacheCompatible(const void * _data, size_t _size, const VkPhysicalDeviceProperties & _properties);
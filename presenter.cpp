@@ -0,0 +1,240 @@
+#include "presenter.h"
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <logger.h>
+
+Presenter::Presenter(VkPhysicalDevice _physicalDevice, VkDevice _device, VkSurfaceKHR _surface,
+        VkQueue _presentQueue, const PresenterConfig & _config) :
+    physicalDevice_(_physicalDevice),
+    device_(_device),
+    surface_(_surface),
+    presentQueue_(_presentQueue),
+    config_(_config),
+    swapChain_(VK_NULL_HANDLE),
+    format_(VK_FORMAT_UNDEFINED),
+    extent_({ 0, 0 }),
+    presentMode_(VK_PRESENT_MODE_FIFO_KHR),
+    frameIndex_(0),
+    lastFrameStart_(std::chrono::steady_clock::now())
+{
+    config_.framesInFlight = std::max<uint32_t>(config_.framesInFlight, 1);
+    frames_.resize(config_.framesInFlight);
+    for (auto & frame : frames_) {
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        // 第一次BeginFrame不用等
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        if (vkCreateFence(device_, &fenceInfo, nullptr, &frame.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create frame fence!");
+        }
+    }
+    CreateSwapChain(config_.desiredExtent);
+}
+
+Presenter::~Presenter()
+{
+    vkDeviceWaitIdle(device_);
+    DestroySwapChainImages();
+    if (swapChain_ != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(device_, swapChain_, nullptr);
+    }
+    for (VkSemaphore semaphore : freeSemaphores_) {
+        vkDestroySemaphore(device_, semaphore, nullptr);
+    }
+    for (auto & frame : frames_) {
+        vkDestroyFence(device_, frame.fence, nullptr);
+    }
+}
+
+VkSemaphore Presenter::GetSemaphore()
+{
+    if (!freeSemaphores_.empty()) {
+        VkSemaphore semaphore = freeSemaphores_.back();
+        freeSemaphores_.pop_back();
+        return semaphore;
+    }
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkSemaphore semaphore;
+    if (vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create semaphore!");
+    }
+    return semaphore;
+}
+
+void Presenter::DestroySwapChainImages()
+{
+    for (auto & image : images_) {
+        vkDestroyImageView(device_, image.view, nullptr);
+        if (image.acquireSemaphore != VK_NULL_HANDLE) {
+            freeSemaphores_.push_back(image.acquireSemaphore);
+        }
+        freeSemaphores_.push_back(image.renderFinished);
+    }
+    images_.clear();
+}
+
+void Presenter::CreateSwapChain(VkExtent2D _desiredExtent)
+{
+    SwapChainSupportDetails support = QuerySwapChainSupport(physicalDevice_, surface_);
+    if (support.formats.empty()) {
+        throw std::runtime_error("surface has no supported format!");
+    }
+    VkExtent2D extent = GetProperSwapChainExtent(support.capabilities, _desiredExtent);
+    if (extent.width == 0 || extent.height == 0) {
+        // 窗口最小化的时候不能创建，等下次BeginFrame再试
+        return;
+    }
+    VkImageUsageFlags usage = GetSwapSufaceImageUsageFlags(support.capabilities);
+    if (usage == static_cast<VkImageUsageFlags>(-1)) {
+        throw std::runtime_error("swap chain image usage is not supported!");
+    }
+
+    VkSurfaceFormatKHR surfaceFormat = GetProperSwapSurfaceFormat(support.formats);
+    presentMode_ = GetPresentModeForPolicy(config_.policy, support.presentModes);
+    uint32_t imageCount = GetSwapChainImageCount(config_.policy, presentMode_, support.capabilities);
+
+    VkCompositeAlphaFlagBitsKHR compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    if (!(support.capabilities.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR)) {
+        compositeAlpha = static_cast<VkCompositeAlphaFlagBitsKHR>(
+                support.capabilities.supportedCompositeAlpha & (~support.capabilities.supportedCompositeAlpha + 1));
+    }
+
+    VkSwapchainKHR oldSwapChain = swapChain_;
+    VkSwapchainCreateInfoKHR createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    createInfo.surface = surface_;
+    createInfo.minImageCount = imageCount;
+    createInfo.imageFormat = surfaceFormat.format;
+    createInfo.imageColorSpace = surfaceFormat.colorSpace;
+    createInfo.imageExtent = extent;
+    createInfo.imageArrayLayers = 1;
+    createInfo.imageUsage = usage;
+    createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    createInfo.preTransform = GetSwapChainTransform(support.capabilities);
+    createInfo.compositeAlpha = compositeAlpha;
+    createInfo.presentMode = presentMode_;
+    createInfo.clipped = VK_TRUE;
+    createInfo.oldSwapchain = oldSwapChain;
+    if (vkCreateSwapchainKHR(device_, &createInfo, nullptr, &swapChain_) != VK_SUCCESS) {
+        swapChain_ = oldSwapChain;
+        throw std::runtime_error("failed to create swap chain!");
+    }
+    DestroySwapChainImages();
+    if (oldSwapChain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(device_, oldSwapChain, nullptr);
+    }
+    format_ = surfaceFormat.format;
+    extent_ = extent;
+
+    uint32_t count = 0;
+    vkGetSwapchainImagesKHR(device_, swapChain_, &count, nullptr);
+    std::vector<VkImage> images(count);
+    vkGetSwapchainImagesKHR(device_, swapChain_, &count, images.data());
+    images_.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        SwapImage & image = images_[i];
+        image.image = images[i];
+        image.acquireSemaphore = VK_NULL_HANDLE;
+        image.inFlight = VK_NULL_HANDLE;
+        image.renderFinished = GetSemaphore();
+        VkImageViewCreateInfo viewInfo = Get2DImageViewCreateInfo(image.image, format_);
+        if (vkCreateImageView(device_, &viewInfo, nullptr, &image.view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create swap chain image view!");
+        }
+    }
+    loginfo("swap chain {}x{} images:{} present mode:{} frames in flight:{}",
+            extent_.width, extent_.height, count, static_cast<int>(presentMode_), frames_.size());
+}
+
+void Presenter::Recreate(VkExtent2D _desiredExtent)
+{
+    config_.desiredExtent = _desiredExtent;
+    // 旧的image可能还在被GPU或者present用
+    vkDeviceWaitIdle(device_);
+    CreateSwapChain(_desiredExtent);
+}
+
+void Presenter::PaceFrame()
+{
+    if (config_.minFrameInterval.count() <= 0) {
+        return;
+    }
+    auto next = lastFrameStart_ + config_.minFrameInterval;
+    if (std::chrono::steady_clock::now() < next) {
+        std::this_thread::sleep_until(next);
+    }
+    lastFrameStart_ = std::chrono::steady_clock::now();
+}
+
+bool Presenter::BeginFrame(FrameImage & _frame)
+{
+    if (swapChain_ == VK_NULL_HANDLE || images_.empty()) {
+        Recreate(config_.desiredExtent);
+        if (images_.empty()) {
+            return false;
+        }
+    }
+
+    PaceFrame();
+
+    FrameSlot & slot = frames_[frameIndex_];
+    vkWaitForFences(device_, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+
+    VkSemaphore semaphore = GetSemaphore();
+    uint32_t imageIndex = 0;
+    VkResult result = vkAcquireNextImageKHR(device_, swapChain_, UINT64_MAX, semaphore, VK_NULL_HANDLE, &imageIndex);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        freeSemaphores_.push_back(semaphore);
+        Recreate(config_.desiredExtent);
+        return false;
+    }
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+        freeSemaphores_.push_back(semaphore);
+        throw std::runtime_error("failed to acquire swap chain image!");
+    }
+
+    SwapImage & image = images_[imageIndex];
+    if (image.inFlight != VK_NULL_HANDLE && image.inFlight != slot.fence) {
+        vkWaitForFences(device_, 1, &image.inFlight, VK_TRUE, UINT64_MAX);
+    }
+    image.inFlight = slot.fence;
+    // 上一次用这张image的提交已经结束，它wait过的semaphore可以复用
+    if (image.acquireSemaphore != VK_NULL_HANDLE) {
+        freeSemaphores_.push_back(image.acquireSemaphore);
+    }
+    image.acquireSemaphore = semaphore;
+    vkResetFences(device_, 1, &slot.fence);
+
+    _frame.frameIndex = frameIndex_;
+    _frame.imageIndex = imageIndex;
+    _frame.image = image.image;
+    _frame.view = image.view;
+    _frame.imageAvailable = semaphore;
+    _frame.renderFinished = image.renderFinished;
+    _frame.fence = slot.fence;
+
+    frameIndex_ = (frameIndex_ + 1) % static_cast<uint32_t>(frames_.size());
+    return true;
+}
+
+bool Presenter::Present(const FrameImage & _frame)
+{
+    VkPresentInfoKHR presentInfo = {};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &_frame.renderFinished;
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &swapChain_;
+    presentInfo.pImageIndices = &_frame.imageIndex;
+    VkResult result = vkQueuePresentKHR(presentQueue_, &presentInfo);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        Recreate(config_.desiredExtent);
+        return false;
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to present swap chain image!");
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <chrono>
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "helper.h"
+#include "frame_target.h"
+
+/*
+ * 交换链和帧循环
+ * framesInFlight个帧槽，每个槽一个fence，CPU最多领先GPU framesInFlight帧
+ * acquire用的semaphore从池里取，acquire成功以后和image绑定，旧的还回池里
+ * renderFinished每个swapchain image一个，present等它
+ * minFrameInterval不为0时BeginFrame会睡到上一帧开始后的这个时间，避免CPU跑得比显示快而堆积延迟
+ */
+struct PresenterConfig {
+    PresentPolicy policy = PresentPolicy::SmoothVsync;
+    uint32_t framesInFlight = 2;
+    VkExtent2D desiredExtent = { 1280, 720 };
+    std::chrono::microseconds minFrameInterval = std::chrono::microseconds(0);
+};
+
+class Presenter : public FrameTarget {
+public:
+    Presenter(VkPhysicalDevice _physicalDevice, VkDevice _device, VkSurfaceKHR _surface, VkQueue _presentQueue,
+            const PresenterConfig & _config);
+    ~Presenter();
+    Presenter(const Presenter &) = delete;
+    Presenter & operator=(const Presenter &) = delete;
+
+    // 窗口大小变化或者OUT_OF_DATE时重建
+    void Recreate(VkExtent2D _desiredExtent);
+
+    // 等帧槽空闲并acquire，swapchain过期时重建并返回false，调用者跳过这一帧
+    bool BeginFrame(FrameImage & _frame) override;
+    // 返回false表示swapchain已经重建
+    bool Present(const FrameImage & _frame) override;
+
+    VkFormat GetFormat() const override { return format_; }
+    VkExtent2D GetExtent() const override { return extent_; }
+    uint32_t GetImageCount() const override { return static_cast<uint32_t>(images_.size()); }
+    uint32_t GetFramesInFlight() const override { return static_cast<uint32_t>(frames_.size()); }
+    VkPresentModeKHR GetPresentMode() const { return presentMode_; }
+
+    ImageUsage GetFinalUsage() const override { return ImageUsage::Present; }
+
+private:
+    struct FrameSlot {
+        VkFence fence;
+    };
+    struct SwapImage {
+        VkImage image;
+        VkImageView view;
+        VkSemaphore acquireSemaphore;
+        VkSemaphore renderFinished;
+        // 正在使用这张image的帧槽的fence，image比帧槽少的时候要等
+        VkFence inFlight;
+    };
+
+    void CreateSwapChain(VkExtent2D _desiredExtent);
+    void DestroySwapChainImages();
+    VkSemaphore GetSemaphore();
+    void PaceFrame();
+
+    VkPhysicalDevice physicalDevice_;
+    VkDevice device_;
+    VkSurfaceKHR surface_;
+    VkQueue presentQueue_;
+    PresenterConfig config_;
+
+    VkSwapchainKHR swapChain_;
+    VkFormat format_;
+    VkExtent2D extent_;
+    VkPresentModeKHR presentMode_;
+    std::vector<SwapImage> images_;
+    std::vector<FrameSlot> frames_;
+    std::vector<VkSemaphore> freeSemaphores_;
+    uint32_t frameIndex_;
+    std::chrono::steady_clock::time_point lastFrameStart_;
+};
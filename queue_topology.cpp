@@ -0,0 +1,218 @@
+#include "queue_topology.h"
+#include "device_capabilities.h"
+#include <stdexcept>
+#include <logger.h>
+
+namespace {
+
+/*
+ * 按族记录已经分配了几个队列，queueCount用完以后和最后一个共用
+ */
+class QueueAllocator {
+public:
+    explicit QueueAllocator(const std::vector<VkQueueFamilyProperties> & _families) :
+        families_(_families),
+        priorities_(_families.size())
+    {
+    }
+
+    QueueAssignment Allocate(uint32_t _familyIndex, float _priority)
+    {
+        const VkQueueFamilyProperties & props = families_[_familyIndex];
+        std::vector<float> & priorities = priorities_[_familyIndex];
+        QueueAssignment assignment;
+        assignment.valid = true;
+        assignment.familyIndex = _familyIndex;
+        assignment.dedicated = (props.queueFlags & VK_QUEUE_GRAPHICS_BIT) == 0;
+        assignment.minImageTransferGranularity = props.minImageTransferGranularity;
+        if (priorities.size() < props.queueCount) {
+            assignment.queueIndex = static_cast<uint32_t>(priorities.size());
+            priorities.push_back(_priority);
+        }
+        else {
+            assignment.queueIndex = static_cast<uint32_t>(priorities.size() - 1);
+        }
+        return assignment;
+    }
+
+    std::vector<QueueFamilyRequest> GetRequests() const
+    {
+        std::vector<QueueFamilyRequest> requests;
+        for (uint32_t i = 0; i < priorities_.size(); i++) {
+            if (!priorities_[i].empty()) {
+                requests.push_back({ i, priorities_[i] });
+            }
+        }
+        return requests;
+    }
+
+private:
+    const std::vector<VkQueueFamilyProperties> & families_;
+    std::vector<std::vector<float>> priorities_;
+};
+
+// 满足_required并且不含_excluded的第一个族，没有返回-1
+int FindFamily(const std::vector<VkQueueFamilyProperties> & _families, VkQueueFlags _required,
+        VkQueueFlags _excluded)
+{
+    for (size_t i = 0; i < _families.size(); i++) {
+        VkQueueFlags flags = _families[i].queueFlags;
+        if (_families[i].queueCount > 0 && (flags & _required) == _required && (flags & _excluded) == 0) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+}
+
+const char * GetQueueRoleName(QueueRole _role)
+{
+    switch (_role) {
+    case QueueRole::Graphics: return "graphics";
+    case QueueRole::Present: return "present";
+    case QueueRole::AsyncCompute: return "async compute";
+    case QueueRole::Transfer: return "transfer";
+    default: return "unknown";
+    }
+}
+
+QueuePlan PlanQueueTopology(VkPhysicalDevice _physicalDevice, VkSurfaceKHR _surface, const QueuePlanOptions & _options)
+{
+    const std::vector<VkQueueFamilyProperties> & families = GetDeviceCapabilities(_physicalDevice).queueFamilies;
+    std::vector<bool> present(families.size(), false);
+    if (_surface != VK_NULL_HANDLE) {
+        for (uint32_t i = 0; i < families.size(); i++) {
+            VkBool32 supported = VK_FALSE;
+            vkGetPhysicalDeviceSurfaceSupportKHR(_physicalDevice, i, _surface, &supported);
+            present[i] = supported == VK_TRUE;
+        }
+    }
+
+    // 图形族：能present的优先，其次带compute的
+    int graphicsFamily = -1;
+    int bestScore = -1;
+    for (size_t i = 0; i < families.size(); i++) {
+        if (families[i].queueCount == 0 || (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) == 0) {
+            continue;
+        }
+        int score = (present[i] ? 2 : 0) + ((families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) ? 1 : 0);
+        if (score > bestScore) {
+            graphicsFamily = static_cast<int>(i);
+            bestScore = score;
+        }
+    }
+    if (graphicsFamily < 0) {
+        throw std::runtime_error("no graphics queue family!");
+    }
+
+    QueuePlan plan;
+    QueueAllocator allocator(families);
+    QueueAssignment & graphics = plan.roles[static_cast<size_t>(QueueRole::Graphics)];
+    graphics = allocator.Allocate(static_cast<uint32_t>(graphicsFamily), _options.graphicsPriority);
+
+    if (_surface != VK_NULL_HANDLE) {
+        QueueAssignment & presentQueue = plan.roles[static_cast<size_t>(QueueRole::Present)];
+        if (present[graphicsFamily]) {
+            presentQueue = graphics;
+        }
+        else {
+            for (uint32_t i = 0; i < families.size(); i++) {
+                if (present[i] && families[i].queueCount > 0) {
+                    presentQueue = allocator.Allocate(i, _options.graphicsPriority);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (_options.asyncCompute) {
+        int family = FindFamily(families, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
+        if (family < 0) {
+            family = graphicsFamily;
+        }
+        plan.roles[static_cast<size_t>(QueueRole::AsyncCompute)] =
+            allocator.Allocate(static_cast<uint32_t>(family), _options.computePriority);
+    }
+
+    if (_options.transfer) {
+        // 只有TRANSFER的族 > compute族 > 图形族，compute和graphics族即使没报TRANSFER也能拷贝
+        int family = FindFamily(families, VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+        if (family < 0) {
+            family = FindFamily(families, VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
+        }
+        if (family < 0) {
+            family = graphicsFamily;
+        }
+        plan.roles[static_cast<size_t>(QueueRole::Transfer)] =
+            allocator.Allocate(static_cast<uint32_t>(family), _options.transferPriority);
+    }
+
+    // 落到同一个VkQueue上的用途都标成shared
+    const size_t count = static_cast<size_t>(QueueRole::Count);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i + 1; j < count; j++) {
+            QueueAssignment & a = plan.roles[i];
+            QueueAssignment & b = plan.roles[j];
+            if (a.valid && b.valid && a.familyIndex == b.familyIndex && a.queueIndex == b.queueIndex) {
+                a.shared = true;
+                b.shared = true;
+            }
+        }
+    }
+    plan.families = allocator.GetRequests();
+
+    for (size_t i = 0; i < count; i++) {
+        const QueueAssignment & assignment = plan.roles[i];
+        if (assignment.valid) {
+            loginfo("queue {}: family:{} index:{}{}{}", GetQueueRoleName(static_cast<QueueRole>(i)),
+                    assignment.familyIndex, assignment.queueIndex, assignment.dedicated ? " dedicated" : "",
+                    assignment.shared ? " shared" : "");
+        }
+    }
+    return plan;
+}
+
+VkDevice CreateLogicalDevice(VkPhysicalDevice _physicalDevice, const QueuePlan & _plan,
+        const std::vector<const char*> & _enableExtensions, const void * _next)
+{
+    if (!CheckPhsicalDeviceExtensionsSupport(_physicalDevice, _enableExtensions)) {
+        throw std::runtime_error("device extensions not supported!");
+    }
+    std::vector<VkDeviceQueueCreateInfo> queueInfos;
+    for (const QueueFamilyRequest & request : _plan.families) {
+        VkDeviceQueueCreateInfo queueInfo = {};
+        queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueInfo.queueFamilyIndex = request.familyIndex;
+        queueInfo.queueCount = static_cast<uint32_t>(request.priorities.size());
+        queueInfo.pQueuePriorities = request.priorities.data();
+        queueInfos.push_back(queueInfo);
+    }
+
+    VkDeviceCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = _next;
+    createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueInfos.size());
+    createInfo.pQueueCreateInfos = queueInfos.data();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(_enableExtensions.size());
+    createInfo.ppEnabledExtensionNames = _enableExtensions.data();
+
+    VkDevice device = VK_NULL_HANDLE;
+    if (vkCreateDevice(_physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create logical device!");
+    }
+    return device;
+}
+
+QueueParameters GetPlannedQueue(VkDevice _device, const QueuePlan & _plan, QueueRole _role)
+{
+    QueueParameters queue;
+    const QueueAssignment & assignment = _plan.Get(_role);
+    if (!assignment.valid) {
+        return queue;
+    }
+    vkGetDeviceQueue(_device, assignment.familyIndex, assignment.queueIndex, &queue.Handle);
+    queue.FamilyIndex = assignment.familyIndex;
+    queue.Index = assignment.queueIndex;
+    return queue;
+}
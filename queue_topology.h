@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "helper.h"
+
+/*
+ * 按队列族的能力给每种用途分配队列
+ *   Graphics      有GRAPHICS的族，有surface时优先能present的族
+ *   Present       优先和Graphics同一个队列，省掉ownership transfer
+ *   AsyncCompute  优先没有GRAPHICS的compute族，其次图形族里另一个队列
+ *   Transfer      优先只有TRANSFER的族(DMA引擎)，其次compute族、图形族里另一个队列
+ * queueCount够的时候每种用途一个独立的队列，可以在不同线程里同时提交，也能和渲染重叠
+ * 不够时和这个族最后分配的队列共用(shared)，同一个VkQueue的提交要调用者自己加锁
+ */
+enum class QueueRole {
+    Graphics,
+    Present,
+    AsyncCompute,
+    Transfer,
+    Count,
+};
+
+struct QueueAssignment {
+    bool valid = false;
+    uint32_t familyIndex = 0;
+    uint32_t queueIndex = 0;
+    // 族里没有GRAPHICS，和渲染在不同的硬件队列上
+    bool dedicated = false;
+    // 和别的用途是同一个VkQueue
+    bool shared = false;
+    // 只有TRANSFER的族可能不是(1,1,1)，image拷贝的offset和extent要按它对齐
+    VkExtent3D minImageTransferGranularity = { 1, 1, 1 };
+};
+
+struct QueueFamilyRequest {
+    uint32_t familyIndex;
+    // 个数就是这个族要建的队列数
+    std::vector<float> priorities;
+};
+
+struct QueuePlanOptions {
+    bool asyncCompute = true;
+    bool transfer = true;
+    float graphicsPriority = 1.0f;
+    float computePriority = 1.0f;
+    // 上传一般是后台任务
+    float transferPriority = 0.5f;
+};
+
+struct QueuePlan {
+    std::vector<QueueFamilyRequest> families;
+    QueueAssignment roles[static_cast<size_t>(QueueRole::Count)];
+
+    const QueueAssignment & Get(QueueRole _role) const { return roles[static_cast<size_t>(_role)]; }
+    bool Has(QueueRole _role) const { return Get(_role).valid; }
+};
+
+const char * GetQueueRoleName(QueueRole _role);
+
+/**
+ * desc: 规划每种用途用哪个族的第几个队列，_surface为空时不分配Present
+ *       没有图形族时抛runtime_error
+ **/
+QueuePlan PlanQueueTopology(VkPhysicalDevice _physicalDevice, VkSurfaceKHR _surface = VK_NULL_HANDLE,
+        const QueuePlanOptions & _options = QueuePlanOptions());
+
+// 按plan里每个族的队列数建逻辑设备，_next挂到VkDeviceCreateInfo::pNext上，用来打开扩展的特性
+VkDevice CreateLogicalDevice(VkPhysicalDevice _physicalDevice, const QueuePlan & _plan,
+        const std::vector<const char*> & _enableExtensions = {}, const void * _next = nullptr);
+
+// _role没有分配时返回的Handle为空
+QueueParameters GetPlannedQueue(VkDevice _device, const QueuePlan & _plan, QueueRole _role);
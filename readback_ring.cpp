@@ -0,0 +1,322 @@
+#include "readback_ring.h"
+#include "helper.h"
+#include "device_capabilities.h"
+#include <algorithm>
+#include <stdexcept>
+#include <logger.h>
+
+ReadbackRing::ReadbackRing(VkDevice _device, VkPhysicalDevice _physicalDevice, VkQueue _queue,
+        uint32_t _queueFamilyIndex, VkExtent2D _extent, VkFormat _format, uint32_t _bytesPerPixel,
+        uint32_t _slotCount, ReadbackMode _mode) :
+    device_(_device),
+    queue_(_queue),
+    queueFamilyIndex_(_queueFamilyIndex),
+    extent_(_extent),
+    format_(_format),
+    mode_(_mode),
+    rowPitch_(static_cast<VkDeviceSize>(_extent.width) * _bytesPerPixel),
+    commandPool_(VK_NULL_HANDLE),
+    nextId_(0)
+{
+    const DeviceCapabilities & caps = GetDeviceCapabilities(_physicalDevice);
+
+    if (mode_ == ReadbackMode::LinearImage) {
+        VkImageFormatProperties formatProps;
+        if (vkGetPhysicalDeviceImageFormatProperties(_physicalDevice, format_, VK_IMAGE_TYPE_2D,
+                VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_TRANSFER_DST_BIT, 0, &formatProps) != VK_SUCCESS
+            || formatProps.maxExtent.width < extent_.width || formatProps.maxExtent.height < extent_.height) {
+            logwarn("linear image readback not supported for format:{}, fall back to buffer", static_cast<int>(format_));
+            mode_ = ReadbackMode::Buffer;
+        }
+    }
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndex_;
+    if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create readback command pool!");
+    }
+
+    slots_.resize(std::max<uint32_t>(_slotCount, 1));
+    for (auto & slot : slots_) {
+        slot = Slot{ VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, nullptr, false, VK_NULL_HANDLE, VK_NULL_HANDLE,
+            0, nullptr };
+    }
+    try {
+        for (uint32_t i = 0; i < slots_.size(); i++) {
+            CreateSlot(slots_[i], caps.memoryProperties);
+            freeSlots_.push_back(i);
+        }
+    }
+    catch (...) {
+        for (auto & slot : slots_) {
+            DestroySlot(slot);
+        }
+        vkDestroyCommandPool(device_, commandPool_, nullptr);
+        throw;
+    }
+    loginfo("readback ring {}x{} slots:{} mode:{} row pitch:{}", extent_.width, extent_.height, slots_.size(),
+            mode_ == ReadbackMode::Buffer ? "buffer" : "linear image", rowPitch_);
+}
+
+ReadbackRing::~ReadbackRing()
+{
+    // 没取走的数据直接丢掉，只等GPU用完
+    for (uint32_t index : inFlight_) {
+        vkWaitForFences(device_, 1, &slots_[index].fence, VK_TRUE, UINT64_MAX);
+    }
+    for (auto & slot : slots_) {
+        DestroySlot(slot);
+    }
+    vkDestroyCommandPool(device_, commandPool_, nullptr);
+}
+
+void ReadbackRing::CreateSlot(Slot & _slot, const VkPhysicalDeviceMemoryProperties & _memoryProps)
+{
+    VkMemoryRequirements requirements;
+    if (mode_ == ReadbackMode::Buffer) {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = rowPitch_ * extent_.height;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (vkCreateBuffer(device_, &bufferInfo, nullptr, &_slot.buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create readback buffer!");
+        }
+        vkGetBufferMemoryRequirements(device_, _slot.buffer, &requirements);
+    }
+    else {
+        VkImageCreateInfo imageInfo = Get2DImageCreateInfo(extent_.width, extent_.height, VK_IMAGE_TILING_LINEAR,
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT, format_);
+        if (vkCreateImage(device_, &imageInfo, nullptr, &_slot.image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create readback image!");
+        }
+        vkGetImageMemoryRequirements(device_, _slot.image, &requirements);
+    }
+
+    // CPU要顺序读整块数据，HOST_CACHED比write-combined的内存读起来快很多
+    int typeIndex = FindMemoryTypeIndex(&_memoryProps, requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    if (typeIndex < 0) {
+        throw std::runtime_error("failed to find readback memory type!");
+    }
+    _slot.coherent = (_memoryProps.memoryTypes[typeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = static_cast<uint32_t>(typeIndex);
+    if (vkAllocateMemory(device_, &allocInfo, nullptr, &_slot.memory) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate readback memory!");
+    }
+    void * mapped = nullptr;
+    if (_slot.buffer != VK_NULL_HANDLE) {
+        vkBindBufferMemory(device_, _slot.buffer, _slot.memory, 0);
+        vkMapMemory(device_, _slot.memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        _slot.mapped = mapped;
+    }
+    else {
+        vkBindImageMemory(device_, _slot.image, _slot.memory, 0);
+        // 每个槽的image参数一样，行距也一样
+        rowPitch_ = GetLinearImageRowPitch(device_, _slot.image);
+        VkImageSubresource subresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
+        VkSubresourceLayout layout = {};
+        vkGetImageSubresourceLayout(device_, _slot.image, &subresource, &layout);
+        vkMapMemory(device_, _slot.memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        _slot.mapped = static_cast<char *>(mapped) + layout.offset;
+    }
+
+    VkCommandBufferAllocateInfo commandInfo = {};
+    commandInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandInfo.commandPool = commandPool_;
+    commandInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device_, &commandInfo, &_slot.commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate readback command buffer!");
+    }
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkCreateFence(device_, &fenceInfo, nullptr, &_slot.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create readback fence!");
+    }
+}
+
+void ReadbackRing::DestroySlot(Slot & _slot)
+{
+    if (_slot.fence != VK_NULL_HANDLE) {
+        vkDestroyFence(device_, _slot.fence, nullptr);
+    }
+    if (_slot.buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device_, _slot.buffer, nullptr);
+    }
+    if (_slot.image != VK_NULL_HANDLE) {
+        vkDestroyImage(device_, _slot.image, nullptr);
+    }
+    if (_slot.memory != VK_NULL_HANDLE) {
+        // 释放内存会隐式unmap
+        vkFreeMemory(device_, _slot.memory, nullptr);
+    }
+    // command buffer跟着pool一起释放
+    _slot = Slot{ VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE, nullptr, false, VK_NULL_HANDLE, VK_NULL_HANDLE,
+        0, nullptr };
+}
+
+void ReadbackRing::Record(Slot & _slot, VkImage _image, VkImageLayout _layout)
+{
+    VkCommandBuffer cmd = _slot.commandBuffer;
+    VkCommandBufferBeginInfo beginInfo = GetCommandBufferOneTimeSubmitBeginInfo();
+    vkBeginCommandBuffer(cmd, &beginInfo);
+
+    VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    VkImageSubresourceLayers layers = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    bool fromAttachment = _layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    // 同一个queue上前面的提交按提交顺序进入第一个同步范围，不需要semaphore
+    std::vector<VkImageMemoryBarrier> before;
+    if (fromAttachment) {
+        VkImageMemoryBarrier barrier = GetSrcImageBeforeCopyMemoryBarrier(queueFamilyIndex_, queueFamilyIndex_,
+                _image, range);
+        // 渲染的写要先可用，helper里只有MEMORY_READ
+        barrier.srcAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        before.push_back(barrier);
+    }
+    else if (_layout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+        throw std::runtime_error("unsupported readback source layout!");
+    }
+    if (_slot.image != VK_NULL_HANDLE) {
+        before.push_back(GetDstImageBeforeCopyMemoryBarrier(queueFamilyIndex_, queueFamilyIndex_, _slot.image, range));
+    }
+    if (!before.empty()) {
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+                static_cast<uint32_t>(before.size()), before.data());
+    }
+
+    std::vector<VkImageMemoryBarrier> after;
+    VkBufferMemoryBarrier bufferBarrier = {};
+    if (_slot.buffer != VK_NULL_HANDLE) {
+        VkBufferImageCopy region = {};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource = layers;
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { extent_.width, extent_.height, 1 };
+        vkCmdCopyImageToBuffer(cmd, _image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, _slot.buffer, 1, &region);
+
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = _slot.buffer;
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+    }
+    else {
+        VkImageCopy region = {};
+        region.srcSubresource = layers;
+        region.dstSubresource = layers;
+        region.extent = { extent_.width, extent_.height, 1 };
+        vkCmdCopyImage(cmd, _image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, _slot.image,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        // CPU直接读线性image要求GENERAL
+        VkImageMemoryBarrier barrier = GetDstImageAfterCopyMemoryBarrier(queueFamilyIndex_, queueFamilyIndex_,
+                _slot.image, range);
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        after.push_back(barrier);
+    }
+    VkPipelineStageFlags dstStages = VK_PIPELINE_STAGE_HOST_BIT;
+    if (fromAttachment) {
+        after.push_back(GetSrcImageAfterCopyMemoryBarrier(queueFamilyIndex_, queueFamilyIndex_, _image, range));
+        dstStages |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    }
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages, 0,
+            0, nullptr, _slot.buffer != VK_NULL_HANDLE ? 1 : 0, &bufferBarrier,
+            static_cast<uint32_t>(after.size()), after.data());
+
+    vkEndCommandBuffer(cmd);
+}
+
+uint64_t ReadbackRing::Readback(VkImage _image, VkImageLayout _layout, Callback _callback, VkSemaphore _signal)
+{
+    Poll();
+    if (freeSlots_.empty()) {
+        //GPU比CPU处理回读慢，等最早的那个，不会无限堆积
+        Complete(inFlight_.front());
+    }
+    uint32_t index = freeSlots_.back();
+    Slot & slot = slots_[index];
+
+    vkResetCommandBuffer(slot.commandBuffer, 0);
+    Record(slot, _image, _layout);
+    vkResetFences(device_, 1, &slot.fence);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &slot.commandBuffer;
+    if (_signal != VK_NULL_HANDLE) {
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &_signal;
+    }
+    if (vkQueueSubmit(queue_, 1, &submitInfo, slot.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit readback!");
+    }
+
+    freeSlots_.pop_back();
+    slot.id = nextId_++;
+    slot.callback = std::move(_callback);
+    inFlight_.push_back(index);
+    return slot.id;
+}
+
+void ReadbackRing::Complete(uint32_t _slotIndex)
+{
+    Slot & slot = slots_[_slotIndex];
+    vkWaitForFences(device_, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+    // 回调按提交顺序执行
+    inFlight_.erase(std::find(inFlight_.begin(), inFlight_.end(), _slotIndex));
+
+    if (!slot.coherent) {
+        VkMappedMemoryRange memoryRange = {};
+        memoryRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        memoryRange.memory = slot.memory;
+        memoryRange.offset = 0;
+        memoryRange.size = VK_WHOLE_SIZE;
+        vkInvalidateMappedMemoryRanges(device_, 1, &memoryRange);
+    }
+
+    Callback callback = std::move(slot.callback);
+    slot.callback = nullptr;
+    // 先还槽，回调里抛异常也不会漏
+    freeSlots_.push_back(_slotIndex);
+    if (callback) {
+        ReadbackData data = { slot.id, slot.mapped, rowPitch_, extent_ };
+        callback(data);
+    }
+}
+
+void ReadbackRing::Poll()
+{
+    while (!inFlight_.empty()) {
+        uint32_t index = inFlight_.front();
+        if (vkGetFenceStatus(device_, slots_[index].fence) != VK_SUCCESS) {
+            break;
+        }
+        Complete(index);
+    }
+}
+
+void ReadbackRing::Finish()
+{
+    while (!inFlight_.empty()) {
+        Complete(inFlight_.front());
+    }
+}
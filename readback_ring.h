@@ -0,0 +1,89 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <functional>
+#include <vulkan/vulkan.h>
+
+/*
+ * GPU到CPU的异步回读
+ * slotCount个槽，每个槽一块一直映射着的内存，一个command buffer和一个fence
+ * Readback在渲染提交之后单独提交一次拷贝，不等它完成就返回，第K帧的拷贝和第K+1帧的渲染重叠
+ * 拷贝完成后在Poll/Finish里调用回调，槽全部在用时Readback会先等最早的那个
+ * Buffer模式拷到HOST_VISIBLE(优先HOST_CACHED)的buffer，行距是width*bytesPerPixel
+ * LinearImage模式拷到LINEAR tiling的image，行距用GetLinearImageRowPitch，格式不支持时退回Buffer模式
+ * 不是线程安全的，回调在调用Poll/Finish/Readback的线程里执行
+ */
+enum class ReadbackMode {
+    Buffer,
+    LinearImage,
+};
+
+struct ReadbackData {
+    uint64_t id;
+    const void * data;
+    VkDeviceSize rowPitch;
+    VkExtent2D extent;
+};
+
+class ReadbackRing {
+public:
+    // data只在回调里有效，之后槽会被复用
+    using Callback = std::function<void(const ReadbackData &)>;
+
+    ReadbackRing(VkDevice _device, VkPhysicalDevice _physicalDevice, VkQueue _queue, uint32_t _queueFamilyIndex,
+            VkExtent2D _extent, VkFormat _format, uint32_t _bytesPerPixel = 4, uint32_t _slotCount = 2,
+            ReadbackMode _mode = ReadbackMode::Buffer);
+    ~ReadbackRing();
+    ReadbackRing(const ReadbackRing &) = delete;
+    ReadbackRing & operator=(const ReadbackRing &) = delete;
+
+    /**
+     * desc: 把_image的第0层拷出来，要在渲染它的提交之后、同一个queue上调用
+     *       _layout 是COLOR_ATTACHMENT_OPTIMAL时前后用GetSrcImage*CopyMemoryBarrier转换，拷完回到COLOR_ATTACHMENT_OPTIMAL
+     *               是TRANSFER_SRC_OPTIMAL时(HeadlessTarget的输出)不转换layout
+     *       _signal 不为空时拷贝完成后signal
+     * return: 这次回读的id，和回调里的ReadbackData::id对应
+     **/
+    uint64_t Readback(VkImage _image, VkImageLayout _layout, Callback _callback,
+            VkSemaphore _signal = VK_NULL_HANDLE);
+    // 对已经完成的槽调用回调，不阻塞
+    void Poll();
+    // 等全部完成并调用回调
+    void Finish();
+
+    ReadbackMode GetMode() const { return mode_; }
+
+private:
+    struct Slot {
+        VkBuffer buffer;
+        VkImage image;
+        VkDeviceMemory memory;
+        // LinearImage模式下已经加上了subresource的offset
+        void * mapped;
+        bool coherent;
+        VkCommandBuffer commandBuffer;
+        VkFence fence;
+        uint64_t id;
+        Callback callback;
+    };
+
+    void CreateSlot(Slot & _slot, const VkPhysicalDeviceMemoryProperties & _memoryProps);
+    void DestroySlot(Slot & _slot);
+    void Complete(uint32_t _slotIndex);
+    void Record(Slot & _slot, VkImage _image, VkImageLayout _layout);
+
+    VkDevice device_;
+    VkQueue queue_;
+    uint32_t queueFamilyIndex_;
+    VkExtent2D extent_;
+    VkFormat format_;
+    ReadbackMode mode_;
+    VkDeviceSize rowPitch_;
+    VkCommandPool commandPool_;
+
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> freeSlots_;
+    // 按提交顺序排的在用槽
+    std::deque<uint32_t> inFlight_;
+    uint64_t nextId_;
+};
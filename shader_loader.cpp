@@ -0,0 +1,184 @@
+#include "shader_loader.h"
+#include "helper.h"
+#include "thread_pool.h"
+#include <future>
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include <logger.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+const uint32_t kSpirvMagic = 0x07230203;
+// magic, version, generator, bound, schema
+const size_t kSpirvHeaderWords = 5;
+
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const char * _path)
+{
+    HANDLE file = CreateFileA(_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error(std::string("failed to open file ") + _path);
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        throw std::runtime_error(std::string("failed to get size of file ") + _path);
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        throw std::runtime_error(std::string("failed to map file ") + _path);
+    }
+    const void * data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error(std::string("failed to map file ") + _path);
+    }
+    file_ = file;
+    mapping_ = mapping;
+    data_ = data;
+    size_ = static_cast<size_t>(size.QuadPart);
+}
+
+void MappedFile::Close()
+{
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+        CloseHandle(file_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    file_ = nullptr;
+    mapping_ = nullptr;
+}
+
+#else
+
+MappedFile::MappedFile(const char * _path)
+{
+    int fd = open(_path, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("failed to open file ") + _path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error(std::string("failed to get size of file ") + _path);
+    }
+    void * data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // 映射建立以后fd就可以关了
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error(std::string("failed to map file ") + _path);
+    }
+    data_ = data;
+    size_ = static_cast<size_t>(st.st_size);
+}
+
+void MappedFile::Close()
+{
+    if (data_ != nullptr) {
+        munmap(const_cast<void *>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile && _other) noexcept
+{
+    *this = std::move(_other);
+}
+
+MappedFile & MappedFile::operator=(MappedFile && _other) noexcept
+{
+    if (this != &_other) {
+        Close();
+        std::swap(data_, _other.data_);
+        std::swap(size_, _other.size_);
+#ifdef _WIN32
+        std::swap(file_, _other.file_);
+        std::swap(mapping_, _other.mapping_);
+#endif
+    }
+    return *this;
+}
+
+bool IsValidSpirv(const void * _data, size_t _size)
+{
+    if (_data == nullptr || _size % sizeof(uint32_t) != 0 || _size / sizeof(uint32_t) < kSpirvHeaderWords) {
+        return false;
+    }
+    // 大端编译出来的spirv magic是反的，vulkan只接受本机字节序
+    return *static_cast<const uint32_t *>(_data) == kSpirvMagic;
+}
+
+VkShaderModule CreateShaderModuleFromMappedFile(VkDevice _device, const char * _fileName)
+{
+    MappedFile file(_fileName);
+    if (!IsValidSpirv(file.GetData(), file.GetSize())) {
+        throw std::runtime_error(std::string("invalid spirv file ") + _fileName);
+    }
+    return CreateShaderModule(_device, static_cast<const uint32_t *>(file.GetData()),
+            file.GetSize() / sizeof(uint32_t));
+}
+
+std::vector<VkShaderModule> CreateShaderModulesFromFiles(VkDevice _device,
+        const std::vector<const char*> & _fileNames, ThreadPool & _pool)
+{
+    std::vector<std::future<VkShaderModule>> futures;
+    futures.reserve(_fileNames.size());
+    for (const char * fileName : _fileNames) {
+        futures.push_back(_pool.Enqueue([_device, fileName]() {
+            return CreateShaderModuleFromMappedFile(_device, fileName);
+        }));
+    }
+
+    // 每个future都要get，保证返回前所有任务都结束了
+    std::vector<VkShaderModule> modules(_fileNames.size(), VK_NULL_HANDLE);
+    std::exception_ptr error;
+    for (size_t i = 0; i < futures.size(); i++) {
+        try {
+            modules[i] = futures[i].get();
+        }
+        catch (const std::exception & e) {
+            logerror("create shader module from {} fail: {}", _fileNames[i], e.what());
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    if (error) {
+        for (VkShaderModule module : modules) {
+            if (module != VK_NULL_HANDLE) {
+                vkDestroyShaderModule(_device, module, nullptr);
+            }
+        }
+        std::rethrow_exception(error);
+    }
+    return modules;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+class ThreadPool;
+
+/*
+ * 只读映射整个文件，映射地址按页对齐，可以直接当uint32_t*用
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    // 打开失败抛runtime_error
+    explicit MappedFile(const char * _path);
+    ~MappedFile();
+    MappedFile(MappedFile && _other) noexcept;
+    MappedFile & operator=(MappedFile && _other) noexcept;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    const void * GetData() const { return data_; }
+    size_t GetSize() const { return size_; }
+
+private:
+    void Close();
+
+    const void * data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void * file_ = nullptr;
+    void * mapping_ = nullptr;
+#endif
+};
+
+/**
+ * desc: 检查magic number(0x07230203)，大小是4的倍数并且至少有5个word的头
+ **/
+bool IsValidSpirv(const void * _data, size_t _size);
+
+// 映射文件后直接把映射的内存交给vkCreateShaderModule，没有读文件的拷贝
+VkShaderModule CreateShaderModuleFromMappedFile(VkDevice _device, const char * _fileName);
+
+/**
+ * desc: 在线程池里并行创建多个shader module，返回顺序和_fileNames一致
+ *       任何一个失败都会销毁已经创建的module，然后抛出第一个错误
+ **/
+std::vector<VkShaderModule> CreateShaderModulesFromFiles(VkDevice _device,
+        const std::vector<const char*> & _fileNames, ThreadPool & _pool);
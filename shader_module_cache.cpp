@@ -0,0 +1,116 @@
+#include "shader_module_cache.h"
+#include "shader_loader.h"
+#include "helper.h"
+#include "hash.h"
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+namespace {
+
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+// 同一个device上的同一份代码才能共用
+inline uint64_t MakeKey(VkDevice _device, uint64_t _hash)
+{
+    return _hash ^ (reinterpret_cast<uintptr_t>(_device) * kPrime5);
+}
+
+}
+
+uint64_t HashSpirv(const uint32_t * _words, size_t _wordCount)
+{
+    return HashBytes(_words, _wordCount * sizeof(uint32_t));
+}
+
+ShaderModuleCache & ShaderModuleCache::Instance()
+{
+    // 故意不析构，静态析构之后仍然可能有句柄被释放
+    static ShaderModuleCache * instance = new ShaderModuleCache();
+    return *instance;
+}
+
+SharedShaderModule ShaderModuleCache::Get(VkDevice _device, const uint32_t * _code, size_t _wordCount)
+{
+    const uint64_t hash = HashSpirv(_code, _wordCount);
+    const uint64_t key = MakeKey(_device, hash);
+    auto lookup = [&]() -> SharedShaderModule {
+        auto range = entries_.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            const Entry & entry = it->second;
+            if (entry.device == _device && entry.code.size() == _wordCount
+                    && memcmp(entry.code.data(), _code, _wordCount * sizeof(uint32_t)) == 0) {
+                SharedShaderModule shared = entry.weak.lock();
+                if (shared) {
+                    return shared;
+                }
+            }
+        }
+        return nullptr;
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        SharedShaderModule shared = lookup();
+        if (shared) {
+            hits_++;
+            return shared;
+        }
+    }
+
+    // 不在锁里创建，多个线程可以同时编译不同的shader
+    VkShaderModule module = CreateShaderModule(_device, _code, _wordCount);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    SharedShaderModule shared = lookup();
+    if (shared) {
+        // 别的线程抢先创建了同样的module
+        vkDestroyShaderModule(_device, module, nullptr);
+        hits_++;
+        return shared;
+    }
+    misses_++;
+
+    ShaderModuleRef * ref = new ShaderModuleRef{ _device, module, hash };
+    shared = SharedShaderModule(ref, [](const ShaderModuleRef * _ref) {
+        ShaderModuleCache::Instance().Release(_ref);
+    });
+    Entry entry;
+    entry.device = _device;
+    entry.code.assign(_code, _code + _wordCount);
+    entry.ref = ref;
+    entry.weak = shared;
+    entries_.emplace(key, std::move(entry));
+    return shared;
+}
+
+SharedShaderModule ShaderModuleCache::GetFromFile(VkDevice _device, const char * _fileName)
+{
+    MappedFile file(_fileName);
+    if (!IsValidSpirv(file.GetData(), file.GetSize())) {
+        throw std::runtime_error(std::string("invalid spirv file ") + _fileName);
+    }
+    return Get(_device, static_cast<const uint32_t *>(file.GetData()), file.GetSize() / sizeof(uint32_t));
+}
+
+void ShaderModuleCache::Release(const ShaderModuleRef * _ref)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto range = entries_.equal_range(MakeKey(_ref->device, _ref->hash));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second.ref == _ref) {
+                entries_.erase(it);
+                break;
+            }
+        }
+    }
+    vkDestroyShaderModule(_ref->device, _ref->module, nullptr);
+    delete _ref;
+}
+
+ShaderModuleCache::Stats ShaderModuleCache::GetStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Stats{ hits_, misses_, entries_.size() };
+}
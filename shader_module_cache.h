@@ -0,0 +1,56 @@
+#pragma once
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <vulkan/vulkan.h>
+
+/*
+ * 按SPIR-V内容去重的shader module缓存，进程内唯一
+ * 内容相同的spirv在同一个device上只创建一个VkShaderModule，返回共享的引用计数句柄
+ * 最后一个引用释放时销毁module，缓存里只保存weak_ptr
+ * hash可以当pipeline的稳定key用
+ */
+struct ShaderModuleRef {
+    VkDevice device;
+    VkShaderModule module;
+    uint64_t hash;
+};
+using SharedShaderModule = std::shared_ptr<const ShaderModuleRef>;
+
+// 就是HashBytes(hash.h)，按word数传长度
+uint64_t HashSpirv(const uint32_t * _words, size_t _wordCount);
+
+class ShaderModuleCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        size_t liveModules;
+    };
+
+    static ShaderModuleCache & Instance();
+
+    SharedShaderModule Get(VkDevice _device, const uint32_t * _code, size_t _wordCount);
+    SharedShaderModule GetFromFile(VkDevice _device, const char * _fileName);
+
+    Stats GetStats();
+
+private:
+    ShaderModuleCache() = default;
+    void Release(const ShaderModuleRef * _ref);
+
+    struct Entry {
+        VkDevice device;
+        // hash相同时逐字节比较，不依赖hash没有碰撞
+        std::vector<uint32_t> code;
+        const ShaderModuleRef * ref;
+        std::weak_ptr<const ShaderModuleRef> weak;
+    };
+
+    std::mutex mutex_;
+    std::unordered_multimap<uint64_t, Entry> entries_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
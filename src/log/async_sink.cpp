@@ -0,0 +1,329 @@
+#include "async_sink.h"
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+size_t round_up_pow2(size_t _value)
+{
+    size_t size = 2;
+    while (size < _value) {
+        size <<= 1;
+    }
+    return size;
+}
+
+// 一次持有drain_mutex_最多写这么多条，flush和崩溃时的drain_now不用等太久
+const size_t drain_batch = 256;
+
+// 等队列腾位置或者flush追上时用，先让出几次，还是没有再睡
+void backoff(int & _spins)
+{
+    if (++_spins < 16) {
+        std::this_thread::yield();
+    }
+    else {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+}
+
+async_sink::async_sink(std::shared_ptr<spdlog::sinks::sink> _target, size_t _queue_size,
+        async_overflow_policy _policy) :
+    target_(std::move(_target)),
+    policy_(_policy),
+    enqueue_pos_(0),
+    dequeue_pos_(0),
+    stopped_(false),
+    enqueued_(0),
+    dropped_newest_(0),
+    dropped_oldest_(0),
+    blocked_(0),
+    consumed_(0),
+    producers_(0),
+    sleeping_(false)
+{
+    size_t size = round_up_pow2(_queue_size);
+    cells_.reset(new cell[size]);
+    mask_ = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    worker_ = std::thread(&async_sink::worker_loop, this);
+}
+
+async_sink::~async_sink()
+{
+    stop();
+}
+
+bool async_sink::try_push(const spdlog::details::log_msg & _msg)
+{
+    cell * target = nullptr;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+        cell & c = cells_[pos & mask_];
+        size_t seq = c.sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                target = &c;
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // 满了
+            return false;
+        }
+        else {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    record & r = target->data;
+    r.time = _msg.time;
+    r.level = _msg.level;
+    r.thread_id = _msg.thread_id;
+    r.source = _msg.source;
+    r.logger_name.assign(_msg.logger_name.data(), _msg.logger_name.size());
+    r.size = _msg.payload.size();
+    if (r.size <= inline_size) {
+        memcpy(r.inline_payload, _msg.payload.data(), r.size);
+        r.long_payload.clear();
+    }
+    else {
+        r.long_payload.assign(_msg.payload.data(), r.size);
+    }
+    target->sequence.store(pos + 1, std::memory_order_release);
+    enqueued_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool async_sink::queue_empty() const
+{
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    return cells_[pos & mask_].sequence.load(std::memory_order_acquire) != pos + 1;
+}
+
+bool async_sink::try_pop(record & _out)
+{
+    cell * target = nullptr;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+        cell & c = cells_[pos & mask_];
+        size_t seq = c.sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0) {
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                target = &c;
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // 空的
+            return false;
+        }
+        else {
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    record & r = target->data;
+    _out.time = r.time;
+    _out.level = r.level;
+    _out.thread_id = r.thread_id;
+    _out.source = r.source;
+    _out.logger_name.swap(r.logger_name);
+    _out.size = r.size;
+    if (r.size <= inline_size) {
+        memcpy(_out.inline_payload, r.inline_payload, r.size);
+    }
+    else {
+        _out.long_payload.swap(r.long_payload);
+    }
+    target->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+void async_sink::write(const record & _record)
+{
+    spdlog::string_view_t payload = _record.size <= inline_size
+        ? spdlog::string_view_t(_record.inline_payload, _record.size)
+        : spdlog::string_view_t(_record.long_payload.data(), _record.long_payload.size());
+    spdlog::details::log_msg msg(_record.time, _record.source,
+            spdlog::string_view_t(_record.logger_name.data(), _record.logger_name.size()), _record.level, payload);
+    msg.thread_id = _record.thread_id;
+    target_->log(msg);
+}
+
+void async_sink::log(const spdlog::details::log_msg & _msg)
+{
+    // 先登记再看stopped_，stop()是先设stopped_再等producers_，两边至少有一边看到对方
+    // 没看到stopped_的生产者放进去的消息，stop()等它们退出以后还会再drain一次
+    producers_.fetch_add(1);
+    if (stopped_.load()) {
+        producers_.fetch_sub(1);
+        std::lock_guard<std::mutex> lock(drain_mutex_);
+        target_->log(_msg);
+        return;
+    }
+    enqueue(_msg);
+    // 和worker_loop里设sleeping_以后再看队列配对，放进去的消息不会没人叫醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed)) {
+        wake_worker();
+    }
+    producers_.fetch_sub(1, std::memory_order_release);
+}
+
+void async_sink::enqueue(const spdlog::details::log_msg & _msg)
+{
+    if (try_push(_msg)) {
+        return;
+    }
+    switch (policy_) {
+    case async_overflow_policy::drop_newest:
+        dropped_newest_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    case async_overflow_policy::drop_oldest: {
+        record oldest;
+        do {
+            if (try_pop(oldest)) {
+                dropped_oldest_.fetch_add(1, std::memory_order_relaxed);
+                consumed_.fetch_add(1, std::memory_order_release);
+            }
+        } while (!try_push(_msg));
+        return;
+    }
+    case async_overflow_policy::block:
+    default: {
+        blocked_.fetch_add(1, std::memory_order_relaxed);
+        int spins = 0;
+        while (!try_push(_msg)) {
+            // 后台线程已经退出，不会再腾出位置
+            if (stopped_.load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lock(drain_mutex_);
+                target_->log(_msg);
+                return;
+            }
+            backoff(spins);
+        }
+        return;
+    }
+    }
+}
+
+void async_sink::wake_worker()
+{
+    {
+        // 后台线程在持有wake_mutex_时检查队列，这里拿一次锁保证它要么还没检查，要么已经在wait里
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+    }
+    wake_.notify_one();
+}
+
+void async_sink::worker_loop()
+{
+    record r;
+    bool dirty = false;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(drain_mutex_);
+            for (size_t i = 0; i < drain_batch && try_pop(r); i++) {
+                write(r);
+                consumed_.fetch_add(1, std::memory_order_release);
+                dirty = true;
+            }
+            // 队列空了才flush，连续写日志的时候不会每条都刷盘
+            if (dirty && queue_empty()) {
+                target_->flush();
+                dirty = false;
+            }
+        }
+        if (!queue_empty()) {
+            continue;
+        }
+        if (stopped_.load(std::memory_order_acquire)) {
+            break;
+        }
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        sleeping_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake_.wait(lock, [this]() {
+            return !queue_empty() || stopped_.load(std::memory_order_acquire);
+        });
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+}
+
+void async_sink::flush()
+{
+    if (!stopped_.load(std::memory_order_acquire)) {
+        unsigned long long target = enqueued_.load(std::memory_order_acquire);
+        int spins = 0;
+        while (consumed_.load(std::memory_order_acquire) < target && !stopped_.load(std::memory_order_acquire)) {
+            backoff(spins);
+        }
+    }
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    target_->flush();
+}
+
+void async_sink::set_pattern(const std::string & _pattern)
+{
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    target_->set_pattern(_pattern);
+}
+
+void async_sink::set_formatter(std::unique_ptr<spdlog::formatter> _formatter)
+{
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    target_->set_formatter(std::move(_formatter));
+}
+
+void async_sink::stop()
+{
+    if (stopped_.exchange(true)) {
+        return;
+    }
+    wake_worker();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    // 已经过了stopped_检查的生产者可能还在放，等它们都退出再写最后一次
+    while (producers_.load() != 0) {
+        std::this_thread::yield();
+    }
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    drain_locked();
+}
+
+void async_sink::drain_locked()
+{
+    record r;
+    while (try_pop(r)) {
+        write(r);
+        consumed_.fetch_add(1, std::memory_order_release);
+    }
+    target_->flush();
+}
+
+bool async_sink::drain_now()
+{
+    // 后台线程可能正好崩在sink里，等不到就放弃，不格式化也不碰sink
+    for (int i = 0; i < 100; i++) {
+        if (drain_mutex_.try_lock()) {
+            drain_locked();
+            drain_mutex_.unlock();
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+async_sink_stats async_sink::get_stats() const
+{
+    return async_sink_stats{ enqueued_.load(), dropped_newest_.load(), dropped_oldest_.load(), blocked_.load() };
+}
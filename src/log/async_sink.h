@@ -0,0 +1,112 @@
+#pragma once
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/sink.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+/*
+ * 异步sink，调用线程只把格式化好的消息拷进有界无锁队列，时间/等级的格式化和写盘都在后台线程
+ * 队列是Vyukov的有界MPMC队列，生产者之间、生产者和消费者之间都不加锁
+ * 队列满的时候按overflow_policy处理：
+ *   block       等后台线程腾出位置，不丢日志
+ *   drop_newest 丢掉当前这条
+ *   drop_oldest 从队头丢掉最老的一条再放进去
+ * 后台线程队列空了就flush然后睡在条件变量上，生产者发现它在睡才去唤醒，不空转
+ * 目标sink的所有调用都在drain_mutex_里，崩溃时try_lock拿不到就放弃，不会死锁在sink的锁里
+ * 停止时先把队列写完再flush
+ */
+enum class async_overflow_policy {
+    block,
+    drop_newest,
+    drop_oldest,
+};
+
+struct async_sink_stats {
+    unsigned long long enqueued;
+    unsigned long long dropped_newest;
+    unsigned long long dropped_oldest;
+    // block策略下等待过的次数
+    unsigned long long blocked;
+};
+
+class async_sink : public spdlog::sinks::sink {
+public:
+    // _queue_size向上取2的幂
+    async_sink(std::shared_ptr<spdlog::sinks::sink> _target, size_t _queue_size, async_overflow_policy _policy);
+    ~async_sink() override;
+    async_sink(const async_sink &) = delete;
+    async_sink & operator=(const async_sink &) = delete;
+
+    void log(const spdlog::details::log_msg & _msg) override;
+    // 等队列里已有的消息写完再flush目标sink
+    void flush() override;
+    void set_pattern(const std::string & _pattern) override;
+    void set_formatter(std::unique_ptr<spdlog::formatter> _formatter) override;
+
+    // 停止后台线程，剩下的消息写完并flush，之后的log直接同步写
+    void stop();
+    // 崩溃时在出问题的线程里直接把队列写完，不等后台线程
+    // 有限次try_lock拿不到drain_mutex_(后台线程可能崩在sink里)就什么都不做，返回false
+    bool drain_now();
+    async_sink_stats get_stats() const;
+
+private:
+    // 短消息直接放在cell里，不用分配内存
+    static const size_t inline_size = 192;
+    struct record {
+        spdlog::log_clock::time_point time;
+        spdlog::level::level_enum level;
+        size_t thread_id;
+        spdlog::source_loc source;
+        std::string logger_name;
+        char inline_payload[inline_size];
+        size_t size;
+        std::string long_payload;
+    };
+    struct cell {
+        std::atomic<size_t> sequence;
+        record data;
+    };
+
+    bool try_push(const spdlog::details::log_msg & _msg);
+    // 放进队列，满了按policy_处理
+    void enqueue(const spdlog::details::log_msg & _msg);
+    bool try_pop(record & _out);
+    bool queue_empty() const;
+    void write(const record & _record);
+    // 调用前持有drain_mutex_
+    void drain_locked();
+    void wake_worker();
+    void worker_loop();
+
+    std::shared_ptr<spdlog::sinks::sink> target_;
+    async_overflow_policy policy_;
+    std::unique_ptr<cell[]> cells_;
+    size_t mask_;
+    // 中间垫开一条cache line，生产者和消费者不互相抢
+    // C++14的new不保证alignas(64)，用填充代替
+    char pad0_[64];
+    std::atomic<size_t> enqueue_pos_;
+    char pad1_[64];
+    std::atomic<size_t> dequeue_pos_;
+    char pad2_[64];
+    std::atomic<bool> stopped_;
+    std::atomic<unsigned long long> enqueued_;
+    std::atomic<unsigned long long> dropped_newest_;
+    std::atomic<unsigned long long> dropped_oldest_;
+    std::atomic<unsigned long long> blocked_;
+    // 出队的条数(写出的和drop_oldest丢掉的)，flush用来判断有没有追上
+    std::atomic<unsigned long long> consumed_;
+    // 正在log()里的生产者，stop要等它们放完再做最后一次drain
+    std::atomic<int> producers_;
+    std::mutex drain_mutex_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::atomic<bool> sleeping_;
+    std::thread worker_;
+};
@@ -0,0 +1,398 @@
+#include "binary_log.h"
+#include <spdlog/details/os.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace binlog_detail {
+std::atomic<bool> enabled(false);
+}
+
+namespace {
+
+const char file_magic[8] = { 'V', 'K', 'B', 'L', 'O', 'G', '0', '1' };
+const uint32_t file_version = 1;
+const uint8_t tag_site = 1;
+const uint8_t tag_block = 2;
+const uint8_t tag_dropped = 3;
+// 记录头：site id、参数字节数、时间戳
+const size_t record_header_size = 16;
+
+size_t round_up_pow2(size_t _value)
+{
+    size_t size = 1024;
+    while (size < _value) {
+        size <<= 1;
+    }
+    return size;
+}
+
+// 单生产者(所属线程)单消费者(写盘线程)
+struct ring {
+    explicit ring(size_t _size, uint64_t _threadId) :
+        data(new char[_size]),
+        mask(_size - 1),
+        head(0),
+        tail(0),
+        thread_id(_threadId),
+        closed(false)
+    {
+    }
+
+    void copy_in(size_t _pos, const void * _src, size_t _size)
+    {
+        size_t offset = _pos & mask;
+        size_t first = std::min(_size, mask + 1 - offset);
+        memcpy(data.get() + offset, _src, first);
+        memcpy(data.get(), static_cast<const char *>(_src) + first, _size - first);
+    }
+
+    void copy_out(size_t _pos, char * _dst, size_t _size) const
+    {
+        size_t offset = _pos & mask;
+        size_t first = std::min(_size, mask + 1 - offset);
+        memcpy(_dst, data.get() + offset, first);
+        memcpy(_dst + first, data.get(), _size - first);
+    }
+
+    std::unique_ptr<char[]> data;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> head;
+    char pad1[64];
+    std::atomic<size_t> tail;
+    uint64_t thread_id;
+    // 线程退出后置上，写盘线程读空后释放
+    std::atomic<bool> closed;
+};
+
+struct site_info {
+    uint32_t id;
+    int32_t level;
+    int32_t line;
+    std::string file;
+    std::string format;
+    std::string types;
+};
+
+struct block {
+    uint64_t thread_id;
+    std::vector<char> bytes;
+};
+
+struct state {
+    // 保护sites、rings、file的打开关闭
+    std::mutex mutex;
+    std::vector<site_info> sites;
+    size_t written_sites = 0;
+    std::vector<std::shared_ptr<ring>> rings;
+    size_t ring_size = 0;
+    // 同一时间只有一个消费者读环
+    std::mutex drain_mutex;
+    FILE * file = nullptr;
+    std::thread writer;
+    std::atomic<bool> stopping{ false };
+    std::atomic<uint64_t> dropped{ 0 };
+    uint64_t written_dropped = 0;
+};
+
+// 不析构，退出时还在打日志的线程不会碰到已经销毁的状态
+state & get_state()
+{
+    static state * s = new state;
+    return *s;
+}
+
+struct thread_ring_holder {
+    ~thread_ring_holder()
+    {
+        if (r) {
+            r->closed.store(true, std::memory_order_release);
+        }
+    }
+    std::shared_ptr<ring> r;
+};
+thread_local thread_ring_holder local_ring;
+
+ring * attach_ring()
+{
+    state & s = get_state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.ring_size == 0) {
+        return nullptr;
+    }
+    local_ring.r = std::make_shared<ring>(s.ring_size, spdlog::details::os::thread_id());
+    s.rings.push_back(local_ring.r);
+    return local_ring.r.get();
+}
+
+template<typename T>
+void write_value(FILE * _file, const T & _value)
+{
+    fwrite(&_value, sizeof(T), 1, _file);
+}
+
+void write_string(FILE * _file, const std::string & _value)
+{
+    write_value(_file, static_cast<uint16_t>(_value.size()));
+    fwrite(_value.data(), 1, _value.size(), _file);
+}
+
+// 调用前持有s.mutex。记录之前登记的site一定已经在sites里，先写site再写block
+void write_sites_locked(state & _s)
+{
+    for (; _s.written_sites < _s.sites.size(); _s.written_sites++) {
+        const site_info & site = _s.sites[_s.written_sites];
+        write_value(_s.file, tag_site);
+        write_value(_s.file, site.id);
+        write_value(_s.file, site.level);
+        write_value(_s.file, site.line);
+        write_string(_s.file, site.file);
+        write_string(_s.file, site.format);
+        write_string(_s.file, site.types);
+    }
+}
+
+// 调用前持有s.mutex
+void write_dropped_locked(state & _s)
+{
+    uint64_t dropped = _s.dropped.load(std::memory_order_relaxed);
+    if (dropped != _s.written_dropped) {
+        write_value(_s.file, tag_dropped);
+        write_value(_s.file, dropped);
+        _s.written_dropped = dropped;
+    }
+}
+
+// 调用前持有drain_mutex
+void drain_locked(state & _s)
+{
+    std::vector<std::shared_ptr<ring>> rings;
+    {
+        std::lock_guard<std::mutex> lock(_s.mutex);
+        rings = _s.rings;
+    }
+
+    std::vector<block> blocks;
+    std::vector<ring *> finished;
+    for (const auto & r : rings) {
+        // 先看closed再读head，closed之后不会再有新记录，这一轮读完就能释放
+        bool closed = r->closed.load(std::memory_order_acquire);
+        size_t head = r->head.load(std::memory_order_acquire);
+        size_t tail = r->tail.load(std::memory_order_relaxed);
+        if (head != tail) {
+            block b;
+            b.thread_id = r->thread_id;
+            b.bytes.resize(head - tail);
+            r->copy_out(tail, b.bytes.data(), b.bytes.size());
+            r->tail.store(head, std::memory_order_release);
+            blocks.push_back(std::move(b));
+        }
+        if (closed) {
+            finished.push_back(r.get());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(_s.mutex);
+    if (!finished.empty()) {
+        for (ring * r : finished) {
+            for (auto it = _s.rings.begin(); it != _s.rings.end(); ++it) {
+                if (it->get() == r) {
+                    _s.rings.erase(it);
+                    break;
+                }
+            }
+        }
+    }
+    if (_s.file == nullptr) {
+        return;
+    }
+    write_sites_locked(_s);
+    for (const block & b : blocks) {
+        write_value(_s.file, tag_block);
+        write_value(_s.file, b.thread_id);
+        write_value(_s.file, static_cast<uint32_t>(b.bytes.size()));
+        fwrite(b.bytes.data(), 1, b.bytes.size(), _s.file);
+    }
+    write_dropped_locked(_s);
+}
+
+/**
+ * desc: 崩溃路径用，持有drain_mutex后只try_lock s.mutex有限次，拿不到(别的线程崩在register_site/attach_ring里)就放弃
+ *       拿到以后一直持有到写完：直接从环写到文件，不拷贝不分配，也不回收已经关闭的环
+ **/
+bool drain_crash_locked(state & _s)
+{
+    std::unique_lock<std::mutex> lock(_s.mutex, std::defer_lock);
+    for (int i = 0; !lock.try_lock(); i++) {
+        if (i >= 100) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (_s.file == nullptr) {
+        return false;
+    }
+    write_sites_locked(_s);
+    for (const auto & r : _s.rings) {
+        size_t head = r->head.load(std::memory_order_acquire);
+        size_t tail = r->tail.load(std::memory_order_relaxed);
+        if (head == tail) {
+            continue;
+        }
+        size_t size = head - tail;
+        size_t offset = tail & r->mask;
+        size_t first = std::min(size, r->mask + 1 - offset);
+        write_value(_s.file, tag_block);
+        write_value(_s.file, r->thread_id);
+        write_value(_s.file, static_cast<uint32_t>(size));
+        fwrite(r->data.get() + offset, 1, first, _s.file);
+        fwrite(r->data.get(), 1, size - first, _s.file);
+        r->tail.store(head, std::memory_order_release);
+    }
+    write_dropped_locked(_s);
+    fflush(_s.file);
+    return true;
+}
+
+void writer_loop()
+{
+    state & s = get_state();
+    while (!s.stopping.load(std::memory_order_acquire)) {
+        {
+            std::lock_guard<std::mutex> lock(s.drain_mutex);
+            drain_locked(s);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+}
+
+namespace binlog_detail {
+
+uint32_t register_site(binlog_site & _site, const char * _types)
+{
+    state & s = get_state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    // 两个线程同时第一次走到同一个调用点
+    uint32_t id = _site.id.load(std::memory_order_relaxed);
+    if (id != 0) {
+        return id;
+    }
+    id = static_cast<uint32_t>(s.sites.size() + 1);
+    site_info info;
+    info.id = id;
+    info.level = _site.level;
+    info.line = _site.line;
+    info.file = _site.file;
+    info.format = _site.format;
+    info.types = _types;
+    s.sites.push_back(std::move(info));
+    _site.id.store(id, std::memory_order_release);
+    return id;
+}
+
+void push(uint32_t _id, const char * _data, size_t _size)
+{
+    ring * r = local_ring.r.get();
+    if (r == nullptr) {
+        r = attach_ring();
+        if (r == nullptr) {
+            return;
+        }
+    }
+    size_t total = record_header_size + _size;
+    size_t head = r->head.load(std::memory_order_relaxed);
+    size_t tail = r->tail.load(std::memory_order_acquire);
+    if (total > r->mask + 1 - (head - tail)) {
+        get_state().dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    uint32_t size = static_cast<uint32_t>(_size);
+    char header[record_header_size];
+    memcpy(header, &_id, 4);
+    memcpy(header + 4, &size, 4);
+    memcpy(header + 8, &timestamp, 8);
+    r->copy_in(head, header, record_header_size);
+    r->copy_in(head + record_header_size, _data, _size);
+    r->head.store(head + total, std::memory_order_release);
+}
+
+}
+
+bool binlog_open(const char * _path, const char * _loggerName, size_t _ringSize)
+{
+    state & s = get_state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.file != nullptr) {
+            return false;
+        }
+        s.file = fopen(_path, "wb");
+        if (s.file == nullptr) {
+            return false;
+        }
+        fwrite(file_magic, 1, sizeof(file_magic), s.file);
+        write_value(s.file, file_version);
+        write_string(s.file, _loggerName);
+        s.ring_size = round_up_pow2(_ringSize);
+    }
+    s.stopping.store(false);
+    s.writer = std::thread(writer_loop);
+    binlog_detail::enabled.store(true, std::memory_order_release);
+    return true;
+}
+
+void binlog_flush()
+{
+    state & s = get_state();
+    std::lock_guard<std::mutex> drain(s.drain_mutex);
+    drain_locked(s);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.file != nullptr) {
+        fflush(s.file);
+    }
+}
+
+void binlog_drain_now()
+{
+    state & s = get_state();
+    // 写盘线程可能正好崩在锁里，等不到就放弃；s.mutex也一样，见drain_crash_locked
+    for (int i = 0; i < 100; i++) {
+        if (s.drain_mutex.try_lock()) {
+            drain_crash_locked(s);
+            s.drain_mutex.unlock();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void binlog_close()
+{
+    state & s = get_state();
+    binlog_detail::enabled.store(false, std::memory_order_release);
+    s.stopping.store(true, std::memory_order_release);
+    if (s.writer.joinable()) {
+        s.writer.join();
+    }
+    std::lock_guard<std::mutex> drain(s.drain_mutex);
+    drain_locked(s);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.file != nullptr) {
+        fclose(s.file);
+        s.file = nullptr;
+    }
+}
+
+uint64_t binlog_dropped()
+{
+    return get_state().dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,188 @@
+#pragma once
+#include <spdlog/spdlog.h>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <iterator>
+#include <type_traits>
+
+/*
+ * 二进制日志，热路径上不做任何文本格式化
+ * 每个调用点一个静态的binlog_site(文件、行号、等级、格式串)，第一次调用时登记得到id，参数类型串也在这时写进文件
+ * 之后每次调用只把id、时间戳和原始参数拷进本线程的单生产者环形缓冲，后台线程轮询所有环写盘
+ * 环满了直接丢弃并计数，不阻塞调用线程
+ * 文件用binlog_decode还原成和文本日志一样的格式
+ *
+ * 文件格式(本机字节序)：
+ *   头      "VKBLOG01" u32:版本 u16:长度 logger名
+ *   site    u8:1 u32:id i32:等级 i32:行号 u16+文件 u16+格式串 u16+参数类型串
+ *   block   u8:2 u64:线程id u32:字节数 若干条记录
+ *   dropped u8:3 u64:到目前为止丢弃的总条数
+ *   记录    u32:site id u32:参数字节数 u64:时间戳(纳秒,system_clock) 参数
+ * 参数类型：b bool(1) c char(1) i int64 u uint64 F float d double p 指针(u64) s u32长度+字节
+ * 不认识的类型在调用线程用fmt转成字符串，按s存
+ */
+struct binlog_site {
+    constexpr binlog_site(const char * _file, int _line, int _level, const char * _format) :
+        file(_file), line(_line), level(_level), format(_format), id(0)
+    {
+    }
+    const char * file;
+    int line;
+    int level;
+    const char * format;
+    // 0表示还没登记
+    std::atomic<uint32_t> id;
+};
+
+namespace binlog_detail {
+
+extern std::atomic<bool> enabled;
+
+uint32_t register_site(binlog_site & _site, const char * _types);
+void push(uint32_t _id, const char * _data, size_t _size);
+
+template<typename T>
+void put(spdlog::memory_buf_t & _buf, const T & _value)
+{
+    const char * p = reinterpret_cast<const char *>(&_value);
+    _buf.append(p, p + sizeof(T));
+}
+
+inline void put_string(spdlog::memory_buf_t & _buf, const char * _data, size_t _size)
+{
+    put(_buf, static_cast<uint32_t>(_size));
+    _buf.append(_data, _data + _size);
+}
+
+// 兜底：调用线程格式化成字符串
+template<typename T, typename Enable = void>
+struct arg_traits {
+    static constexpr char code = 's';
+    static void encode(spdlog::memory_buf_t & _buf, const T & _value)
+    {
+        size_t at = _buf.size();
+        put(_buf, uint32_t(0));
+        fmt::format_to(std::back_inserter(_buf), "{}", _value);
+        uint32_t size = static_cast<uint32_t>(_buf.size() - at - sizeof(uint32_t));
+        memcpy(_buf.data() + at, &size, sizeof(size));
+    }
+};
+
+template<typename T>
+struct arg_traits<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value
+        && !std::is_same<T, char>::value>::type> {
+    static constexpr char code = 'i';
+    static void encode(spdlog::memory_buf_t & _buf, T _value) { put(_buf, static_cast<int64_t>(_value)); }
+};
+
+template<typename T>
+struct arg_traits<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value
+        && !std::is_same<T, bool>::value && !std::is_same<T, char>::value>::type> {
+    static constexpr char code = 'u';
+    static void encode(spdlog::memory_buf_t & _buf, T _value) { put(_buf, static_cast<uint64_t>(_value)); }
+};
+
+template<>
+struct arg_traits<bool> {
+    static constexpr char code = 'b';
+    static void encode(spdlog::memory_buf_t & _buf, bool _value) { put(_buf, static_cast<uint8_t>(_value)); }
+};
+
+template<>
+struct arg_traits<char> {
+    static constexpr char code = 'c';
+    static void encode(spdlog::memory_buf_t & _buf, char _value) { put(_buf, _value); }
+};
+
+// float和double用{}打印出来不一样，分开存
+template<>
+struct arg_traits<float> {
+    static constexpr char code = 'F';
+    static void encode(spdlog::memory_buf_t & _buf, float _value) { put(_buf, _value); }
+};
+
+template<>
+struct arg_traits<double> {
+    static constexpr char code = 'd';
+    static void encode(spdlog::memory_buf_t & _buf, double _value) { put(_buf, _value); }
+};
+
+template<>
+struct arg_traits<long double> {
+    static constexpr char code = 'd';
+    static void encode(spdlog::memory_buf_t & _buf, long double _value) { put(_buf, static_cast<double>(_value)); }
+};
+
+template<>
+struct arg_traits<const char *> {
+    static constexpr char code = 's';
+    static void encode(spdlog::memory_buf_t & _buf, const char * _value)
+    {
+        if (_value == nullptr) {
+            _value = "(null)";
+        }
+        put_string(_buf, _value, strlen(_value));
+    }
+};
+
+template<>
+struct arg_traits<char *> : arg_traits<const char *> {
+};
+
+template<>
+struct arg_traits<std::string> {
+    static constexpr char code = 's';
+    static void encode(spdlog::memory_buf_t & _buf, const std::string & _value)
+    {
+        put_string(_buf, _value.data(), _value.size());
+    }
+};
+
+template<typename T>
+struct arg_traits<T, typename std::enable_if<std::is_pointer<T>::value
+        && !std::is_same<T, const char *>::value && !std::is_same<T, char *>::value>::type> {
+    static constexpr char code = 'p';
+    static void encode(spdlog::memory_buf_t & _buf, T _value)
+    {
+        put(_buf, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(_value)));
+    }
+};
+
+template<typename... Args>
+struct type_codes {
+    static constexpr char value[sizeof...(Args) + 1] = { arg_traits<Args>::code..., '\0' };
+};
+template<typename... Args>
+constexpr char type_codes<Args...>::value[sizeof...(Args) + 1];
+
+}
+
+inline bool binlog_enabled()
+{
+    return binlog_detail::enabled.load(std::memory_order_relaxed);
+}
+
+template<typename... Args>
+void binlog_write(binlog_site & _site, const Args &... _args)
+{
+    uint32_t id = _site.id.load(std::memory_order_acquire);
+    if (id == 0) {
+        id = binlog_detail::register_site(_site, binlog_detail::type_codes<typename std::decay<Args>::type...>::value);
+    }
+    // 短的参数都在栈上
+    spdlog::memory_buf_t buf;
+    int expand[] = { 0, (binlog_detail::arg_traits<typename std::decay<Args>::type>::encode(buf, _args), 0)... };
+    (void)expand;
+    binlog_detail::push(id, buf.data(), buf.size());
+}
+
+// 每个线程的环的字节数，向上取2的幂
+bool binlog_open(const char * _path, const char * _loggerName, size_t _ringSize);
+// 把已经写进环的记录写盘并fflush
+void binlog_flush();
+// 崩溃时在出问题的线程里尽量写完，后台线程正在写或者别的线程正在登记site时等一小会儿，等不到就不写
+void binlog_drain_now();
+void binlog_close();
+uint64_t binlog_dropped();
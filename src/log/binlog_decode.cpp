@@ -0,0 +1,248 @@
+/*
+ * 把logger_init_binary_output写的二进制日志还原成文本日志的格式
+ * 用法：binlog_decode <输入文件> [输出文件]，不给输出文件就写到stdout
+ * 各线程的记录按时间戳合并排序，整个文件在内存里处理
+ */
+#include <spdlog/spdlog.h>
+#include <spdlog/details/os.h>
+#include <spdlog/fmt/fmt.h>
+// dynamic_format_arg_store在fmt 7以上才有
+#if defined(SPDLOG_FMT_EXTERNAL)
+#include <fmt/args.h>
+#else
+#include <spdlog/fmt/bundled/args.h>
+#endif
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct site_info {
+    int32_t level;
+    int32_t line;
+    std::string file;
+    std::string format;
+    std::string types;
+};
+
+struct entry {
+    uint64_t timestamp;
+    std::string text;
+};
+
+class reader {
+public:
+    reader(const char * _data, size_t _size) : data_(_data), size_(_size), pos_(0) {}
+
+    bool done() const { return pos_ >= size_; }
+
+    template<typename T>
+    T read()
+    {
+        T value;
+        bytes(&value, sizeof(T));
+        return value;
+    }
+
+    std::string read_string16()
+    {
+        std::string value(read<uint16_t>(), '\0');
+        bytes(&value[0], value.size());
+        return value;
+    }
+
+    std::string read_string32()
+    {
+        std::string value(read<uint32_t>(), '\0');
+        bytes(&value[0], value.size());
+        return value;
+    }
+
+    reader sub(size_t _size)
+    {
+        check(_size);
+        reader r(data_ + pos_, _size);
+        pos_ += _size;
+        return r;
+    }
+
+private:
+    void check(size_t _size) const
+    {
+        if (_size > size_ - pos_) {
+            throw std::runtime_error("truncated binary log");
+        }
+    }
+
+    void bytes(void * _dst, size_t _size)
+    {
+        check(_size);
+        if (_size > 0) {
+            memcpy(_dst, data_ + pos_, _size);
+        }
+        pos_ += _size;
+    }
+
+    const char * data_;
+    size_t size_;
+    size_t pos_;
+};
+
+const char * level_name(int _level)
+{
+    // 和spdlog文本输出里的等级名一致
+    static const char * names[] = { "debug", "info", "warning", "error" };
+    if (_level < 0 || _level > 3) {
+        return "off";
+    }
+    return names[_level];
+}
+
+std::string format_message(const site_info & _site, reader & _args)
+{
+    fmt::dynamic_format_arg_store<fmt::format_context> store;
+    for (char type : _site.types) {
+        switch (type) {
+        case 'b': store.push_back(_args.read<uint8_t>() != 0); break;
+        case 'c': store.push_back(_args.read<char>()); break;
+        case 'i': store.push_back(_args.read<int64_t>()); break;
+        case 'u': store.push_back(_args.read<uint64_t>()); break;
+        case 'F': store.push_back(_args.read<float>()); break;
+        case 'd': store.push_back(_args.read<double>()); break;
+        case 'p': store.push_back(reinterpret_cast<const void *>(static_cast<uintptr_t>(_args.read<uint64_t>()))); break;
+        case 's': store.push_back(_args.read_string32()); break;
+        default: throw std::runtime_error("unknown argument type in binary log");
+        }
+    }
+    try {
+        return fmt::vformat(_site.format, store);
+    }
+    catch (const fmt::format_error & e) {
+        return _site.format + " [format error: " + e.what() + "]";
+    }
+}
+
+// [%Y-%m-%d %H:%M:%S.%e] [logger] [level] file:line: message
+std::string format_line(const std::string & _logger, const site_info & _site, uint64_t _timestamp,
+        const std::string & _message)
+{
+    time_t seconds = static_cast<time_t>(_timestamp / 1000000000ull);
+    unsigned millis = static_cast<unsigned>(_timestamp / 1000000ull % 1000);
+    std::tm tm = spdlog::details::os::localtime(seconds);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+    return fmt::format("[{}.{:03}] [{}] [{}] {}:{}: {}\n", date, millis, _logger, level_name(_site.level),
+            _site.file, _site.line, _message);
+}
+
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <binary log> [output]\n", argv[0]);
+        return 1;
+    }
+    FILE * in = fopen(argv[1], "rb");
+    if (in == nullptr) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<char> data;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(in);
+
+    std::vector<entry> entries;
+    uint64_t dropped = 0;
+    bool truncated = false;
+    std::string logger;
+    try {
+        reader r(data.data(), data.size());
+        char magic[8];
+        for (char & c : magic) {
+            c = r.read<char>();
+        }
+        if (memcmp(magic, "VKBLOG01", 8) != 0) {
+            fprintf(stderr, "%s is not a binary log\n", argv[1]);
+            return 1;
+        }
+        uint32_t version = r.read<uint32_t>();
+        if (version != 1) {
+            fprintf(stderr, "unsupported binary log version %u\n", version);
+            return 1;
+        }
+        logger = r.read_string16();
+
+        std::map<uint32_t, site_info> sites;
+        while (!r.done()) {
+            uint8_t tag = r.read<uint8_t>();
+            if (tag == 1) {
+                uint32_t id = r.read<uint32_t>();
+                site_info site;
+                site.level = r.read<int32_t>();
+                site.line = r.read<int32_t>();
+                site.file = r.read_string16();
+                site.format = r.read_string16();
+                site.types = r.read_string16();
+                sites[id] = std::move(site);
+            }
+            else if (tag == 2) {
+                r.read<uint64_t>();
+                reader records = r.sub(r.read<uint32_t>());
+                while (!records.done()) {
+                    uint32_t id = records.read<uint32_t>();
+                    uint32_t size = records.read<uint32_t>();
+                    uint64_t timestamp = records.read<uint64_t>();
+                    reader args = records.sub(size);
+                    auto it = sites.find(id);
+                    if (it == sites.end()) {
+                        throw std::runtime_error("record references unknown call site");
+                    }
+                    entries.push_back({ timestamp, format_line(logger, it->second, timestamp,
+                            format_message(it->second, args)) });
+                }
+            }
+            else if (tag == 3) {
+                dropped = r.read<uint64_t>();
+            }
+            else {
+                throw std::runtime_error("unknown tag in binary log");
+            }
+        }
+    }
+    catch (const std::exception & e) {
+        // 进程崩溃时文件尾部可能不完整，前面的照样输出
+        fprintf(stderr, "%s: %s\n", argv[1], e.what());
+        truncated = true;
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), [](const entry & _a, const entry & _b) {
+        return _a.timestamp < _b.timestamp;
+    });
+    FILE * out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (out == nullptr) {
+        fprintf(stderr, "cannot open %s\n", argv[2]);
+        return 1;
+    }
+    for (const entry & e : entries) {
+        fwrite(e.text.data(), 1, e.text.size(), out);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "%llu records were dropped because a thread's ring was full\n",
+                static_cast<unsigned long long>(dropped));
+    }
+    return truncated ? 2 : 0;
+}
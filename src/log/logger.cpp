@@ -1,7 +1,67 @@
 #include "logger.h"
+#include "async_sink.h"
+#include <spdlog/sinks/rotating_file_sink.h>
+#include <csignal>
+#include <cstdlib>
+#include <atomic>
 //https://github.com/gabime/spdlog/wiki/Using-printf-syntax
 
 std::shared_ptr<spdlog::logger> spdlogger;
+//和spdlog默认的info一致
+std::atomic<int> logger_runtime_level(LOGGER_LEVEL_INFO);
+static std::shared_ptr<async_sink> asyncsink;
+
+static spdlog::level::level_enum to_spdlog_level(int level) {
+    switch (level) {
+    case LOGGER_LEVEL_DEBUG: return spdlog::level::debug;
+    case LOGGER_LEVEL_INFO: return spdlog::level::info;
+    case LOGGER_LEVEL_WARN: return spdlog::level::warn;
+    case LOGGER_LEVEL_ERROR: return spdlog::level::err;
+    default: return spdlog::level::off;
+    }
+}
+
+static const int crash_signals[] = {
+    SIGSEGV, SIGABRT, SIGFPE, SIGILL,
+#ifdef SIGBUS
+    SIGBUS,
+#endif
+};
+typedef void (*signal_handler)(int);
+static signal_handler previous_handlers[sizeof(crash_signals) / sizeof(crash_signals[0])];
+static std::atomic<bool> crashing(false);
+
+//尽力而为：在崩溃的线程里把队列写完，然后交还给原来的处理函数
+//binlog和异步sink都只try_lock有限次，别的线程崩在锁里时放弃写出，不会死锁
+static void crash_handler(int sig) {
+    if (!crashing.exchange(true)) {
+        if (binlog_enabled())
+            binlog_drain_now();
+        else if (asyncsink.get() != nullptr)
+            asyncsink->drain_now();
+        else if (spdlogger.get() != nullptr)
+            spdlogger->flush();
+    }
+    for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++) {
+        if (crash_signals[i] == sig) {
+            signal_handler previous = previous_handlers[i];
+            std::signal(sig, (previous == SIG_ERR || previous == SIG_IGN) ? SIG_DFL : previous);
+            break;
+        }
+    }
+    std::raise(sig);
+}
+
+static void install_crash_handlers() {
+    static bool installed = false;
+    if (installed)
+        return;
+    installed = true;
+    for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++) {
+        previous_handlers[i] = std::signal(crash_signals[i], crash_handler);
+    }
+    std::atexit(logger_shutdown);
+}
 
 extern "C" void logger_init_file_output(const char * path) {
     if(spdlogger.get() != nullptr)
@@ -11,34 +71,86 @@ extern "C" void logger_init_file_output(const char * path) {
     strcpy(filepath, path);
     
     spdlogger = spdlog::rotating_logger_mt("file_logger", filepath, 1024 * 1024 * 10, 3);
-    if (spdlogger.get() != nullptr)
+    if (spdlogger.get() != nullptr) {
+        spdlogger->set_level(to_spdlog_level(logger_runtime_level.load()));
+        install_crash_handlers();
         spdlogger->info("ok");
+    }
 }
 
-extern "C" void logger_set_level_debug(){
+extern "C" void logger_init_async_file_output(const char * path, unsigned int queue_size, int overflow_policy) {
     if(spdlogger.get() != nullptr)
         return;
 
-    spdlogger->set_level(spdlog::level::level_enum::debug);
+    async_overflow_policy policy = async_overflow_policy::block;
+    if (overflow_policy == LOGGER_OVERFLOW_DROP_NEWEST)
+        policy = async_overflow_policy::drop_newest;
+    else if (overflow_policy == LOGGER_OVERFLOW_DROP_OLDEST)
+        policy = async_overflow_policy::drop_oldest;
+
+    //文件只在后台线程写，目标sink用_mt是为了set_pattern之类的调用
+    auto file_sink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(path, 1024 * 1024 * 10, 3);
+    asyncsink = std::make_shared<async_sink>(file_sink, queue_size, policy);
+    spdlogger = std::make_shared<spdlog::logger>("file_logger", asyncsink);
+    spdlogger->set_level(to_spdlog_level(logger_runtime_level.load()));
+    spdlog::register_logger(spdlogger);
+    install_crash_handlers();
+    spdlogger->info("ok async queue:{} policy:{}", queue_size, overflow_policy);
 }
 
-extern "C" void logger_set_level_info(){
-    if(spdlogger.get() != nullptr)
+extern "C" void logger_init_binary_output(const char * path, unsigned int ring_size) {
+    if(spdlogger.get() != nullptr || binlog_enabled())
         return;
-    
-    spdlogger->set_level(spdlog::level::level_enum::info);
+
+    if (!binlog_open(path, "file_logger", ring_size))
+        return;
+    install_crash_handlers();
+    loginfo("ok binary ring:{}", ring_size);
 }
 
-extern "C" void logger_set_level_warn(){
+extern "C" int logger_get_async_stats(struct logger_async_stats * stats) {
+    if (asyncsink.get() == nullptr || stats == nullptr)
+        return 0;
+    async_sink_stats s = asyncsink->get_stats();
+    stats->enqueued = s.enqueued;
+    stats->dropped_newest = s.dropped_newest;
+    stats->dropped_oldest = s.dropped_oldest;
+    stats->blocked = s.blocked;
+    return 1;
+}
+
+extern "C" void logger_flush() {
+    if (binlog_enabled())
+        binlog_flush();
     if(spdlogger.get() != nullptr)
-        return;
-    
-    spdlogger->set_level(spdlog::level::level_enum::warn);
+        spdlogger->flush();
 }
 
-extern "C" void logger_set_level_error(){
+extern "C" void logger_shutdown() {
+    binlog_close();
+    if (asyncsink.get() != nullptr)
+        asyncsink->stop();
+    logger_flush();
+}
+
+static void set_level(int level) {
+    logger_runtime_level.store(level, std::memory_order_relaxed);
     if(spdlogger.get() != nullptr)
-        return;
-    
-    spdlogger->set_level(spdlog::level::level_enum::err);
+        spdlogger->set_level(to_spdlog_level(level));
+}
+
+extern "C" void logger_set_level_debug(){
+    set_level(LOGGER_LEVEL_DEBUG);
+}
+
+extern "C" void logger_set_level_info(){
+    set_level(LOGGER_LEVEL_INFO);
+}
+
+extern "C" void logger_set_level_warn(){
+    set_level(LOGGER_LEVEL_WARN);
+}
+
+extern "C" void logger_set_level_error(){
+    set_level(LOGGER_LEVEL_ERROR);
 }
@@ -1,21 +1,91 @@
 #include <spdlog/spdlog.h>
 #include <stdarg.h>
+#include <atomic>
+#include "binary_log.h"
 extern std::shared_ptr<spdlog::logger> spdlogger;
 #define _s_l_(x) #x
 #define _str_line_(x) _s_l_(x)
 #define __STR_LINE__ _str_line_(__LINE__)
 
-#define logdebug(fmt,...) \
-    if(spdlogger.get() != nullptr) spdlogger->debug(__FILE__ ":" __STR_LINE__ ": " fmt, ##__VA_ARGS__)
-#define loginfo(fmt,...) \
-    if(spdlogger.get() != nullptr)  spdlogger->info(__FILE__ ":" __STR_LINE__ ": " fmt, ##__VA_ARGS__)
-#define logwarn(fmt,...) \
-    if(spdlogger.get() != nullptr)  spdlogger->warn(__FILE__ ":" __STR_LINE__ ": " fmt, ##__VA_ARGS__)
-#define logerror(fmt,...) \
-    if(spdlogger.get() != nullptr) spdlogger->error(__FILE__ ":" __STR_LINE__ ": " fmt, ##__VA_ARGS__)
+//日志等级，数值越大越重要
+#define LOGGER_LEVEL_DEBUG 0
+#define LOGGER_LEVEL_INFO 1
+#define LOGGER_LEVEL_WARN 2
+#define LOGGER_LEVEL_ERROR 3
+#define LOGGER_LEVEL_OFF 4
+
+//编译期最低等级，低于它的日志宏展开成空语句，参数不会求值
+//发布版本可以在cmake里-DLOGGER_ACTIVE_LEVEL=LOGGER_LEVEL_WARN
+#ifndef LOGGER_ACTIVE_LEVEL
+#define LOGGER_ACTIVE_LEVEL LOGGER_LEVEL_DEBUG
+#endif
+
+//运行期等级，由logger_set_level_*设置，先于参数求值检查
+extern std::atomic<int> logger_runtime_level;
+
+//二进制模式下只记site id和原始参数，文本在binlog_decode里还原
+#define _logger_call_(lvl, method, fmt, ...) \
+    do { \
+        if (logger_runtime_level.load(std::memory_order_relaxed) <= (lvl)) { \
+            if (binlog_enabled()) { \
+                static binlog_site _logger_site_(__FILE__, __LINE__, (lvl), fmt); \
+                binlog_write(_logger_site_, ##__VA_ARGS__); \
+            } \
+            else if (spdlogger.get() != nullptr) \
+                spdlogger->method(__FILE__ ":" __STR_LINE__ ": " fmt, ##__VA_ARGS__); \
+        } \
+    } while (0)
+#define _logger_disabled_() do {} while (0)
+
+#if LOGGER_ACTIVE_LEVEL <= LOGGER_LEVEL_DEBUG
+#define logdebug(fmt,...) _logger_call_(LOGGER_LEVEL_DEBUG, debug, fmt, ##__VA_ARGS__)
+#else
+#define logdebug(fmt,...) _logger_disabled_()
+#endif
+#if LOGGER_ACTIVE_LEVEL <= LOGGER_LEVEL_INFO
+#define loginfo(fmt,...) _logger_call_(LOGGER_LEVEL_INFO, info, fmt, ##__VA_ARGS__)
+#else
+#define loginfo(fmt,...) _logger_disabled_()
+#endif
+#if LOGGER_ACTIVE_LEVEL <= LOGGER_LEVEL_WARN
+#define logwarn(fmt,...) _logger_call_(LOGGER_LEVEL_WARN, warn, fmt, ##__VA_ARGS__)
+#else
+#define logwarn(fmt,...) _logger_disabled_()
+#endif
+#if LOGGER_ACTIVE_LEVEL <= LOGGER_LEVEL_ERROR
+#define logerror(fmt,...) _logger_call_(LOGGER_LEVEL_ERROR, error, fmt, ##__VA_ARGS__)
+#else
+#define logerror(fmt,...) _logger_disabled_()
+#endif
 
 
 extern "C" void logger_init_file_output(const char * path);
+
+//异步模式：调用线程只入队，后台线程格式化和写盘
+//队列满时的处理，丢掉的条数在logger_async_stats里
+enum logger_overflow_policy {
+    LOGGER_OVERFLOW_BLOCK = 0,
+    LOGGER_OVERFLOW_DROP_NEWEST = 1,
+    LOGGER_OVERFLOW_DROP_OLDEST = 2,
+};
+struct logger_async_stats {
+    unsigned long long enqueued;
+    unsigned long long dropped_newest;
+    unsigned long long dropped_oldest;
+    unsigned long long blocked;
+};
+//queue_size向上取2的幂；退出时自动logger_shutdown，崩溃信号里会先把队列写完
+extern "C" void logger_init_async_file_output(const char * path, unsigned int queue_size, int overflow_policy);
+//二进制模式：每个线程一个ring_size字节的环，满了丢弃，丢弃数记在文件里
+//文件用binlog_decode转成文本；spdlog的logger不创建，退出和崩溃时的处理和异步模式一样
+extern "C" void logger_init_binary_output(const char * path, unsigned int ring_size);
+//不是异步模式时返回0
+extern "C" int logger_get_async_stats(struct logger_async_stats * stats);
+//等已经入队的日志写完并刷盘
+extern "C" void logger_flush();
+//停止后台线程，之后的日志同步写
+extern "C" void logger_shutdown();
+//初始化前后都可以调用
 extern "C" void logger_set_level_debug();
 extern "C" void logger_set_level_info();
 extern "C" void logger_set_level_warn();
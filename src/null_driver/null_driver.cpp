@@ -0,0 +1,622 @@
+#include "null_driver.h"
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+const uint32_t kSpirvMagic = 0x07230203;
+// 物理设备句柄 = (instance序号 << 8) | (设备下标 + 1)
+const uint32_t kMaxDevices = 255;
+
+// 配置展开成vk结构体，查询时只做拷贝
+struct DeviceState {
+    VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceFeatures features;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    std::vector<VkQueueFamilyProperties> queueFamilies;
+    std::vector<VkExtensionProperties> extensions;
+};
+
+struct DriverState {
+    NullDriverConfig config;
+    std::vector<VkLayerProperties> layers;
+    std::vector<VkExtensionProperties> instanceExtensions;
+    std::vector<DeviceState> devices;
+};
+
+struct NullInstance {
+    uint64_t serial;
+};
+
+struct NullDevice {
+    uint32_t deviceIndex;
+    // [queueFamilyIndex][queueIndex]，没有创建的族为空
+    std::vector<std::vector<VkQueue>> queues;
+};
+
+struct NullShaderModule {
+    // 和真驱动一样拷贝一份，调用者可以马上释放pCode
+    std::vector<uint32_t> code;
+};
+
+std::mutex gStateMutex;
+std::unique_ptr<DriverState> gState;
+std::atomic<uint64_t> gInstanceSerial(0);
+std::atomic<uint64_t> gQueueSerial(0);
+std::atomic<uint64_t> gLiveInstances(0);
+
+std::atomic<uint64_t> gInstanceQueries(0);
+std::atomic<uint64_t> gPhysicalDeviceQueries(0);
+std::atomic<uint64_t> gObjectsCreated(0);
+std::atomic<uint64_t> gLiveObjects(0);
+
+void CopyName(char * _dst, size_t _size, const std::string & _name)
+{
+    strncpy(_dst, _name.c_str(), _size - 1);
+    _dst[_size - 1] = '\0';
+}
+
+VkExtensionProperties MakeExtension(const std::string & _name)
+{
+    VkExtensionProperties props = {};
+    CopyName(props.extensionName, sizeof(props.extensionName), _name);
+    props.specVersion = 1;
+    return props;
+}
+
+std::unique_ptr<DriverState> BuildState(const NullDriverConfig & _config)
+{
+    if (_config.devices.size() > kMaxDevices) {
+        throw std::runtime_error("null driver supports at most 255 physical devices!");
+    }
+    std::unique_ptr<DriverState> state(new DriverState());
+    state->config = _config;
+    for (const std::string & name : _config.layers) {
+        VkLayerProperties props = {};
+        CopyName(props.layerName, sizeof(props.layerName), name);
+        props.specVersion = VK_API_VERSION_1_1;
+        props.implementationVersion = 1;
+        CopyName(props.description, sizeof(props.description), "null driver layer");
+        state->layers.push_back(props);
+    }
+    for (const std::string & name : _config.instanceExtensions) {
+        state->instanceExtensions.push_back(MakeExtension(name));
+    }
+    for (size_t i = 0; i < _config.devices.size(); i++) {
+        const NullDeviceConfig & device = _config.devices[i];
+        if (device.memoryHeaps.size() > VK_MAX_MEMORY_HEAPS || device.memoryTypes.size() > VK_MAX_MEMORY_TYPES) {
+            throw std::runtime_error("null driver device has too many memory heaps or types!");
+        }
+        DeviceState ds = {};
+        ds.properties.apiVersion = device.apiVersion;
+        ds.properties.driverVersion = 1;
+        ds.properties.vendorID = device.vendorID;
+        ds.properties.deviceID = device.deviceID;
+        ds.properties.deviceType = device.type;
+        CopyName(ds.properties.deviceName, sizeof(ds.properties.deviceName), device.name);
+        // 磁盘缓存按UUID区分设备，每块设备要不一样
+        snprintf(reinterpret_cast<char *>(ds.properties.pipelineCacheUUID), VK_UUID_SIZE, "nulldrv%08x", device.deviceID);
+        ds.properties.limits = device.limits;
+        ds.features = device.features;
+        ds.memoryProperties.memoryHeapCount = static_cast<uint32_t>(device.memoryHeaps.size());
+        std::copy(device.memoryHeaps.begin(), device.memoryHeaps.end(), ds.memoryProperties.memoryHeaps);
+        ds.memoryProperties.memoryTypeCount = static_cast<uint32_t>(device.memoryTypes.size());
+        for (size_t t = 0; t < device.memoryTypes.size(); t++) {
+            if (device.memoryTypes[t].heapIndex >= device.memoryHeaps.size()) {
+                throw std::runtime_error("null driver memory type references a missing heap!");
+            }
+            ds.memoryProperties.memoryTypes[t] = device.memoryTypes[t];
+        }
+        ds.queueFamilies = device.queueFamilies;
+        for (const std::string & name : device.extensions) {
+            ds.extensions.push_back(MakeExtension(name));
+        }
+        state->devices.push_back(std::move(ds));
+    }
+    return state;
+}
+
+DriverState & GetState()
+{
+    std::lock_guard<std::mutex> lock(gStateMutex);
+    if (gState.get() == nullptr) {
+        gState = BuildState(GetDefaultNullDriverConfig());
+    }
+    return *gState;
+}
+
+// 非dispatchable句柄在32位下是uint64_t，用C风格转换两种都能编译
+template<typename Handle>
+Handle ToHandle(const void * _object)
+{
+    return (Handle)(uintptr_t)_object;
+}
+
+template<typename Object, typename Handle>
+Object * FromHandle(Handle _handle)
+{
+    return (Object *)(uintptr_t)_handle;
+}
+
+// 物理设备句柄不对应任何内存，换instance以后句柄一定不同
+const DeviceState * GetDeviceState(VkPhysicalDevice _physicalDevice)
+{
+    uintptr_t value = reinterpret_cast<uintptr_t>(_physicalDevice);
+    uint32_t index = static_cast<uint32_t>(value & 0xff);
+    DriverState & state = GetState();
+    if (index == 0 || index > state.devices.size()) {
+        return nullptr;
+    }
+    return &state.devices[index - 1];
+}
+
+template<typename T>
+VkResult CopyArray(const std::vector<T> & _src, uint32_t * _count, T * _dst)
+{
+    uint32_t size = static_cast<uint32_t>(_src.size());
+    if (_dst == nullptr) {
+        *_count = size;
+        return VK_SUCCESS;
+    }
+    uint32_t n = std::min(*_count, size);
+    std::copy(_src.begin(), _src.begin() + n, _dst);
+    *_count = n;
+    return n < size ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
+bool HasLayer(const DriverState & _state, const char * _name)
+{
+    return std::find(_state.config.layers.begin(), _state.config.layers.end(), _name) != _state.config.layers.end();
+}
+
+bool HasExtension(const std::vector<VkExtensionProperties> & _extensions, const char * _name)
+{
+    for (const VkExtensionProperties & props : _extensions) {
+        if (strcmp(props.extensionName, _name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Created()
+{
+    gObjectsCreated.fetch_add(1, std::memory_order_relaxed);
+    gLiveObjects.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Destroyed()
+{
+    gLiveObjects.fetch_sub(1, std::memory_order_relaxed);
+}
+
+}
+
+NullDriverConfig GetDefaultNullDriverConfig(uint32_t _extraExtensions)
+{
+    NullDriverConfig config;
+    config.layers = { "VK_LAYER_KHRONOS_validation" };
+    config.instanceExtensions = {
+        "VK_KHR_surface", "VK_KHR_xcb_surface", "VK_KHR_xlib_surface", "VK_KHR_wayland_surface",
+        "VK_KHR_win32_surface", "VK_EXT_debug_utils", "VK_EXT_debug_report", "VK_KHR_get_physical_device_properties2",
+    };
+
+    // 填充的扩展排在前面，真正会被查的排在后面
+    std::vector<std::string> extensions;
+    char name[VK_MAX_EXTENSION_NAME_SIZE];
+    for (uint32_t i = 0; i < _extraExtensions; i++) {
+        snprintf(name, sizeof(name), "VK_NULL_padding_extension_%u", i);
+        extensions.push_back(name);
+    }
+    const char * common[] = {
+        "VK_KHR_swapchain", "VK_KHR_maintenance1", "VK_KHR_dedicated_allocation", "VK_KHR_timeline_semaphore",
+        "VK_KHR_synchronization2", "VK_EXT_memory_budget", "VK_KHR_push_descriptor",
+    };
+    extensions.insert(extensions.end(), std::begin(common), std::end(common));
+
+    NullDeviceConfig discrete;
+    discrete.name = "Null Discrete GPU";
+    discrete.type = VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+    discrete.deviceID = 1;
+    discrete.extensions = extensions;
+    discrete.queueFamilies = {
+        { VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT, 16, 64, { 1, 1, 1 } },
+        { VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT, 8, 64, { 1, 1, 1 } },
+        { VK_QUEUE_TRANSFER_BIT, 2, 64, { 16, 16, 8 } },
+    };
+    discrete.memoryHeaps = {
+        { 8ull << 30, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT },
+        { 256ull << 20, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT },
+        { 16ull << 30, 0 },
+    };
+    discrete.memoryTypes = {
+        { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0 },
+        { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 2 },
+        { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+            | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 2 },
+        { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 1 },
+    };
+    discrete.features.samplerAnisotropy = VK_TRUE;
+    discrete.features.fillModeNonSolid = VK_TRUE;
+    discrete.features.shaderInt64 = VK_TRUE;
+    discrete.features.pipelineStatisticsQuery = VK_TRUE;
+    VkPhysicalDeviceLimits & limits = discrete.limits;
+    limits.maxImageDimension2D = 16384;
+    limits.maxMemoryAllocationCount = 4096;
+    limits.bufferImageGranularity = 1024;
+    limits.maxBoundDescriptorSets = 8;
+    limits.maxPushConstantsSize = 256;
+    limits.maxComputeWorkGroupCount[0] = limits.maxComputeWorkGroupCount[1] = limits.maxComputeWorkGroupCount[2] = 65535;
+    limits.maxComputeWorkGroupInvocations = 1024;
+    limits.maxComputeWorkGroupSize[0] = 1024;
+    limits.maxComputeWorkGroupSize[1] = 1024;
+    limits.maxComputeWorkGroupSize[2] = 64;
+    limits.maxComputeSharedMemorySize = 48 * 1024;
+    limits.maxSamplerAnisotropy = 16.0f;
+    limits.minUniformBufferOffsetAlignment = 256;
+    limits.minStorageBufferOffsetAlignment = 16;
+    limits.optimalBufferCopyOffsetAlignment = 1;
+    limits.optimalBufferCopyRowPitchAlignment = 1;
+    limits.nonCoherentAtomSize = 64;
+    limits.timestampComputeAndGraphics = VK_TRUE;
+    limits.timestampPeriod = 1.0f;
+    limits.discreteQueuePriorities = 2;
+    limits.framebufferColorSampleCounts = VK_SAMPLE_COUNT_1_BIT | VK_SAMPLE_COUNT_4_BIT | VK_SAMPLE_COUNT_8_BIT;
+
+    NullDeviceConfig integrated;
+    integrated.name = "Null Integrated GPU";
+    integrated.type = VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU;
+    integrated.deviceID = 2;
+    integrated.extensions = extensions;
+    integrated.queueFamilies = {
+        { VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT, 1, 36, { 1, 1, 1 } },
+    };
+    integrated.memoryHeaps = {
+        { 8ull << 30, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT },
+    };
+    integrated.memoryTypes = {
+        { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0 },
+        { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0 },
+        { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 0 },
+    };
+    integrated.features = discrete.features;
+    integrated.limits = discrete.limits;
+    integrated.limits.bufferImageGranularity = 1;
+    integrated.limits.maxPushConstantsSize = 128;
+    integrated.limits.minUniformBufferOffsetAlignment = 64;
+    integrated.limits.timestampPeriod = 52.08f;
+
+    config.devices = { discrete, integrated };
+    return config;
+}
+
+void SetNullDriverConfig(const NullDriverConfig & _config)
+{
+    std::unique_ptr<DriverState> state = BuildState(_config);
+    std::lock_guard<std::mutex> lock(gStateMutex);
+    // 查询不加锁，有instance时配置必须保持不变
+    if (gLiveInstances.load() != 0) {
+        throw std::runtime_error("cannot change null driver config while instances are alive!");
+    }
+    gState = std::move(state);
+}
+
+const NullDriverConfig & GetNullDriverConfig()
+{
+    return GetState().config;
+}
+
+NullDriverStats GetNullDriverStats()
+{
+    return NullDriverStats{ gInstanceQueries.load(), gPhysicalDeviceQueries.load(), gObjectsCreated.load(),
+        gLiveObjects.load() };
+}
+
+void ResetNullDriverStats()
+{
+    gInstanceQueries.store(0);
+    gPhysicalDeviceQueries.store(0);
+    gObjectsCreated.store(0);
+}
+
+extern "C" {
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateInstanceVersion(uint32_t * pApiVersion)
+{
+    gInstanceQueries.fetch_add(1, std::memory_order_relaxed);
+    *pApiVersion = VK_API_VERSION_1_1;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateInstanceLayerProperties(uint32_t * pPropertyCount,
+        VkLayerProperties * pProperties)
+{
+    gInstanceQueries.fetch_add(1, std::memory_order_relaxed);
+    return CopyArray(GetState().layers, pPropertyCount, pProperties);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateInstanceExtensionProperties(const char * pLayerName,
+        uint32_t * pPropertyCount, VkExtensionProperties * pProperties)
+{
+    gInstanceQueries.fetch_add(1, std::memory_order_relaxed);
+    DriverState & state = GetState();
+    if (pLayerName != nullptr) {
+        // 假的层不带自己的扩展
+        if (!HasLayer(state, pLayerName)) {
+            return VK_ERROR_LAYER_NOT_PRESENT;
+        }
+        *pPropertyCount = 0;
+        return VK_SUCCESS;
+    }
+    return CopyArray(state.instanceExtensions, pPropertyCount, pProperties);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateInstance(const VkInstanceCreateInfo * pCreateInfo,
+        const VkAllocationCallbacks *, VkInstance * pInstance)
+{
+    DriverState & state = GetState();
+    for (uint32_t i = 0; i < pCreateInfo->enabledLayerCount; i++) {
+        if (!HasLayer(state, pCreateInfo->ppEnabledLayerNames[i])) {
+            return VK_ERROR_LAYER_NOT_PRESENT;
+        }
+    }
+    for (uint32_t i = 0; i < pCreateInfo->enabledExtensionCount; i++) {
+        if (!HasExtension(state.instanceExtensions, pCreateInfo->ppEnabledExtensionNames[i])) {
+            return VK_ERROR_EXTENSION_NOT_PRESENT;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(gStateMutex);
+        gLiveInstances.fetch_add(1);
+    }
+    NullInstance * instance = new NullInstance();
+    instance->serial = gInstanceSerial.fetch_add(1) + 1;
+    *pInstance = reinterpret_cast<VkInstance>(instance);
+    Created();
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyInstance(VkInstance instance, const VkAllocationCallbacks *)
+{
+    if (instance == VK_NULL_HANDLE) {
+        return;
+    }
+    delete reinterpret_cast<NullInstance *>(instance);
+    Destroyed();
+    gLiveInstances.fetch_sub(1);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumeratePhysicalDevices(VkInstance instance, uint32_t * pPhysicalDeviceCount,
+        VkPhysicalDevice * pPhysicalDevices)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    uint64_t serial = reinterpret_cast<NullInstance *>(instance)->serial;
+    std::vector<VkPhysicalDevice> devices(GetState().devices.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+        devices[i] = reinterpret_cast<VkPhysicalDevice>(static_cast<uintptr_t>((serial << 8) | (i + 1)));
+    }
+    return CopyArray(devices, pPhysicalDeviceCount, pPhysicalDevices);
+}
+
+VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceProperties(VkPhysicalDevice physicalDevice,
+        VkPhysicalDeviceProperties * pProperties)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    *pProperties = GetDeviceState(physicalDevice)->properties;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceFeatures(VkPhysicalDevice physicalDevice,
+        VkPhysicalDeviceFeatures * pFeatures)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    *pFeatures = GetDeviceState(physicalDevice)->features;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceMemoryProperties(VkPhysicalDevice physicalDevice,
+        VkPhysicalDeviceMemoryProperties * pMemoryProperties)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    *pMemoryProperties = GetDeviceState(physicalDevice)->memoryProperties;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceQueueFamilyProperties(VkPhysicalDevice physicalDevice,
+        uint32_t * pQueueFamilyPropertyCount, VkQueueFamilyProperties * pQueueFamilyProperties)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    CopyArray(GetDeviceState(physicalDevice)->queueFamilies, pQueueFamilyPropertyCount, pQueueFamilyProperties);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkEnumerateDeviceExtensionProperties(VkPhysicalDevice physicalDevice,
+        const char * pLayerName, uint32_t * pPropertyCount, VkExtensionProperties * pProperties)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    if (pLayerName != nullptr) {
+        if (!HasLayer(GetState(), pLayerName)) {
+            return VK_ERROR_LAYER_NOT_PRESENT;
+        }
+        *pPropertyCount = 0;
+        return VK_SUCCESS;
+    }
+    return CopyArray(GetDeviceState(physicalDevice)->extensions, pPropertyCount, pProperties);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateDevice(VkPhysicalDevice physicalDevice, const VkDeviceCreateInfo * pCreateInfo,
+        const VkAllocationCallbacks *, VkDevice * pDevice)
+{
+    const DeviceState * ds = GetDeviceState(physicalDevice);
+    if (ds == nullptr) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    for (uint32_t i = 0; i < pCreateInfo->enabledExtensionCount; i++) {
+        if (!HasExtension(ds->extensions, pCreateInfo->ppEnabledExtensionNames[i])) {
+            return VK_ERROR_EXTENSION_NOT_PRESENT;
+        }
+    }
+    if (pCreateInfo->pEnabledFeatures != nullptr) {
+        // VkPhysicalDeviceFeatures全是VkBool32
+        const VkBool32 * requested = reinterpret_cast<const VkBool32 *>(pCreateInfo->pEnabledFeatures);
+        const VkBool32 * supported = reinterpret_cast<const VkBool32 *>(&ds->features);
+        for (size_t i = 0; i < sizeof(VkPhysicalDeviceFeatures) / sizeof(VkBool32); i++) {
+            if (requested[i] && !supported[i]) {
+                return VK_ERROR_FEATURE_NOT_PRESENT;
+            }
+        }
+    }
+    std::unique_ptr<NullDevice> device(new NullDevice());
+    device->deviceIndex = static_cast<uint32_t>(ds - GetState().devices.data());
+    device->queues.resize(ds->queueFamilies.size());
+    for (uint32_t i = 0; i < pCreateInfo->queueCreateInfoCount; i++) {
+        const VkDeviceQueueCreateInfo & queueInfo = pCreateInfo->pQueueCreateInfos[i];
+        // 同一个族只能出现一次，个数不能超过queueCount
+        if (queueInfo.queueFamilyIndex >= ds->queueFamilies.size() || queueInfo.queueCount == 0
+                || queueInfo.queueCount > ds->queueFamilies[queueInfo.queueFamilyIndex].queueCount
+                || !device->queues[queueInfo.queueFamilyIndex].empty()) {
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        for (uint32_t q = 0; q < queueInfo.queueCount; q++) {
+            device->queues[queueInfo.queueFamilyIndex].push_back(
+                    reinterpret_cast<VkQueue>(static_cast<uintptr_t>(gQueueSerial.fetch_add(1) + 1)));
+        }
+    }
+    *pDevice = reinterpret_cast<VkDevice>(device.release());
+    Created();
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyDevice(VkDevice device, const VkAllocationCallbacks *)
+{
+    if (device == VK_NULL_HANDLE) {
+        return;
+    }
+    delete reinterpret_cast<NullDevice *>(device);
+    Destroyed();
+}
+
+VKAPI_ATTR void VKAPI_CALL vkGetDeviceQueue(VkDevice device, uint32_t queueFamilyIndex, uint32_t queueIndex,
+        VkQueue * pQueue)
+{
+    NullDevice * nullDevice = reinterpret_cast<NullDevice *>(device);
+    *pQueue = VK_NULL_HANDLE;
+    if (queueFamilyIndex < nullDevice->queues.size() && queueIndex < nullDevice->queues[queueFamilyIndex].size()) {
+        *pQueue = nullDevice->queues[queueFamilyIndex][queueIndex];
+    }
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkCreateShaderModule(VkDevice, const VkShaderModuleCreateInfo * pCreateInfo,
+        const VkAllocationCallbacks *, VkShaderModule * pShaderModule)
+{
+    if (pCreateInfo->codeSize == 0 || pCreateInfo->codeSize % sizeof(uint32_t) != 0
+            || pCreateInfo->pCode[0] != kSpirvMagic) {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    NullShaderModule * module = new NullShaderModule();
+    module->code.assign(pCreateInfo->pCode, pCreateInfo->pCode + pCreateInfo->codeSize / sizeof(uint32_t));
+    *pShaderModule = ToHandle<VkShaderModule>(module);
+    Created();
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkDestroyShaderModule(VkDevice, VkShaderModule shaderModule, const VkAllocationCallbacks *)
+{
+    if (shaderModule == VK_NULL_HANDLE) {
+        return;
+    }
+    delete FromHandle<NullShaderModule>(shaderModule);
+    Destroyed();
+}
+
+VKAPI_ATTR void VKAPI_CALL vkGetImageSubresourceLayout(VkDevice, VkImage, const VkImageSubresource *,
+        VkSubresourceLayout * pLayout)
+{
+    // 不创建image
+    *pLayout = {};
+}
+
+// 没有surface，交换链相关的查询都当作不支持
+VKAPI_ATTR VkResult VKAPI_CALL vkGetPhysicalDeviceSurfaceSupportKHR(VkPhysicalDevice, uint32_t, VkSurfaceKHR,
+        VkBool32 * pSupported)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    *pSupported = VK_FALSE;
+    return VK_SUCCESS;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkGetPhysicalDeviceSurfaceCapabilitiesKHR(VkPhysicalDevice, VkSurfaceKHR,
+        VkSurfaceCapabilitiesKHR * pSurfaceCapabilities)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    *pSurfaceCapabilities = {};
+    return VK_ERROR_SURFACE_LOST_KHR;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkGetPhysicalDeviceSurfaceFormatsKHR(VkPhysicalDevice, VkSurfaceKHR,
+        uint32_t * pSurfaceFormatCount, VkSurfaceFormatKHR *)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    *pSurfaceFormatCount = 0;
+    return VK_ERROR_SURFACE_LOST_KHR;
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkGetPhysicalDeviceSurfacePresentModesKHR(VkPhysicalDevice, VkSurfaceKHR,
+        uint32_t * pPresentModeCount, VkPresentModeKHR *)
+{
+    gPhysicalDeviceQueries.fetch_add(1, std::memory_order_relaxed);
+    *pPresentModeCount = 0;
+    return VK_ERROR_SURFACE_LOST_KHR;
+}
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vkGetInstanceProcAddr(VkInstance, const char * pName)
+{
+#define NULL_DRIVER_ENTRY(name) { #name, reinterpret_cast<PFN_vkVoidFunction>(name) }
+    static const struct {
+        const char * name;
+        PFN_vkVoidFunction function;
+    } entries[] = {
+        NULL_DRIVER_ENTRY(vkGetInstanceProcAddr),
+        NULL_DRIVER_ENTRY(vkGetDeviceProcAddr),
+        NULL_DRIVER_ENTRY(vkEnumerateInstanceVersion),
+        NULL_DRIVER_ENTRY(vkEnumerateInstanceLayerProperties),
+        NULL_DRIVER_ENTRY(vkEnumerateInstanceExtensionProperties),
+        NULL_DRIVER_ENTRY(vkCreateInstance),
+        NULL_DRIVER_ENTRY(vkDestroyInstance),
+        NULL_DRIVER_ENTRY(vkEnumeratePhysicalDevices),
+        NULL_DRIVER_ENTRY(vkGetPhysicalDeviceProperties),
+        NULL_DRIVER_ENTRY(vkGetPhysicalDeviceFeatures),
+        NULL_DRIVER_ENTRY(vkGetPhysicalDeviceMemoryProperties),
+        NULL_DRIVER_ENTRY(vkGetPhysicalDeviceQueueFamilyProperties),
+        NULL_DRIVER_ENTRY(vkEnumerateDeviceExtensionProperties),
+        NULL_DRIVER_ENTRY(vkCreateDevice),
+        NULL_DRIVER_ENTRY(vkDestroyDevice),
+        NULL_DRIVER_ENTRY(vkGetDeviceQueue),
+        NULL_DRIVER_ENTRY(vkCreateShaderModule),
+        NULL_DRIVER_ENTRY(vkDestroyShaderModule),
+        NULL_DRIVER_ENTRY(vkGetImageSubresourceLayout),
+        NULL_DRIVER_ENTRY(vkGetPhysicalDeviceSurfaceSupportKHR),
+        NULL_DRIVER_ENTRY(vkGetPhysicalDeviceSurfaceCapabilitiesKHR),
+        NULL_DRIVER_ENTRY(vkGetPhysicalDeviceSurfaceFormatsKHR),
+        NULL_DRIVER_ENTRY(vkGetPhysicalDeviceSurfacePresentModesKHR),
+    };
+#undef NULL_DRIVER_ENTRY
+    // 没实现的扩展入口返回空，调用者按扩展不可用处理，例如DebugMessenger
+    for (const auto & entry : entries) {
+        if (strcmp(entry.name, pName) == 0) {
+            return entry.function;
+        }
+    }
+    return nullptr;
+}
+
+VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vkGetDeviceProcAddr(VkDevice, const char * pName)
+{
+    return vkGetInstanceProcAddr(VK_NULL_HANDLE, pName);
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+/*
+ * 没有GPU时代替vulkan loader的空驱动，链接它而不是libvulkan，vk*入口直接由这里实现
+ * 只实现helper、device_capabilities、shader_loader用到的入口，返回配置好的假设备、层、扩展、队列族和内存堆
+ *   1. 每个instance的物理设备句柄都不一样，GetDeviceCapabilities的缓存每次都是冷的，和真实启动一样
+ *   2. vkCreateInstance/vkCreateDevice检查层、扩展和队列，不支持时返回和真驱动一样的错误码
+ *   3. 统计查询次数和还没销毁的对象数，查询次数是确定的，比耗时更适合在CI上比较
+ * 不执行命令，也不分配设备内存，只用来测启动和CPU侧的开销
+ */
+struct NullDeviceConfig {
+    std::string name;
+    VkPhysicalDeviceType type = VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+    uint32_t apiVersion = VK_API_VERSION_1_1;
+    uint32_t vendorID = 0;
+    uint32_t deviceID = 0;
+    std::vector<std::string> extensions;
+    std::vector<VkQueueFamilyProperties> queueFamilies;
+    std::vector<VkMemoryHeap> memoryHeaps;
+    // heapIndex指向memoryHeaps
+    std::vector<VkMemoryType> memoryTypes;
+    VkPhysicalDeviceFeatures features = {};
+    VkPhysicalDeviceLimits limits = {};
+};
+
+struct NullDriverConfig {
+    std::vector<std::string> layers;
+    std::vector<std::string> instanceExtensions;
+    std::vector<NullDeviceConfig> devices;
+};
+
+struct NullDriverStats {
+    // vkEnumerateInstance*
+    uint64_t instanceQueries;
+    // vkEnumeratePhysicalDevices、vkGetPhysicalDevice*、vkEnumerateDevice*
+    uint64_t physicalDeviceQueries;
+    uint64_t objectsCreated;
+    // 还没销毁的instance、device、shader module
+    uint64_t liveObjects;
+};
+
+/**
+ * desc: 一块独显加一块集显，各带_extraExtensions个假的设备扩展(真实驱动一般有一两百个)
+ *       独显：graphics+compute+transfer、compute、transfer三个队列族，DEVICE_LOCAL显存、BAR、系统内存
+ *       集显：一个全能队列族，共享内存
+ **/
+NullDriverConfig GetDefaultNullDriverConfig(uint32_t _extraExtensions = 0);
+
+// 还有没销毁的instance时不能换配置，抛runtime_error；也不能和别的vk调用同时进行
+void SetNullDriverConfig(const NullDriverConfig & _config);
+const NullDriverConfig & GetNullDriverConfig();
+
+NullDriverStats GetNullDriverStats();
+// 只清零查询和创建次数，liveObjects不变
+void ResetNullDriverStats();
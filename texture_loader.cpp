@@ -0,0 +1,208 @@
+#include "texture_loader.h"
+#include "helper.h"
+#include "thread_pool.h"
+#include "upload_ring.h"
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <logger.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+struct TextureLoader::DecodedImage {
+    std::shared_ptr<stbi_uc> pixels;
+    uint32_t width;
+    uint32_t height;
+};
+
+TextureLoader::TextureLoader(VkDevice _device, VkPhysicalDevice _physicalDevice, DeviceMemoryAllocator & _allocator,
+        UploadRing & _uploadRing, ThreadPool & _pool) :
+    device_(_device),
+    physicalDevice_(_physicalDevice),
+    allocator_(_allocator),
+    uploadRing_(_uploadRing),
+    pool_(_pool)
+{
+}
+
+std::vector<Texture> TextureLoader::LoadTextures(const std::vector<const char*> & _fileNames, bool _srgb,
+        bool _generateMips)
+{
+    // 解码全部丢给线程池，调用线程按顺序边等边上传，第一张解完就开始上传
+    std::vector<std::future<DecodedImage>> futures;
+    futures.reserve(_fileNames.size());
+    for (const char * fileName : _fileNames) {
+        futures.push_back(pool_.Enqueue([fileName]() {
+            int width = 0;
+            int height = 0;
+            int channels = 0;
+            // 三通道的格式很多设备不支持做OPTIMAL image，统一解成RGBA
+            stbi_uc * pixels = stbi_load(fileName, &width, &height, &channels, STBI_rgb_alpha);
+            if (pixels == nullptr) {
+                logerror("failed to decode {}: {}", fileName, stbi_failure_reason());
+                throw std::runtime_error("failed to decode texture!");
+            }
+            DecodedImage decoded;
+            decoded.pixels = std::shared_ptr<stbi_uc>(pixels, stbi_image_free);
+            decoded.width = static_cast<uint32_t>(width);
+            decoded.height = static_cast<uint32_t>(height);
+            return decoded;
+        }));
+    }
+
+    VkFormat format = _srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    std::vector<Texture> textures;
+    textures.reserve(_fileNames.size());
+    try {
+        for (auto & future : futures) {
+            textures.push_back(CreateTexture(future.get(), format, _generateMips));
+        }
+        uploadRing_.Submit();
+    }
+    catch (...) {
+        // 剩下的解码任务也要等完，pixels跟着future一起释放
+        for (auto & future : futures) {
+            if (future.valid()) {
+                future.wait();
+            }
+        }
+        // 已经提交的上传可能还在用这些image
+        uploadRing_.Finish();
+        for (auto & texture : textures) {
+            DestroyTexture(texture);
+        }
+        throw;
+    }
+    loginfo("loaded {} textures", textures.size());
+    return textures;
+}
+
+Texture TextureLoader::CreateTexture(const DecodedImage & _decoded, VkFormat _format, bool _generateMips)
+{
+    Texture texture;
+    texture.format = _format;
+    texture.width = _decoded.width;
+    texture.height = _decoded.height;
+
+    VkFilter filter = VK_FILTER_LINEAR;
+    if (_generateMips) {
+        VkFormatProperties formatProps;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice_, _format, &formatProps);
+        VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+        if ((formatProps.optimalTilingFeatures & blit) != blit) {
+            logwarn("format:{} does not support blit, mips are not generated", static_cast<int>(_format));
+        }
+        else {
+            texture.mipLevels = GetMipLevelCount(texture.width, texture.height);
+            if (!(formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+                filter = VK_FILTER_NEAREST;
+            }
+        }
+    }
+
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (texture.mipLevels > 1) {
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    VkImageCreateInfo imageInfo = Get2DImageCreateInfo(texture.width, texture.height, VK_IMAGE_TILING_OPTIMAL,
+            usage, _format, texture.mipLevels);
+    if (vkCreateImage(device_, &imageInfo, nullptr, &texture.image) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create texture image!");
+    }
+    try {
+        texture.memory = allocator_.AllocateForImage(texture.image, VK_IMAGE_TILING_OPTIMAL,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VkImageViewCreateInfo viewInfo = Get2DImageViewCreateInfo(texture.image, _format, texture.mipLevels);
+        if (vkCreateImageView(device_, &viewInfo, nullptr, &texture.view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture image view!");
+        }
+
+        VkImageSubresourceLayers layers = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        VkDeviceSize size = static_cast<VkDeviceSize>(texture.width) * texture.height * 4;
+        if (texture.mipLevels == 1) {
+            // 没有mip的可以攒在一个batch里，最后一起提交
+            uploadRing_.UploadImage(texture.image, layers, { texture.width, texture.height, 1 },
+                    _decoded.pixels.get(), size, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        }
+        else {
+            // 第0层拷完直接是TRANSFER_SRC，mip在同一个command buffer里接着生成
+            uploadRing_.UploadImage(texture.image, layers, { texture.width, texture.height, 1 },
+                    _decoded.pixels.get(), size, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+            uploadRing_.Submit(VK_NULL_HANDLE, [this, &texture, filter](VkCommandBuffer _commandBuffer) {
+                RecordMipChain(_commandBuffer, texture, filter);
+            });
+        }
+    }
+    catch (...) {
+        DestroyTexture(texture);
+        throw;
+    }
+    return texture;
+}
+
+void TextureLoader::RecordMipChain(VkCommandBuffer _commandBuffer, const Texture & _texture, VkFilter _filter)
+{
+    // 1..n-1层一次转成TRANSFER_DST
+    VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 1, _texture.mipLevels - 1, 0, 1 };
+    VkImageMemoryBarrier barrier = GetDstImageBeforeCopyMemoryBarrier(VK_QUEUE_FAMILY_IGNORED,
+            VK_QUEUE_FAMILY_IGNORED, _texture.image, range);
+    barrier.srcAccessMask = 0;
+    vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+    int32_t width = static_cast<int32_t>(_texture.width);
+    int32_t height = static_cast<int32_t>(_texture.height);
+    for (uint32_t level = 1; level < _texture.mipLevels; level++) {
+        int32_t nextWidth = width > 1 ? width / 2 : 1;
+        int32_t nextHeight = height > 1 ? height / 2 : 1;
+
+        VkImageBlit blit = {};
+        blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+        blit.srcOffsets[0] = { 0, 0, 0 };
+        blit.srcOffsets[1] = { width, height, 1 };
+        blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+        blit.dstOffsets[0] = { 0, 0, 0 };
+        blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+        vkCmdBlitImage(_commandBuffer, _texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                _texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, _filter);
+
+        // 这一层写完变成下一层的源
+        VkImageMemoryBarrier levelBarrier = barrier;
+        levelBarrier.subresourceRange.baseMipLevel = level;
+        levelBarrier.subresourceRange.levelCount = 1;
+        levelBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        levelBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        levelBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        levelBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                0, nullptr, 0, nullptr, 1, &levelBarrier);
+
+        width = nextWidth;
+        height = nextHeight;
+    }
+
+    // 所有层一起转成采样用的layout
+    VkImageMemoryBarrier finalBarrier = barrier;
+    finalBarrier.subresourceRange.baseMipLevel = 0;
+    finalBarrier.subresourceRange.levelCount = _texture.mipLevels;
+    finalBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    finalBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    finalBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    finalBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &finalBarrier);
+}
+
+void TextureLoader::DestroyTexture(Texture & _texture)
+{
+    if (_texture.view != VK_NULL_HANDLE) {
+        vkDestroyImageView(device_, _texture.view, nullptr);
+    }
+    if (_texture.image != VK_NULL_HANDLE) {
+        vkDestroyImage(device_, _texture.image, nullptr);
+    }
+    allocator_.Free(_texture.memory);
+    _texture = Texture();
+}
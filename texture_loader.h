@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <vulkan/vulkan.h>
+#include "memory_allocator.h"
+
+class ThreadPool;
+class UploadRing;
+
+/*
+ * 纹理加载
+ *   1. 线程池里并行用stb_image解码，统一解成RGBA8
+ *   2. 在调用线程里建image，第0层通过UploadRing拷进去
+ *   3. 同一个command buffer里用vkCmdBlitImage逐级生成mip，最后整张转成SHADER_READ_ONLY_OPTIMAL
+ * 格式不支持BLIT_SRC/BLIT_DST时只有一层，不支持线性过滤时用NEAREST缩小
+ * 上传和mip生成提交到UploadRing的queue上，同一个queue上之后提交的命令可以直接采样
+ */
+struct Texture {
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    MemoryAllocation memory;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 1;
+};
+
+class TextureLoader {
+public:
+    TextureLoader(VkDevice _device, VkPhysicalDevice _physicalDevice, DeviceMemoryAllocator & _allocator,
+            UploadRing & _uploadRing, ThreadPool & _pool);
+
+    /**
+     * desc: 加载一组图片，返回的顺序和_fileNames一致
+     *       _srgb 颜色贴图用SRGB格式，法线、粗糙度这类数据贴图用UNORM
+     *       有文件解码失败时已经创建的纹理全部销毁，然后抛异常
+     **/
+    std::vector<Texture> LoadTextures(const std::vector<const char*> & _fileNames, bool _srgb = true,
+            bool _generateMips = true);
+    void DestroyTexture(Texture & _texture);
+
+private:
+    struct DecodedImage;
+
+    Texture CreateTexture(const DecodedImage & _decoded, VkFormat _format, bool _generateMips);
+    void RecordMipChain(VkCommandBuffer _commandBuffer, const Texture & _texture, VkFilter _filter);
+
+    VkDevice device_;
+    VkPhysicalDevice physicalDevice_;
+    DeviceMemoryAllocator & allocator_;
+    UploadRing & uploadRing_;
+    ThreadPool & pool_;
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+/*
+ * 固定线程数的线程池，Enqueue返回future，任务里抛出的异常会在future.get()时重新抛出
+ * 析构时等已经入队的任务全部执行完
+ */
+class ThreadPool {
+public:
+    // _threadCount为0时用hardware_concurrency
+    explicit ThreadPool(size_t _threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    template<typename F>
+    auto Enqueue(F && _task) -> std::future<decltype(_task())>
+    {
+        using Result = decltype(_task());
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(_task));
+        std::future<Result> future = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace([packaged]() { (*packaged)(); });
+        }
+        cond_.notify_one();
+        return future;
+    }
+
+    size_t GetThreadCount() const { return workers_.size(); }
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_;
+};
@@ -0,0 +1,316 @@
+#include "upload_ring.h"
+#include "helper.h"
+#include "device_capabilities.h"
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <logger.h>
+
+namespace {
+
+VkDeviceSize AlignUp(VkDeviceSize _value, VkDeviceSize _alignment)
+{
+    return (_value + _alignment - 1) / _alignment * _alignment;
+}
+
+bool SameRange(const VkImageSubresourceRange & _a, const VkImageSubresourceRange & _b)
+{
+    return _a.aspectMask == _b.aspectMask && _a.baseMipLevel == _b.baseMipLevel && _a.levelCount == _b.levelCount
+        && _a.baseArrayLayer == _b.baseArrayLayer && _a.layerCount == _b.layerCount;
+}
+
+}
+
+UploadRing::UploadRing(VkDevice _device, VkPhysicalDevice _physicalDevice, VkQueue _queue,
+        uint32_t _queueFamilyIndex, VkDeviceSize _size, uint32_t _maxBatches) :
+    device_(_device),
+    queue_(_queue),
+    buffer_(VK_NULL_HANDLE),
+    memory_(VK_NULL_HANDLE),
+    mapped_(nullptr),
+    size_(_size),
+    maxBatches_(std::max<uint32_t>(_maxBatches, 1)),
+    commandPool_(VK_NULL_HANDLE),
+    head_(0),
+    tail_(0)
+{
+    const DeviceCapabilities & caps = GetDeviceCapabilities(_physicalDevice);
+    // bufferOffset必须是4和texel大小的倍数，16可以覆盖到RGBA32F
+    imageAlignment_ = std::max<VkDeviceSize>(caps.properties.limits.optimalBufferCopyOffsetAlignment, 16);
+
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size_;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(device_, &bufferInfo, nullptr, &buffer_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create staging buffer!");
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device_, buffer_, &requirements);
+    //规范保证至少有一种HOST_VISIBLE|HOST_COHERENT的内存类型
+    int typeIndex = FindMemoryTypeIndex(&caps.memoryProperties, requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if (typeIndex < 0) {
+        vkDestroyBuffer(device_, buffer_, nullptr);
+        throw std::runtime_error("failed to find staging memory type!");
+    }
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = requirements.size;
+    allocInfo.memoryTypeIndex = static_cast<uint32_t>(typeIndex);
+    if (vkAllocateMemory(device_, &allocInfo, nullptr, &memory_) != VK_SUCCESS) {
+        vkDestroyBuffer(device_, buffer_, nullptr);
+        throw std::runtime_error("failed to allocate staging memory!");
+    }
+    vkBindBufferMemory(device_, buffer_, memory_, 0);
+    void * mapped = nullptr;
+    vkMapMemory(device_, memory_, 0, VK_WHOLE_SIZE, 0, &mapped);
+    mapped_ = static_cast<char *>(mapped);
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = _queueFamilyIndex;
+    if (vkCreateCommandPool(device_, &poolInfo, nullptr, &commandPool_) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload command pool!");
+    }
+}
+
+UploadRing::~UploadRing()
+{
+    if (!bufferCopies_.empty() || !imageUploads_.empty()) {
+        logwarn("upload ring destroyed with pending uploads");
+    }
+    while (!inFlight_.empty()) {
+        RetireOldest();
+    }
+    for (auto & batch : freeBatches_) {
+        vkDestroyFence(device_, batch.fence, nullptr);
+    }
+    vkDestroyCommandPool(device_, commandPool_, nullptr);
+    vkUnmapMemory(device_, memory_);
+    vkFreeMemory(device_, memory_, nullptr);
+    vkDestroyBuffer(device_, buffer_, nullptr);
+}
+
+VkDeviceSize UploadRing::Allocate(VkDeviceSize _size, VkDeviceSize _alignment)
+{
+    if (_size > size_) {
+        throw std::runtime_error("upload larger than staging ring!");
+    }
+
+    for (;;) {
+        uint64_t pos = head_;
+        VkDeviceSize phys = pos % size_;
+        VkDeviceSize aligned = AlignUp(phys, _alignment);
+        if (aligned + _size > size_) {
+            //尾部放不下，跳到开头
+            pos += size_ - phys;
+            aligned = 0;
+        }
+        else {
+            pos += aligned - phys;
+        }
+
+        if (pos + _size - tail_ <= size_) {
+            head_ = pos + _size;
+            return aligned;
+        }
+
+        if (!inFlight_.empty()) {
+            RetireOldest();
+        }
+        else if (!bufferCopies_.empty() || !imageUploads_.empty()) {
+            //当前batch自己把ring占满了，先提交
+            Submit();
+        }
+        else {
+            head_ = tail_ = 0;
+        }
+    }
+}
+
+void UploadRing::RetireOldest()
+{
+    Batch batch = inFlight_.front();
+    inFlight_.pop_front();
+    vkWaitForFences(device_, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(device_, 1, &batch.fence);
+    tail_ = batch.end;
+    freeBatches_.push_back(batch);
+}
+
+void UploadRing::Poll()
+{
+    while (!inFlight_.empty() && vkGetFenceStatus(device_, inFlight_.front().fence) == VK_SUCCESS) {
+        RetireOldest();
+    }
+}
+
+UploadRing::Batch UploadRing::AcquireBatch()
+{
+    if (freeBatches_.empty()) {
+        if (inFlight_.size() < maxBatches_) {
+            Batch batch = {};
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = commandPool_;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+            if (vkAllocateCommandBuffers(device_, &allocInfo, &batch.commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate upload command buffer!");
+            }
+            VkFenceCreateInfo fenceInfo = {};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            if (vkCreateFence(device_, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create upload fence!");
+            }
+            return batch;
+        }
+        RetireOldest();
+    }
+    Batch batch = freeBatches_.back();
+    freeBatches_.pop_back();
+    return batch;
+}
+
+void UploadRing::UploadBuffer(VkBuffer _dst, VkDeviceSize _dstOffset, const void * _data, VkDeviceSize _size)
+{
+    VkDeviceSize offset = Allocate(_size, 4);
+    memcpy(mapped_ + offset, _data, _size);
+
+    //连续的小块合并成一个region
+    auto & regions = bufferCopies_[_dst];
+    if (!regions.empty()) {
+        VkBufferCopy & last = regions.back();
+        if (last.srcOffset + last.size == offset && last.dstOffset + last.size == _dstOffset) {
+            last.size += _size;
+            return;
+        }
+    }
+    regions.push_back(VkBufferCopy{ offset, _dstOffset, _size });
+}
+
+void UploadRing::UploadImage(VkImage _image, const VkImageSubresourceLayers & _subresource, VkExtent3D _extent,
+        const void * _data, VkDeviceSize _size, VkImageLayout _finalLayout)
+{
+    VkDeviceSize offset = Allocate(_size, imageAlignment_);
+    memcpy(mapped_ + offset, _data, _size);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = offset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource = _subresource;
+    region.imageOffset = { 0, 0, 0 };
+    region.imageExtent = _extent;
+
+    VkImageSubresourceRange range = {
+        _subresource.aspectMask,
+        _subresource.mipLevel,
+        1,
+        _subresource.baseArrayLayer,
+        _subresource.layerCount
+    };
+
+    ImageUpload & upload = imageUploads_[_image];
+    upload.finalLayout = _finalLayout;
+    upload.regions.push_back(region);
+    bool found = false;
+    for (const auto & r : upload.ranges) {
+        if (SameRange(r, range)) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        upload.ranges.push_back(range);
+    }
+}
+
+VkFence UploadRing::Submit(VkSemaphore _signal, const std::function<void(VkCommandBuffer)> & _record)
+{
+    if (bufferCopies_.empty() && imageUploads_.empty()) {
+        return VK_NULL_HANDLE;
+    }
+
+    Poll();
+    Batch batch = AcquireBatch();
+    VkCommandBuffer cmd = batch.commandBuffer;
+
+    VkCommandBufferBeginInfo beginInfo = GetCommandBufferOneTimeSubmitBeginInfo();
+    vkBeginCommandBuffer(cmd, &beginInfo);
+
+    for (const auto & copy : bufferCopies_) {
+        vkCmdCopyBuffer(cmd, buffer_, copy.first, static_cast<uint32_t>(copy.second.size()), copy.second.data());
+    }
+
+    std::vector<VkImageMemoryBarrier> barriers;
+    for (const auto & upload : imageUploads_) {
+        for (const auto & range : upload.second.ranges) {
+            barriers.push_back(GetDstImageBeforeCopyMemoryBarrier(
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, upload.first, range));
+        }
+    }
+    if (!barriers.empty()) {
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+    }
+
+    for (const auto & upload : imageUploads_) {
+        vkCmdCopyBufferToImage(cmd, buffer_, upload.first, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                static_cast<uint32_t>(upload.second.regions.size()), upload.second.regions.data());
+    }
+
+    barriers.clear();
+    for (const auto & upload : imageUploads_) {
+        for (const auto & range : upload.second.ranges) {
+            VkImageMemoryBarrier barrier = GetDstImageAfterCopyMemoryBarrier(
+                    VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, upload.first, range);
+            barrier.newLayout = upload.second.finalLayout;
+            barriers.push_back(barrier);
+        }
+    }
+    //buffer的写入用一个全局memory barrier让后面的命令可见
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+            bufferCopies_.empty() ? 0 : 1, &memoryBarrier, 0, nullptr,
+            static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    if (_record) {
+        _record(cmd);
+    }
+    vkEndCommandBuffer(cmd);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    if (_signal != VK_NULL_HANDLE) {
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &_signal;
+    }
+    if (vkQueueSubmit(queue_, 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit upload batch!");
+    }
+
+    batch.end = head_;
+    inFlight_.push_back(batch);
+    bufferCopies_.clear();
+    imageUploads_.clear();
+    return batch.fence;
+}
+
+void UploadRing::Finish()
+{
+    Submit();
+    while (!inFlight_.empty()) {
+        RetireOldest();
+    }
+}
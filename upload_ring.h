@@ -0,0 +1,74 @@
+#pragma once
+#include <map>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <vulkan/vulkan.h>
+
+/*
+ * 上传用的staging ring
+ * 一块一直映射着的HOST_VISIBLE|HOST_COHERENT buffer，当成环形缓冲区用
+ * Upload*只把数据拷进ring并记下copy，Submit时合并成少量vkCmdCopyBuffer/vkCmdCopyBufferToImage一次提交
+ * 每次Submit的区域由fence保护，fence signal以后自动回收；ring写满会先提交当前batch或者等最早的batch完成
+ * 不是线程安全的，一个线程用一个
+ */
+class UploadRing {
+public:
+    UploadRing(VkDevice _device, VkPhysicalDevice _physicalDevice, VkQueue _queue, uint32_t _queueFamilyIndex,
+            VkDeviceSize _size = 64 * 1024 * 1024, uint32_t _maxBatches = 4);
+    ~UploadRing();
+    UploadRing(const UploadRing &) = delete;
+    UploadRing & operator=(const UploadRing &) = delete;
+
+    void UploadBuffer(VkBuffer _dst, VkDeviceSize _dstOffset, const void * _data, VkDeviceSize _size);
+    // 整个subresource会被覆盖，之前的内容不保留(oldLayout是UNDEFINED)
+    void UploadImage(VkImage _image, const VkImageSubresourceLayers & _subresource, VkExtent3D _extent,
+            const void * _data, VkDeviceSize _size,
+            VkImageLayout _finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    // 提交当前batch，没有待上传的数据返回VK_NULL_HANDLE
+    // _record在copy和after barrier之后、EndCommandBuffer之前调用，可以在同一个command buffer里追加命令
+    // _signal不为空时提交完成后signal，给渲染队列wait用
+    VkFence Submit(VkSemaphore _signal = VK_NULL_HANDLE,
+            const std::function<void(VkCommandBuffer)> & _record = nullptr);
+    // 回收已经完成的batch，不阻塞
+    void Poll();
+    // 提交并等待全部完成
+    void Finish();
+
+private:
+    struct Batch {
+        VkCommandBuffer commandBuffer;
+        VkFence fence;
+        uint64_t end;
+    };
+    struct ImageUpload {
+        VkImageLayout finalLayout;
+        std::vector<VkImageSubresourceRange> ranges;
+        std::vector<VkBufferImageCopy> regions;
+    };
+
+    // 返回ring里的物理offset
+    VkDeviceSize Allocate(VkDeviceSize _size, VkDeviceSize _alignment);
+    void RetireOldest();
+    Batch AcquireBatch();
+
+    VkDevice device_;
+    VkQueue queue_;
+    VkBuffer buffer_;
+    VkDeviceMemory memory_;
+    char * mapped_;
+    VkDeviceSize size_;
+    VkDeviceSize imageAlignment_;
+    uint32_t maxBatches_;
+    VkCommandPool commandPool_;
+
+    // head_/tail_是一直增长的虚拟位置，% size_得到物理offset
+    uint64_t head_;
+    uint64_t tail_;
+    std::deque<Batch> inFlight_;
+    std::vector<Batch> freeBatches_;
+
+    std::map<VkBuffer, std::vector<VkBufferCopy>> bufferCopies_;
+    std::map<VkImage, ImageUpload> imageUploads_;
+};